@@ -4,6 +4,7 @@
 #include <ifaddrs.h>
 
 #include "../moka/address.h"
+#include "../moka/dns.h"
 #include "../moka/macro.h"
 #include "../moka/log.h"
 
@@ -135,6 +136,29 @@ bool Address::operator!=(const Address& rhs) const {
 }
 
 bool IPAddress::DnsToIPAddr(const char* host, const char* port, std::vector<IPAddress::ptr>& addrs) {
+  // 端口可以是数字或者服务名(如"http")
+  uint16_t port_num = 0;
+  if (port && *port) {
+    if (isdigit(*port)) {
+      port_num = atoi(port);
+    } else {
+      struct servent* serv = getservbyname(port, "tcp");
+      if (!serv) {
+        MOKA_LOG_WARN(g_logger) << "unknown service: " << port;
+        return false;
+      }
+      port_num = ntohs(serv->s_port);
+    }
+  }
+  // 先使用协程化的解析器(通过hook的UDP socket查询，不会阻塞调度线程)
+  DnsResolver* resolver = DnsResolver::GetInstance();
+  if (resolver->resolve(host, addrs, port_num)) {
+    return true;
+  }
+  if (!resolver->get_servers().empty()) {
+    return false;
+  }
+  // 没有可用的DNS服务器时退回到getaddrinfo
   struct addrinfo hints;
   struct addrinfo* res;
   memset(&hints, 0, sizeof(hints));
@@ -57,7 +57,8 @@ class IPAddress : public Address {
   // 获取子网掩码
   virtual IPAddress::ptr get_netmask(uint32_t prefix_len) = 0;
 
-  // 域名转换为IP地址的通用函数，获取域名对应的所有ip地址
+  // 域名转换为IP地址的通用函数，获取域名对应的所有ip地址(IPv4地址在前)
+  // 通过DnsResolver解析(hosts文件、带TTL的缓存、协程化的UDP查询)，没有DNS服务器时退回到getaddrinfo
   static bool DnsToIPAddr(const char* host, const char* port, std::vector<IPAddress::ptr>& addrs);
   static moka::IPAddress::ptr LookupIPv4Addr(const char* host, const char* port) {
     std::vector<moka::IPAddress::ptr> addrs;
@@ -0,0 +1,567 @@
+#include "binlog.h"
+
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <sstream>
+#include <iostream>
+#include <yaml-cpp/yaml.h>
+
+#include "util.h"
+#include "fiber.h"
+
+namespace moka {
+
+// 记录类型(每条记录的第一个字节，0为文件末尾未写入的填充)
+enum BinLogRecordType : uint8_t {
+  BINLOG_HEADER = 'M',   // 段开始: "OKABLOG" 版本号 格式串
+  BINLOG_SITE = 'S',     // 调用点: 编号 级别 行号 文件名 格式串 参数类型
+  BINLOG_THREAD = 'T',   // 线程名: 线程id 名称
+  BINLOG_LOGGER = 'L',   // 日志器名: 编号 名称
+  BINLOG_FILE = 'F',     // 文件名: 编号 名称
+  BINLOG_EVENT = 'E',    // 二进制日志: 调用点 时间 线程id 协程id 日志器 参数长度 参数
+  BINLOG_TEXT = 'X'      // 流式日志: 级别 文件名 行号 时间 线程id 协程id 日志器 内容
+};
+
+static const char kBinLogMagic[] = "OKABLOG";
+static const uint8_t kBinLogVersion = 1;
+
+static std::atomic<uint32_t> s_binlog_site_id = {0};
+
+BinLogSite::BinLogSite(const char* file, uint32_t line, LogLevel::level level, const char* fmt)
+    : file(file), line(line), level(level), fmt(fmt), id(s_binlog_site_id++) {
+}
+
+// 解码后的一个参数
+struct BinLogArg {
+  char type = 0;
+  int64_t i = 0;
+  uint64_t u = 0;
+  double d = 0;
+  std::string s;
+};
+
+static bool decode_arg(char type, const char* data, size_t len, size_t& pos, BinLogArg& arg) {
+  arg.type = type;
+  uint64_t v = 0;
+  size_t n = 0;
+  switch (type) {
+    case 'i':
+    case 'u':
+    case 'p':
+      n = ByteArray::GetVarint64((const uint8_t*)data + pos, len - pos, &v);
+      if (!n) {
+        return false;
+      }
+      pos += n;
+      arg.u = v;
+      arg.i = type == 'i'? ByteArray::Unzigzag64(v): (int64_t)v;
+      arg.d = type == 'i'? (double)arg.i: (double)v;
+      return true;
+    case 'd':
+      if (len - pos < sizeof(double)) {
+        return false;
+      }
+      memcpy(&arg.d, data + pos, sizeof(double));
+      pos += sizeof(double);
+      arg.i = arg.d;
+      arg.u = arg.d;
+      return true;
+    case 's':
+      n = ByteArray::GetVarint64((const uint8_t*)data + pos, len - pos, &v);
+      if (!n || len - pos - n < v) {
+        return false;
+      }
+      arg.s.assign(data + pos + n, v);
+      pos += n + v;
+      return true;
+    default:
+      return false;
+  }
+}
+
+template<class T>
+static void append_format(std::string& out, const std::string& spec, T v) {
+  char buf[128];
+  int n = snprintf(buf, sizeof(buf), spec.c_str(), v);
+  if (n < 0) {
+    return;
+  }
+  if ((size_t)n < sizeof(buf)) {
+    out.append(buf, n);
+  } else {
+    std::string tmp(n + 1, '\0');
+    snprintf(&tmp[0], tmp.size(), spec.c_str(), v);
+    out.append(tmp.c_str(), n);
+  }
+}
+
+std::string BinLogFormat(const char* fmt, const char* types, const char* data, size_t len) {
+  std::string out;
+  size_t pos = 0;
+  const char* type = types;
+  // 取下一个参数，参数不足或数据被截断时返回false
+  auto next_arg = [&](BinLogArg& arg) {
+    if (!*type) {
+      return false;
+    }
+    if (!decode_arg(*type++, data, len, pos, arg)) {
+      type = "";
+      return false;
+    }
+    return true;
+  };
+  BinLogArg arg;
+  const char* p = fmt;
+  while (*p) {
+    if (*p != '%') {
+      out.append(1, *p++);
+      continue;
+    }
+    if (p[1] == '%') {
+      out.append(1, '%');
+      p += 2;
+      continue;
+    }
+    // 重新拼出不带长度修饰符的转换说明，参数统一按long long/double/char*格式化
+    std::string spec = "%";
+    ++p;
+    while (*p && strchr("-+ #0", *p)) {
+      spec.append(1, *p++);
+    }
+    for (int i = 0; i < 2; ++i) {
+      if (*p == '*') {
+        if (!next_arg(arg)) {
+          break;
+        }
+        spec.append(std::to_string(arg.i));
+        ++p;
+      } else {
+        while (*p >= '0' && *p <= '9') {
+          spec.append(1, *p++);
+        }
+      }
+      if (i == 0 && *p == '.') {
+        spec.append(1, *p++);
+      } else {
+        break;
+      }
+    }
+    while (*p && strchr("hlLqjzt", *p)) {
+      ++p;
+    }
+    char conv = *p;
+    if (!conv) {
+      break;
+    }
+    ++p;
+    if (conv == 'n') {
+      continue;
+    }
+    if (!next_arg(arg)) {
+      out.append("<truncated>");
+      continue;
+    }
+    switch (conv) {
+      case 'd':
+      case 'i':
+        append_format(out, spec + "lld", (long long)arg.i);
+        break;
+      case 'o':
+      case 'u':
+      case 'x':
+      case 'X':
+        append_format(out, spec + "ll" + conv, (unsigned long long)arg.u);
+        break;
+      case 'c':
+        append_format(out, spec + "c", (int)arg.i);
+        break;
+      case 'e':
+      case 'E':
+      case 'f':
+      case 'F':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        append_format(out, spec + conv, arg.d);
+        break;
+      case 's':
+        if (arg.type == 's') {
+          append_format(out, spec + "s", arg.s.c_str());
+        } else {
+          append_format(out, spec + "s", std::to_string(arg.i).c_str());
+        }
+        break;
+      case 'p':
+        append_format(out, spec + "p", (void*)(uintptr_t)arg.u);
+        break;
+      default:
+        out.append("<error_format %").append(1, conv).append(">");
+        break;
+    }
+  }
+  return out;
+}
+
+BinaryLogAppender::BinaryLogAppender(const std::string& filename, size_t map_size)
+    : filename_(filename) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  map_size_ = (map_size + page - 1) / page * page;
+  if (map_size_ < 16 * page) {
+    map_size_ = 16 * page;
+  }
+  fd_ = open(filename_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    std::cout << "binary log open " << filename_ << " errno=" << errno
+              << " errstr=" << strerror(errno) << std::endl;
+    return;
+  }
+  // 从文件末尾开始新的一段(上次异常退出时末尾可能是未写入的0，读取时会跳过)
+  struct stat st;
+  file_size_ = fstat(fd_, &st) == 0? st.st_size: 0;
+}
+
+BinaryLogAppender::~BinaryLogAppender() {
+  if (map_) {
+    munmap(map_, map_size_);
+  }
+  if (fd_ >= 0) {
+    // 截掉映射时预留的空间
+    if (ftruncate(fd_, file_size_)) {
+      std::cout << "binary log truncate " << filename_ << " errno=" << errno << std::endl;
+    }
+    close(fd_);
+  }
+}
+
+bool BinaryLogAppender::ensure(size_t len) {
+  if (fd_ < 0) {
+    return false;
+  }
+  if (!map_ || file_size_ + len > map_offset_ + map_size_) {
+    if (map_) {
+      munmap(map_, map_size_);
+      map_ = nullptr;
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+    map_offset_ = file_size_ / page * page;
+    if (file_size_ + len > map_offset_ + map_size_) {
+      // 单条记录超过映射区域大小
+      return false;
+    }
+    if (ftruncate(fd_, map_offset_ + map_size_)) {
+      return false;
+    }
+    void* addr = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, map_offset_);
+    if (addr == MAP_FAILED) {
+      return false;
+    }
+    map_ = (char*)addr;
+  }
+  if (!header_) {
+    // 每次打开文件后的第一条记录之前写入文件头，读取时据此重置各个编号表
+    header_ = true;
+    std::string pattern = formatter_? formatter_->get_pattern(): "";
+    if (!ensure(16 + pattern.size() + len)) {
+      return false;
+    }
+    uint8_t type = BINLOG_HEADER;
+    put(&type, 1);
+    put(kBinLogMagic, sizeof(kBinLogMagic) - 1);
+    put(&kBinLogVersion, 1);
+    putString(pattern.c_str(), pattern.size());
+  }
+  return true;
+}
+
+void BinaryLogAppender::put(const void* data, size_t len) {
+  memcpy(map_ + (file_size_ - map_offset_), data, len);
+  file_size_ += len;
+}
+
+void BinaryLogAppender::putVarint(uint64_t v) {
+  file_size_ += ByteArray::PutVarint64((uint8_t*)map_ + (file_size_ - map_offset_), v);
+}
+
+void BinaryLogAppender::putString(const char* str, size_t len) {
+  putVarint(len);
+  put(str, len);
+}
+
+uint32_t BinaryLogAppender::loggerId(Logger* logger) {
+  auto it = loggers_.find(logger);
+  if (it != loggers_.end()) {
+    return it->second;
+  }
+  uint32_t id = loggers_.size();
+  const std::string& name = logger->get_name();
+  if (ensure(16 + name.size())) {
+    uint8_t type = BINLOG_LOGGER;
+    put(&type, 1);
+    putVarint(id);
+    putString(name.c_str(), name.size());
+    loggers_[logger] = id;
+  }
+  return id;
+}
+
+uint32_t BinaryLogAppender::fileId(const char* file) {
+  auto it = files_.find(file);
+  if (it != files_.end()) {
+    return it->second;
+  }
+  uint32_t id = files_.size();
+  size_t len = strlen(file);
+  if (ensure(16 + len)) {
+    uint8_t type = BINLOG_FILE;
+    put(&type, 1);
+    putVarint(id);
+    putString(file, len);
+    files_[file] = id;
+  }
+  return id;
+}
+
+void BinaryLogAppender::defineThread(uint32_t tid) {
+  if (threads_.count(tid)) {
+    return;
+  }
+  const std::string& name = GetThreadName();
+  if (ensure(16 + name.size())) {
+    uint8_t type = BINLOG_THREAD;
+    put(&type, 1);
+    putVarint(tid);
+    putString(name.c_str(), name.size());
+    threads_[tid] = true;
+  }
+}
+
+void BinaryLogAppender::logBinary(const std::shared_ptr<Logger>& logger, const BinLogSite& site,
+                                  const char* types, const char* data, size_t len) {
+  if (site.level < level_) {
+    return;
+  }
+  uint32_t tid = GetThreadId();
+  uint64_t fiber_id = GetFiberId();
+  time_t now = time(0);
+  Spinlock::LockGuard lock(mutex_);
+  if (site.id >= sites_.size() || !sites_[site.id]) {
+    size_t file_len = strlen(site.file);
+    size_t fmt_len = strlen(site.fmt);
+    size_t types_len = strlen(types);
+    if (!ensure(64 + file_len + fmt_len + types_len)) {
+      return;
+    }
+    uint8_t type = BINLOG_SITE;
+    put(&type, 1);
+    putVarint(site.id);
+    putVarint(site.level);
+    putVarint(site.line);
+    putString(site.file, file_len);
+    putString(site.fmt, fmt_len);
+    putString(types, types_len);
+    if (site.id >= sites_.size()) {
+      sites_.resize(site.id + 1);
+    }
+    sites_[site.id] = true;
+  }
+  defineThread(tid);
+  uint32_t logger_id = loggerId(logger.get());
+  if (!ensure(64 + len)) {
+    return;
+  }
+  uint8_t type = BINLOG_EVENT;
+  put(&type, 1);
+  putVarint(site.id);
+  putVarint(now);
+  putVarint(tid);
+  putVarint(fiber_id);
+  putVarint(logger_id);
+  putVarint(len);
+  put(data, len);
+}
+
+void BinaryLogAppender::log(LogLevel::level level, LogEvent::ptr event) {
+  if (level < level_) {
+    return;
+  }
+  std::string msg = event->get_content();
+  Spinlock::LockGuard lock(mutex_);
+  defineThread(event->get_thread_id());
+  uint32_t logger_id = loggerId(event->get_logger().get());
+  uint32_t file_id = fileId(event->get_filename());
+  if (!ensure(64 + msg.size())) {
+    return;
+  }
+  uint8_t type = BINLOG_TEXT;
+  put(&type, 1);
+  putVarint(level);
+  putVarint(file_id);
+  putVarint(event->get_line_num());
+  putVarint(event->get_timestamp());
+  putVarint(event->get_thread_id());
+  putVarint(event->get_fiber_id());
+  putVarint(logger_id);
+  putString(msg.c_str(), msg.size());
+}
+
+std::string BinaryLogAppender::toYamlString() {
+  Spinlock::LockGuard lock(mutex_);
+  YAML::Node node;
+  node["type"] = "BinaryLogAppender";
+  node["file"] = filename_;
+  if (level_ != LogLevel::UNKNOW) {
+    node["level"] = LogLevel::ToString(level_);
+  }
+  if (is_own_fmt_) {
+    node["formatter"] = formatter_->get_pattern();
+  }
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+BinaryLogReader::~BinaryLogReader() {
+  if (data_) {
+    munmap((void*)data_, size_);
+  }
+}
+
+bool BinaryLogReader::open(const std::string& filename) {
+  int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  data_ = (const char*)addr;
+  size_ = st.st_size;
+  pos_ = 0;
+  return true;
+}
+
+bool BinaryLogReader::getVarint(uint64_t& v) {
+  size_t n = ByteArray::GetVarint64((const uint8_t*)data_ + pos_, size_ - pos_, &v);
+  pos_ += n;
+  return n > 0;
+}
+
+bool BinaryLogReader::getString(std::string& str) {
+  uint64_t len = 0;
+  if (!getVarint(len) || size_ - pos_ < len) {
+    return false;
+  }
+  str.assign(data_ + pos_, len);
+  pos_ += len;
+  return true;
+}
+
+bool BinaryLogReader::readHeader() {
+  size_t magic_len = sizeof(kBinLogMagic) - 1;
+  if (size_ - pos_ < magic_len + 1 || memcmp(data_ + pos_, kBinLogMagic, magic_len)
+      || (uint8_t)data_[pos_ + magic_len] != kBinLogVersion) {
+    return false;
+  }
+  pos_ += magic_len + 1;
+  sites_.clear();
+  threads_.clear();
+  loggers_.clear();
+  files_.clear();
+  return getString(pattern_);
+}
+
+bool BinaryLogReader::next(BinLogRecord& record) {
+  uint64_t v[8];
+  std::string str;
+  while (pos_ < size_) {
+    uint8_t type = data_[pos_++];
+    switch (type) {
+      case 0:
+        // 上次异常退出时预留的空间
+        break;
+      case BINLOG_HEADER:
+        if (!readHeader()) {
+          return false;
+        }
+        break;
+      case BINLOG_SITE: {
+        Site site;
+        if (!getVarint(v[0]) || !getVarint(v[1]) || !getVarint(v[2]) || !getString(site.file)
+            || !getString(site.fmt) || !getString(site.types)) {
+          return false;
+        }
+        site.level = (LogLevel::level)v[1];
+        site.line = v[2];
+        sites_[v[0]] = site;
+        break;
+      }
+      case BINLOG_THREAD:
+      case BINLOG_LOGGER:
+      case BINLOG_FILE:
+        if (!getVarint(v[0]) || !getString(str)) {
+          return false;
+        }
+        (type == BINLOG_THREAD? threads_: type == BINLOG_LOGGER? loggers_: files_)[v[0]] = str;
+        break;
+      case BINLOG_EVENT: {
+        for (int i = 0; i < 6; ++i) {
+          if (!getVarint(v[i])) {
+            return false;
+          }
+        }
+        auto it = sites_.find(v[0]);
+        if (it == sites_.end() || size_ - pos_ < v[5]) {
+          return false;
+        }
+        Site& site = it->second;
+        record.level = site.level;
+        record.file = site.file.c_str();
+        record.line = site.line;
+        record.timestamp = v[1];
+        record.thread_id = v[2];
+        record.fiber_id = v[3];
+        record.thread_name = threads_.count(v[2])? &threads_[v[2]]: &empty_;
+        record.logger_name = loggers_.count(v[4])? &loggers_[v[4]]: &empty_;
+        record.message = BinLogFormat(site.fmt.c_str(), site.types.c_str(), data_ + pos_, v[5]);
+        pos_ += v[5];
+        return true;
+      }
+      case BINLOG_TEXT: {
+        for (int i = 0; i < 7; ++i) {
+          if (!getVarint(v[i])) {
+            return false;
+          }
+        }
+        if (!getString(record.message)) {
+          return false;
+        }
+        record.level = (LogLevel::level)v[0];
+        record.file = files_.count(v[1])? files_[v[1]].c_str(): "";
+        record.line = v[2];
+        record.timestamp = v[3];
+        record.thread_id = v[4];
+        record.fiber_id = v[5];
+        record.thread_name = threads_.count(v[4])? &threads_[v[4]]: &empty_;
+        record.logger_name = loggers_.count(v[6])? &loggers_[v[6]]: &empty_;
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+  return false;
+}
+
+}
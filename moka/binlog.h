@@ -0,0 +1,215 @@
+#ifndef __MOKA_BINLOG_H__
+#define __MOKA_BINLOG_H__
+
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <type_traits>
+
+#include "log.h"
+#include "bytearray.h"
+
+// 二进制日志宏: 只记录调用点编号和参数的原始字节，由moka_logdump离线还原为文本
+// fmt必须是字符串字面量，参数只支持printf兼容的类型(整数、浮点数、C字符串、指针)
+#define MOKA_LOG_BIN_LEVEL(logger, level, fmt, ...) \
+  do { \
+    if (logger->isEnabled(level)) { \
+      static const moka::BinLogSite __moka_bin_site(__FILE__, __LINE__, level, fmt); \
+      moka::BinLog(logger, __moka_bin_site, ##__VA_ARGS__); \
+    } \
+  } while (0)
+
+#define MOKA_LOG_BIN_DEBUG(logger, fmt, ...) MOKA_LOG_BIN_LEVEL(logger, moka::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define MOKA_LOG_BIN_INFO(logger, fmt, ...) MOKA_LOG_BIN_LEVEL(logger, moka::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define MOKA_LOG_BIN_WARN(logger, fmt, ...) MOKA_LOG_BIN_LEVEL(logger, moka::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define MOKA_LOG_BIN_ERROR(logger, fmt, ...) MOKA_LOG_BIN_LEVEL(logger, moka::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#define MOKA_LOG_BIN_FATAL(logger, fmt, ...) MOKA_LOG_BIN_LEVEL(logger, moka::LogLevel::FATAL, fmt, ##__VA_ARGS__)
+
+namespace moka {
+
+// 二进制日志的调用点(宏中的静态变量)，进程内编号唯一
+struct BinLogSite {
+  BinLogSite(const char* file, uint32_t line, LogLevel::level level, const char* fmt);
+  const char* file;
+  uint32_t line;
+  LogLevel::level level;
+  const char* fmt;
+  uint32_t id;
+};
+
+// 参数类型标记: i有符号整数 u无符号整数 d浮点数 s字符串 p指针
+template<class T>
+struct BinLogArgType {
+  static const char value = std::is_floating_point<T>::value? 'd'
+      : std::is_integral<T>::value? (std::is_signed<T>::value? 'i': 'u')
+      : (std::is_same<T, char*>::value || std::is_same<T, const char*>::value)? 's'
+      : std::is_pointer<T>::value? 'p': 0;
+  static_assert(value != 0, "binary log argument must be printf compatible");
+};
+
+template<class... Args>
+struct BinLogTypes {
+  static const char* get() {
+    static const char s_types[] = {BinLogArgType<typename std::decay<Args>::type>::value..., '\0'};
+    return s_types;
+  }
+};
+
+// 参数编码: 整数为varint(有符号数先zigzag)，浮点数为8字节，字符串为varint长度+内容
+// 缓冲区不够时截断，解码时会标记为<truncated>
+static const size_t kBinLogMaxArgs = 1024;
+
+inline char* BinLogPutVarint(char* p, char* end, uint64_t v) {
+  if (end - p < 10) {
+    return end;
+  }
+  return p + ByteArray::PutVarint64((uint8_t*)p, v);
+}
+
+template<class T>
+inline char* BinLogPutArg(char* p, char* end, T v, std::integral_constant<char, 'i'>) {
+  return BinLogPutVarint(p, end, ByteArray::Zigzag64(v));
+}
+
+template<class T>
+inline char* BinLogPutArg(char* p, char* end, T v, std::integral_constant<char, 'u'>) {
+  return BinLogPutVarint(p, end, v);
+}
+
+template<class T>
+inline char* BinLogPutArg(char* p, char* end, T v, std::integral_constant<char, 'd'>) {
+  double d = v;
+  if (end - p < (ptrdiff_t)sizeof(d)) {
+    return end;
+  }
+  memcpy(p, &d, sizeof(d));
+  return p + sizeof(d);
+}
+
+template<class T>
+inline char* BinLogPutArg(char* p, char* end, T v, std::integral_constant<char, 's'>) {
+  size_t len = v? strlen(v): 0;
+  p = BinLogPutVarint(p, end, len);
+  if ((size_t)(end - p) < len) {
+    return end;
+  }
+  memcpy(p, v, len);
+  return p + len;
+}
+
+template<class T>
+inline char* BinLogPutArg(char* p, char* end, T v, std::integral_constant<char, 'p'>) {
+  return BinLogPutVarint(p, end, (uint64_t)(uintptr_t)v);
+}
+
+inline char* BinLogPutArgs(char* p, char* end) {
+  return p;
+}
+
+template<class T, class... Args>
+inline char* BinLogPutArgs(char* p, char* end, const T& v, const Args&... args) {
+  using Type = typename std::decay<T>::type;
+  p = BinLogPutArg(p, end, v, std::integral_constant<char, BinLogArgType<Type>::value>());
+  return BinLogPutArgs(p, end, args...);
+}
+
+template<class... Args>
+void BinLog(const Logger::ptr& logger, const BinLogSite& site, const Args&... args) {
+  char buf[kBinLogMaxArgs];
+  char* end = BinLogPutArgs(buf, buf + sizeof(buf), args...);
+  logger->logBinary(logger, site, BinLogTypes<Args...>::get(), buf, end - buf);
+}
+
+// 按printf格式串和参数类型把编码后的参数还原为文本
+std::string BinLogFormat(const char* fmt, const char* types, const char* data, size_t len);
+
+// 二进制日志输出器，写入mmap映射的文件
+// 文件由若干段组成，每段以文件头开始(进程每次打开文件时写入)，段内依次是
+// 调用点/线程名/日志器名/文件名的定义记录和日志记录，定义只在第一次使用时写入
+class BinaryLogAppender : public LogAppender {
+ public:
+  using ptr = std::shared_ptr<BinaryLogAppender>;
+  BinaryLogAppender(const std::string& filename, size_t map_size = 16 * 1024 * 1024);
+  ~BinaryLogAppender();
+  virtual void log(LogLevel::level level, LogEvent::ptr event) override;   // 流式日志记录为文本内容
+  virtual void logBinary(const std::shared_ptr<Logger>& logger, const BinLogSite& site,
+                         const char* types, const char* data, size_t len) override;
+  virtual std::string toYamlString() override;
+
+ private:
+  bool ensure(size_t len);        // 保证映射区域还有len字节
+  void put(const void* data, size_t len);
+  void putVarint(uint64_t v);
+  void putString(const char* str, size_t len);
+  uint32_t loggerId(Logger* logger);
+  uint32_t fileId(const char* file);
+  void defineThread(uint32_t tid);
+
+ private:
+  std::string filename_;
+  int fd_ = -1;
+  size_t map_size_;
+  char* map_ = nullptr;           // 当前映射区域
+  uint64_t map_offset_ = 0;       // 映射区域在文件中的偏移(页对齐)
+  uint64_t file_size_ = 0;        // 已写入的文件大小
+  bool header_ = false;           // 本次打开后是否已写入文件头
+  std::vector<bool> sites_;                            // 本段已定义的调用点
+  std::unordered_map<uint32_t, bool> threads_;         // 本段已定义名称的线程
+  std::unordered_map<Logger*, uint32_t> loggers_;      // 日志器名称编号
+  std::unordered_map<const char*, uint32_t> files_;    // 流式日志的文件名编号
+};
+
+// 解码后的一条日志
+struct BinLogRecord {
+  LogLevel::level level;
+  const char* file;
+  uint32_t line;
+  uint32_t thread_id;
+  uint32_t fiber_id;
+  const std::string* thread_name;
+  const std::string* logger_name;
+  uint64_t timestamp;
+  std::string message;
+};
+
+// 二进制日志文件读取器
+class BinaryLogReader {
+ public:
+  BinaryLogReader() {}
+  ~BinaryLogReader();
+  bool open(const std::string& filename);
+  // 读取下一条日志，文件结束或数据损坏时返回false
+  bool next(BinLogRecord& record);
+  // 当前段写入时输出器使用的格式
+  const std::string& get_pattern() const { return pattern_; }
+
+ private:
+  struct Site {
+    LogLevel::level level;
+    uint32_t line;
+    std::string file;
+    std::string fmt;
+    std::string types;
+  };
+  bool getVarint(uint64_t& v);
+  bool getString(std::string& str);
+  bool readHeader();
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  size_t pos_ = 0;
+  std::string pattern_;
+  std::map<uint32_t, Site> sites_;
+  std::map<uint32_t, std::string> threads_;
+  std::map<uint32_t, std::string> loggers_;
+  std::map<uint32_t, std::string> files_;
+  std::string empty_;
+};
+
+}
+
+#endif
@@ -1,8 +1,18 @@
 #include "bytearray.h"
 #include "string.h"
 #include "../moka/log.h"
+#include "../moka/config.h"
 
+#include <new>
 #include <byteswap.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <algorithm>
 #include <iomanip>
 #include <fstream>
 #include <sstream>
@@ -11,14 +21,221 @@ namespace moka {
 
 static moka::Logger::ptr g_logger = MOKA_LOG_NAME("system");
 
-ByteArray::Node::Node() : ptr(nullptr), size(0), next(nullptr) {}
+// 每个线程缓存的每级空闲节点内存的最大数量
+static ConfigVar<uint32_t>::ptr g_bytearray_thread_cache_size =
+  Config::Lookup<uint32_t>("bytearray.pool.thread_cache_size", 64, "bytearray node buffers cached per thread per size class");
+
+// 全局缓存的每级空闲节点内存的最大数量(线程缓存满了之后归还到这里，超过则直接释放)
+static ConfigVar<uint32_t>::ptr g_bytearray_global_cache_size =
+  Config::Lookup<uint32_t>("bytearray.pool.global_cache_size", 1024, "bytearray node buffers cached globally per size class");
+
+static std::atomic<uint32_t> s_thread_cache_size {0};
+static std::atomic<uint32_t> s_global_cache_size {0};
+
+struct _ByteArrayIniter {
+  _ByteArrayIniter() {
+    s_thread_cache_size = g_bytearray_thread_cache_size->get_value();
+    s_global_cache_size = g_bytearray_global_cache_size->get_value();
+    g_bytearray_thread_cache_size->addListener(0xb7a7, [](const uint32_t& old_val, const uint32_t& new_val) {
+      s_thread_cache_size = new_val;
+    });
+    g_bytearray_global_cache_size->addListener(0xb7a7, [](const uint32_t& old_val, const uint32_t& new_val) {
+      s_global_cache_size = new_val;
+    });
+  }
+};
+
+static _ByteArrayIniter s_bytearray_initer;
+
+// 内存池的大小级别: 64B, 128B, ..., 64KB
+static const uint32_t kMinClassShift = 6;
+static const uint32_t kMaxClassShift = 16;
+static const uint32_t kClassCount = kMaxClassShift - kMinClassShift + 1;
+// 直接malloc的节点内存和文件映射的节点内存使用的大小级别
+static const uint32_t kMallocClass = kClassCount;
+static const uint32_t kMappedClass = kClassCount + 1;
+
+// 文件映射，所有节点共享同一块映射(每个节点持有一个引用)，引用全部释放后munmap
+struct MappedBuffer : public ByteArray::Buffer {
+  char* addr;
+  size_t len;
+};
+
+// 节点内存池，每个线程按大小级别缓存空闲的节点内存，线程缓存为空时从全局缓存批量取，满了批量还回去
+class BufferPool {
+ public:
+  static ByteArray::Buffer* Alloc(uint32_t size_class);
+  static void Release(ByteArray::Buffer* buffer);
+
+ private:
+  struct Cache {
+    std::vector<ByteArray::Buffer*> buffers[kClassCount];
+  };
+  struct Global {
+    Spinlock mutex[kClassCount];
+    std::vector<ByteArray::Buffer*> buffers[kClassCount];
+  };
+
+  // 线程退出时把缓存还给全局缓存
+  struct CacheHolder {
+    ~CacheHolder();
+  };
+
+  static Global* GetGlobal() {
+    // 不析构，进程退出时其他线程可能还在释放节点
+    static Global* s_global = new Global;
+    return s_global;
+  }
+
+  static Cache* GetCache();
+  static void PutGlobal(uint32_t size_class, std::vector<ByteArray::Buffer*>& buffers, size_t count);
+
+  // 与协程栈缓存相同，线程局部变量析构之后释放的内存直接还给全局缓存
+  static thread_local Cache* t_cache;
+  static thread_local bool t_cache_destroyed;
+};
+
+thread_local BufferPool::Cache* BufferPool::t_cache = nullptr;
+thread_local bool BufferPool::t_cache_destroyed = false;
+
+BufferPool::CacheHolder::~CacheHolder() {
+  Cache* cache = t_cache;
+  t_cache = nullptr;
+  t_cache_destroyed = true;
+  if (!cache) {
+    return;
+  }
+  for (uint32_t i = 0; i < kClassCount; ++i) {
+    PutGlobal(i, cache->buffers[i], cache->buffers[i].size());
+  }
+  delete cache;
+}
+
+BufferPool::Cache* BufferPool::GetCache() {
+  if (t_cache_destroyed) {
+    return nullptr;
+  }
+  if (!t_cache) {
+    static thread_local CacheHolder s_holder;
+    (void)s_holder;
+    t_cache = new Cache;
+  }
+  return t_cache;
+}
+
+// 把buffers末尾的count个还给全局缓存，全局缓存满了则释放
+void BufferPool::PutGlobal(uint32_t size_class, std::vector<ByteArray::Buffer*>& buffers, size_t count) {
+  Global* global = GetGlobal();
+  size_t limit = s_global_cache_size;
+  {
+    Spinlock::LockGuard lock(global->mutex[size_class]);
+    auto& free_list = global->buffers[size_class];
+    while (count > 0 && free_list.size() < limit) {
+      free_list.push_back(buffers.back());
+      buffers.pop_back();
+      --count;
+    }
+  }
+  while (count > 0) {
+    free(buffers.back());
+    buffers.pop_back();
+    --count;
+  }
+}
+
+ByteArray::Buffer* BufferPool::Alloc(uint32_t size_class) {
+  Cache* cache = GetCache();
+  if (cache) {
+    auto& buffers = cache->buffers[size_class];
+    if (buffers.empty()) {
+      // 从全局缓存取一批(线程缓存容量的一半)
+      size_t count = s_thread_cache_size / 2 + 1;
+      Global* global = GetGlobal();
+      Spinlock::LockGuard lock(global->mutex[size_class]);
+      auto& free_list = global->buffers[size_class];
+      while (count > 0 && !free_list.empty()) {
+        buffers.push_back(free_list.back());
+        free_list.pop_back();
+        --count;
+      }
+    }
+    if (!buffers.empty()) {
+      ByteArray::Buffer* buffer = buffers.back();
+      buffers.pop_back();
+      return buffer;
+    }
+  }
+  void* vp = malloc(sizeof(ByteArray::Buffer) + ((size_t)1 << (size_class + kMinClassShift)));
+  if (!vp) {
+    throw std::bad_alloc();
+  }
+  ByteArray::Buffer* buffer = new (vp) ByteArray::Buffer;
+  buffer->size_class = size_class;
+  return buffer;
+}
+
+void BufferPool::Release(ByteArray::Buffer* buffer) {
+  uint32_t size_class = buffer->size_class;
+  Cache* cache = GetCache();
+  if (!cache) {
+    std::vector<ByteArray::Buffer*> buffers(1, buffer);
+    PutGlobal(size_class, buffers, 1);
+    return;
+  }
+  auto& buffers = cache->buffers[size_class];
+  buffers.push_back(buffer);
+  size_t limit = s_thread_cache_size;
+  if (buffers.size() > limit) {
+    // 超过上限时还回去一半，避免在上限附近反复分配释放时每次都加锁
+    PutGlobal(size_class, buffers, buffers.size() - limit / 2);
+  }
+}
+
+ByteArray::Buffer* ByteArray::Buffer::Alloc(size_t size) {
+  Buffer* buffer = nullptr;
+  if (size > ((size_t)1 << kMaxClassShift)) {
+    void* vp = malloc(sizeof(Buffer) + size);
+    if (!vp) {
+      throw std::bad_alloc();
+    }
+    buffer = new (vp) Buffer;
+    buffer->size_class = kMallocClass;
+  } else {
+    uint32_t size_class = 0;
+    while (((size_t)1 << (size_class + kMinClassShift)) < size) {
+      ++size_class;
+    }
+    buffer = BufferPool::Alloc(size_class);
+  }
+  buffer->ref.store(1, std::memory_order_relaxed);
+  return buffer;
+}
+
+void ByteArray::Buffer::Unref(Buffer* buffer) {
+  if (buffer->ref.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  if (buffer->size_class == kMappedClass) {
+    MappedBuffer* mapped = static_cast<MappedBuffer*>(buffer);
+    munmap(mapped->addr, mapped->len);
+    delete mapped;
+  } else if (buffer->size_class == kMallocClass) {
+    free(buffer);
+  } else {
+    BufferPool::Release(buffer);
+  }
+}
+
+ByteArray::Node::Node() : ptr(nullptr), size(0), next(nullptr), buffer(nullptr) {}
 
 // comment: 以字节为单位
-ByteArray::Node::Node(size_t s) : ptr(new char[s]), size(s), next(nullptr) {}
+ByteArray::Node::Node(size_t s) : size(s), next(nullptr), buffer(Buffer::Alloc(s)) {
+  ptr = buffer->data();
+}
 
 ByteArray::Node::~Node() {
-  if (ptr) {
-    delete[] ptr;
+  if (buffer) {
+    Buffer::Unref(buffer);
   }
 }
 
@@ -106,6 +323,12 @@ void ByteArray::writeInt32V (int32_t value) {
 }
 
 void ByteArray::writeUint32V(uint32_t value) {
+  size_t cur_node_pos = rw_pos_ % node_base_size_;
+  if (cur_node_ && cur_node_->size - cur_node_pos >= 5) {
+    // 当前节点放得下时直接编码到节点内存
+    advance(PutVarint64((uint8_t*)cur_node_->ptr + cur_node_pos, value));
+    return;
+  }
   // TLV编码
   uint8_t tmp[5];  // 压缩类型的上限(5个字节)
   uint8_t i = 0;
@@ -123,14 +346,408 @@ void ByteArray::writeInt64V(int64_t value) {
 }
 
 void ByteArray::writeUint64V(uint64_t value) {
+  size_t cur_node_pos = rw_pos_ % node_base_size_;
+  if (cur_node_ && cur_node_->size - cur_node_pos >= 10) {
+    advance(PutVarint64((uint8_t*)cur_node_->ptr + cur_node_pos, value));
+    return;
+  }
   uint8_t tmp[10];
-  uint8_t i = 0;
+  write(tmp, PutVarint64(tmp, value));
+}
+
+size_t ByteArray::PutVarint64(uint8_t* buf, uint64_t value) {
+  size_t i = 0;
   while (value >= 0x80) {
-    tmp[i++] = (value & 0x7F) | 0x80;
+    buf[i++] = (value & 0x7F) | 0x80;
     value >>= 7;
   }
-  tmp[i++] = value;
-  write(tmp, i);
+  buf[i++] = value;
+  return i;
+}
+
+size_t ByteArray::GetVarint64(const uint8_t* buf, size_t len, uint64_t* value) {
+  uint64_t res = 0;
+  for (size_t i = 0; i < len && i < 10; ++i) {
+    res |= ((uint64_t)(buf[i] & 0x7f)) << (i * 7);
+    if (buf[i] < 0x80) {
+      *value = res;
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+uint64_t ByteArray::Zigzag64(int64_t value) {
+  return EncodeZigzag64(value);
+}
+
+int64_t ByteArray::Unzigzag64(uint64_t value) {
+  return DecodeZigzag64(value);
+}
+
+// 批量varint编解码的实现
+// SIMD版本只加速最常见的单字节值(小于128)的连续片段，其他值仍然逐个编解码
+// 64位的值每个向量只能放2~4个，检查的开销抵消了打包的收益，编码仍然使用逐个编码的实现
+namespace {
+
+struct VarintKernels {
+  const char* name;
+  size_t (*encode32)(const uint32_t* values, size_t count, uint8_t* out);
+  size_t (*encode64)(const uint64_t* values, size_t count, uint8_t* out);
+  // 从in中最多解码count个值，遇到不完整的值时停止，used返回消耗的字节数
+  size_t (*decode32)(const uint8_t* in, size_t len, uint32_t* values, size_t count, size_t* used);
+  size_t (*decode64)(const uint8_t* in, size_t len, uint64_t* values, size_t count, size_t* used);
+};
+
+template<class T>
+struct VarintMaxLen {
+  static const size_t value = (sizeof(T) * 8 + 6) / 7;
+};
+
+template<class T>
+size_t EncodeVarintScalar(const T* values, size_t count, uint8_t* out) {
+  uint8_t* p = out;
+  for (size_t i = 0; i < count; ++i) {
+    p += ByteArray::PutVarint64(p, values[i]);
+  }
+  return p - out;
+}
+
+// 解码一个值，与readUint32V/readUint64V一样最多读取VarintMaxLen个字节
+template<class T>
+inline size_t DecodeOne(const uint8_t* in, size_t len, T* value) {
+  uint64_t v = 0;
+  size_t n = ByteArray::GetVarint64(in, len < VarintMaxLen<T>::value? len: VarintMaxLen<T>::value, &v);
+  *value = v;
+  return n;
+}
+
+template<class T>
+size_t DecodeVarintScalar(const uint8_t* in, size_t len, T* values, size_t count, size_t* used) {
+  size_t i = 0;
+  size_t pos = 0;
+  for (; i < count; ++i) {
+    size_t n = DecodeOne(in + pos, len - pos, values + i);
+    if (!n) {
+      break;
+    }
+    pos += n;
+  }
+  *used = pos;
+  return i;
+}
+
+const VarintKernels s_scalar_kernels = {
+  "scalar",
+  EncodeVarintScalar<uint32_t>,
+  EncodeVarintScalar<uint64_t>,
+  DecodeVarintScalar<uint32_t>,
+  DecodeVarintScalar<uint64_t>
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define MOKA_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define MOKA_TARGET_AVX2 __attribute__((target("avx2,bmi,bmi2")))
+
+// 把n个单字节值扩展后写入values
+MOKA_TARGET_SSE41 inline void WidenBytes4(const uint8_t* in, uint32_t* values) {
+  int32_t b;
+  memcpy(&b, in, sizeof(b));
+  _mm_storeu_si128((__m128i*)values, _mm_cvtepu8_epi32(_mm_cvtsi32_si128(b)));
+}
+
+MOKA_TARGET_SSE41 inline void WidenBytes4(const uint8_t* in, uint64_t* values) {
+  int16_t b[2];
+  memcpy(b, in, sizeof(b));
+  _mm_storeu_si128((__m128i*)values, _mm_cvtepu8_epi64(_mm_cvtsi32_si128((uint16_t)b[0])));
+  _mm_storeu_si128((__m128i*)(values + 2), _mm_cvtepu8_epi64(_mm_cvtsi32_si128((uint16_t)b[1])));
+}
+
+MOKA_TARGET_AVX2 inline void WidenBytes8(const uint8_t* in, uint32_t* values) {
+  _mm256_storeu_si256((__m256i*)values, _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)in)));
+}
+
+MOKA_TARGET_AVX2 inline void WidenBytes8(const uint8_t* in, uint64_t* values) {
+  int32_t b[2];
+  memcpy(b, in, sizeof(b));
+  _mm256_storeu_si256((__m256i*)values, _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(b[0])));
+  _mm256_storeu_si256((__m256i*)(values + 4), _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(b[1])));
+}
+
+// 编码时每个值是否需要多个字节(按位表示)
+MOKA_TARGET_SSE41 inline uint32_t BigMask(__m128i a, __m128i b, __m128i c, __m128i d, __m128i high) {
+  const __m128i zero = _mm_setzero_si128();
+  return ~(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(a, high), zero)))
+      | _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(b, high), zero))) << 4
+      | _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(c, high), zero))) << 8
+      | _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(d, high), zero))) << 12) & 0xffff;
+}
+
+// 按mask逐个编码一块值，单字节的值直接存为字节
+template<class T>
+inline uint8_t* EncodeBlock(const T* values, size_t count, uint32_t mask, uint8_t* p) {
+  for (size_t k = 0; k < count; ++k) {
+    if (mask & (1u << k)) {
+      p += ByteArray::PutVarint64(p, values[k]);
+    } else {
+      *p++ = values[k];
+    }
+  }
+  return p;
+}
+
+// 整块(16个)都是单字节值时打包后一次写入，否则按mask逐个编码
+MOKA_TARGET_SSE41 size_t EncodeVarint32SSE(const uint32_t* values, size_t count, uint8_t* out) {
+  uint8_t* p = out;
+  size_t i = 0;
+  const __m128i high = _mm_set1_epi32(~0x7f);
+  while (count - i >= 16) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(values + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(values + i + 4));
+    __m128i c = _mm_loadu_si128((const __m128i*)(values + i + 8));
+    __m128i d = _mm_loadu_si128((const __m128i*)(values + i + 12));
+    uint32_t mask = BigMask(a, b, c, d, high);
+    if (!mask) {
+      _mm_storeu_si128((__m128i*)p, _mm_packus_epi16(_mm_packus_epi32(a, b), _mm_packus_epi32(c, d)));
+      p += 16;
+      i += 16;
+      continue;
+    }
+    p = EncodeBlock(values + i, 16, mask, p);
+    i += 16;
+  }
+  p += EncodeVarintScalar(values + i, count - i, p);
+  return p - out;
+}
+
+// 先用movemask找出开头连续的单字节值，整块都是单字节时用SIMD扩展
+template<class T>
+MOKA_TARGET_SSE41 size_t DecodeVarintSSE(const uint8_t* in, size_t len, T* values, size_t count, size_t* used) {
+  size_t i = 0;
+  size_t pos = 0;
+  while (i < count) {
+    if (len - pos >= 16) {
+      uint32_t mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(in + pos)));
+      size_t run = mask? __builtin_ctz(mask): 16;
+      run = run < count - i? run: count - i;
+      if (run == 16) {
+        for (size_t k = 0; k < 16; k += 4) {
+          WidenBytes4(in + pos + k, values + i + k);
+        }
+      } else {
+        for (size_t k = 0; k < run; ++k) {
+          values[i + k] = in[pos + k];
+        }
+      }
+      i += run;
+      pos += run;
+      if (run > 0) {
+        continue;
+      }
+    }
+    size_t n = DecodeOne(in + pos, len - pos, values + i);
+    if (!n) {
+      break;
+    }
+    pos += n;
+    ++i;
+  }
+  *used = pos;
+  return i;
+}
+
+// 与SSE版本相同，每块32个值
+// packus按128位的通道分别打包，最后按32位重新排列
+MOKA_TARGET_AVX2 size_t EncodeVarint32AVX2(const uint32_t* values, size_t count, uint8_t* out) {
+  uint8_t* p = out;
+  size_t i = 0;
+  const __m256i high = _mm256_set1_epi32(~0x7f);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  while (count - i >= 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(values + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(values + i + 8));
+    __m256i c = _mm256_loadu_si256((const __m256i*)(values + i + 16));
+    __m256i d = _mm256_loadu_si256((const __m256i*)(values + i + 24));
+    uint32_t mask = ~((uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(a, high), zero)))
+        | (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(b, high), zero))) << 8
+        | (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(c, high), zero))) << 16
+        | (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(d, high), zero))) << 24);
+    if (!mask) {
+      __m256i bytes = _mm256_packus_epi16(_mm256_packus_epi32(a, b), _mm256_packus_epi32(c, d));
+      _mm256_storeu_si256((__m256i*)p, _mm256_permutevar8x32_epi32(bytes, order));
+      p += 32;
+      i += 32;
+      continue;
+    }
+    p = EncodeBlock(values + i, 32, mask, p);
+    i += 32;
+  }
+  p += EncodeVarint32SSE(values + i, count - i, p);
+  return p - out;
+}
+
+// 与SSE版本相同，另外多字节的值用pext一次取出所有的7位分组
+template<class T>
+MOKA_TARGET_AVX2 size_t DecodeVarintAVX2(const uint8_t* in, size_t len, T* values, size_t count, size_t* used) {
+  size_t i = 0;
+  size_t pos = 0;
+  while (i < count) {
+    if (len - pos >= 32) {
+      uint32_t mask = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(in + pos)));
+      size_t run = mask? __builtin_ctz(mask): 32;
+      run = run < count - i? run: count - i;
+      if (run == 32) {
+        for (size_t k = 0; k < 32; k += 8) {
+          WidenBytes8(in + pos + k, values + i + k);
+        }
+      } else {
+        for (size_t k = 0; k < run; ++k) {
+          values[i + k] = in[pos + k];
+        }
+      }
+      i += run;
+      pos += run;
+      if (run > 0) {
+        continue;
+      }
+      // mask的最低位是1，第一个0的位置就是这个值的最后一个字节
+      size_t n = __builtin_ctz(~mask) + 1;
+      if (n <= 8 && n <= VarintMaxLen<T>::value) {
+        uint64_t word;
+        memcpy(&word, in + pos, sizeof(word));
+        uint64_t keep = n == 8? ~0ull: ((1ull << (n * 8)) - 1);
+        values[i++] = _pext_u64(word & keep, 0x7f7f7f7f7f7f7f7full);
+        pos += n;
+        continue;
+      }
+    }
+    size_t n = DecodeOne(in + pos, len - pos, values + i);
+    if (!n) {
+      break;
+    }
+    pos += n;
+    ++i;
+  }
+  *used = pos;
+  return i;
+}
+
+#undef MOKA_TARGET_SSE41
+#undef MOKA_TARGET_AVX2
+
+const VarintKernels s_sse_kernels = {
+  "sse4.1",
+  EncodeVarint32SSE,
+  EncodeVarintScalar<uint64_t>,
+  DecodeVarintSSE<uint32_t>,
+  DecodeVarintSSE<uint64_t>
+};
+
+const VarintKernels s_avx2_kernels = {
+  "avx2",
+  EncodeVarint32AVX2,
+  EncodeVarintScalar<uint64_t>,
+  DecodeVarintAVX2<uint32_t>,
+  DecodeVarintAVX2<uint64_t>
+};
+
+#endif
+
+const VarintKernels* SelectVarintKernels(bool simd) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (simd) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2")) {
+      return &s_avx2_kernels;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+      return &s_sse_kernels;
+    }
+  }
+#endif
+  return &s_scalar_kernels;
+}
+
+}
+
+// 批量varint编解码是否使用SIMD(按运行时的CPU选择，关闭后使用逐个编解码的实现)
+static ConfigVar<bool>::ptr g_bytearray_varint_simd =
+  Config::Lookup<bool>("bytearray.varint_simd", true, "use simd for bulk varint encode/decode");
+
+static std::atomic<const VarintKernels*> s_varint_kernels {&s_scalar_kernels};
+
+struct _VarintIniter {
+  _VarintIniter() {
+    s_varint_kernels = SelectVarintKernels(g_bytearray_varint_simd->get_value());
+    g_bytearray_varint_simd->addListener(0xb7a8, [](const bool& old_val, const bool& new_val) {
+      s_varint_kernels = SelectVarintKernels(new_val);
+    });
+  }
+};
+
+static _VarintIniter s_varint_initer;
+
+const char* ByteArray::VarintKernelName() {
+  return s_varint_kernels.load(std::memory_order_relaxed)->name;
+}
+
+template<class T, class Encode>
+void ByteArray::writeVArray(const T* values, size_t count, Encode encode) {
+  // 分段编码，当前节点放得下整段时直接编码到节点内存
+  static const size_t kChunk = 256;
+  uint8_t tmp[kChunk * VarintMaxLen<T>::value];
+  while (count > 0) {
+    size_t n = count < kChunk? count: kChunk;
+    size_t cur_node_pos = rw_pos_ % node_base_size_;
+    if (cur_node_ && cur_node_->size - cur_node_pos >= n * VarintMaxLen<T>::value) {
+      advance(encode(values, n, (uint8_t*)cur_node_->ptr + cur_node_pos));
+    } else {
+      write(tmp, encode(values, n, tmp));
+    }
+    values += n;
+    count -= n;
+  }
+}
+
+template<class T, class Decode>
+void ByteArray::readVArray(T* values, size_t count, Decode decode) {
+  while (count > 0) {
+    size_t readable = get_readable_size();
+    if (readable == 0) {
+      throw std::out_of_range("not enough len");
+    }
+    // 每次解码当前节点内的可读数据，跨节点的值单独读取
+    size_t cur_node_pos = rw_pos_ % node_base_size_;
+    size_t avail = cur_node_->size - cur_node_pos;
+    avail = avail < readable? avail: readable;
+    size_t used = 0;
+    size_t n = decode((const uint8_t*)cur_node_->ptr + cur_node_pos, avail, values, count, &used);
+    advance(used);
+    values += n;
+    count -= n;
+    if (n == 0) {
+      *values++ = sizeof(T) == sizeof(uint32_t)? readUint32V(): readUint64V();
+      --count;
+    }
+  }
+}
+
+void ByteArray::writeUint32VArray(const uint32_t* values, size_t count) {
+  writeVArray(values, count, s_varint_kernels.load(std::memory_order_relaxed)->encode32);
+}
+
+void ByteArray::writeUint64VArray(const uint64_t* values, size_t count) {
+  writeVArray(values, count, s_varint_kernels.load(std::memory_order_relaxed)->encode64);
+}
+
+void ByteArray::readUint32VArray(uint32_t* values, size_t count) {
+  readVArray(values, count, s_varint_kernels.load(std::memory_order_relaxed)->decode32);
+}
+
+void ByteArray::readUint64VArray(uint64_t* values, size_t count) {
+  readVArray(values, count, s_varint_kernels.load(std::memory_order_relaxed)->decode64);
 }
 
 void ByteArray::writeFloat(float value) {
@@ -223,6 +840,16 @@ int32_t ByteArray::readInt32V() {
 
 uint32_t ByteArray::readUint32V() {
   uint32_t res = 0;
+  if (cur_node_ && get_readable_size() > 0) {
+    // 整个值都在当前节点内时直接解码
+    size_t cur_node_pos = rw_pos_ % node_base_size_;
+    size_t avail = std::min(cur_node_->size - cur_node_pos, get_readable_size());
+    size_t n = DecodeOne((const uint8_t*)cur_node_->ptr + cur_node_pos, avail, &res);
+    if (n) {
+      advance(n);
+      return res;
+    }
+  }
   for(int i = 0; i < 32; i += 7) {
     uint8_t b = readUint8F();
     if (b < 0x80) {
@@ -241,6 +868,15 @@ int64_t ByteArray::readInt64V() {
 }
 uint64_t ByteArray::readUint64V() {
   uint64_t res = 0;
+  if (cur_node_ && get_readable_size() > 0) {
+    size_t cur_node_pos = rw_pos_ % node_base_size_;
+    size_t avail = std::min(cur_node_->size - cur_node_pos, get_readable_size());
+    size_t n = DecodeOne((const uint8_t*)cur_node_->ptr + cur_node_pos, avail, &res);
+    if (n) {
+      advance(n);
+      return res;
+    }
+  }
   for(int i = 0; i < 64; i += 7) {
     uint8_t b = readUint8F();
     if (b < 0x80) {
@@ -294,7 +930,10 @@ std::string ByteArray::readString64F() {
 }
 
 std::string ByteArray::readStringIntV() {
-  uint64_t len = readUint64F();
+  uint64_t len = readUint64V();
+  if (len > get_readable_size()) {
+    throw std::out_of_range("not enough len");
+  }
   std::string buf;
   buf.resize(len);
   read(&buf[0], len);
@@ -313,6 +952,12 @@ void ByteArray::clear() {
   cur_node_ = root_;
   // comment:只留一个节点，释放其他节点
   root_->next = nullptr;
+  if (root_->buffer->ref.load(std::memory_order_acquire) > 1) {
+    // 根节点的内存还被切片引用，换一块新的，避免之后的写入改写切片的数据
+    Buffer::Unref(root_->buffer);
+    root_->buffer = Buffer::Alloc(node_base_size_);
+    root_->ptr = root_->buffer->data();
+  }
 }
 
 void ByteArray::write(const void* buf, size_t size) {
@@ -433,6 +1078,66 @@ void ByteArray::set_rw_position(size_t v) {
   }
 }
 
+void ByteArray::advance(size_t size) {
+  if (size > get_remain_capacity()) {
+    throw std::out_of_range("advance out of range");
+  }
+  size_t cur_node_pos = rw_pos_ % node_base_size_;
+  while (size > 0) {
+    size_t remain_cap = cur_node_->size - cur_node_pos;
+    if (remain_cap > size) {
+      rw_pos_ += size;
+      size = 0;
+    } else {
+      // 与read/write一致，恰好用完一个节点时指向下一个节点
+      rw_pos_ += remain_cap;
+      size -= remain_cap;
+      cur_node_ = cur_node_->next;
+      cur_node_pos = 0;
+    }
+  }
+  if (rw_pos_ > size_) {
+    size_ = rw_pos_;
+  }
+}
+
+ByteSlice ByteArray::readSlice(size_t len) {
+  if (len > get_readable_size()) {
+    throw std::out_of_range("not enough len");
+  }
+  ByteSlice slice;
+  size_t cur_node_pos = rw_pos_ % node_base_size_;
+  while (len > 0) {
+    size_t n = cur_node_->size - cur_node_pos;
+    n = n > len? len: n;
+    Buffer::Ref(cur_node_->buffer);
+    slice.pieces_.push_back({cur_node_->buffer, cur_node_->ptr + cur_node_pos, n});
+    slice.size_ += n;
+    if (cur_node_->size == cur_node_pos + n) {
+      cur_node_ = cur_node_->next;
+    }
+    rw_pos_ += n;
+    len -= n;
+    cur_node_pos = 0;
+  }
+  return slice;
+}
+
+size_t ByteArray::discardRead() {
+  // cur_node_之前的节点都已经读完，至少保留一个节点
+  size_t discard = 0;
+  while (root_ != cur_node_ && root_->next) {
+    Node* tmp = root_;
+    root_ = root_->next;
+    delete tmp;
+    discard += node_base_size_;
+  }
+  rw_pos_ -= discard;
+  size_ -= discard;
+  capacity_ -= discard;
+  return discard;
+}
+
 bool ByteArray::writeToFile(const std::string& filename) const {
   // 将数据写入到文件
   std::ofstream ofs;   
@@ -477,6 +1182,78 @@ bool ByteArray::readFromFile(const std::string& filename) {
   return true;
 }
 
+bool ByteArray::mapFromFile(const std::string& filename) {
+  int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    MOKA_LOG_ERROR(g_logger) << "mapFromFile filename=" << filename
+      << " error, errno=" << errno << " errstr=" << strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    MOKA_LOG_ERROR(g_logger) << "mapFromFile fstat filename=" << filename
+      << " error, errno=" << errno << " errstr=" << strerror(errno);
+    close(fd);
+    return false;
+  }
+  size_t file_size = st.st_size;
+  if (file_size == 0) {
+    close(fd);
+    clear();
+    return true;
+  }
+  // 映射长度向上取整到节点大小，保证每个节点大小相同(读写位置按node_base_size_定位节点)
+  // 先保留匿名内存，再把文件覆盖映射到开头，文件末尾之后的部分是可写的零页
+  size_t len = (file_size + node_base_size_ - 1) / node_base_size_ * node_base_size_;
+  void* addr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (addr == MAP_FAILED) {
+    MOKA_LOG_ERROR(g_logger) << "mapFromFile mmap len=" << len
+      << " error, errno=" << errno << " errstr=" << strerror(errno);
+    close(fd);
+    return false;
+  }
+  // MAP_PRIVATE: 读直接使用页缓存，写时才拷贝对应的页，修改不会写回文件
+  if (mmap(addr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    MOKA_LOG_ERROR(g_logger) << "mapFromFile mmap filename=" << filename
+      << " error, errno=" << errno << " errstr=" << strerror(errno);
+    munmap(addr, len);
+    close(fd);
+    return false;
+  }
+  // 映射建立后文件描述符可以关闭
+  close(fd);
+  madvise(addr, file_size, MADV_SEQUENTIAL);
+
+  MappedBuffer* mapped = new MappedBuffer;
+  mapped->ref.store(0, std::memory_order_relaxed);
+  mapped->size_class = kMappedClass;
+  mapped->addr = (char*)addr;
+  mapped->len = len;
+
+  Node* tmp = root_;
+  while (tmp) {
+    cur_node_ = tmp;
+    tmp = tmp->next;
+    delete cur_node_;
+  }
+  root_ = nullptr;
+  Node** next = &root_;
+  for (size_t off = 0; off < len; off += node_base_size_) {
+    Node* node = new Node;
+    node->ptr = mapped->addr + off;
+    node->size = node_base_size_;
+    node->buffer = mapped;
+    Buffer::Ref(mapped);
+    *next = node;
+    next = &node->next;
+  }
+  cur_node_ = root_;
+  rw_pos_ = 0;
+  size_ = file_size;
+  capacity_ = len;
+  return true;
+}
+
 bool ByteArray::isLitteEndian() const {
   return endian_ == __ORDER_LITTLE_ENDIAN__;
 }
@@ -560,6 +1337,7 @@ uint64_t ByteArray::get_read_buffers(std::vector<iovec>& buffers, uint64_t len)
   size_t cur_node_pos = rw_pos_ % node_base_size_;
   size_t remain_capacity = cur_node_->size - cur_node_pos;
   struct iovec iov;
+  size_t first = buffers.size();
   Node* cur = cur_node_;
   while (len > 0) {
     if (remain_capacity >= len) {
@@ -574,7 +1352,13 @@ uint64_t ByteArray::get_read_buffers(std::vector<iovec>& buffers, uint64_t len)
       remain_capacity = cur->size;
       cur_node_pos = 0;
     }
-    buffers.push_back(iov);
+    if (buffers.size() > first
+        && (char*)buffers.back().iov_base + buffers.back().iov_len == iov.iov_base) {
+      // 相邻节点的内存连续(文件映射)时合并成一个iovec
+      buffers.back().iov_len += iov.iov_len;
+    } else {
+      buffers.push_back(iov);
+    }
   }
   return res;
 }
@@ -595,6 +1379,7 @@ uint64_t ByteArray::get_read_buffers(std::vector<iovec>& buffers, uint64_t len,
 
   size_t ncap = cur->size - cur_node_pos;
   struct iovec iov;
+  size_t first = buffers.size();
   while (len > 0) {
     if (ncap >= len) {
       iov.iov_base = cur->ptr + cur_node_pos;
@@ -608,7 +1393,13 @@ uint64_t ByteArray::get_read_buffers(std::vector<iovec>& buffers, uint64_t len,
       ncap = cur->size;
       cur_node_pos = 0;
     }
-    buffers.push_back(iov);
+    if (buffers.size() > first
+        && (char*)buffers.back().iov_base + buffers.back().iov_len == iov.iov_base) {
+      // 相邻节点的内存连续(文件映射)时合并成一个iovec
+      buffers.back().iov_len += iov.iov_len;
+    } else {
+      buffers.push_back(iov);
+    }
   }
   return res;
 }
@@ -641,4 +1432,98 @@ uint64_t ByteArray::get_write_buffers(std::vector<iovec>& buffers, uint64_t len)
   return res;
 }
 
-}
\ No newline at end of file
+ByteSlice::ByteSlice(const ByteSlice& oth)
+    : pieces_(oth.pieces_),
+      size_(oth.size_) {
+  for (auto& i : pieces_) {
+    ByteArray::Buffer::Ref(i.buffer);
+  }
+}
+
+ByteSlice::ByteSlice(ByteSlice&& oth) {
+  pieces_.swap(oth.pieces_);
+  std::swap(size_, oth.size_);
+}
+
+ByteSlice& ByteSlice::operator=(const ByteSlice& oth) {
+  if (this != &oth) {
+    ByteSlice tmp(oth);
+    pieces_.swap(tmp.pieces_);
+    std::swap(size_, tmp.size_);
+  }
+  return *this;
+}
+
+ByteSlice& ByteSlice::operator=(ByteSlice&& oth) {
+  pieces_.swap(oth.pieces_);
+  std::swap(size_, oth.size_);
+  return *this;
+}
+
+ByteSlice::~ByteSlice() {
+  clear();
+}
+
+void ByteSlice::clear() {
+  for (auto& i : pieces_) {
+    ByteArray::Buffer::Unref(i.buffer);
+  }
+  pieces_.clear();
+  size_ = 0;
+}
+
+void ByteSlice::append(const ByteSlice& oth) {
+  if (this == &oth) {
+    ByteSlice tmp(oth);
+    append(tmp);
+    return;
+  }
+  for (auto& i : oth.pieces_) {
+    ByteArray::Buffer::Ref(i.buffer);
+    pieces_.push_back(i);
+  }
+  size_ += oth.size_;
+}
+
+void ByteSlice::read(void* buf, size_t len, size_t pos) const {
+  if (pos > size_ || len > size_ - pos) {
+    throw std::out_of_range("not enough len");
+  }
+  char* out = (char*)buf;
+  for (auto& i : pieces_) {
+    if (len == 0) {
+      break;
+    }
+    if (pos >= i.len) {
+      pos -= i.len;
+      continue;
+    }
+    size_t n = i.len - pos;
+    n = n > len? len: n;
+    memcpy(out, i.ptr + pos, n);
+    out += n;
+    len -= n;
+    pos = 0;
+  }
+}
+
+std::string ByteSlice::toString() const {
+  std::string str;
+  str.resize(size_);
+  if (!str.empty()) {
+    read(&str[0], size_);
+  }
+  return str;
+}
+
+uint64_t ByteSlice::get_read_buffers(std::vector<iovec>& buffers) const {
+  for (auto& i : pieces_) {
+    iovec iov;
+    iov.iov_base = (void*)i.ptr;
+    iov.iov_len = i.len;
+    buffers.push_back(iov);
+  }
+  return size_;
+}
+
+}
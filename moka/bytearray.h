@@ -2,6 +2,7 @@
 #define __MOKA_BYTEARRAY_H__
 
 #include <memory>
+#include <atomic>
 #include <string>
 #include <vector>
 #include <stdint.h>
@@ -11,9 +12,22 @@
 
 namespace moka {
 
+class ByteSlice;
+
 class ByteArray {
  public:
   using ptr = std::shared_ptr<ByteArray>;
+  // 节点内存(引用计数，由节点和ByteSlice共享)，数据紧跟在结构体之后
+  // 不超过64K的按2的幂分级，从线程缓存的内存池中分配
+  struct Buffer {
+    std::atomic<uint32_t> ref;
+    uint32_t size_class;  // 内存池的大小级别(超过最大级别的直接malloc)
+    char* data() { return (char*)(this + 1); }
+
+    static Buffer* Alloc(size_t size);
+    static void Ref(Buffer* buffer) { buffer->ref.fetch_add(1, std::memory_order_relaxed); }
+    static void Unref(Buffer* buffer);
+  };
   struct Node {
     // 结构体为链表
     Node();
@@ -23,6 +37,7 @@ class ByteArray {
     char* ptr;
     size_t size;  // 当前节点所使用的空间(以字节为单位)
     Node* next;
+    Buffer* buffer;
   };
   ByteArray(size_t node_size = 4096);
   ~ByteArray();
@@ -44,6 +59,10 @@ class ByteArray {
   void writeInt64V (int64_t value);
   void writeUint64V(uint64_t value);
 
+  // 批量写入/读取varint(格式与逐个调用writeUint32V等相同)，按CPU支持的指令集选择SIMD实现
+  void writeUint32VArray(const uint32_t* values, size_t count);
+  void writeUint64VArray(const uint64_t* values, size_t count);
+
   void writeFloat(float value);
   void writeDouble(double value);
 
@@ -69,6 +88,9 @@ class ByteArray {
   int64_t  readInt64V();
   uint64_t readUint64V();
 
+  void readUint32VArray(uint32_t* values, size_t count);
+  void readUint64VArray(uint64_t* values, size_t count);
+
   float    readFloat();
   double   readDouble();
 
@@ -91,6 +113,10 @@ class ByteArray {
   // TODO:这里是不是可以调整一下返回值？学一下系统API返回写入或者读出字节数？
   bool writeToFile(const std::string& filename) const;
   bool readFromFile(const std::string& filename);
+  // 把文件映射为ByteArray的内容(替换原有数据，读写位置为0)，节点直接指向映射的内存
+  // 读取和get_read_buffers都不拷贝，写入时写时复制(不会改写文件)，之后追加的数据使用普通节点
+  // 大文件建议使用较大的节点大小，减少节点数量
+  bool mapFromFile(const std::string& filename);
 
   size_t get_base_size() const { return node_base_size_; }
   size_t get_readable_size() const { return size_ - rw_pos_; } 
@@ -108,8 +134,29 @@ class ByteArray {
 
   // 增加容量，不修改rw_pos_
   uint64_t get_write_buffers(std::vector<iovec>& buffers, uint64_t len);
+  // 读写指针后移size字节(不拷贝数据)，用于直接读写get_read_buffers/get_write_buffers的内存之后
+  void advance(size_t size);
+
+  // 从读写位置取出len字节的切片(共享节点内存，不拷贝)，读写指针后移len
+  // 切片持有节点内存的引用，之后不要再回退读写指针改写这段数据
+  ByteSlice readSlice(size_t len);
+  // 释放读写位置之前已经读完的整个节点(还给内存池)，返回释放的字节数
+  // 读写位置和大小同时减去释放的字节数，长连接的缓冲区解析完一条消息后调用，避免内存一直增长
+  size_t discardRead();
   size_t get_size() const { return size_; }
+
+  // 直接操作内存的varint编解码(与writeUint64V/readUint64V的格式相同)
+  static size_t PutVarint64(uint8_t* buf, uint64_t value);                     // buf至少10字节，返回写入的字节数
+  static size_t GetVarint64(const uint8_t* buf, size_t len, uint64_t* value);  // 返回读取的字节数，数据不完整时返回0
+  static uint64_t Zigzag64(int64_t value);
+  static int64_t Unzigzag64(uint64_t value);
+  // 当前批量varint编解码使用的实现(avx2/sse4.1/scalar)
+  static const char* VarintKernelName();
  private:
+  template<class T, class Encode>
+  void writeVArray(const T* values, size_t count, Encode encode);
+  template<class T, class Decode>
+  void readVArray(T* values, size_t count, Decode decode);
   void addCapacity(size_t size);
   size_t get_remain_capacity() const { return capacity_ - rw_pos_; }
  private:
@@ -123,6 +170,40 @@ class ByteArray {
   Node* cur_node_;                 // 当前节点指针
 };
 
+// ByteArray中一段数据的只读引用，拷贝只增加节点内存的引用计数，可以交给其他协程/线程处理
+class ByteSlice {
+ public:
+  ByteSlice() {}
+  ByteSlice(const ByteSlice& oth);
+  ByteSlice(ByteSlice&& oth);
+  ByteSlice& operator=(const ByteSlice& oth);
+  ByteSlice& operator=(ByteSlice&& oth);
+  ~ByteSlice();
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  void clear();
+  // 把oth的数据追加到末尾(只增加引用计数)
+  void append(const ByteSlice& oth);
+  // 数据在一块连续内存中时返回其地址，否则(包括为空时)返回nullptr
+  const char* data() const { return pieces_.size() == 1? pieces_[0].ptr: nullptr; }
+  // 拷贝[pos, pos + len)的数据到buf
+  void read(void* buf, size_t len, size_t pos = 0) const;
+  std::string toString() const;
+  // 适配socket的iovec结构
+  uint64_t get_read_buffers(std::vector<iovec>& buffers) const;
+
+ private:
+  friend class ByteArray;
+  struct Piece {
+    ByteArray::Buffer* buffer;
+    const char* ptr;
+    size_t len;
+  };
+  std::vector<Piece> pieces_;
+  size_t size_ = 0;
+};
+
 }
 
 #endif
\ No newline at end of file
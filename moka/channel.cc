@@ -0,0 +1,106 @@
+#include "channel.h"
+#include "iomanager.h"
+#include "util.h"
+
+namespace moka {
+
+// 连续在线程私有队列中唤醒的次数，超过后走调度器的共享队列，
+// 避免两个协程一直互相唤醒时同一线程上的其他任务饿死
+static const uint32_t s_max_direct_wakeups = 64;
+static thread_local uint32_t t_direct_wakeups = 0;
+
+// select从不同的分支开始尝试，避免排在前面的channel一直有数据时后面的饿死
+static thread_local uint32_t t_select_seq = 0;
+
+ChannelWaiter::ptr ChannelWaiter::Create() {
+  Scheduler* scheduler = Scheduler::GetThis();
+  MOKA_ASSERT_2(scheduler, "channel must block inside a scheduler");
+  ChannelWaiter::ptr waiter(new ChannelWaiter);
+  waiter->fiber = Fiber::GetThis();
+  waiter->scheduler = scheduler;
+  waiter->thread = GetThreadId();
+  return waiter;
+}
+
+void ChannelWaiter::wake() {
+  Fiber::ptr f = std::move(fiber);
+  Scheduler* s = scheduler;
+  // 等待者挂起在当前线程上时它一定已经切换出去了，可以直接放入当前线程私有的队列(不加锁也不需要通知其他线程)
+  if (s == Scheduler::GetThis() && thread == GetThreadId()
+      && ++t_direct_wakeups % s_max_direct_wakeups != 0) {
+    s->schedule(f, thread);
+    return;
+  }
+  s->schedule(f);
+}
+
+int ChannelSelect::wait(uint64_t timeout_ms) {
+  MOKA_ASSERT(!cases_.empty());
+  size_t n = cases_.size();
+  uint64_t deadline = -1;
+  if (timeout_ms != (uint64_t)-1) {
+    deadline = GetCurrentMs() + timeout_ms;
+  }
+  while (true) {
+    size_t start = t_select_seq++ % n;
+    for (size_t k = 0; k < n; ++k) {
+      size_t i = (start + k) % n;
+      if (cases_[i]->tryComplete(closed_)) {
+        return i;
+      }
+    }
+    uint64_t now = 0;
+    if (deadline != (uint64_t)-1) {
+      now = GetCurrentMs();
+      if (now >= deadline) {
+        return -1;
+      }
+    }
+
+    // 在所有分支上登记等待者
+    ChannelWaiter::ptr waiter = ChannelWaiter::Create();
+    ChannelCase::Status status = ChannelCase::QUEUED;
+    size_t queued = 0;
+    for (; queued < n; ++queued) {
+      status = cases_[queued]->enqueue(waiter.get(), queued);
+      if (status != ChannelCase::QUEUED) {
+        break;
+      }
+    }
+    if (status == ChannelCase::QUEUED || status == ChannelCase::CLAIMED) {
+      Timer::ptr timer;
+      if (deadline != (uint64_t)-1) {
+        IOManager* iom = IOManager::GetThis();
+        MOKA_ASSERT_2(iom, "channel timeout needs an IOManager");
+        std::weak_ptr<ChannelWaiter> weak_waiter(waiter);
+        timer = iom->addTimer(deadline - now, [weak_waiter]() {
+          ChannelWaiter::ptr waiter = weak_waiter.lock();
+          if (waiter && waiter->claim()) {
+            waiter->timeout = true;
+            waiter->wake();
+          }
+        });
+      }
+      Fiber::YieldToHoldSched();
+      if (timer) {
+        timer->cancel();
+      }
+    }
+    for (size_t i = 0; i < queued; ++i) {
+      cases_[i]->dequeue();
+    }
+
+    if (status == ChannelCase::DONE) {
+      closed_ = false;
+      return queued;
+    } else if (status == ChannelCase::READY || waiter->retry) {
+      continue;
+    } else if (waiter->timeout) {
+      return -1;
+    }
+    closed_ = waiter->closed;
+    return waiter->index;
+  }
+}
+
+}
@@ -0,0 +1,593 @@
+#ifndef __MOKA_CHANNEL_H__
+#define __MOKA_CHANNEL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "fiber.h"
+#include "scheduler.h"
+#include "thread.h"
+#include "macro.h"
+#include "noncopyable.h"
+
+namespace moka {
+
+template<class T> class Channel;
+
+// 挂起在channel上的协程，一次阻塞的push/pop/select对应一个
+// 可能同时登记在多个channel上(select)，第一个把state从WAITING改为DONE的一方(对端、定时器或close)负责唤醒它
+struct ChannelWaiter {
+  using ptr = std::shared_ptr<ChannelWaiter>;
+  enum State {
+    WAITING = 0,
+    DONE = 1
+  };
+
+  std::atomic<int> state = {WAITING};
+  int index = -1;           // 完成的分支序号
+  bool closed = false;      // 分支因为channel关闭而完成
+  bool retry = false;       // 被唤醒但没有完成，需要重新尝试
+  bool timeout = false;
+  Fiber::ptr fiber;
+  Scheduler* scheduler = nullptr;
+  pid_t thread = -1;        // 挂起时所在的调度线程
+
+  // 创建当前协程的等待者(必须在调度器的协程中)
+  static ptr Create();
+
+  bool claim() {
+    int expected = WAITING;
+    return state.compare_exchange_strong(expected, DONE, std::memory_order_acq_rel);
+  }
+  // 唤醒等待者，调用之后不能再访问等待者
+  void wake();
+};
+
+// select的一个分支(在一个channel上收或发)
+class ChannelCase {
+ public:
+  enum Status {
+    QUEUED,     // 已经登记，等待对端唤醒
+    READY,      // channel的状态已经变化(等待者已经被自己认领)，需要重新尝试
+    DONE,       // 登记时和已经挂起的对端直接完成了交换
+    CLAIMED     // 等待者已经被其他分支认领，挂起等待唤醒
+  };
+
+  virtual ~ChannelCase() {}
+  // 不挂起地尝试完成，完成(包括channel已关闭)返回true
+  virtual bool tryComplete(bool& closed) = 0;
+  // 在channel上登记等待者
+  virtual Status enqueue(ChannelWaiter* waiter, int index) = 0;
+  // 取消登记(已经被对端取走的不需要处理)
+  virtual void dequeue() = 0;
+};
+
+// 同时在多个channel上等待，哪个分支先完成就返回哪个
+//   int a; std::string b;
+//   ChannelSelect select;
+//   select.recv(ch1, a);        // 分支0
+//   select.send(ch2, "hello");  // 分支1
+//   switch (select.wait(100)) { ... }
+// 同一个select中不要对同一个channel同时收和发
+class ChannelSelect : public Noncopyable {
+ public:
+  // 添加从ch接收到v的分支，返回分支序号
+  template<class T>
+  int recv(Channel<T>& ch, T& v);
+  // 添加把v发送到ch的分支，返回分支序号
+  template<class T>
+  int send(Channel<T>& ch, T v);
+
+  // 等待任意一个分支完成，返回分支序号，超过timeout_ms毫秒返回-1(timeout_ms为0时不等待)
+  // 带超时的等待需要在IOManager中调用
+  int wait(uint64_t timeout_ms = -1);
+  // 完成的分支是否因为channel关闭而返回(没有收到或发出数据)
+  bool is_closed() const { return closed_; }
+
+ private:
+  std::vector<std::unique_ptr<ChannelCase>> cases_;
+  bool closed_ = false;
+};
+
+// 有界多生产者多消费者channel，用于协程之间传递数据
+// 缓冲区是无锁的环形队列，缓冲区不满/不空并且没有挂起的对端时push/pop不加锁也不唤醒任何协程
+// 缓冲区满(空)时挂起当前协程，对端pop(push)时直接把数据交给挂起的协程，不经过缓冲区
+// 唤醒在同一个调度线程上挂起的协程时放入线程私有的队列，不经过调度器的共享队列
+// capacity为0时没有缓冲区，push和pop必须配对完成
+// close之后push失败，pop取完缓冲区中剩余的数据之后失败
+template<class T>
+class Channel : public Noncopyable {
+  friend class ChannelSelect;
+ public:
+  using ptr = std::shared_ptr<Channel>;
+
+  Channel(size_t capacity);
+  ~Channel();
+
+  // 发送数据，等待最多timeout_ms毫秒，超时或channel已关闭返回false
+  bool push(T v, uint64_t timeout_ms = -1);
+  // 接收数据，等待最多timeout_ms毫秒，超时或channel已关闭(并且没有剩余数据)返回false
+  bool pop(T& v, uint64_t timeout_ms = -1);
+  bool try_push(T v) { return push(std::move(v), 0); }
+  bool try_pop(T& v) { return pop(v, 0); }
+
+  // 关闭channel，唤醒所有挂起的协程
+  void close();
+  bool is_closed() const { return closed_.load(std::memory_order_acquire); }
+  // 缓冲区中的数据量(近似值)
+  size_t size() const;
+  size_t capacity() const { return capacity_; }
+
+ private:
+  // 挂起的一方登记在等待队列中的节点(在挂起协程的栈上)
+  struct Entry {
+    ChannelWaiter* waiter = nullptr;
+    int index = 0;
+    T* slot = nullptr;        // 接收方写入数据的位置/发送方待发送的数据
+    Entry* prev = nullptr;
+    Entry* next = nullptr;
+    bool queued = false;
+  };
+
+  // 侵入式双向链表，由mutex_保护
+  struct WaitQueue {
+    Entry* head = nullptr;
+    Entry* tail = nullptr;
+    std::atomic<uint32_t> size = {0};   // 不加锁检查是否有挂起的对端
+
+    void push_back(Entry* e);
+    void remove(Entry* e);
+    // 取出第一个可以认领的等待者(跳过exclude和已经被认领的)
+    Entry* claim(ChannelWaiter* exclude);
+  };
+
+  // 第lap圈的槽位: seq为lap*2时可以写入，为lap*2+1时可以取出
+  // (不用Vyukov原来的pos序号，否则容量为1时无法区分满和空)
+  struct Cell {
+    std::atomic<uint64_t> seq;
+    T value;
+  };
+
+  class RecvCase : public ChannelCase {
+   public:
+    RecvCase(Channel* ch, T* out) : ch_(ch) { entry_.slot = out; }
+    virtual bool tryComplete(bool& closed) override { return ch_->tryRecv(*entry_.slot, closed); }
+    virtual Status enqueue(ChannelWaiter* waiter, int index) override;
+    virtual void dequeue() override { ch_->dequeue(&entry_, ch_->recvq_); }
+   private:
+    Channel* ch_;
+    Entry entry_;
+  };
+
+  class SendCase : public ChannelCase {
+   public:
+    SendCase(Channel* ch, T v) : ch_(ch), value_(std::move(v)) { entry_.slot = &value_; }
+    virtual bool tryComplete(bool& closed) override { return ch_->trySend(value_, closed); }
+    virtual Status enqueue(ChannelWaiter* waiter, int index) override;
+    virtual void dequeue() override { ch_->dequeue(&entry_, ch_->sendq_); }
+   private:
+    Channel* ch_;
+    T value_;
+    Entry entry_;
+  };
+
+  // 无锁环形队列(Vyukov的有界MPMC队列)，失败时不修改v
+  bool ringPush(T& v);
+  bool ringPop(T& v);
+  bool ringEmpty() const;
+  bool ringFull() const;
+
+  // 不挂起地收发，完成或者channel已关闭返回true
+  bool trySend(T& v, bool& closed);
+  bool tryRecv(T& v, bool& closed);
+  // 放入/取出缓冲区之后检查是否有挂起的对端需要唤醒
+  void wakeReceiver();
+  void wakeSender();
+  void dequeue(Entry* e, WaitQueue& queue);
+
+ private:
+  // 生产者和消费者竞争的位置分开放在不同的缓存行
+  std::atomic<uint64_t> enqueue_pos_ = {0};
+  char pad1_[64 - sizeof(std::atomic<uint64_t>)];
+  std::atomic<uint64_t> dequeue_pos_ = {0};
+  char pad2_[64 - sizeof(std::atomic<uint64_t>)];
+  const size_t capacity_;
+  Cell* cells_ = nullptr;
+
+  std::atomic<bool> closed_ = {false};
+  Spinlock mutex_;               // 保护等待队列
+  WaitQueue recvq_;
+  WaitQueue sendq_;
+};
+
+template<class T>
+int ChannelSelect::recv(Channel<T>& ch, T& v) {
+  cases_.emplace_back(new typename Channel<T>::RecvCase(&ch, &v));
+  return cases_.size() - 1;
+}
+
+template<class T>
+int ChannelSelect::send(Channel<T>& ch, T v) {
+  cases_.emplace_back(new typename Channel<T>::SendCase(&ch, std::move(v)));
+  return cases_.size() - 1;
+}
+
+template<class T>
+Channel<T>::Channel(size_t capacity)
+    : capacity_(capacity) {
+  if (capacity_) {
+    cells_ = new Cell[capacity_];
+    for (size_t i = 0; i < capacity_; ++i) {
+      cells_[i].seq.store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+template<class T>
+Channel<T>::~Channel() {
+  MOKA_ASSERT(!recvq_.head && !sendq_.head);
+  delete[] cells_;
+}
+
+template<class T>
+void Channel<T>::WaitQueue::push_back(Entry* e) {
+  e->prev = tail;
+  e->next = nullptr;
+  if (tail) {
+    tail->next = e;
+  } else {
+    head = e;
+  }
+  tail = e;
+  e->queued = true;
+  size.fetch_add(1);
+}
+
+template<class T>
+void Channel<T>::WaitQueue::remove(Entry* e) {
+  if (e->prev) {
+    e->prev->next = e->next;
+  } else {
+    head = e->next;
+  }
+  if (e->next) {
+    e->next->prev = e->prev;
+  } else {
+    tail = e->prev;
+  }
+  e->prev = e->next = nullptr;
+  e->queued = false;
+  size.fetch_sub(1);
+}
+
+template<class T>
+typename Channel<T>::Entry* Channel<T>::WaitQueue::claim(ChannelWaiter* exclude) {
+  Entry* e = head;
+  while (e) {
+    Entry* next = e->next;
+    if (e->waiter != exclude) {
+      // 认领失败的等待者已经在其他channel上完成(或超时)，也从队列中移除
+      remove(e);
+      if (e->waiter->claim()) {
+        return e;
+      }
+    }
+    e = next;
+  }
+  return nullptr;
+}
+
+template<class T>
+bool Channel<T>::ringPush(T& v) {
+  if (!capacity_) {
+    return false;
+  }
+  uint64_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    Cell& cell = cells_[pos % capacity_];
+    uint64_t lap = pos / capacity_;
+    uint64_t seq = cell.seq.load(std::memory_order_acquire);
+    int64_t diff = (int64_t)seq - (int64_t)(lap * 2);
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        cell.value = std::move(v);
+        cell.seq.store(lap * 2 + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      // 上一圈的数据还没有被取走，队列已满
+      return false;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template<class T>
+bool Channel<T>::ringPop(T& v) {
+  if (!capacity_) {
+    return false;
+  }
+  uint64_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    Cell& cell = cells_[pos % capacity_];
+    uint64_t lap = pos / capacity_;
+    uint64_t seq = cell.seq.load(std::memory_order_acquire);
+    int64_t diff = (int64_t)seq - (int64_t)(lap * 2 + 1);
+    if (diff == 0) {
+      if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        v = std::move(cell.value);
+        cell.seq.store(lap * 2 + 2, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      // 这一圈的数据还没有写入，队列为空
+      return false;
+    } else {
+      pos = dequeue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+// 写入或取出进行到一半的槽位也算作有数据/有空位，调用者会重新尝试
+template<class T>
+bool Channel<T>::ringEmpty() const {
+  return enqueue_pos_.load(std::memory_order_acquire) == dequeue_pos_.load(std::memory_order_acquire);
+}
+
+template<class T>
+bool Channel<T>::ringFull() const {
+  return size() >= capacity_;
+}
+
+template<class T>
+size_t Channel<T>::size() const {
+  uint64_t d = dequeue_pos_.load(std::memory_order_acquire);
+  uint64_t e = enqueue_pos_.load(std::memory_order_acquire);
+  return e > d? e - d: 0;
+}
+
+template<class T>
+bool Channel<T>::trySend(T& v, bool& closed) {
+  closed = false;
+  if (is_closed()) {
+    closed = true;
+    return true;
+  }
+  if (recvq_.size.load() > 0) {
+    // 有挂起的接收方(缓冲区为空)，直接交给它
+    ChannelWaiter* waiter = nullptr;
+    {
+      Spinlock::LockGuard lock(mutex_);
+      Entry* e = recvq_.claim(nullptr);
+      if (e) {
+        *e->slot = std::move(v);
+        waiter = e->waiter;
+        waiter->index = e->index;
+      }
+    }
+    if (waiter) {
+      waiter->wake();
+      return true;
+    }
+  }
+  if (ringPush(v)) {
+    wakeReceiver();
+    return true;
+  }
+  return false;
+}
+
+template<class T>
+bool Channel<T>::tryRecv(T& v, bool& closed) {
+  closed = false;
+  if (ringPop(v)) {
+    wakeSender();
+    return true;
+  }
+  if (sendq_.size.load() > 0) {
+    // 有挂起的发送方(缓冲区已满或者没有缓冲区)，直接取走它的数据
+    ChannelWaiter* waiter = nullptr;
+    {
+      Spinlock::LockGuard lock(mutex_);
+      Entry* e = sendq_.claim(nullptr);
+      if (e) {
+        v = std::move(*e->slot);
+        waiter = e->waiter;
+        waiter->index = e->index;
+      }
+    }
+    if (waiter) {
+      waiter->wake();
+      return true;
+    }
+  }
+  if (is_closed()) {
+    // 关闭之前写入缓冲区的数据仍然可以取出
+    if (ringPop(v)) {
+      return true;
+    }
+    closed = true;
+    return true;
+  }
+  return false;
+}
+
+// 接收方登记时先增加等待队列的大小再检查缓冲区，这里先写入缓冲区再检查等待队列的大小，不会错过唤醒
+template<class T>
+void Channel<T>::wakeReceiver() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (recvq_.size.load() == 0) {
+    return;
+  }
+  ChannelWaiter* waiter = nullptr;
+  {
+    Spinlock::LockGuard lock(mutex_);
+    Entry* e = recvq_.claim(nullptr);
+    if (!e) {
+      return;
+    }
+    waiter = e->waiter;
+    if (ringPop(*e->slot)) {
+      waiter->index = e->index;
+    } else {
+      // 数据已经被其他接收方取走
+      waiter->retry = true;
+    }
+  }
+  waiter->wake();
+}
+
+template<class T>
+void Channel<T>::wakeSender() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sendq_.size.load() == 0) {
+    return;
+  }
+  ChannelWaiter* waiter = nullptr;
+  {
+    Spinlock::LockGuard lock(mutex_);
+    Entry* e = sendq_.claim(nullptr);
+    if (!e) {
+      return;
+    }
+    waiter = e->waiter;
+    if (ringPush(*e->slot)) {
+      waiter->index = e->index;
+    } else {
+      // 空位已经被其他发送方占用
+      waiter->retry = true;
+    }
+  }
+  waiter->wake();
+}
+
+template<class T>
+ChannelCase::Status Channel<T>::RecvCase::enqueue(ChannelWaiter* waiter, int index) {
+  entry_.waiter = waiter;
+  entry_.index = index;
+  ChannelWaiter* peer = nullptr;
+  {
+    Spinlock::LockGuard lock(ch_->mutex_);
+    ch_->recvq_.push_back(&entry_);
+    // 与wakeReceiver的顺序相反
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool has_sender = ch_->sendq_.head
+                      && (ch_->sendq_.head != ch_->sendq_.tail || ch_->sendq_.head->waiter != waiter);
+    if (!has_sender && ch_->ringEmpty() && !ch_->is_closed()) {
+      return QUEUED;
+    }
+    ch_->recvq_.remove(&entry_);
+    if (!waiter->claim()) {
+      return CLAIMED;
+    }
+    Entry* e = ch_->sendq_.claim(waiter);
+    if (!e) {
+      return READY;
+    }
+    *entry_.slot = std::move(*e->slot);
+    peer = e->waiter;
+    peer->index = e->index;
+  }
+  peer->wake();
+  return DONE;
+}
+
+template<class T>
+ChannelCase::Status Channel<T>::SendCase::enqueue(ChannelWaiter* waiter, int index) {
+  entry_.waiter = waiter;
+  entry_.index = index;
+  ChannelWaiter* peer = nullptr;
+  {
+    Spinlock::LockGuard lock(ch_->mutex_);
+    ch_->sendq_.push_back(&entry_);
+    // 与wakeSender的顺序相反
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool has_receiver = ch_->recvq_.head
+                        && (ch_->recvq_.head != ch_->recvq_.tail || ch_->recvq_.head->waiter != waiter);
+    if (!has_receiver && ch_->ringFull() && !ch_->is_closed()) {
+      return QUEUED;
+    }
+    ch_->sendq_.remove(&entry_);
+    if (!waiter->claim()) {
+      return CLAIMED;
+    }
+    Entry* e = ch_->recvq_.claim(waiter);
+    if (!e) {
+      return READY;
+    }
+    *e->slot = std::move(value_);
+    peer = e->waiter;
+    peer->index = e->index;
+  }
+  peer->wake();
+  return DONE;
+}
+
+template<class T>
+void Channel<T>::dequeue(Entry* e, WaitQueue& queue) {
+  Spinlock::LockGuard lock(mutex_);
+  if (e->queued) {
+    queue.remove(e);
+  }
+}
+
+template<class T>
+bool Channel<T>::push(T v, uint64_t timeout_ms) {
+  bool closed;
+  if (trySend(v, closed)) {
+    return !closed;
+  }
+  if (timeout_ms == 0) {
+    return false;
+  }
+  ChannelSelect select;
+  select.send(*this, std::move(v));
+  return select.wait(timeout_ms) == 0 && !select.is_closed();
+}
+
+template<class T>
+bool Channel<T>::pop(T& v, uint64_t timeout_ms) {
+  bool closed;
+  if (tryRecv(v, closed)) {
+    return !closed;
+  }
+  if (timeout_ms == 0) {
+    return false;
+  }
+  ChannelSelect select;
+  select.recv(*this, v);
+  return select.wait(timeout_ms) == 0 && !select.is_closed();
+}
+
+template<class T>
+void Channel<T>::close() {
+  std::vector<ChannelWaiter*> waiters;
+  {
+    Spinlock::LockGuard lock(mutex_);
+    if (is_closed()) {
+      return;
+    }
+    closed_.store(true, std::memory_order_release);
+    // 发送方直接失败；接收方重新尝试，先取完缓冲区中剩余的数据
+    while (Entry* e = sendq_.claim(nullptr)) {
+      e->waiter->index = e->index;
+      e->waiter->closed = true;
+      waiters.push_back(e->waiter);
+    }
+    while (Entry* e = recvq_.claim(nullptr)) {
+      e->waiter->retry = true;
+      waiters.push_back(e->waiter);
+    }
+  }
+  for (auto i : waiters) {
+    i->wake();
+  }
+}
+
+}
+
+#endif
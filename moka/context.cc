@@ -0,0 +1,156 @@
+#include "context.h"
+#include "macro.h"
+
+#include <stdint.h>
+
+#if defined(__x86_64__)
+// x86-64 System V: rbx, rbp, r12-r15是callee-saved寄存器，另外保存mxcsr和x87控制字
+// 栈帧布局(由低到高): [mxcsr|x87cw] r12 r13 r14 r15 rbx rbp 返回地址
+asm(R"(
+  .text
+  .globl moka_swap_context
+  .type moka_swap_context, @function
+  .align 16
+moka_swap_context:
+  pushq %rbp
+  pushq %rbx
+  pushq %r15
+  pushq %r14
+  pushq %r13
+  pushq %r12
+  subq $8, %rsp
+  stmxcsr (%rsp)
+  fnstcw 4(%rsp)
+  movq %rsp, (%rdi)
+  movq %rsi, %rsp
+  ldmxcsr (%rsp)
+  fldcw 4(%rsp)
+  addq $8, %rsp
+  popq %r12
+  popq %r13
+  popq %r14
+  popq %r15
+  popq %rbx
+  popq %rbp
+  ret
+  .size moka_swap_context, .-moka_swap_context
+  .section .note.GNU-stack,"",@progbits
+  .text
+)");
+#elif defined(__aarch64__)
+// AAPCS64: x19-x28, fp(x29), lr(x30)和d8-d15是callee-saved寄存器
+// 栈帧布局(由低到高): d8-d15 x19-x28 fp lr 返回地址 填充(保证16字节对齐)
+asm(R"(
+  .text
+  .globl moka_swap_context
+  .type moka_swap_context, %function
+  .align 4
+moka_swap_context:
+  sub sp, sp, #0xb0
+  stp d8, d9, [sp, #0x00]
+  stp d10, d11, [sp, #0x10]
+  stp d12, d13, [sp, #0x20]
+  stp d14, d15, [sp, #0x30]
+  stp x19, x20, [sp, #0x40]
+  stp x21, x22, [sp, #0x50]
+  stp x23, x24, [sp, #0x60]
+  stp x25, x26, [sp, #0x70]
+  stp x27, x28, [sp, #0x80]
+  stp x29, x30, [sp, #0x90]
+  str x30, [sp, #0xa0]
+  mov x9, sp
+  str x9, [x0]
+  mov sp, x1
+  ldp d8, d9, [sp, #0x00]
+  ldp d10, d11, [sp, #0x10]
+  ldp d12, d13, [sp, #0x20]
+  ldp d14, d15, [sp, #0x30]
+  ldp x19, x20, [sp, #0x40]
+  ldp x21, x22, [sp, #0x50]
+  ldp x23, x24, [sp, #0x60]
+  ldp x25, x26, [sp, #0x70]
+  ldp x27, x28, [sp, #0x80]
+  ldp x29, x30, [sp, #0x90]
+  ldr x9, [sp, #0xa0]
+  add sp, sp, #0xb0
+  ret x9
+  .size moka_swap_context, .-moka_swap_context
+  .section .note.GNU-stack,"",%progbits
+  .text
+)");
+#endif
+
+namespace moka {
+
+#if MOKA_HAVE_ASM_CONTEXT
+void* MakeAsmContext(void* stack, size_t size, void (*fn)()) {
+  // 栈顶按16字节对齐
+  uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+#if defined(__x86_64__)
+  // ret之后rsp = top - 8，和普通函数调用入口的对齐方式一致(rsp % 16 == 8)
+  uint64_t* sp = (uint64_t*)(top - 72);
+  sp[0] = 0x1F80 | ((uint64_t)0x037F << 32);  // mxcsr和x87控制字的默认值
+  sp[1] = 0;                                  // r12
+  sp[2] = 0;                                  // r13
+  sp[3] = 0;                                  // r14
+  sp[4] = 0;                                  // r15
+  sp[5] = 0;                                  // rbx
+  sp[6] = 0;                                  // rbp
+  sp[7] = (uint64_t)fn;                       // ret跳转到fn
+  sp[8] = 0;                                  // fn的返回地址(fn不会返回，方便backtrace终止)
+#else
+  uint64_t* sp = (uint64_t*)(top - 0xb0);
+  for (int i = 0; i < 0xb0 / 8; ++i) {
+    sp[i] = 0;                                // d8-d15, x19-x28, fp, lr
+  }
+  sp[0xa0 / 8] = (uint64_t)fn;                // ret跳转到fn
+#endif
+  return sp;
+}
+#endif
+
+#if MOKA_USE_ASM_CONTEXT
+
+void InitMainContext(Context& ctx) {
+  // 主协程使用线程自己的栈，第一次切换出去时才会保存栈指针
+  ctx.sp = nullptr;
+}
+
+void MakeContext(Context& ctx, void* stack, size_t size, void (*fn)()) {
+  ctx.sp = MakeAsmContext(stack, size, fn);
+}
+
+int SwapContext(Context& from, Context& to) {
+  moka_swap_context(&from.sp, to.sp);
+  return 0;
+}
+
+const char* GetContextBackend() {
+  return "asm";
+}
+
+#else
+
+void InitMainContext(Context& ctx) {
+  MOKA_ASSERT_2(!getcontext(&ctx.uc), "getcontext");
+}
+
+void MakeContext(Context& ctx, void* stack, size_t size, void (*fn)()) {
+  MOKA_ASSERT_2(!getcontext(&ctx.uc), "getcontext");
+  ctx.uc.uc_link = nullptr;
+  ctx.uc.uc_stack.ss_sp = stack;
+  ctx.uc.uc_stack.ss_size = size;
+  makecontext(&ctx.uc, fn, 0);
+}
+
+int SwapContext(Context& from, Context& to) {
+  return swapcontext(&from.uc, &to.uc);
+}
+
+const char* GetContextBackend() {
+  return "ucontext";
+}
+
+#endif
+
+}
@@ -0,0 +1,55 @@
+#ifndef __MOKA_CONTEXT_H__
+#define __MOKA_CONTEXT_H__
+
+#include <ucontext.h>
+#include <stddef.h>
+
+// 汇编实现的上下文切换只支持x86-64和aarch64
+#if defined(__x86_64__) || defined(__aarch64__)
+#define MOKA_HAVE_ASM_CONTEXT 1
+#else
+#define MOKA_HAVE_ASM_CONTEXT 0
+#endif
+
+// 编译时通过MOKA_ASM_CONTEXT选择协程使用的上下文切换方式，不支持的平台回退到ucontext
+#if defined(MOKA_ASM_CONTEXT) && MOKA_HAVE_ASM_CONTEXT
+#define MOKA_USE_ASM_CONTEXT 1
+#else
+#define MOKA_USE_ASM_CONTEXT 0
+#endif
+
+extern "C" {
+// 将callee-saved寄存器压入当前栈，当前栈指针保存到*from_sp，然后切换到to_sp并恢复寄存器
+// 只保存ABI要求被调用者保存的寄存器，不保存信号掩码(没有rt_sigprocmask系统调用)
+void moka_swap_context(void** from_sp, void* to_sp);
+}
+
+namespace moka {
+
+#if MOKA_HAVE_ASM_CONTEXT
+// 在协程栈顶构造初始栈帧，第一次切换进来时会从fn开始执行(fn不能返回)
+// 返回该上下文的栈指针
+void* MakeAsmContext(void* stack, size_t size, void (*fn)());
+#endif
+
+// 协程上下文
+struct Context {
+#if MOKA_USE_ASM_CONTEXT
+  void* sp = nullptr;     // 切换出去时保存的栈指针(寄存器保存在栈上)
+#else
+  ucontext_t uc;
+#endif
+};
+
+// 初始化主协程的上下文(使用当前线程的栈)
+void InitMainContext(Context& ctx);
+// 初始化子协程的上下文，切换进来时从fn开始执行
+void MakeContext(Context& ctx, void* stack, size_t size, void (*fn)());
+// 保存当前上下文到from，切换到to，成功返回0
+int SwapContext(Context& from, Context& to);
+// 当前使用的上下文切换方式
+const char* GetContextBackend();
+
+}
+
+#endif
@@ -0,0 +1,635 @@
+#include "dns.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#include "socket.h"
+#include "scheduler.h"
+#include "config.h"
+#include "log.h"
+#include "util.h"
+
+namespace moka {
+
+static moka::Logger::ptr g_logger = MOKA_LOG_NAME("system");
+
+static ConfigVar<std::vector<std::string>>::ptr g_dns_servers =
+  Config::Lookup("dns.servers", std::vector<std::string>(), "dns servers(ip or ip:port), empty to use /etc/resolv.conf");
+
+static ConfigVar<std::string>::ptr g_dns_hosts_file =
+  Config::Lookup<std::string>("dns.hosts_file", "/etc/hosts", "hosts file checked before dns servers");
+
+static ConfigVar<uint64_t>::ptr g_dns_timeout =
+  Config::Lookup<uint64_t>("dns.timeout", 2000, "dns query timeout per server(ms)");
+
+static ConfigVar<uint32_t>::ptr g_dns_attempts =
+  Config::Lookup<uint32_t>("dns.attempts", 2, "dns query rounds over all servers");
+
+static ConfigVar<uint32_t>::ptr g_dns_negative_ttl =
+  Config::Lookup<uint32_t>("dns.negative_ttl", 5, "dns cache ttl(s) for names without addresses");
+
+static ConfigVar<std::vector<std::string>>::ptr g_dns_search =
+  Config::Lookup("dns.search", std::vector<std::string>(), "dns search domains for short names, empty to use /etc/resolv.conf");
+
+static ConfigVar<uint32_t>::ptr g_dns_ndots =
+  Config::Lookup<uint32_t>("dns.ndots", 1, "names with fewer dots are tried with dns.search first");
+
+static ConfigVar<uint32_t>::ptr g_dns_cache_size =
+  Config::Lookup<uint32_t>("dns.cache_size", 10000, "dns cache max names");
+
+// DNS报文中的常量(RFC 1035)
+static const uint16_t DNS_TYPE_A = 1;
+static const uint16_t DNS_TYPE_AAAA = 28;
+static const uint16_t DNS_CLASS_IN = 1;
+static const uint16_t DNS_FLAG_QR = 0x8000;
+static const uint16_t DNS_FLAG_TC = 0x0200;
+static const uint16_t DNS_FLAG_RD = 0x0100;
+static const int DNS_RCODE_NXDOMAIN = 3;
+static const size_t DNS_HEADER_SIZE = 12;
+static const size_t DNS_MAX_UDP_SIZE = 4096;
+
+static uint16_t ReadUint16(const uint8_t* p) {
+  return (p[0] << 8) | p[1];
+}
+
+static uint32_t ReadUint32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void WriteUint16(std::string& out, uint16_t v) {
+  out.push_back((char)(v >> 8));
+  out.push_back((char)(v & 0xff));
+}
+
+// 域名统一转换为小写并去掉末尾的'.'
+static std::string NormalizeName(const std::string& host) {
+  std::string name(host);
+  if (!name.empty() && name.back() == '.') {
+    name.pop_back();
+  }
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+  return name;
+}
+
+// 构造只有一个问题的查询报文，域名不合法时返回false
+static bool BuildQuery(uint16_t id, const std::string& name, uint16_t qtype, std::string& out) {
+  if (name.empty() || name.size() > 253) {
+    return false;
+  }
+  out.clear();
+  WriteUint16(out, id);
+  WriteUint16(out, DNS_FLAG_RD);   // 请求递归查询
+  WriteUint16(out, 1);             // qdcount
+  WriteUint16(out, 0);             // ancount
+  WriteUint16(out, 0);             // nscount
+  WriteUint16(out, 0);             // arcount
+  size_t begin = 0;
+  while (begin <= name.size()) {
+    size_t end = name.find('.', begin);
+    if (end == std::string::npos) {
+      end = name.size();
+    }
+    size_t len = end - begin;
+    if (len == 0 || len > 63) {
+      return false;
+    }
+    out.push_back((char)len);
+    out.append(name, begin, len);
+    begin = end + 1;
+  }
+  out.push_back(0);
+  WriteUint16(out, qtype);
+  WriteUint16(out, DNS_CLASS_IN);
+  return true;
+}
+
+// 跳过报文中的域名(可能以压缩指针结尾)，返回域名之后的偏移，报文不合法时返回0
+static size_t SkipName(const uint8_t* data, size_t len, size_t pos) {
+  while (pos < len) {
+    uint8_t l = data[pos];
+    if (l == 0) {
+      return pos + 1;
+    }
+    if ((l & 0xc0) == 0xc0) {
+      return pos + 2 <= len? pos + 2: 0;
+    }
+    if (l & 0xc0) {
+      return 0;
+    }
+    pos += l + 1;
+  }
+  return 0;
+}
+
+// 解析响应报文中qtype类型的记录，ttl为这些记录中最小的TTL
+// 报文不合法时返回false
+static bool ParseResponse(const uint8_t* data, size_t len, uint16_t qtype, int& rcode,
+        std::vector<IPAddress::ptr>& addrs, uint32_t& ttl) {
+  if (len < DNS_HEADER_SIZE) {
+    return false;
+  }
+  uint16_t flags = ReadUint16(data + 2);
+  if (!(flags & DNS_FLAG_QR)) {
+    return false;
+  }
+  if (flags & DNS_FLAG_TC) {
+    MOKA_LOG_DEBUG(g_logger) << "dns response truncated, use received records only";
+  }
+  rcode = flags & 0xf;
+  uint16_t qdcount = ReadUint16(data + 4);
+  uint16_t ancount = ReadUint16(data + 6);
+  size_t pos = DNS_HEADER_SIZE;
+  for (uint16_t i = 0; i < qdcount; ++i) {
+    pos = SkipName(data, len, pos);
+    if (pos == 0 || pos + 4 > len) {
+      return false;
+    }
+    pos += 4;
+  }
+  for (uint16_t i = 0; i < ancount; ++i) {
+    pos = SkipName(data, len, pos);
+    if (pos == 0 || pos + 10 > len) {
+      // 截断的报文可能只有部分记录
+      break;
+    }
+    uint16_t type = ReadUint16(data + pos);
+    uint16_t cls = ReadUint16(data + pos + 2);
+    uint32_t record_ttl = ReadUint32(data + pos + 4);
+    uint16_t rdlen = ReadUint16(data + pos + 8);
+    pos += 10;
+    if (pos + rdlen > len) {
+      break;
+    }
+    // 其他类型的记录(如CNAME)跳过，递归服务器会把CNAME链最终的地址一起返回
+    if (cls == DNS_CLASS_IN && type == qtype) {
+      if (type == DNS_TYPE_A && rdlen == 4) {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        memcpy(&addr.sin_addr, data + pos, 4);
+        addrs.push_back(IPAddress::ptr(new IPv4Address(addr)));
+        ttl = std::min(ttl, record_ttl);
+      } else if (type == DNS_TYPE_AAAA && rdlen == 16) {
+        sockaddr_in6 addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin6_family = AF_INET6;
+        memcpy(&addr.sin6_addr, data + pos, 16);
+        addrs.push_back(IPAddress::ptr(new IPv6Address(addr)));
+        ttl = std::min(ttl, record_ttl);
+      }
+    }
+    pos += rdlen;
+  }
+  return true;
+}
+
+// 数字形式的IP地址
+static IPAddress::ptr ParseNumeric(const std::string& host) {
+  sockaddr_in addr4;
+  memset(&addr4, 0, sizeof(addr4));
+  if (inet_pton(AF_INET, host.c_str(), &addr4.sin_addr) == 1) {
+    addr4.sin_family = AF_INET;
+    return IPAddress::ptr(new IPv4Address(addr4));
+  }
+  sockaddr_in6 addr6;
+  memset(&addr6, 0, sizeof(addr6));
+  if (inet_pton(AF_INET6, host.c_str(), &addr6.sin6_addr) == 1) {
+    addr6.sin6_family = AF_INET6;
+    return IPAddress::ptr(new IPv6Address(addr6));
+  }
+  return nullptr;
+}
+
+// 缓存中的地址是共享的，返回给调用者的是设置了端口的拷贝
+static IPAddress::ptr CopyWithPort(IPAddress::ptr addr, uint16_t port) {
+  IPAddress::ptr copy;
+  if (addr->get_family() == AF_INET) {
+    copy.reset(new IPv4Address(*(const sockaddr_in*)addr->get_addr()));
+  } else {
+    copy.reset(new IPv6Address(*(const sockaddr_in6*)addr->get_addr()));
+  }
+  copy->set_port(port);
+  return copy;
+}
+
+// "ip"、"ip:port"或者"[ipv6]:port"形式的DNS服务器地址
+static Address::ptr ParseServer(const std::string& str) {
+  std::string host = str;
+  uint16_t port = 53;
+  if (!str.empty() && str[0] == '[') {
+    size_t end = str.find(']');
+    if (end == std::string::npos) {
+      return nullptr;
+    }
+    host = str.substr(1, end - 1);
+    if (end + 1 < str.size() && str[end + 1] == ':') {
+      port = atoi(str.c_str() + end + 2);
+    }
+  } else if (std::count(str.begin(), str.end(), ':') == 1) {
+    size_t colon = str.find(':');
+    host = str.substr(0, colon);
+    port = atoi(str.c_str() + colon + 1);
+  }
+  IPAddress::ptr addr = ParseNumeric(host);
+  if (addr) {
+    addr->set_port(port);
+  }
+  return addr;
+}
+
+// resolv.conf中的配置，search和domain以最后出现的为准
+struct ResolvConf {
+  std::vector<Address::ptr> servers;
+  std::vector<std::string> search;
+  uint32_t ndots = 1;
+};
+
+static ResolvConf LoadResolvConf() {
+  ResolvConf conf;
+  std::ifstream ifs("/etc/resolv.conf");
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream iss(line);
+    std::string key, value;
+    if (!(iss >> key) || key[0] == '#' || key[0] == ';') {
+      continue;
+    }
+    if (key == "nameserver") {
+      Address::ptr addr = iss >> value? ParseServer(value): nullptr;
+      if (addr) {
+        conf.servers.push_back(addr);
+      }
+    } else if (key == "search" || key == "domain") {
+      conf.search.clear();
+      while (iss >> value) {
+        conf.search.push_back(value);
+      }
+    } else if (key == "options") {
+      while (iss >> value) {
+        if (value.compare(0, 6, "ndots:") == 0) {
+          conf.ndots = atoi(value.c_str() + 6);
+        }
+      }
+    }
+  }
+  return conf;
+}
+
+DnsResolver::DnsResolver(const std::vector<Address::ptr>& servers, const std::string& hosts_file)
+    : servers_(servers),
+      hosts_file_(hosts_file) {
+  if (servers_.empty()) {
+    ResolvConf conf = LoadResolvConf();
+    servers_ = conf.servers;
+    set_search(conf.search, conf.ndots);
+  }
+  reloadHosts();
+}
+
+DnsResolver* DnsResolver::GetInstance() {
+  static DnsResolver* s_resolver = []() {
+    std::vector<Address::ptr> servers;
+    for (auto& str : g_dns_servers->get_value()) {
+      Address::ptr addr = ParseServer(str);
+      if (addr) {
+        servers.push_back(addr);
+      } else {
+        MOKA_LOG_ERROR(g_logger) << "invalid dns server: " << str;
+      }
+    }
+    DnsResolver* resolver = new DnsResolver(servers, g_dns_hosts_file->get_value());
+    if (!g_dns_search->get_value().empty()) {
+      resolver->set_search(g_dns_search->get_value(), g_dns_ndots->get_value());
+    }
+    return resolver;
+  }();
+  return s_resolver;
+}
+
+void DnsResolver::set_search(const std::vector<std::string>& search, uint32_t ndots) {
+  search_.clear();
+  for (auto& i : search) {
+    std::string domain = NormalizeName(i);
+    if (!domain.empty()) {
+      search_.push_back(domain);
+    }
+  }
+  // 和glibc一样最大为15
+  ndots_ = std::min(ndots, (uint32_t)15);
+}
+
+std::vector<std::string> DnsResolver::expand(const std::string& host, const std::string& name) const {
+  std::vector<std::string> names;
+  if (host.back() == '.' || search_.empty()) {
+    // 以'.'结尾的是完整的域名
+    names.push_back(name);
+    return names;
+  }
+  bool enough_dots = (uint32_t)std::count(name.begin(), name.end(), '.') >= ndots_;
+  if (enough_dots) {
+    names.push_back(name);
+  }
+  for (auto& domain : search_) {
+    // 超过长度的域名不能查询
+    if (name.size() + 1 + domain.size() <= 253) {
+      names.push_back(name + "." + domain);
+    }
+  }
+  if (!enough_dots) {
+    names.push_back(name);
+  }
+  return names;
+}
+
+void DnsResolver::reloadHosts() {
+  std::unordered_map<std::string, std::vector<IPAddress::ptr>> hosts;
+  if (!hosts_file_.empty()) {
+    std::ifstream ifs(hosts_file_);
+    std::string line;
+    while (std::getline(ifs, line)) {
+      size_t comment = line.find('#');
+      if (comment != std::string::npos) {
+        line.resize(comment);
+      }
+      std::istringstream iss(line);
+      std::string ip, name;
+      if (!(iss >> ip)) {
+        continue;
+      }
+      IPAddress::ptr addr = ParseNumeric(ip);
+      if (!addr) {
+        continue;
+      }
+      while (iss >> name) {
+        hosts[NormalizeName(name)].push_back(addr);
+      }
+    }
+  }
+  for (auto& i : hosts) {
+    // IPv4地址在前(LookupIPv4Addr取第一个地址)
+    std::stable_partition(i.second.begin(), i.second.end(), [](const IPAddress::ptr& addr) {
+      return addr->get_family() == AF_INET;
+    });
+  }
+  RWmutex::WriteLock lock(hosts_mutex_);
+  hosts_.swap(hosts);
+}
+
+bool DnsResolver::lookupHosts(const std::string& name, std::vector<IPAddress::ptr>& result) {
+  RWmutex::ReadLock lock(hosts_mutex_);
+  auto it = hosts_.find(name);
+  if (it == hosts_.end()) {
+    return false;
+  }
+  result = it->second;
+  return true;
+}
+
+bool DnsResolver::lookupCache(const std::string& name, std::vector<IPAddress::ptr>& result) {
+  RWmutex::ReadLock lock(cache_mutex_);
+  auto it = cache_.find(name);
+  if (it == cache_.end() || it->second.expire_ms <= GetCurrentMs()) {
+    return false;
+  }
+  result = it->second.addrs;
+  return true;
+}
+
+bool DnsResolver::lookupCache(const std::vector<std::string>& names, std::vector<IPAddress::ptr>& result) {
+  for (auto& name : names) {
+    if (!lookupCache(name, result)) {
+      return false;
+    }
+    if (!result.empty()) {
+      return true;
+    }
+  }
+  return true;
+}
+
+void DnsResolver::insertCache(const std::string& name, const std::vector<IPAddress::ptr>& addrs, uint32_t ttl) {
+  uint64_t now = GetCurrentMs();
+  RWmutex::WriteLock lock(cache_mutex_);
+  size_t limit = g_dns_cache_size->get_value();
+  if (cache_.size() >= limit) {
+    // 先清理过期的，仍然超过7/8时随便淘汰一批(遍历的开销分摊到之后的插入上)
+    for (auto it = cache_.begin(); it != cache_.end();) {
+      if (it->second.expire_ms <= now) {
+        it = cache_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    while (!cache_.empty() && cache_.size() >= limit - limit / 8) {
+      cache_.erase(cache_.begin());
+    }
+  }
+  CacheEntry& entry = cache_[name];
+  entry.addrs = addrs;
+  entry.expire_ms = now + (uint64_t)ttl * 1000;
+}
+
+void DnsResolver::clearCache() {
+  RWmutex::WriteLock lock(cache_mutex_);
+  cache_.clear();
+}
+
+DnsResolver::Stats DnsResolver::get_stats() const {
+  Stats stats;
+  stats.lookups = lookups_;
+  stats.hosts_hits = hosts_hits_;
+  stats.cache_hits = cache_hits_;
+  stats.merged = merged_;
+  stats.queries = queries_;
+  stats.timeouts = timeouts_;
+  return stats;
+}
+
+bool DnsResolver::queryServer(Address::ptr server, const std::string& name,
+        std::vector<IPAddress::ptr>& result, uint32_t& ttl, bool& nxdomain) {
+  static thread_local std::mt19937 s_rand(std::random_device{}());
+  // A和AAAA使用相邻的id
+  uint16_t id = s_rand() & 0xfffe;
+  std::string query_a, query_aaaa;
+  if (!BuildQuery(id, name, DNS_TYPE_A, query_a)
+      || !BuildQuery(id + 1, name, DNS_TYPE_AAAA, query_aaaa)) {
+    MOKA_LOG_WARN(g_logger) << "invalid dns name: " << name;
+    return false;
+  }
+  // 连接后的UDP socket只会收到该服务器的报文
+  Socket::ptr sock = Socket::CreateUDP(server);
+  if (!sock->connect(server)) {
+    return false;
+  }
+  if (sock->send(query_a.data(), query_a.size()) < 0
+      || sock->send(query_aaaa.data(), query_aaaa.size()) < 0) {
+    MOKA_LOG_WARN(g_logger) << "dns send to " << server->toString()
+                            << " errno=" << errno << " errstr=" << strerror(errno);
+    return false;
+  }
+  queries_ += 2;
+
+  std::vector<IPAddress::ptr> addrs_a, addrs_aaaa;
+  bool answered[2] = {false, false};
+  uint64_t deadline = GetCurrentMs() + g_dns_timeout->get_value();
+  std::string buf(DNS_MAX_UDP_SIZE, '\0');
+  while (!answered[0] || !answered[1]) {
+    uint64_t now = GetCurrentMs();
+    if (now >= deadline) {
+      ++timeouts_;
+      break;
+    }
+    sock->set_recv_timeout(deadline - now);
+    int n = sock->recv(&buf[0], buf.size());
+    if (n < 0) {
+      if (errno == ETIMEDOUT || errno == EAGAIN) {
+        ++timeouts_;
+      }
+      break;
+    }
+    const uint8_t* data = (const uint8_t*)buf.data();
+    if (n < (int)DNS_HEADER_SIZE) {
+      continue;
+    }
+    uint16_t rid = ReadUint16(data);
+    if ((rid != id && rid != id + 1) || answered[rid - id]) {
+      continue;
+    }
+    int index = rid - id;
+    int rcode = 0;
+    if (!ParseResponse(data, n, index == 0? DNS_TYPE_A: DNS_TYPE_AAAA,
+          rcode, index == 0? addrs_a: addrs_aaaa, ttl)) {
+      continue;
+    }
+    if (rcode != 0 && rcode != DNS_RCODE_NXDOMAIN) {
+      // SERVFAIL/REFUSED等，换下一个服务器
+      MOKA_LOG_WARN(g_logger) << "dns server " << server->toString()
+                              << " rcode=" << rcode << " name=" << name;
+      return false;
+    }
+    nxdomain = nxdomain || rcode == DNS_RCODE_NXDOMAIN;
+    answered[index] = true;
+  }
+  if (!answered[0] && !answered[1]) {
+    return false;
+  }
+  result.insert(result.end(), addrs_a.begin(), addrs_a.end());
+  result.insert(result.end(), addrs_aaaa.begin(), addrs_aaaa.end());
+  return true;
+}
+
+bool DnsResolver::queryName(const std::string& name, std::vector<IPAddress::ptr>& result) {
+  for (uint32_t attempt = 0; attempt < g_dns_attempts->get_value(); ++attempt) {
+    for (auto& server : servers_) {
+      std::vector<IPAddress::ptr> addrs;
+      uint32_t ttl = UINT32_MAX;
+      bool nxdomain = false;
+      if (!queryServer(server, name, addrs, ttl, nxdomain)) {
+        continue;
+      }
+      if (addrs.empty()) {
+        ttl = g_dns_negative_ttl->get_value();
+      }
+      insertCache(name, addrs, ttl);
+      result = addrs;
+      return true;
+    }
+  }
+  MOKA_LOG_WARN(g_logger) << "dns lookup " << name << " failed, no server answered";
+  return false;
+}
+
+bool DnsResolver::query(const std::vector<std::string>& names, std::vector<IPAddress::ptr>& result) {
+  for (auto& name : names) {
+    result.clear();
+    // 之前已经确认不存在的域名不再查询
+    if (!lookupCache(name, result) && !queryName(name, result)) {
+      // 服务器都没有响应时，后面的域名也查询不到
+      return false;
+    }
+    if (!result.empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DnsResolver::resolve(const std::string& host, std::vector<IPAddress::ptr>& addrs,
+        uint16_t port, int family) {
+  ++lookups_;
+  if (host.empty()) {
+    return false;
+  }
+  std::vector<IPAddress::ptr> result;
+  IPAddress::ptr numeric = ParseNumeric(host);
+  std::string name = NormalizeName(host);
+  std::vector<std::string> names;
+  if (!numeric) {
+    names = expand(host, name);
+  }
+  if (numeric) {
+    result.push_back(numeric);
+  } else if (lookupHosts(name, result)) {
+    ++hosts_hits_;
+  } else if (lookupCache(names, result)) {
+    ++cache_hits_;
+  } else if (!Scheduler::GetThis()) {
+    // 不在协程中，不能挂起等待其他查询
+    query(names, result);
+  } else {
+    // 以'.'结尾的域名不展开，和不带'.'的是不同的查询
+    std::string key = host.back() == '.'? name + ".": name;
+    std::shared_ptr<Lookup> lookup;
+    bool leader = false;
+    {
+      Mutex::LockGuard lock(pending_mutex_);
+      auto it = pending_.find(key);
+      if (it == pending_.end()) {
+        lookup.reset(new Lookup);
+        pending_[key] = lookup;
+        leader = true;
+      } else {
+        lookup = it->second;
+      }
+    }
+    if (leader) {
+      // 上一个查询可能在检查缓存之后刚刚完成
+      result.clear();
+      if (!lookupCache(names, result)) {
+        query(names, result);
+      }
+      {
+        Mutex::LockGuard lock(pending_mutex_);
+        pending_.erase(key);
+      }
+      {
+        FiberMutex::LockGuard lock(lookup->mutex);
+        lookup->done = true;
+        lookup->addrs = result;
+      }
+      lookup->cond.notify_all();
+    } else {
+      ++merged_;
+      FiberMutex::LockGuard lock(lookup->mutex);
+      while (!lookup->done) {
+        lookup->cond.wait(lookup->mutex);
+      }
+      result = lookup->addrs;
+    }
+  }
+
+  bool found = false;
+  for (auto& addr : result) {
+    if (family == AF_UNSPEC || addr->get_family() == family) {
+      addrs.push_back(CopyWithPort(addr, port));
+      found = true;
+    }
+  }
+  return found;
+}
+
+}
@@ -0,0 +1,116 @@
+#ifndef __MOKA_DNS_H__
+#define __MOKA_DNS_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "address.h"
+#include "fiber_sync.h"
+#include "thread.h"
+#include "noncopyable.h"
+
+namespace moka {
+
+// 协程化的DNS解析器，替代会阻塞调度线程的getaddrinfo
+// 查询顺序: 数字形式的IP地址 -> hosts文件 -> 缓存 -> 通过hook的UDP Socket向DNS服务器同时发送A和AAAA查询
+// 不以'.'结尾的域名按search列表展开(和resolv.conf的语义一致): 点的数量不少于ndots时先查询域名本身，
+// 否则先依次查询"域名.搜索域"，直到某个域名有地址为止
+// 解析结果按展开后的域名和记录中最小的TTL缓存，域名不存在(或没有记录)时按dns.negative_ttl缓存
+// 同一个域名的并发查询合并为一次，后来的协程挂起等待第一个查询完成(不在协程中调用时不参与合并)
+// 响应被截断(TC)时只使用已经收到的记录，不退回到TCP查询
+class DnsResolver : public Noncopyable {
+ public:
+  using ptr = std::shared_ptr<DnsResolver>;
+
+  // 统计信息
+  struct Stats {
+    uint64_t lookups = 0;         // resolve调用次数
+    uint64_t hosts_hits = 0;      // 命中hosts文件的次数
+    uint64_t cache_hits = 0;      // 命中缓存的次数
+    uint64_t merged = 0;          // 合并到其他协程正在进行的查询的次数
+    uint64_t queries = 0;         // 发送给DNS服务器的查询报文数量(A和AAAA各算一次)
+    uint64_t timeouts = 0;        // 等待DNS服务器响应超时的次数
+  };
+
+  // servers为空时使用/etc/resolv.conf中的nameserver以及search/domain/ndots，hosts_file为空时不查hosts文件
+  DnsResolver(const std::vector<Address::ptr>& servers, const std::string& hosts_file = "/etc/hosts");
+
+  // 使用配置dns.servers(为空时读取/etc/resolv.conf)、dns.search/dns.ndots和dns.hosts_file的全局解析器
+  static DnsResolver* GetInstance();
+
+  // 设置search列表，需要在开始解析之前调用
+  void set_search(const std::vector<std::string>& search, uint32_t ndots = 1);
+  const std::vector<std::string>& get_search() const { return search_; }
+  uint32_t get_ndots() const { return ndots_; }
+
+  // 解析host，结果追加到addrs中(IPv4地址在前)，地址的端口设置为port
+  // family为AF_INET/AF_INET6时只返回对应地址族的地址，解析失败或者没有地址时返回false
+  bool resolve(const std::string& host, std::vector<IPAddress::ptr>& addrs,
+          uint16_t port = 0, int family = AF_UNSPEC);
+
+  void clearCache();
+  // 重新读取hosts文件
+  void reloadHosts();
+
+  const std::vector<Address::ptr>& get_servers() const { return servers_; }
+  Stats get_stats() const;
+
+ private:
+  struct CacheEntry {
+    std::vector<IPAddress::ptr> addrs;
+    uint64_t expire_ms = 0;
+  };
+
+  // 正在进行的查询，同一个域名的其他协程在上面等待
+  struct Lookup {
+    FiberMutex mutex;
+    FiberCondition cond;
+    bool done = false;
+    std::vector<IPAddress::ptr> addrs;
+  };
+
+  // 按search列表展开成依次查询的域名
+  std::vector<std::string> expand(const std::string& host, const std::string& name) const;
+  bool lookupHosts(const std::string& name, std::vector<IPAddress::ptr>& result);
+  bool lookupCache(const std::string& name, std::vector<IPAddress::ptr>& result);
+  // 依次检查展开后的域名的缓存，第一个有地址的域名之前都命中缓存(或者全部命中不存在的缓存)时返回true
+  bool lookupCache(const std::vector<std::string>& names, std::vector<IPAddress::ptr>& result);
+  // 依次查询展开后的域名(跳过缓存中不存在的域名)，直到某个域名有地址
+  bool query(const std::vector<std::string>& names, std::vector<IPAddress::ptr>& result);
+  // 向DNS服务器查询一个域名并写入缓存，没有服务器响应时返回false
+  bool queryName(const std::string& name, std::vector<IPAddress::ptr>& result);
+  // 向一个DNS服务器发送A和AAAA查询并等待响应，服务器没有响应时返回false
+  bool queryServer(Address::ptr server, const std::string& name,
+          std::vector<IPAddress::ptr>& result, uint32_t& ttl, bool& nxdomain);
+  void insertCache(const std::string& name, const std::vector<IPAddress::ptr>& addrs, uint32_t ttl);
+
+ private:
+  std::vector<Address::ptr> servers_;
+  std::vector<std::string> search_;    // 搜索域(已经规范化)
+  uint32_t ndots_ = 1;
+  std::string hosts_file_;
+
+  RWmutex hosts_mutex_;
+  std::unordered_map<std::string, std::vector<IPAddress::ptr>> hosts_;
+
+  RWmutex cache_mutex_;
+  std::unordered_map<std::string, CacheEntry> cache_;
+
+  Mutex pending_mutex_;
+  std::unordered_map<std::string, std::shared_ptr<Lookup>> pending_;
+
+  std::atomic<uint64_t> lookups_ = {0};
+  std::atomic<uint64_t> hosts_hits_ = {0};
+  std::atomic<uint64_t> cache_hits_ = {0};
+  std::atomic<uint64_t> merged_ = {0};
+  std::atomic<uint64_t> queries_ = {0};
+  std::atomic<uint64_t> timeouts_ = {0};
+};
+
+}
+
+#endif
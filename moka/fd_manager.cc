@@ -4,8 +4,8 @@
 #include "hook.h"
 
 namespace moka {
-FdCtx::FdCtx(int fd) : is_init_(false), is_socket_(false), is_sys_nonblock_(false), 
-    is_user_nonblock_(false), is_closed_(false), fd_(fd), recv_timeout_(-1), send_timeout_(-1) {
+FdCtx::FdCtx(int fd) : is_init_(false), is_socket_(false), is_file_(false), is_pollable_(false), is_sys_nonblock_(false), 
+    is_user_nonblock_(false), is_closed_(false), is_no_offload_(false), fd_(fd), recv_timeout_(-1), send_timeout_(-1) {
     init();
 }
 
@@ -27,23 +27,31 @@ bool FdCtx::init() {
     // error
     is_init_ = false;
     is_socket_ = false;
+    is_file_ = false;
+    is_pollable_ = false;
   } else {
     is_init_ = true;
     // S_ISSOCK判断该fd是否为socket
     is_socket_ = S_ISSOCK(fd_stat.st_mode);
+    is_file_ = S_ISREG(fd_stat.st_mode);
+    // eventfd/timerfd/epoll等匿名inode的文件类型为0
+    is_pollable_ = is_socket_ || S_ISFIFO(fd_stat.st_mode) || (fd_stat.st_mode & S_IFMT) == 0;
   }
-  if (is_socket_) {
+  is_user_nonblock_ = false;
+  if (is_pollable_) {
     // 调用原始fcntl，获取当前fd的标志
     int flags = fcntl_f(fd_, F_GETFL, 0);
     if (!(flags & O_NONBLOCK)) {
       // 若当前fd是阻塞的，将其设置为非阻塞(系统设置的)
       fcntl_f(fd_, F_SETFL, flags | O_NONBLOCK);
+    } else {
+      // 创建时已经指定了非阻塞(SOCK_NONBLOCK/O_NONBLOCK/EFD_NONBLOCK)，保留用户的语义
+      is_user_nonblock_ = true;
     }
     is_sys_nonblock_ = true;
   } else {
     is_sys_nonblock_ = false;
   }
-  is_user_nonblock_ = false;
   is_closed_ = false;
   return is_init_;
 }
@@ -19,6 +19,8 @@ class FdCtx : public std::enable_shared_from_this<FdCtx> {
   bool init();   // 初始化信息
   bool isInit() const { return is_init_; }
   bool isSocket() const { return is_socket_; }
+  bool isFile() const { return is_file_; }
+  bool isPollable() const { return is_pollable_; }
   bool isClosed() const { return is_closed_; }
   bool close();
 
@@ -28,6 +30,11 @@ class FdCtx : public std::enable_shared_from_this<FdCtx> {
   void set_sys_nonblock(bool val) { is_sys_nonblock_ = val; }
   bool get_sys_nonblock() { return is_sys_nonblock_; }
 
+  // 普通文件上的阻塞操作不卸载(不挂起协程)，直接在调用线程执行
+  // 用于持有自旋锁等不能切走协程的场景
+  void set_no_offload(bool val) { is_no_offload_ = val; }
+  bool get_no_offload() { return is_no_offload_; }
+
   void set_timeout(int type, uint64_t val);
   uint64_t get_timeout(int type);
 
@@ -35,9 +42,12 @@ class FdCtx : public std::enable_shared_from_this<FdCtx> {
   // 只占用一个bit
   bool is_init_: 1;              // 是否初始化
   bool is_socket_: 1;            // socket还是文件?
+  bool is_file_: 1;              // 是否为普通文件(IO交给卸载线程池执行)
+  bool is_pollable_: 1;          // 是否可以通过epoll等待读写(socket、管道、eventfd等)
   bool is_sys_nonblock_: 1;      // 是否系统设置为非阻塞(在FdCtx初始化时)
   bool is_user_nonblock_: 1;     // 是否人为设置为非阻塞
   bool is_closed_: 1;            // 是否关闭
+  bool is_no_offload_: 1;        // 是否禁止卸载普通文件的阻塞操作
   int fd_;                       // 文件描述符
 
   uint64_t recv_timeout_;        // 接收的超时时间
@@ -5,6 +5,10 @@
 #include "scheduler.h"
 
 #include <atomic>
+#include <map>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
 
 namespace moka {
 
@@ -20,27 +24,205 @@ static thread_local Fiber::ptr t_main_fiber = nullptr;    // 当前线程的主
 // 协程栈默认大小为1M，注册配置项到集合中
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size = 
   Config::Lookup<uint32_t>("fiber.stack_size", 1024 * 1024, "fiber stack size");
+
+// 协程栈分配器: mmap(带保护页，按线程缓存复用)或者malloc
+static ConfigVar<std::string>::ptr g_fiber_stack_allocator =
+  Config::Lookup<std::string>("fiber.stack_allocator", "mmap", "fiber stack allocator(mmap/malloc)");
+
+// 每个线程缓存的空闲协程栈的最大数量
+static ConfigVar<uint32_t>::ptr g_fiber_stack_cache_size =
+  Config::Lookup<uint32_t>("fiber.stack_cache_size", 64, "fiber stack cache size per thread");
+
+// 每个线程协程对象池的最大容量
+static ConfigVar<uint32_t>::ptr g_fiber_pool_size =
+  Config::Lookup<uint32_t>("fiber.pool_size", 64, "fiber pool size per thread");
   
-// 协程栈空间分配器
-class MallocStackAllocator {
+// 热路径上使用的配置值(避免每次创建/回收协程都对配置项加读锁)
+static std::atomic<uint32_t> s_stack_size {0};
+static std::atomic<uint32_t> s_stack_cache_size {0};
+static std::atomic<uint32_t> s_pool_size {0};
+
+// 直接使用malloc分配协程栈
+class MallocStackAllocator : public StackAllocator {
  public:
-  static void* alloc(size_t size) {
-    return malloc(size);
+  void* alloc(size_t size) override {
+    void* vp = malloc(size);
+    if (!vp) {
+      throw std::bad_alloc();
+    }
+    return vp;
   }
-  static void dealloc(void* vp, size_t size) {
+  void dealloc(void* vp, size_t size) override {
     return free(vp);
   }
 };
 
-using StackAllocator = MallocStackAllocator;
+// 使用mmap分配协程栈，栈底(低地址)放一个PROT_NONE的保护页
+// 栈溢出时会在保护页上触发SIGSEGV，而不是悄悄地破坏相邻的堆内存
+// 释放的栈先放入线程局部的空闲链表，下次分配同样大小的栈时直接复用(避免频繁mmap/munmap)
+class MmapStackAllocator : public StackAllocator {
+ public:
+  void* alloc(size_t size) override {
+    size = roundUp(size);
+    StackCache* cache = GetCache();
+    if (cache) {
+      auto it = cache->stacks.find(size);
+      if (it != cache->stacks.end() && !it->second.empty()) {
+        void* vp = it->second.back();
+        it->second.pop_back();
+        --cache->counts;
+        return vp;
+      }
+    }
+    size_t page = PageSize();
+    void* base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+      MOKA_LOG_ERROR(g_logger) << "mmap fiber stack size=" << size
+          << " errno=" << errno << " errstr=" << strerror(errno);
+      throw std::bad_alloc();
+    }
+    // 栈向低地址增长，保护页放在最低的一页
+    if (mprotect(base, page, PROT_NONE)) {
+      MOKA_LOG_ERROR(g_logger) << "mprotect fiber stack guard page errno="
+          << errno << " errstr=" << strerror(errno);
+      munmap(base, size + page);
+      throw std::bad_alloc();
+    }
+    return (char*)base + page;
+  }
+
+  void dealloc(void* vp, size_t size) override {
+    size = roundUp(size);
+    StackCache* cache = GetCache();
+    if (cache && cache->counts < s_stack_cache_size) {
+      cache->stacks[size].push_back(vp);
+      ++cache->counts;
+      return;
+    }
+    Unmap(vp, size);
+  }
+
+ private:
+  struct StackCache {
+    std::map<size_t, std::vector<void*>> stacks;  // 栈大小 -> 空闲栈
+    size_t counts = 0;
+  };
+
+  // 线程退出时释放缓存的栈
+  struct StackCacheHolder {
+    ~StackCacheHolder();
+  };
+
+  static size_t PageSize() {
+    static size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+  }
+
+  static size_t roundUp(size_t size) {
+    size_t page = PageSize();
+    return (size + page - 1) / page * page;
+  }
+
+  static void Unmap(void* vp, size_t size) {
+    size_t page = PageSize();
+    munmap((char*)vp - page, size + page);
+  }
+
+  static StackCache* GetCache();
+
+  // 线程局部变量析构的顺序不确定(协程对象池可能在缓存之后析构)
+  // 因此缓存用指针保存，析构后置空，之后释放的栈直接munmap
+  static thread_local StackCache* t_cache;
+  static thread_local bool t_cache_destroyed;
+};
+
+thread_local MmapStackAllocator::StackCache* MmapStackAllocator::t_cache = nullptr;
+thread_local bool MmapStackAllocator::t_cache_destroyed = false;
+
+MmapStackAllocator::StackCacheHolder::~StackCacheHolder() {
+  StackCache* cache = t_cache;
+  t_cache = nullptr;
+  t_cache_destroyed = true;
+  if (!cache) {
+    return;
+  }
+  for (auto& i : cache->stacks) {
+    for (auto vp : i.second) {
+      Unmap(vp, i.first);
+    }
+  }
+  delete cache;
+}
+
+MmapStackAllocator::StackCache* MmapStackAllocator::GetCache() {
+  if (t_cache_destroyed) {
+    return nullptr;
+  }
+  if (!t_cache) {
+    static thread_local StackCacheHolder s_holder;
+    (void)s_holder;
+    t_cache = new StackCache;
+  }
+  return t_cache;
+}
+
+static MallocStackAllocator s_malloc_allocator;
+static MmapStackAllocator s_mmap_allocator;
+static std::atomic<StackAllocator*> s_stack_allocator {nullptr};
+
+static StackAllocator* ParseStackAllocator(const std::string& name) {
+  if (name == "malloc") {
+    return &s_malloc_allocator;
+  }
+  if (name != "mmap") {
+    MOKA_LOG_ERROR(g_logger) << "unknown fiber.stack_allocator=" << name << ", use mmap";
+  }
+  return &s_mmap_allocator;
+}
+
+struct _FiberIniter {
+  _FiberIniter() {
+    s_stack_allocator = ParseStackAllocator(g_fiber_stack_allocator->get_value());
+    s_stack_size = g_fiber_stack_size->get_value();
+    s_stack_cache_size = g_fiber_stack_cache_size->get_value();
+    s_pool_size = g_fiber_pool_size->get_value();
+    g_fiber_stack_allocator->addListener(0x57ac, [](const std::string& old_val, const std::string& new_val) {
+      MOKA_LOG_INFO(g_logger) << "fiber stack allocator changed from "
+                              << old_val << " to " << new_val;
+      s_stack_allocator = ParseStackAllocator(new_val);
+    });
+    g_fiber_stack_size->addListener(0x57ac, [](const uint32_t& old_val, const uint32_t& new_val) {
+      s_stack_size = new_val;
+    });
+    g_fiber_stack_cache_size->addListener(0x57ac, [](const uint32_t& old_val, const uint32_t& new_val) {
+      s_stack_cache_size = new_val;
+    });
+    g_fiber_pool_size->addListener(0x57ac, [](const uint32_t& old_val, const uint32_t& new_val) {
+      s_pool_size = new_val;
+    });
+  }
+};
+
+static _FiberIniter s_fiber_initer;
+
+StackAllocator* Fiber::GetStackAllocator() {
+  StackAllocator* allocator = s_stack_allocator;
+  // 静态初始化完成之前创建协程时使用默认的分配器
+  return allocator? allocator: &s_mmap_allocator;
+}
+
+void Fiber::SetStackAllocator(StackAllocator* allocator) {
+  s_stack_allocator = allocator;
+}
 
 // 创建主协程的构造函数(一个线程只有一个，私有方法，只能通过GetThis调用)
 Fiber::Fiber() {
   state_ = EXEC;
   // 新建主协程时，会将当前正在执行的协程设置为主协程
   SetThis(this);
-  // 使用当前线程的上下文初始化uc
-  MOKA_ASSERT_2(!getcontext(&uc_), "getcontext");
+  // 使用当前线程的上下文初始化ctx
+  InitMainContext(ctx_);
   ++s_fiber_count;
   MOKA_LOG_DEBUG(g_logger) << "Fiber::Fiber";
 }
@@ -51,17 +233,18 @@ Fiber::Fiber() {
 Fiber::Fiber(std::function<void()> cb, bool link_to_main_fiber, size_t stacksize)
     : id_ (++s_fiber_id), cb_(cb) {
   ++s_fiber_count;
-  stack_size_ = stack_size_? stack_size_: g_fiber_stack_size->get_value();
-  stack_ = StackAllocator::alloc(stack_size_);   // 分配协程栈空间
-  MOKA_ASSERT_2(!getcontext(&uc_), "getcontext");
-  uc_.uc_stack.ss_sp = stack_;
-  uc_.uc_stack.ss_size = stack_size_;
-
+  stack_size_ = stacksize? stacksize: s_stack_size.load();
+  if (!stack_size_) {
+    // 静态初始化完成之前创建的协程
+    stack_size_ = g_fiber_stack_size->get_value();
+  }
+  allocator_ = GetStackAllocator();
+  stack_ = allocator_->alloc(stack_size_);   // 分配协程栈空间
   // 子协程发生上下文切换(调度)时调用MainFunc执行
   if (link_to_main_fiber) {
-    makecontext(&uc_, Fiber::MainFunc, 0);
+    MakeContext(ctx_, stack_, stack_size_, &Fiber::MainFunc);
   } else {
-    makecontext(&uc_, &Fiber::MainFuncSched, 0);
+    MakeContext(ctx_, stack_, stack_size_, &Fiber::MainFuncSched);
   }
   MOKA_LOG_DEBUG(g_logger) << "Fiber::Fiber id = " << id_;
 }
@@ -72,7 +255,7 @@ Fiber::~Fiber() {
     // 子协程
     MOKA_ASSERT(state_ == TERM || state_ == INIT || state_ == EXCEPT);
     // 回收栈
-    StackAllocator::dealloc(stack_, stack_size_);
+    allocator_->dealloc(stack_, stack_size_);
   } else {
     // 主协程(不需要协程栈空间)
     MOKA_ASSERT(!cb_);
@@ -93,14 +276,11 @@ void Fiber::reset(std::function<void()> cb, bool link_to_main_fiber) {
   MOKA_ASSERT(state_ == TERM || state_ == INIT || state_ == EXCEPT);
   // 回收资源
   cb_ = cb;
-  MOKA_ASSERT_2(!getcontext(&uc_), "getcontext");
   // 使用当前协程的栈资源
-  uc_.uc_stack.ss_sp = stack_;        
-  uc_.uc_stack.ss_size = stack_size_;
   if (link_to_main_fiber) {
-    makecontext(&uc_, &Fiber::MainFunc, 0);  // 设置当发生上下文切换时调用MainFunc(调用回调函数)
+    MakeContext(ctx_, stack_, stack_size_, &Fiber::MainFunc);  // 设置当发生上下文切换时调用MainFunc(调用回调函数)
   } else {
-    makecontext(&uc_, &Fiber::MainFuncSched, 0);
+    MakeContext(ctx_, stack_, stack_size_, &Fiber::MainFuncSched);
   }
   state_ = INIT;
 }
@@ -111,7 +291,7 @@ void Fiber::sched() {
   MOKA_ASSERT(state_ != EXEC);
   state_ = EXEC;     // 切换为执行态
   // 当前协程上下文为主协程的上下文
-  MOKA_ASSERT_2(!swapcontext(&(t_main_fiber->uc_), &uc_), "swapcontext");
+  MOKA_ASSERT_2(!SwapContext(t_main_fiber->ctx_, ctx_), "swapcontext");
 }
 
 // 将当前协程切换到后台，执行主协程
@@ -119,7 +299,7 @@ void Fiber::yield() {
   // 设置当前执行协程为主协程(即由子协程切换到主协程)
   SetThis(t_main_fiber.get());
   // 当前协程上下文切换到主协程
-  MOKA_ASSERT_2(!swapcontext(&uc_, &(t_main_fiber->uc_)), "swapcontext");
+  MOKA_ASSERT_2(!SwapContext(ctx_, t_main_fiber->ctx_), "swapcontext");
 }
 
 void Fiber::call() {
@@ -128,14 +308,14 @@ void Fiber::call() {
   MOKA_ASSERT(state_ != EXEC);
   state_ = EXEC;   
   // 当前协程上下文为调度协程的上下文
-  MOKA_ASSERT_2(!swapcontext(&(Scheduler::GetSchedFiber()->uc_), &uc_), "swapcontext");
+  MOKA_ASSERT_2(!SwapContext(Scheduler::GetSchedFiber()->ctx_, ctx_), "swapcontext");
 }
 
 void Fiber::back() {
   // 设置当前运行协程为调度协程
   SetThis(Scheduler::GetSchedFiber());
   // 当前协程上下文切换到调度协程
-  MOKA_ASSERT_2(!swapcontext(&uc_, &(Scheduler::GetSchedFiber()->uc_)), "swapcontext");
+  MOKA_ASSERT_2(!SwapContext(ctx_, Scheduler::GetSchedFiber()->ctx_), "swapcontext");
 }
 
 void Fiber::SetThis(Fiber* f) {
@@ -174,7 +354,8 @@ void Fiber::YieldToReadySched() {
 
 void Fiber::YieldToHoldSched() {
   Fiber::ptr cur = GetThis();
-  cur->state_ = HOLD;
+  // 保持EXEC状态，切换回调度协程之后再由调度器设置为HOLD
+  // 否则事件在切换完成之前触发时，其他线程可能会同时执行该协程
   cur->back();
 }
 
@@ -241,5 +422,69 @@ uint64_t Fiber::GetFiberId() {
   return 0;
 }
 
+// 线程退出时析构空闲链表中的协程(协程析构时会归还栈空间)
+struct FiberPoolHolder {
+  ~FiberPoolHolder();
+};
+
+static thread_local std::vector<Fiber::ptr>* t_fiber_pool = nullptr;
+static thread_local bool t_fiber_pool_destroyed = false;
+
+FiberPoolHolder::~FiberPoolHolder() {
+  std::vector<Fiber::ptr>* pool = t_fiber_pool;
+  t_fiber_pool = nullptr;
+  t_fiber_pool_destroyed = true;
+  delete pool;
+}
+
+static std::vector<Fiber::ptr>* GetFiberPool() {
+  if (t_fiber_pool_destroyed) {
+    return nullptr;
+  }
+  if (!t_fiber_pool) {
+    static thread_local FiberPoolHolder s_holder;
+    (void)s_holder;
+    t_fiber_pool = new std::vector<Fiber::ptr>;
+  }
+  return t_fiber_pool;
+}
+
+Fiber::ptr FiberPool::Get(std::function<void()> cb, bool link_to_main_fiber) {
+  std::vector<Fiber::ptr>* pool = GetFiberPool();
+  if (pool && !pool->empty()) {
+    Fiber::ptr fiber = std::move(pool->back());
+    pool->pop_back();
+    // 复用协程对象和栈，重新初始化上下文
+    fiber->reset(cb, link_to_main_fiber);
+    return fiber;
+  }
+  return Fiber::ptr(new Fiber(cb, link_to_main_fiber));
+}
+
+bool FiberPool::Put(Fiber::ptr& fiber) {
+  if (!fiber || fiber.use_count() != 1) {
+    // 还有其他地方持有该协程，不能复用
+    return false;
+  }
+  if (fiber->get_state() != Fiber::TERM && fiber->get_state() != Fiber::EXCEPT) {
+    return false;
+  }
+  // 只复用默认栈大小的协程
+  if (fiber->get_stack_size() != s_stack_size) {
+    return false;
+  }
+  std::vector<Fiber::ptr>* pool = GetFiberPool();
+  if (!pool || pool->size() >= s_pool_size) {
+    return false;
+  }
+  fiber->get_cb() = nullptr;
+  pool->push_back(std::move(fiber));
+  return true;
+}
+
+size_t FiberPool::GetIdleCounts() {
+  std::vector<Fiber::ptr>* pool = GetFiberPool();
+  return pool? pool->size(): 0;
 }
 
+}
\ No newline at end of file
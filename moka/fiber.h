@@ -1,12 +1,21 @@
 #ifndef __MOKA_FIBER_H__
 #define __MOKA_FIBER_H__
 
-#include <ucontext.h>
 #include <memory>
 #include <functional>
 
+#include "context.h"
+
 namespace moka {
 
+// 协程栈分配器(可以通过Fiber::SetStackAllocator替换成自定义的分配器)
+class StackAllocator {
+ public:
+  virtual ~StackAllocator() {}
+  virtual void* alloc(size_t size) = 0;
+  virtual void dealloc(void* vp, size_t size) = 0;
+};
+
 class Fiber : public std::enable_shared_from_this<Fiber> {
  public:
   using ptr = std::shared_ptr<Fiber>;
@@ -57,15 +66,33 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
   static void MainFuncSched();     // 执行完之后返回调度协程
   static uint64_t GetFiberId();        // 获取当前协程的id
 
+  // 获取/设置新建协程使用的栈分配器(未设置时由配置fiber.stack_allocator决定)
+  static StackAllocator* GetStackAllocator();
+  static void SetStackAllocator(StackAllocator* allocator);
+
+  uint32_t get_stack_size() const { return stack_size_; }
+
  private:
   uint64_t id_ = 0;
   uint32_t stack_size_ = 0;
+  StackAllocator* allocator_ = nullptr;  // 分配当前协程栈的分配器(释放时使用同一个)
   state state_ = INIT;
-  ucontext_t uc_;            // 协程上下文结构
+  Context ctx_;              // 协程上下文结构(汇编实现或ucontext)
   void* stack_ = nullptr;
   std::function<void()> cb_;
 };
 
+// 协程对象池，每个线程一个空闲链表，通过Fiber::reset复用协程对象及其栈空间
+class FiberPool {
+ public:
+  // 从当前线程的空闲链表中取出一个协程并重置，没有空闲协程则新建
+  static Fiber::ptr Get(std::function<void()> cb, bool link_to_main_fiber = false);
+  // 回收执行结束的协程，只有该智能指针是唯一引用时才会回收(回收成功后fiber被置空)
+  static bool Put(Fiber::ptr& fiber);
+  // 当前线程空闲链表中的协程数量
+  static size_t GetIdleCounts();
+};
+
 }
 
 #endif
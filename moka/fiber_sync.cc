@@ -0,0 +1,206 @@
+#include "fiber_sync.h"
+
+#include <algorithm>
+
+#include "iomanager.h"
+#include "macro.h"
+
+namespace moka {
+
+// 挂起当前协程，直到被wake重新调度
+static void Park() {
+  // 保持EXEC状态切回调度协程，唤醒者在切换完成之前调度该协程时，调度器会等待切换完成
+  Fiber::YieldToHoldSched();
+}
+
+static FiberWaiter CurrentWaiter() {
+  Scheduler* scheduler = Scheduler::GetThis();
+  MOKA_ASSERT_2(scheduler, "fiber sync primitives must wait inside a scheduler");
+  return {Fiber::GetThis(), scheduler};
+}
+
+static void Wake(const FiberWaiter& waiter) {
+  waiter.scheduler->schedule(waiter.fiber);
+}
+
+void FiberMutex::lock() {
+  uint32_t expected = UNLOCKED;
+  if (state_.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire)) {
+    return;
+  }
+  lockSlow();
+}
+
+bool FiberMutex::try_lock() {
+  uint32_t expected = UNLOCKED;
+  return state_.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire);
+}
+
+void FiberMutex::lockSlow() {
+  FiberWaiter waiter = CurrentWaiter();
+  {
+    Spinlock::LockGuard lock(wait_mutex_);
+    uint32_t state = state_.load(std::memory_order_relaxed);
+    while (true) {
+      if (state == UNLOCKED) {
+        // 在获取等待队列的锁之前已经解锁(此时队列一定为空)
+        if (state_.compare_exchange_weak(state, LOCKED, std::memory_order_acquire)) {
+          return;
+        }
+      } else if (state == LOCKED) {
+        // 标记有等待者，解锁时走慢路径
+        if (state_.compare_exchange_weak(state, CONTENDED, std::memory_order_relaxed)) {
+          break;
+        }
+      } else {
+        break;
+      }
+    }
+    waiters_.push_back(&waiter);
+  }
+  Park();
+  // 被唤醒时锁已经交给当前协程
+}
+
+void FiberMutex::unlock() {
+  uint32_t expected = LOCKED;
+  if (state_.compare_exchange_strong(expected, UNLOCKED, std::memory_order_release)) {
+    return;
+  }
+  unlockSlow();
+}
+
+void FiberMutex::unlockSlow() {
+  FiberWaiter waiter;
+  {
+    Spinlock::LockGuard lock(wait_mutex_);
+    MOKA_ASSERT(state_ == CONTENDED && !waiters_.empty());
+    // 锁直接交给队首的等待者(不经过UNLOCKED状态)，等待者返回后waiter所在的栈就失效了，这里拷贝一份
+    waiter = *waiters_.front();
+    waiters_.pop_front();
+    if (waiters_.empty()) {
+      state_.store(LOCKED, std::memory_order_release);
+    }
+  }
+  Wake(waiter);
+}
+
+void FiberCondition::wait(FiberMutex& mutex) {
+  std::shared_ptr<Waiter> waiter(new Waiter);
+  static_cast<FiberWaiter&>(*waiter) = CurrentWaiter();
+  {
+    Spinlock::LockGuard lock(wait_mutex_);
+    waiters_.push_back(waiter);
+  }
+  mutex.unlock();
+  Park();
+  mutex.lock();
+}
+
+bool FiberCondition::wait(FiberMutex& mutex, uint64_t timeout_ms) {
+  IOManager* iom = IOManager::GetThis();
+  MOKA_ASSERT_2(iom, "timed wait needs an IOManager");
+  std::shared_ptr<Waiter> waiter(new Waiter);
+  static_cast<FiberWaiter&>(*waiter) = CurrentWaiter();
+  {
+    Spinlock::LockGuard lock(wait_mutex_);
+    waiters_.push_back(waiter);
+  }
+  std::weak_ptr<Waiter> weak_waiter(waiter);
+  Timer::ptr timer = iom->addTimer(timeout_ms, [this, weak_waiter]() {
+    std::shared_ptr<Waiter> waiter = weak_waiter.lock();
+    if (!waiter) {
+      return;
+    }
+    {
+      Spinlock::LockGuard lock(wait_mutex_);
+      auto it = std::find(waiters_.begin(), waiters_.end(), waiter);
+      if (it == waiters_.end()) {
+        // 已经被notify唤醒
+        return;
+      }
+      waiters_.erase(it);
+      waiter->timeout = true;
+    }
+    Wake(*waiter);
+  });
+  mutex.unlock();
+  Park();
+  timer->cancel();
+  mutex.lock();
+  return !waiter->timeout;
+}
+
+void FiberCondition::notify_one() {
+  std::shared_ptr<Waiter> waiter;
+  {
+    Spinlock::LockGuard lock(wait_mutex_);
+    if (waiters_.empty()) {
+      return;
+    }
+    waiter = waiters_.front();
+    waiters_.pop_front();
+  }
+  Wake(*waiter);
+}
+
+void FiberCondition::notify_all() {
+  std::list<std::shared_ptr<Waiter>> waiters;
+  {
+    Spinlock::LockGuard lock(wait_mutex_);
+    waiters.swap(waiters_);
+  }
+  for (auto& i : waiters) {
+    Wake(*i);
+  }
+}
+
+FiberSemaphore::FiberSemaphore(uint32_t count)
+    : count_(count) {
+}
+
+void FiberSemaphore::wait() {
+  if (count_.fetch_sub(1, std::memory_order_acquire) > 0) {
+    return;
+  }
+  FiberWaiter waiter = CurrentWaiter();
+  {
+    Spinlock::LockGuard lock(wait_mutex_);
+    if (wakeups_ > 0) {
+      // post在入队之前已经执行
+      --wakeups_;
+      return;
+    }
+    waiters_.push_back(&waiter);
+  }
+  Park();
+}
+
+bool FiberSemaphore::try_wait() {
+  int64_t count = count_.load(std::memory_order_relaxed);
+  while (count > 0) {
+    if (count_.compare_exchange_weak(count, count - 1, std::memory_order_acquire)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void FiberSemaphore::post() {
+  if (count_.fetch_add(1, std::memory_order_release) >= 0) {
+    return;
+  }
+  FiberWaiter waiter;
+  {
+    Spinlock::LockGuard lock(wait_mutex_);
+    if (waiters_.empty()) {
+      ++wakeups_;
+      return;
+    }
+    waiter = *waiters_.front();
+    waiters_.pop_front();
+  }
+  Wake(waiter);
+}
+
+}
@@ -0,0 +1,88 @@
+#ifndef __MOKA_FIBER_SYNC_H__
+#define __MOKA_FIBER_SYNC_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <memory>
+
+#include "fiber.h"
+#include "scheduler.h"
+#include "thread.h"
+#include "noncopyable.h"
+
+namespace moka {
+
+// 协程同步原语: 竞争时只挂起当前协程(让出给调度器)，不阻塞线程，同一线程上的其他协程继续运行
+// 释放时把等待的协程重新交给它的调度器，等待者按先进先出的顺序直接获得锁/信号量(不会被后来者抢走)
+// 没有竞争时加锁/解锁只有一次原子操作
+// 只能在调度器中的协程里等待(有竞争时)，等待队列用自旋锁保护(临界区只有几条指令)
+
+// 挂起的协程
+struct FiberWaiter {
+  Fiber::ptr fiber;
+  Scheduler* scheduler;
+};
+
+class FiberMutex : public Noncopyable {
+ public:
+  using LockGuard = ScopedLock<FiberMutex>;
+
+  void lock();
+  bool try_lock();
+  void unlock();
+
+ private:
+  void lockSlow();
+  void unlockSlow();
+
+ private:
+  enum {
+    UNLOCKED = 0,
+    LOCKED = 1,
+    CONTENDED = 2      // 已加锁并且有等待者，解锁时需要唤醒
+  };
+  std::atomic<uint32_t> state_ = {UNLOCKED};
+  Spinlock wait_mutex_;
+  std::deque<FiberWaiter*> waiters_;
+};
+
+// 条件变量，配合FiberMutex使用
+class FiberCondition : public Noncopyable {
+ public:
+  // 释放mutex并挂起，被唤醒后重新加锁
+  void wait(FiberMutex& mutex);
+  // 同wait，超过timeout_ms毫秒没有被唤醒返回false(需要在IOManager中调用)
+  bool wait(FiberMutex& mutex, uint64_t timeout_ms);
+  void notify_one();
+  void notify_all();
+
+ private:
+  struct Waiter : public FiberWaiter {
+    bool timeout = false;
+  };
+
+  Spinlock wait_mutex_;
+  std::list<std::shared_ptr<Waiter>> waiters_;
+};
+
+// 信号量: count_为可用数量减去等待者数量，小于0时post需要唤醒等待者
+class FiberSemaphore : public Noncopyable {
+ public:
+  FiberSemaphore(uint32_t count = 0);
+
+  void wait();
+  bool try_wait();
+  void post();
+
+ private:
+  std::atomic<int64_t> count_;
+  Spinlock wait_mutex_;
+  std::deque<FiberWaiter*> waiters_;
+  uint32_t wakeups_ = 0;     // post时等待者还没有入队，留给它直接返回
+};
+
+}
+
+#endif
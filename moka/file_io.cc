@@ -0,0 +1,90 @@
+#include "file_io.h"
+
+#include <errno.h>
+
+#include "config.h"
+#include "log.h"
+
+namespace moka {
+
+static moka::Logger::ptr g_logger = MOKA_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_file_io_threads =
+  Config::Lookup<uint32_t>("file_io.threads", 4, "threads executing blocking file io for fibers");
+
+FileIOPool* FileIOPool::GetInstance() {
+  // 后台线程可能仍在执行操作，不析构
+  static FileIOPool* s_pool = new FileIOPool;
+  return s_pool;
+}
+
+FileIOPool::FileIOPool() {
+  uint32_t n = g_file_io_threads->get_value();
+  if (n == 0) {
+    n = 1;
+  }
+  for (uint32_t i = 0; i < n; ++i) {
+    threads_.push_back(Thread::ptr(new Thread(std::bind(&FileIOPool::work, this),
+            "file_io_" + std::to_string(i))));
+  }
+  MOKA_LOG_INFO(g_logger) << "file io pool started, threads=" << n;
+}
+
+bool FileIOPool::CanOffload() {
+  if (!Scheduler::GetThis()) {
+    return false;
+  }
+  Fiber::ptr cur = Fiber::GetThis();
+  return cur->get_fiber_id() != 0
+      && cur.get() != Scheduler::GetSchedFiber()
+      && cur.get() != Scheduler::GetIdleFiber();
+}
+
+ssize_t FileIOPool::run(std::function<ssize_t()> fn) {
+  if (!CanOffload()) {
+    return fn();
+  }
+  Scheduler* scheduler = Scheduler::GetThis();
+  // 协程挂起期间不在调度器的任何队列中，需要阻止调度器停止(否则完成后会交给已经停止的调度器)
+  // 恢复执行后再减少计数，此时当前线程处于活跃状态，调度器仍然不会停止
+  scheduler->addExternalWaiter();
+  Task task;
+  task.fn.swap(fn);
+  task.fiber = Fiber::GetThis();
+  task.scheduler = scheduler;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(&task);
+  }
+  cond_.notify_one();
+  ++offloaded_;
+  // 保持EXEC状态切回调度协程，后台线程在切换完成之前调度该协程时，调度器会等待切换完成
+  Fiber::YieldToHoldSched();
+  scheduler->delExternalWaiter();
+  errno = task.err;
+  return task.res;
+}
+
+void FileIOPool::work() {
+  while (true) {
+    Task* task = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (tasks_.empty()) {
+        cond_.wait(lock);
+      }
+      task = tasks_.front();
+      tasks_.pop_front();
+    }
+    errno = 0;
+    task->res = task->fn();
+    task->err = errno;
+    // 协程被唤醒后task所在的栈就失效了，先取出来
+    Fiber::ptr fiber;
+    fiber.swap(task->fiber);
+    Scheduler* scheduler = task->scheduler;
+    scheduler->schedule(fiber);
+  }
+}
+
+}
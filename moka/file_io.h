@@ -0,0 +1,61 @@
+#ifndef __MOKA_FILE_IO_H__
+#define __MOKA_FILE_IO_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "fiber.h"
+#include "scheduler.h"
+#include "thread.h"
+#include "noncopyable.h"
+
+namespace moka {
+
+// 普通文件的IO卸载线程池
+// 普通文件不能注册到epoll中(总是可读写)，读写冷数据时会阻塞整个调度线程
+// 协程中的阻塞文件操作交给后台线程执行，当前协程挂起，完成后重新交给原来的调度器
+// 线程数由配置file_io.threads决定，第一次使用时启动，不随进程退出析构
+class FileIOPool : public Noncopyable {
+ public:
+  static FileIOPool* GetInstance();
+
+  // 在后台线程中执行fn并挂起当前协程，返回fn的返回值(errno也恢复为fn执行后的值)
+  // 只卸载调度器执行的任务协程中的操作，调度协程、idle协程和线程主协程不能挂起，直接在当前线程执行
+  ssize_t run(std::function<ssize_t()> fn);
+
+  // 当前协程中的阻塞操作是否会卸载到后台线程
+  static bool CanOffload();
+
+  uint64_t get_offloaded() const { return offloaded_; }   // 卸载到后台线程执行的操作数量
+  size_t get_threads() const { return threads_.size(); }
+
+ private:
+  FileIOPool();
+  void work();
+
+ private:
+  // 等待执行的操作(保存在发起操作的协程栈上)
+  struct Task {
+    std::function<ssize_t()> fn;
+    ssize_t res = -1;
+    int err = 0;
+    Fiber::ptr fiber;
+    Scheduler* scheduler = nullptr;
+  };
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<Task*> tasks_;
+  std::vector<Thread::ptr> threads_;
+  std::atomic<uint64_t> offloaded_ = {0};
+};
+
+}
+
+#endif
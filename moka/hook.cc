@@ -1,13 +1,19 @@
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <linux/io_uring.h>
+#include <atomic>
+#include <map>
+#include <vector>
 
 #include "hook.h"
 #include "fiber.h"
 #include "iomanager.h"
 #include "fd_manager.h"
+#include "file_io.h"
 #include "log.h"
 #include "config.h"
+#include "util.h"
 
 moka::Logger::ptr g_logger = MOKA_LOG_NAME("system");
 
@@ -26,6 +32,8 @@ static thread_local bool t_hook_enable = false;
   XX(socket) \
   XX(connect) \
   XX(accept) \
+  XX(accept4) \
+  XX(socketpair) \
   XX(read) \
   XX(readv) \
   XX(recv) \
@@ -40,7 +48,21 @@ static thread_local bool t_hook_enable = false;
   XX(fcntl) \
   XX(ioctl) \
   XX(getsockopt) \
-  XX(setsockopt)
+  XX(setsockopt) \
+  XX(dup) \
+  XX(dup2) \
+  XX(dup3) \
+  XX(pipe) \
+  XX(pipe2) \
+  XX(eventfd) \
+  XX(poll) \
+  XX(select) \
+  XX(epoll_wait) \
+  XX(open) \
+  XX(pread) \
+  XX(pwrite) \
+  XX(fsync) \
+  XX(stat)
 
 
 void hook_init() {
@@ -87,10 +109,45 @@ struct TimerInfo {
   int cancelled = 0;
 };
 
+// 普通文件总是"就绪"的，不能通过注册事件等待，阻塞的操作交给内核或者后台线程执行
+// io_uring模式下uop不为空时直接提交给内核，否则交给卸载线程池，当前协程挂起直到完成
+// fd禁止卸载或者当前不在任务协程中(调度/idle协程不能挂起)时直接执行
+template<typename Fun>
+static ssize_t do_file_io(const FdCtx::ptr& ctx, int fd, const IOManager::UringOp* uop, Fun fun) {
+  if (ctx->get_no_offload() || !FileIOPool::CanOffload()) {
+    return fun();
+  }
+  moka::IOManager* iom = moka::IOManager::GetThis();
+  if (uop && iom && iom->isUringOpSupported(uop->opcode)) {
+    return iom->submitIO(fd, *uop);
+  }
+  return FileIOPool::GetInstance()->run(fun);
+}
+
+// hook只对普通文件有意义的操作(pread/pwrite/fsync)
+template<typename OriginFun, typename ... Args>
+static ssize_t do_file_op(int fd, OriginFun fun, const IOManager::UringOp* uop, Args&&... args) {
+  if (!moka::t_hook_enable) {
+    return fun(fd, std::forward<Args>(args)...);
+  }
+  moka::FdCtx::ptr ctx = moka::FdMgr::GetInstance()->get(fd);
+  if (!ctx || !ctx->isFile()) {
+    return fun(fd, std::forward<Args>(args)...);
+  }
+  if (ctx->isClosed()) {
+    errno = EBADF;
+    return -1;
+  }
+  return do_file_io(ctx, fd, uop, [&]() -> ssize_t {
+    return fun(fd, args...);
+  });
+}
+
 // hook通用读写函数(自动推导出函数类型)，函数模板可变参数
+// uop不为空时，io_uring模式下阻塞的IO操作直接提交给内核执行
 template<typename OriginFun, typename ... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
-        uint32_t event, int timeout_so, Args&&... args) {
+        uint32_t event, int timeout_so, const IOManager::UringOp* uop, Args&&... args) {
   if (!moka::t_hook_enable) {
     // forward完美转发保留参数左右值属性(引用折叠)
     return fun(fd, std::forward<Args>(args)...);
@@ -107,8 +164,19 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
     return -1;
   }
 
-  if (!ctx->isSocket() || ctx->get_user_nonblock()) {
-    // 用户已经设置了非阻塞或者不是套接字，也不需要hook
+  if (ctx->isFile()) {
+    IOManager::UringOp op;
+    if (uop) {
+      // 偏移量为-1表示使用(并更新)文件当前的偏移量，和read/write的语义一致
+      op = *uop;
+      op.off = (uint64_t)-1;
+    }
+    return do_file_io(ctx, fd, uop? &op: nullptr, [&]() -> ssize_t {
+      return fun(fd, args...);
+    });
+  }
+  if (!ctx->isPollable() || ctx->get_user_nonblock()) {
+    // 用户已经设置了非阻塞或者不能通过epoll等待(如终端、字符设备)，也不需要hook
     return fun(fd, std::forward<Args>(args)...);
   }
   // 获取fd的超时时间
@@ -127,6 +195,14 @@ retry:
   if (n == -1 && errno == EAGAIN) {
     // 阻塞状态等待数据(如没有数据可以read或者没有数据可写，需要做异步操作)
     moka::IOManager* iom = moka::IOManager::GetThis();
+    if (uop && iom->isUringOpSupported(uop->opcode)) {
+      // 不需要注册事件，IO操作完成后由内核返回结果(超时由内核取消)
+      n = iom->submitIO(fd, *uop, timeout);
+      if (n != -1 || errno != EAGAIN) {
+        return n;
+      }
+      // 旧内核对非阻塞的fd会直接返回EAGAIN，退回到注册事件的方式
+    }
     // 创建定时器
     moka::Timer::ptr timer;
     // 加定时条件
@@ -179,6 +255,129 @@ retry:
   return n;
 }
 
+// poll/select/epoll_wait挂起的协程，由第一个触发的事件或者超时定时器唤醒一次
+struct PollWaiter {
+  std::atomic<bool> woken = {false};
+  bool timed_out = false;
+  IOManager* iom = nullptr;
+  Fiber::ptr fiber;
+
+  void wake(bool timeout) {
+    if (!woken.exchange(true)) {
+      timed_out = timeout;
+      iom->schedule(fiber);
+    }
+  }
+};
+
+// 有fd的事件已经被其他协程等待(hook的read/write、其他poll或者epoll_wait)时，每隔这么久poll一次
+static const uint64_t s_poll_retry_interval = 10;
+
+// 等待fds中任意一个就绪，timeout_ms为-1时一直等待，返回值和poll一致
+// 先用0超时的poll检查一次，没有就绪时在每个fd上注册一次性的读写事件并挂起协程
+// 同一个fd出现多次时合并成一次注册，fd的事件已经被其他协程等待时不能再注册，改为定时poll
+// 唤醒后删除没有触发的事件，再poll一次得到准确的revents(边沿触发可能有虚假唤醒，此时继续等待)
+static int do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
+  int n = poll_f(fds, nfds, 0);
+  IOManager* iom = IOManager::GetThis();
+  if (n != 0 || timeout_ms == 0 || !iom) {
+    return n != 0 || timeout_ms == 0? n: poll_f(fds, nfds, timeout_ms);
+  }
+  // 每个fd需要等待的事件
+  std::map<int, uint32_t> fd_events;
+  for (nfds_t i = 0; i < nfds; ++i) {
+    if (fds[i].fd < 0) {
+      continue;
+    }
+    // POLLERR/POLLHUP总是会报告，只关心写的fd也需要等待
+    uint32_t& events = fd_events[fds[i].fd];
+    if ((fds[i].events & (POLLIN | POLLPRI | POLLRDHUP)) || !(fds[i].events & POLLOUT)) {
+      events |= IOManager::READ;
+    }
+    if (fds[i].events & POLLOUT) {
+      events |= IOManager::WRITE;
+    }
+  }
+  uint64_t deadline = timeout_ms < 0? (uint64_t)-1: GetCurrentMs() + timeout_ms;
+  std::vector<std::pair<int, IOManager::Event>> added;
+  while (true) {
+    std::shared_ptr<PollWaiter> waiter(new PollWaiter);
+    waiter->iom = iom;
+    waiter->fiber = Fiber::GetThis();
+    added.clear();
+    bool busy = false;
+    for (auto& i : fd_events) {
+      for (IOManager::Event event : {IOManager::READ, IOManager::WRITE}) {
+        if (!(i.second & event)) {
+          continue;
+        }
+        if (iom->tryAddEvent(i.first, event, [waiter]() {
+              waiter->wake(false);
+            }, waiter.get()) == 0) {
+          added.push_back(std::make_pair(i.first, event));
+        } else if (errno == EEXIST) {
+          busy = true;
+        }
+      }
+    }
+    uint64_t now = GetCurrentMs();
+    uint64_t remain = deadline > now? deadline - now: 0;
+    if (added.empty() && !busy) {
+      // 没有可以注册事件的fd(如普通文件总是就绪)，退回到直接调用
+      return poll_f(fds, nfds, deadline == (uint64_t)-1? -1: (int)remain);
+    }
+    // 有fd不能注册事件时，超时之前也要定时醒来poll
+    bool retry = busy && remain > s_poll_retry_interval;
+    Timer::ptr timer;
+    if (retry || deadline != (uint64_t)-1) {
+      timer = iom->addTimer(retry? s_poll_retry_interval: remain, [waiter]() {
+        waiter->wake(true);
+      });
+    }
+    Fiber::YieldToHoldSched();
+    if (timer) {
+      timer->cancel();
+    }
+    // 已经触发的事件在trigger时就被删除了，这里只删除自己注册的还在等待的事件
+    for (auto& i : added) {
+      iom->delEvent(i.first, i.second, waiter.get());
+    }
+    n = poll_f(fds, nfds, 0);
+    if (n != 0 || (waiter->timed_out && !retry)) {
+      return n;
+    }
+  }
+}
+
+// 复制出来的fd和原来的fd共享文件状态，继承原来fd的hook信息
+static void dup_fd_ctx(int oldfd, int newfd) {
+  FdCtx::ptr old_ctx = FdMgr::GetInstance()->get(oldfd);
+  if (!old_ctx || old_ctx->isClosed()) {
+    return;
+  }
+  FdCtx::ptr ctx = FdMgr::GetInstance()->get(newfd, true);
+  ctx->set_user_nonblock(old_ctx->get_user_nonblock());
+  ctx->set_timeout(SO_RCVTIMEO, old_ctx->get_timeout(SO_RCVTIMEO));
+  ctx->set_timeout(SO_SNDTIMEO, old_ctx->get_timeout(SO_SNDTIMEO));
+}
+
+// dup2/dup3会先关闭newfd，和close一样先取消newfd上的事件
+static void close_fd_ctx(int fd) {
+  if (FdMgr::GetInstance()->get(fd)) {
+    IOManager* iom = IOManager::GetThis();
+    if (iom) {
+      iom->cancelAll(fd);
+    }
+    FdMgr::GetInstance()->del(fd);
+  }
+}
+
+}
+
+// sleep的定时器到期后重新调度协程
+// 每个线程使用自己的定时器时，回调已经在调用sleep的线程上执行，协程也留在这个线程上
+static void wake_sleeper(moka::IOManager* iom, moka::Fiber::ptr fiber) {
+  iom->schedule(fiber, iom->isThreadTimer()? moka::GetThreadId(): -1);
 }
 
 extern "C" {
@@ -200,7 +399,7 @@ unsigned int sleep(unsigned int seconds) {
   // 该任务是由当前正在执行的协程来调度的
   iom->addTimer(seconds * 1000, [iom, fiber](){
     // seconds秒之后回调，当前执行sleep的协程获得执行权(从return 0处开始继续执行退出函数体)
-    iom->schedule(fiber);
+    wake_sleeper(iom, fiber);
   });
   // 将当前执行权转移给调度协程(因为当前协程执行sleep会发生阻塞)
   moka::Fiber::YieldToHoldSched();
@@ -214,7 +413,7 @@ int usleep(useconds_t usec) {
   moka::Fiber::ptr fiber = moka::Fiber::GetThis();
   moka::IOManager* iom = moka::IOManager::GetThis();
   iom->addTimer(usec / 1000, [iom, fiber](){
-    iom->schedule(fiber);
+    wake_sleeper(iom, fiber);
   });
   moka::Fiber::YieldToHoldSched();
   return 0;
@@ -228,7 +427,7 @@ int nanosleep(const struct timespec *req, struct timespec *rem) {
   moka::Fiber::ptr fiber = moka::Fiber::GetThis();
   moka::IOManager* iom = moka::IOManager::GetThis();
   iom->addTimer(timeout_ms, [iom, fiber](){
-    iom->schedule(fiber);
+    wake_sleeper(iom, fiber);
   });
   moka::Fiber::YieldToHoldSched();
   return 0;
@@ -266,14 +465,24 @@ int connect_with_timeout(int sockfd, const struct sockaddr* addr, socklen_t addr
     // 如果用户已经设置过非阻塞(已经有异步的效果)
     return connect_f(sockfd, addr, addrlen);
   }
+  moka::IOManager* iom = moka::IOManager::GetThis();
+  if (iom->isUringOpSupported(IORING_OP_CONNECT)) {
+    // 连接操作直接提交给内核，不需要再注册写事件和getsockopt获取错误
+    moka::IOManager::UringOp op = {IORING_OP_CONNECT, (uint64_t)addr, 0, (uint64_t)addrlen, 0};
+    int ret = iom->submitIO(sockfd, op, timeout_ms);
+    if (ret == 0 || (errno != EINVAL && errno != EOPNOTSUPP)) {
+      return ret;
+    }
+    // 内核(或者seccomp等限制)拒绝了该操作，退回到非阻塞connect+等待写事件的方式
+    // 参数本身错误时connect_f会再次返回同样的错误
+  }
   int ret = connect_f(sockfd, addr, addrlen);
   if (ret == 0) {
     return 0;
-  } else if (ret == -1 || errno != EINPROGRESS) {
+  } else if (ret != -1 || errno != EINPROGRESS) {
     // EINPROGRES(表示fd实际上已经连接了，但fd为非阻塞)
     return ret;
   }
-  moka::IOManager* iom = moka::IOManager::GetThis();
   moka::Timer::ptr timer;
   std::shared_ptr<moka::TimerInfo> t_info(new moka::TimerInfo);
   std::weak_ptr<moka::TimerInfo> w_info(t_info);
@@ -330,7 +539,8 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 
 int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
   // 监听读事件
-  int fd = moka::do_io(sockfd, accept_f, "accept", moka::IOManager::Event::READ, SO_RCVTIMEO, addr, addrlen);
+  moka::IOManager::UringOp op = {IORING_OP_ACCEPT, (uint64_t)addr, 0, (uint64_t)addrlen, 0};
+  int fd = moka::do_io(sockfd, accept_f, "accept", moka::IOManager::Event::READ, SO_RCVTIMEO, &op, addr, addrlen);
   if (fd >= 0) {
     // 将连接套接字放入信息集合中
     moka::FdMgr::GetInstance()->get(fd, true);
@@ -338,44 +548,74 @@ int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
   return fd;
 }
 
+int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+  moka::IOManager::UringOp op = {IORING_OP_ACCEPT, (uint64_t)addr, 0, (uint64_t)addrlen, (uint32_t)flags};
+  int fd = moka::do_io(sockfd, accept4_f, "accept4", moka::IOManager::Event::READ, SO_RCVTIMEO, &op, addr, addrlen, flags);
+  if (fd >= 0) {
+    // SOCK_NONBLOCK会在初始化fd信息时记录为用户设置的非阻塞
+    moka::FdMgr::GetInstance()->get(fd, true);
+  }
+  return fd;
+}
+
+int socketpair(int domain, int type, int protocol, int sv[2]) {
+  if (!moka::t_hook_enable) {
+    return socketpair_f(domain, type, protocol, sv);
+  }
+  int ret = socketpair_f(domain, type, protocol, sv);
+  if (ret == 0) {
+    moka::FdMgr::GetInstance()->get(sv[0], true);
+    moka::FdMgr::GetInstance()->get(sv[1], true);
+  }
+  return ret;
+}
+
 ssize_t read(int fd, void *buf, size_t count) {
-  return do_io(fd, read_f, "read", moka::IOManager::READ, SO_RCVTIMEO, buf, count);
+  moka::IOManager::UringOp op = {IORING_OP_READ, (uint64_t)buf, (uint32_t)count, 0, 0};
+  return do_io(fd, read_f, "read", moka::IOManager::READ, SO_RCVTIMEO, &op, buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
-  return do_io(fd, readv_f, "readv", moka::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+  moka::IOManager::UringOp op = {IORING_OP_READV, (uint64_t)iov, (uint32_t)iovcnt, 0, 0};
+  return do_io(fd, readv_f, "readv", moka::IOManager::READ, SO_RCVTIMEO, &op, iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
-  return do_io(sockfd, recv_f, "recv", moka::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+  moka::IOManager::UringOp op = {IORING_OP_RECV, (uint64_t)buf, (uint32_t)len, 0, (uint32_t)flags};
+  return do_io(sockfd, recv_f, "recv", moka::IOManager::READ, SO_RCVTIMEO, &op, buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen) {
-  return do_io(sockfd, recvfrom_f, "recvfrom", moka::IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+  return do_io(sockfd, recvfrom_f, "recvfrom", moka::IOManager::READ, SO_RCVTIMEO, nullptr, buf, len, flags, src_addr, addrlen);
 }
 
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
-  return do_io(sockfd, recvmsg_f, "recvmsg", moka::IOManager::READ, SO_RCVTIMEO, msg, flags);
+  moka::IOManager::UringOp op = {IORING_OP_RECVMSG, (uint64_t)msg, 1, 0, (uint32_t)flags};
+  return do_io(sockfd, recvmsg_f, "recvmsg", moka::IOManager::READ, SO_RCVTIMEO, &op, msg, flags);
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
-  return do_io(fd, write_f, "write", moka::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+  moka::IOManager::UringOp op = {IORING_OP_WRITE, (uint64_t)buf, (uint32_t)count, 0, 0};
+  return do_io(fd, write_f, "write", moka::IOManager::WRITE, SO_SNDTIMEO, &op, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
-  return do_io(fd, writev_f, "writev", moka::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+  moka::IOManager::UringOp op = {IORING_OP_WRITEV, (uint64_t)iov, (uint32_t)iovcnt, 0, 0};
+  return do_io(fd, writev_f, "writev", moka::IOManager::WRITE, SO_SNDTIMEO, &op, iov, iovcnt);
 }
 
 ssize_t send(int sockfd, const void *buf, size_t len, int flags) {
-  return do_io(sockfd, send_f, "send", moka::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags);
+  moka::IOManager::UringOp op = {IORING_OP_SEND, (uint64_t)buf, (uint32_t)len, 0, (uint32_t)flags};
+  return do_io(sockfd, send_f, "send", moka::IOManager::WRITE, SO_SNDTIMEO, &op, buf, len, flags);
 }
 
 ssize_t sendto(int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen) {
-  return do_io(sockfd, sendto_f, "sendto", moka::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags, dest_addr, addrlen);
+  return do_io(sockfd, sendto_f, "sendto", moka::IOManager::WRITE, SO_SNDTIMEO, nullptr, buf, len, flags, dest_addr, addrlen);
 }
 
 ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
-  return do_io(sockfd, sendmsg_f, "sendmsg", moka::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+  moka::IOManager::UringOp op = {IORING_OP_SENDMSG, (uint64_t)msg, 1, 0, (uint32_t)flags};
+  return do_io(sockfd, sendmsg_f, "sendmsg", moka::IOManager::WRITE, SO_SNDTIMEO, &op, msg, flags);
 }
 
 int close(int fd) {
@@ -423,7 +663,7 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
       va_end(va);
       int arg = fcntl_f(fd, cmd);  // 取出fd的状态标志
       moka::FdCtx::ptr ctx = moka::FdMgr::GetInstance()->get(fd);
-      if (!ctx || ctx->isClosed() || !ctx->isSocket()) {
+      if (!ctx || ctx->isClosed() || !ctx->isPollable()) {
         return arg;
       }
       // 即便hook设置该fd为非阻塞，也根据用户当前fd的状态返回对应的状态标志
@@ -434,9 +674,18 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
         return arg & ~O_NONBLOCK;
       }
     }
-    // int
     case F_DUPFD:
-    case F_DUPFD_CLOEXEC: 
+    case F_DUPFD_CLOEXEC: {
+      int arg = va_arg(va, int);
+      va_end(va);
+      int ret = fcntl_f(fd, cmd, arg);
+      // 和dup一样，复制出来的fd继承原来fd的hook信息
+      if (ret >= 0 && moka::t_hook_enable) {
+        moka::dup_fd_ctx(fd, ret);
+      }
+      return ret;
+    }
+    // int
     case F_SETFD:
     case F_SETOWN:
     case F_SETSIG:
@@ -496,7 +745,7 @@ int ioctl(int fd, unsigned long request, ...) {
     // 第三个参数值为0表示禁用非阻塞模式
     bool user_nonblock = !!*((int*)arg);
     moka::FdCtx::ptr ctx = moka::FdMgr::GetInstance()->get(fd);
-    if (!ctx || ctx->isClosed() || !ctx->isSocket()) {
+    if (!ctx || ctx->isClosed() || !ctx->isPollable()) {
       return ioctl_f(fd, request, arg);
     }
     // 用户设置为非阻塞(获取用户设置的状态)
@@ -527,6 +776,226 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
   return setsockopt_f(sockfd, level, optname, optval, optlen);
 }
 
+int dup(int oldfd) {
+  if (!moka::t_hook_enable) {
+    return dup_f(oldfd);
+  }
+  int fd = dup_f(oldfd);
+  if (fd >= 0) {
+    moka::dup_fd_ctx(oldfd, fd);
+  }
+  return fd;
+}
+
+int dup2(int oldfd, int newfd) {
+  if (!moka::t_hook_enable) {
+    return dup2_f(oldfd, newfd);
+  }
+  if (oldfd != newfd) {
+    moka::close_fd_ctx(newfd);
+  }
+  int fd = dup2_f(oldfd, newfd);
+  if (fd >= 0 && oldfd != newfd) {
+    moka::dup_fd_ctx(oldfd, fd);
+  }
+  return fd;
+}
+
+int dup3(int oldfd, int newfd, int flags) {
+  if (!moka::t_hook_enable) {
+    return dup3_f(oldfd, newfd, flags);
+  }
+  if (oldfd != newfd) {
+    moka::close_fd_ctx(newfd);
+  }
+  int fd = dup3_f(oldfd, newfd, flags);
+  if (fd >= 0) {
+    moka::dup_fd_ctx(oldfd, fd);
+  }
+  return fd;
+}
+
+int pipe(int pipefd[2]) {
+  if (!moka::t_hook_enable) {
+    return pipe_f(pipefd);
+  }
+  int ret = pipe_f(pipefd);
+  if (ret == 0) {
+    // 管道可以通过epoll等待，读写和socket一样hook
+    moka::FdMgr::GetInstance()->get(pipefd[0], true);
+    moka::FdMgr::GetInstance()->get(pipefd[1], true);
+  }
+  return ret;
+}
+
+int pipe2(int pipefd[2], int flags) {
+  if (!moka::t_hook_enable) {
+    return pipe2_f(pipefd, flags);
+  }
+  int ret = pipe2_f(pipefd, flags);
+  if (ret == 0) {
+    moka::FdMgr::GetInstance()->get(pipefd[0], true);
+    moka::FdMgr::GetInstance()->get(pipefd[1], true);
+  }
+  return ret;
+}
+
+int eventfd(unsigned int initval, int flags) {
+  if (!moka::t_hook_enable) {
+    return eventfd_f(initval, flags);
+  }
+  int fd = eventfd_f(initval, flags);
+  if (fd >= 0) {
+    moka::FdMgr::GetInstance()->get(fd, true);
+  }
+  return fd;
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+  if (!moka::t_hook_enable) {
+    return poll_f(fds, nfds, timeout);
+  }
+  return moka::do_poll(fds, nfds, timeout);
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
+  if (!moka::t_hook_enable) {
+    return select_f(nfds, readfds, writefds, exceptfds, timeout);
+  }
+  // 转换成pollfd数组等待，再按照select的语义写回fd_set
+  std::vector<struct pollfd> fds;
+  for (int fd = 0; fd < nfds; ++fd) {
+    short events = 0;
+    if (readfds && FD_ISSET(fd, readfds)) {
+      events |= POLLIN;
+    }
+    if (writefds && FD_ISSET(fd, writefds)) {
+      events |= POLLOUT;
+    }
+    if (exceptfds && FD_ISSET(fd, exceptfds)) {
+      events |= POLLPRI;
+    }
+    if (events) {
+      fds.push_back({fd, events, 0});
+    }
+  }
+  int timeout_ms = timeout? (int)(timeout->tv_sec * 1000 + timeout->tv_usec / 1000): -1;
+  int n = moka::do_poll(fds.data(), fds.size(), timeout_ms);
+  if (n < 0) {
+    return n;
+  }
+  for (auto& i : fds) {
+    if (i.revents & POLLNVAL) {
+      errno = EBADF;
+      return -1;
+    }
+  }
+  if (readfds) {
+    FD_ZERO(readfds);
+  }
+  if (writefds) {
+    FD_ZERO(writefds);
+  }
+  if (exceptfds) {
+    FD_ZERO(exceptfds);
+  }
+  int count = 0;
+  for (auto& i : fds) {
+    if (readfds && (i.events & POLLIN) && (i.revents & (POLLIN | POLLHUP | POLLERR))) {
+      FD_SET(i.fd, readfds);
+      ++count;
+    }
+    if (writefds && (i.events & POLLOUT) && (i.revents & (POLLOUT | POLLERR))) {
+      FD_SET(i.fd, writefds);
+      ++count;
+    }
+    if (exceptfds && (i.events & POLLPRI) && (i.revents & POLLPRI)) {
+      FD_SET(i.fd, exceptfds);
+      ++count;
+    }
+  }
+  if (timeout && !count) {
+    timeout->tv_sec = 0;
+    timeout->tv_usec = 0;
+  }
+  return count;
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+  if (!moka::t_hook_enable) {
+    return epoll_wait_f(epfd, events, maxevents, timeout);
+  }
+  // epoll实例本身可以被poll，有事件就绪时可读
+  uint64_t deadline = timeout < 0? (uint64_t)-1: moka::GetCurrentMs() + timeout;
+  while (true) {
+    int n = epoll_wait_f(epfd, events, maxevents, 0);
+    if (n != 0 || timeout == 0) {
+      return n;
+    }
+    int remain = -1;
+    if (deadline != (uint64_t)-1) {
+      uint64_t now = moka::GetCurrentMs();
+      if (now >= deadline) {
+        return 0;
+      }
+      remain = deadline - now;
+    }
+    struct pollfd pfd = {epfd, POLLIN, 0};
+    n = moka::do_poll(&pfd, 1, remain);
+    if (n <= 0) {
+      return n;
+    }
+    // 就绪的事件可能已经被其他线程取走，继续等待
+  }
+}
+
+int open(const char *pathname, int flags, ... /* mode_t mode */) {
+  mode_t mode = 0;
+  if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) {
+    // 只有创建文件时才有第三个参数
+    va_list va;
+    va_start(va, flags);
+    mode = va_arg(va, int);
+    va_end(va);
+  }
+  if (!moka::t_hook_enable) {
+    return open_f(pathname, flags, mode);
+  }
+  // 打开文件可能需要读取目录和inode(冷缓存时阻塞)，打开FIFO时会一直阻塞到对端也打开
+  int fd = moka::FileIOPool::GetInstance()->run([pathname, flags, mode]() -> ssize_t {
+    return open_f(pathname, flags, mode);
+  });
+  if (fd >= 0) {
+    // 放入fd信息集合中，之后在该fd上的读写才会被hook
+    moka::FdMgr::GetInstance()->get(fd, true);
+  }
+  return fd;
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+  moka::IOManager::UringOp op = {IORING_OP_READ, (uint64_t)buf, (uint32_t)count, (uint64_t)offset, 0};
+  return moka::do_file_op(fd, pread_f, &op, buf, count, offset);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+  moka::IOManager::UringOp op = {IORING_OP_WRITE, (uint64_t)buf, (uint32_t)count, (uint64_t)offset, 0};
+  return moka::do_file_op(fd, pwrite_f, &op, buf, count, offset);
+}
+
+int fsync(int fd) {
+  moka::IOManager::UringOp op = {IORING_OP_FSYNC, 0, 0, 0, 0};
+  return moka::do_file_op(fd, fsync_f, &op);
+}
+
+int stat(const char *pathname, struct stat *statbuf) {
+  if (!moka::t_hook_enable) {
+    return stat_f(pathname, statbuf);
+  }
+  return moka::FileIOPool::GetInstance()->run([pathname, statbuf]() -> ssize_t {
+    return stat_f(pathname, statbuf);
+  });
+}
+
 }
 
 // 外部函数指针变量的声明(一定不要放到moka的命名空间中，否则链接时找不到)
@@ -5,6 +5,11 @@
 #include <sys/socket.h>
 #include <sys/uio.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
@@ -27,6 +32,8 @@ typedef int (*nanosleep_fun)(const struct timespec *req, struct timespec *rem);
 typedef int (*socket_fun)(int domain, int type, int protocol);
 typedef int (*connect_fun)(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
 typedef int (*accept_fun)(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
+typedef int (*accept4_fun)(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+typedef int (*socketpair_fun)(int domain, int type, int protocol, int sv[2]);
 
 // read
 typedef ssize_t (*read_fun)(int fd, void *buf, size_t count);
@@ -48,6 +55,24 @@ typedef int (*fcntl_fun)(int fd, int cmd, ... /* arg */ );
 typedef int (*ioctl_fun)(int fd, unsigned long request, ...);
 typedef int (*getsockopt_fun)(int sockfd, int level, int optname, void *optval, socklen_t *optlen);
 typedef int (*setsockopt_fun)(int sockfd, int level, int optname, const void *optval, socklen_t optlen);
+typedef int (*dup_fun)(int oldfd);
+typedef int (*dup2_fun)(int oldfd, int newfd);
+typedef int (*dup3_fun)(int oldfd, int newfd, int flags);
+typedef int (*pipe_fun)(int pipefd[2]);
+typedef int (*pipe2_fun)(int pipefd[2], int flags);
+typedef int (*eventfd_fun)(unsigned int initval, int flags);
+
+// 多路复用(第三方库自己等待fd就绪时只挂起协程)
+typedef int (*poll_fun)(struct pollfd *fds, nfds_t nfds, int timeout);
+typedef int (*select_fun)(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout);
+typedef int (*epoll_wait_fun)(int epfd, struct epoll_event *events, int maxevents, int timeout);
+
+// file(阻塞的文件操作交给卸载线程池执行)
+typedef int (*open_fun)(const char *pathname, int flags, ... /* mode_t mode */);
+typedef ssize_t (*pread_fun)(int fd, void *buf, size_t count, off_t offset);
+typedef ssize_t (*pwrite_fun)(int fd, const void *buf, size_t count, off_t offset);
+typedef int (*fsync_fun)(int fd);
+typedef int (*stat_fun)(const char *pathname, struct stat *statbuf);
 
 // 定义外部变量(函数指针变量)
 extern sleep_fun sleep_f;
@@ -56,6 +81,8 @@ extern nanosleep_fun nanosleep_f;
 extern socket_fun socket_f;
 extern connect_fun connect_f;
 extern accept_fun accept_f;
+extern accept4_fun accept4_f;
+extern socketpair_fun socketpair_f;
 extern read_fun read_f;
 extern readv_fun readv_f;
 extern recv_fun recv_f;
@@ -71,6 +98,20 @@ extern fcntl_fun fcntl_f;
 extern ioctl_fun ioctl_f;
 extern getsockopt_fun getsockopt_f;
 extern setsockopt_fun setsockopt_f;
+extern dup_fun dup_f;
+extern dup2_fun dup2_f;
+extern dup3_fun dup3_f;
+extern pipe_fun pipe_f;
+extern pipe2_fun pipe2_f;
+extern eventfd_fun eventfd_f;
+extern poll_fun poll_f;
+extern select_fun select_f;
+extern epoll_wait_fun epoll_wait_f;
+extern open_fun open_f;
+extern pread_fun pread_f;
+extern pwrite_fun pwrite_f;
+extern fsync_fun fsync_f;
+extern stat_fun stat_f;
 extern int connect_with_timeout(int sockfd, const struct sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms);
 }
 
@@ -0,0 +1,203 @@
+#include "http.h"
+
+#include <strings.h>
+#include <sstream>
+
+namespace moka {
+
+static const char* s_method_string[] = {
+#define XX(num, name, string) #string,
+  HTTP_METHOD_MAP(XX)
+#undef XX
+};
+
+HttpMethod StringToHttpMethod(const char* str, size_t len) {
+#define XX(num, name, string) \
+  if (len == sizeof(#string) - 1 && memcmp(str, #string, len) == 0) { \
+    return HttpMethod::name; \
+  }
+  HTTP_METHOD_MAP(XX);
+#undef XX
+  return HttpMethod::INVALID_METHOD;
+}
+
+const char* HttpMethodToString(HttpMethod m) {
+  uint32_t idx = (uint32_t)m;
+  if (idx >= sizeof(s_method_string) / sizeof(s_method_string[0])) {
+    return "<unknown>";
+  }
+  return s_method_string[idx];
+}
+
+const char* HttpStatusToString(HttpStatus s) {
+  switch (s) {
+#define XX(code, name, msg) \
+    case HttpStatus::name: \
+      return #msg;
+    HTTP_STATUS_MAP(XX);
+#undef XX
+    default:
+      return "<unknown>";
+  }
+}
+
+bool StringRef::equalsIgnoreCase(const StringRef& oth) const {
+  return size == oth.size && (size == 0 || strncasecmp(data, oth.data, size) == 0);
+}
+
+std::ostream& operator<<(std::ostream& os, const StringRef& str) {
+  return os.write(str.data, str.size);
+}
+
+StringRef HttpMessage::get_header(const StringRef& name) const {
+  for (auto& i : headers_) {
+    if (i.name.equalsIgnoreCase(name)) {
+      return i.value;
+    }
+  }
+  return StringRef();
+}
+
+bool HttpMessage::has_header(const StringRef& name) const {
+  for (auto& i : headers_) {
+    if (i.name.equalsIgnoreCase(name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::ostream& HttpRequest::dump(std::ostream& os) const {
+  os << method_str_ << " " << uri_ << " HTTP/"
+     << (uint32_t)(version_ >> 4) << "." << (uint32_t)(version_ & 0x0f) << "\r\n";
+  for (auto& i : headers_) {
+    os << i.name << ": " << i.value << "\r\n";
+  }
+  os << "\r\n" << body_.toString();
+  return os;
+}
+
+std::string HttpRequest::toString() const {
+  std::stringstream ss;
+  dump(ss);
+  return ss.str();
+}
+
+HttpResponse::HttpResponse(uint8_t version, bool keep_alive)
+    : version_(version),
+      keep_alive_(keep_alive) {
+}
+
+void HttpResponse::set_status(HttpStatus v, const std::string& reason) {
+  status_ = v;
+  reason_ = reason;
+}
+
+void HttpResponse::set_header(const std::string& name, const std::string& value) {
+  for (auto& i : headers_) {
+    if (strcasecmp(i.first.c_str(), name.c_str()) == 0) {
+      i.second = value;
+      return;
+    }
+  }
+  headers_.push_back(std::make_pair(name, value));
+}
+
+std::string HttpResponse::get_header(const std::string& name, const std::string& def) const {
+  for (auto& i : headers_) {
+    if (strcasecmp(i.first.c_str(), name.c_str()) == 0) {
+      return i.second;
+    }
+  }
+  return def;
+}
+
+void HttpResponse::del_header(const std::string& name) {
+  for (auto it = headers_.begin(); it != headers_.end(); ++it) {
+    if (strcasecmp(it->first.c_str(), name.c_str()) == 0) {
+      headers_.erase(it);
+      return;
+    }
+  }
+}
+
+void HttpResponse::add_chunk(const std::string& chunk) {
+  chunked_ = true;
+  if (!chunk.empty()) {
+    // 空块表示结束，由序列化时写入
+    chunks_.push_back(chunk);
+  }
+}
+
+void HttpResponse::serialize(ByteArray& ba, bool with_body) const {
+  char line[64];
+  int n = snprintf(line, sizeof(line), "HTTP/%u.%u %u ", (uint32_t)(version_ >> 4),
+                   (uint32_t)(version_ & 0x0f), (uint32_t)status_);
+  ba.write(line, n);
+  ba.writeString(reason_.empty()? HttpStatusToString(status_): reason_);
+  ba.write("\r\n", 2);
+  for (auto& i : headers_) {
+    if (strcasecmp(i.first.c_str(), "content-length") == 0
+        || strcasecmp(i.first.c_str(), "transfer-encoding") == 0
+        || strcasecmp(i.first.c_str(), "connection") == 0) {
+      continue;
+    }
+    ba.writeString(i.first);
+    ba.write(": ", 2);
+    ba.writeString(i.second);
+    ba.write("\r\n", 2);
+  }
+  // HTTP/1.1默认长连接，HTTP/1.0默认短连接
+  if (version_ >= 0x11) {
+    if (!keep_alive_) {
+      ba.writeString("Connection: close\r\n");
+    }
+  } else if (keep_alive_) {
+    ba.writeString("Connection: keep-alive\r\n");
+  }
+  uint32_t code = (uint32_t)status_;
+  if (code < 200 || code == 204 || code == 304) {
+    // 这些状态码没有消息体
+    ba.write("\r\n", 2);
+    return;
+  }
+  if (chunked_ && version_ >= 0x11) {
+    ba.writeString("Transfer-Encoding: chunked\r\n\r\n");
+    if (!with_body) {
+      return;
+    }
+    for (auto& i : chunks_) {
+      n = snprintf(line, sizeof(line), "%zx\r\n", i.size());
+      ba.write(line, n);
+      ba.writeString(i);
+      ba.write("\r\n", 2);
+    }
+    ba.write("0\r\n\r\n", 5);
+  } else if (chunked_) {
+    // HTTP/1.0不支持分块编码，拼接后按长度发送
+    size_t len = 0;
+    for (auto& i : chunks_) {
+      len += i.size();
+    }
+    n = snprintf(line, sizeof(line), "Content-Length: %zu\r\n\r\n", len);
+    ba.write(line, n);
+    for (size_t i = 0; with_body && i < chunks_.size(); ++i) {
+      ba.writeString(chunks_[i]);
+    }
+  } else {
+    n = snprintf(line, sizeof(line), "Content-Length: %zu\r\n\r\n", body_.size());
+    ba.write(line, n);
+    if (with_body) {
+      ba.writeString(body_);
+    }
+  }
+}
+
+std::string HttpResponse::toString() const {
+  ByteArray ba;
+  serialize(ba);
+  ba.set_rw_position(0);
+  return ba.toString();
+}
+
+}
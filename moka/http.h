@@ -0,0 +1,202 @@
+#ifndef __MOKA_HTTP_H__
+#define __MOKA_HTTP_H__
+
+#include <string.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "bytearray.h"
+
+namespace moka {
+
+// 请求方法
+#define HTTP_METHOD_MAP(XX)   \
+  XX(0,  DELETE,  DELETE)     \
+  XX(1,  GET,     GET)        \
+  XX(2,  HEAD,    HEAD)       \
+  XX(3,  POST,    POST)       \
+  XX(4,  PUT,     PUT)        \
+  XX(5,  CONNECT, CONNECT)    \
+  XX(6,  OPTIONS, OPTIONS)    \
+  XX(7,  TRACE,   TRACE)      \
+  XX(8,  PATCH,   PATCH)
+
+// 状态码
+#define HTTP_STATUS_MAP(XX)                                                 \
+  XX(100, CONTINUE,                        Continue)                        \
+  XX(101, SWITCHING_PROTOCOLS,             Switching Protocols)             \
+  XX(200, OK,                              OK)                              \
+  XX(201, CREATED,                         Created)                         \
+  XX(202, ACCEPTED,                        Accepted)                        \
+  XX(204, NO_CONTENT,                      No Content)                      \
+  XX(206, PARTIAL_CONTENT,                 Partial Content)                 \
+  XX(301, MOVED_PERMANENTLY,               Moved Permanently)               \
+  XX(302, FOUND,                           Found)                           \
+  XX(304, NOT_MODIFIED,                    Not Modified)                    \
+  XX(400, BAD_REQUEST,                     Bad Request)                     \
+  XX(401, UNAUTHORIZED,                    Unauthorized)                    \
+  XX(403, FORBIDDEN,                       Forbidden)                       \
+  XX(404, NOT_FOUND,                       Not Found)                       \
+  XX(405, METHOD_NOT_ALLOWED,              Method Not Allowed)              \
+  XX(408, REQUEST_TIMEOUT,                 Request Timeout)                 \
+  XX(411, LENGTH_REQUIRED,                 Length Required)                 \
+  XX(413, PAYLOAD_TOO_LARGE,               Payload Too Large)               \
+  XX(431, REQUEST_HEADER_FIELDS_TOO_LARGE, Request Header Fields Too Large) \
+  XX(500, INTERNAL_SERVER_ERROR,           Internal Server Error)           \
+  XX(501, NOT_IMPLEMENTED,                 Not Implemented)                 \
+  XX(502, BAD_GATEWAY,                     Bad Gateway)                     \
+  XX(503, SERVICE_UNAVAILABLE,             Service Unavailable)             \
+  XX(505, HTTP_VERSION_NOT_SUPPORTED,      HTTP Version Not Supported)
+
+enum class HttpMethod {
+#define XX(num, name, string) name = num,
+  HTTP_METHOD_MAP(XX)
+#undef XX
+  INVALID_METHOD
+};
+
+enum class HttpStatus {
+#define XX(code, name, desc) name = code,
+  HTTP_STATUS_MAP(XX)
+#undef XX
+};
+
+HttpMethod StringToHttpMethod(const char* str, size_t len);
+const char* HttpMethodToString(HttpMethod m);
+const char* HttpStatusToString(HttpStatus s);
+
+// 指向其他内存(接收缓冲区)的字符串，不持有内存
+struct StringRef {
+  StringRef() {}
+  StringRef(const char* d, size_t s) : data(d), size(s) {}
+  StringRef(const char* d) : data(d), size(strlen(d)) {}
+
+  bool empty() const { return size == 0; }
+  std::string str() const { return std::string(data, size); }
+  bool operator==(const StringRef& oth) const {
+    return size == oth.size && (size == 0 || memcmp(data, oth.data, size) == 0);
+  }
+  bool operator!=(const StringRef& oth) const { return !(*this == oth); }
+  // 忽略大小写比较
+  bool equalsIgnoreCase(const StringRef& oth) const;
+
+  const char* data = nullptr;
+  size_t size = 0;
+};
+
+std::ostream& operator<<(std::ostream& os, const StringRef& str);
+
+struct HttpHeader {
+  StringRef name;
+  StringRef value;
+};
+
+// 解析出的消息的公共部分(由HttpParser填充)
+// 起始行和头部指向接收缓冲区的节点内存(通过head_持有引用，不拷贝)，只有跨越节点时才拷贝到head_copy_
+class HttpMessage {
+ public:
+  uint8_t get_version() const { return version_; }   // 0x11表示HTTP/1.1
+  const std::vector<HttpHeader>& get_headers() const { return headers_; }
+  // 按名称(忽略大小写)查找头部，不存在时返回空字符串
+  StringRef get_header(const StringRef& name) const;
+  bool has_header(const StringRef& name) const;
+  // 消息体(分块编码时为拼接后的数据)，与头部一样引用接收缓冲区的节点内存
+  const ByteSlice& get_body() const { return body_; }
+  bool is_keep_alive() const { return keep_alive_; }
+  bool is_chunked() const { return chunked_; }
+
+ protected:
+  friend class HttpParser;
+  uint8_t version_ = 0x11;
+  bool keep_alive_ = true;
+  bool chunked_ = false;
+  std::vector<HttpHeader> headers_;
+  ByteSlice head_;
+  std::string head_copy_;
+  ByteSlice body_;
+};
+
+class HttpRequest : public HttpMessage {
+ public:
+  using ptr = std::shared_ptr<HttpRequest>;
+
+  HttpMethod get_method() const { return method_; }
+  StringRef get_method_string() const { return method_str_; }
+  StringRef get_uri() const { return uri_; }
+  StringRef get_path() const { return path_; }
+  StringRef get_query() const { return query_; }
+  StringRef get_fragment() const { return fragment_; }
+
+  std::ostream& dump(std::ostream& os) const;
+  std::string toString() const;
+
+ private:
+  friend class HttpParser;
+  HttpMethod method_ = HttpMethod::INVALID_METHOD;
+  StringRef method_str_;
+  StringRef uri_;
+  StringRef path_;
+  StringRef query_;
+  StringRef fragment_;
+};
+
+// 客户端解析出的响应
+class HttpReply : public HttpMessage {
+ public:
+  using ptr = std::shared_ptr<HttpReply>;
+
+  int get_status() const { return status_; }
+  StringRef get_reason() const { return reason_; }
+
+ private:
+  friend class HttpParser;
+  int status_ = 0;
+  StringRef reason_;
+};
+
+// 服务器构造的响应
+class HttpResponse {
+ public:
+  using ptr = std::shared_ptr<HttpResponse>;
+  HttpResponse(uint8_t version = 0x11, bool keep_alive = true);
+
+  HttpStatus get_status() const { return status_; }
+  void set_status(HttpStatus v, const std::string& reason = "");
+  uint8_t get_version() const { return version_; }
+  bool is_keep_alive() const { return keep_alive_; }
+  void set_keep_alive(bool v) { keep_alive_ = v; }
+
+  // Content-Length/Transfer-Encoding/Connection由序列化时根据消息体和keep_alive生成
+  void set_header(const std::string& name, const std::string& value);
+  std::string get_header(const std::string& name, const std::string& def = "") const;
+  void del_header(const std::string& name);
+
+  const std::string& get_body() const { return body_; }
+  void set_body(const std::string& v) { body_ = v; }
+  void append_body(const char* data, size_t len) { body_.append(data, len); }
+
+  // 使用分块编码，每次调用作为一块，序列化时写入结束块
+  void add_chunk(const std::string& chunk);
+  bool is_chunked() const { return chunked_; }
+
+  // 序列化后写入ByteArray的读写位置，with_body为false时只写起始行和头部(HEAD请求的响应)
+  void serialize(ByteArray& ba, bool with_body = true) const;
+  std::string toString() const;
+
+ private:
+  HttpStatus status_ = HttpStatus::OK;
+  uint8_t version_;
+  bool keep_alive_;
+  bool chunked_ = false;
+  std::string reason_;
+  std::vector<std::pair<std::string, std::string>> headers_;
+  std::string body_;
+  std::vector<std::string> chunks_;
+};
+
+}
+
+#endif
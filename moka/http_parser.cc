@@ -0,0 +1,525 @@
+#include "http_parser.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+
+#include "config.h"
+#include "log.h"
+
+namespace moka {
+
+static moka::Logger::ptr g_logger = MOKA_LOG_NAME("system");
+
+// 起始行加头部的最大长度，超过时返回431
+static ConfigVar<uint64_t>::ptr g_http_max_header_size =
+  Config::Lookup<uint64_t>("http.max_header_size", 64 * 1024, "http max request/response header size");
+
+// 消息体的最大长度，超过时返回413
+static ConfigVar<uint64_t>::ptr g_http_max_body_size =
+  Config::Lookup<uint64_t>("http.max_body_size", 64 * 1024 * 1024, "http max request/response body size");
+
+static std::atomic<uint64_t> s_max_header_size {0};
+static std::atomic<uint64_t> s_max_body_size {0};
+
+struct _HttpParserIniter {
+  _HttpParserIniter() {
+    s_max_header_size = g_http_max_header_size->get_value();
+    s_max_body_size = g_http_max_body_size->get_value();
+    g_http_max_header_size->addListener(0x4779, [](const uint64_t& old_val, const uint64_t& new_val) {
+      s_max_header_size = new_val;
+    });
+    g_http_max_body_size->addListener(0x4779, [](const uint64_t& old_val, const uint64_t& new_val) {
+      s_max_body_size = new_val;
+    });
+  }
+};
+
+static _HttpParserIniter s_http_parser_initer;
+
+// 块大小行(包括扩展)的最大长度
+static const size_t s_max_chunk_line = 1024;
+
+static bool IsSpace(char c) {
+  return c == ' ' || c == '\t';
+}
+
+// 去掉行尾的\r
+static const char* TrimCR(const char* begin, const char* end) {
+  return (end > begin && end[-1] == '\r')? end - 1: end;
+}
+
+// 逗号分隔的列表(Connection/Transfer-Encoding)中是否有token，last为true时只比较最后一个
+static bool HasToken(const StringRef& value, const StringRef& token, bool last = false) {
+  const char* p = value.data;
+  const char* end = value.data + value.size;
+  bool found = false;
+  while (p < end) {
+    const char* comma = (const char*)memchr(p, ',', end - p);
+    const char* item_end = comma? comma: end;
+    const char* b = p;
+    const char* e = item_end;
+    while (b < e && IsSpace(*b)) {
+      ++b;
+    }
+    while (e > b && IsSpace(e[-1])) {
+      --e;
+    }
+    if (b != e) {
+      found = StringRef(b, e - b).equalsIgnoreCase(token);
+      if (found && !last) {
+        return true;
+      }
+    }
+    p = item_end + 1;
+  }
+  return found;
+}
+
+// 解析HTTP/x.y，返回0x10 * x + y，格式错误返回0
+static uint8_t ParseVersion(const char* begin, const char* end) {
+  if (end - begin != 8 || memcmp(begin, "HTTP/", 5) != 0 || begin[6] != '.'
+      || !isdigit(begin[5]) || !isdigit(begin[7])) {
+    return 0;
+  }
+  return (uint8_t)(((begin[5] - '0') << 4) | (begin[7] - '0'));
+}
+
+HttpParser::HttpParser(Type type)
+    : type_(type) {
+  reset();
+}
+
+void HttpParser::reset() {
+  state_ = HEAD;
+  scanned_ = 0;
+  line_start_ = 0;
+  last_ = 0;
+  remain_ = 0;
+  trailer_size_ = 0;
+  error_status_ = HttpStatus::BAD_REQUEST;
+  error_.clear();
+  if (type_ == REQUEST) {
+    request_.reset(new HttpRequest);
+    msg_ = request_.get();
+  } else {
+    reply_.reset(new HttpReply);
+    msg_ = reply_.get();
+  }
+}
+
+HttpParser::Result HttpParser::fail(HttpStatus status, const char* error) {
+  state_ = FAIL;
+  error_status_ = status;
+  error_ = error;
+  MOKA_LOG_DEBUG(g_logger) << "http parse error: " << error;
+  return ERROR;
+}
+
+HttpParser::Result HttpParser::execute(ByteArray& ba) {
+  if (state_ == FINISH) {
+    reset();
+  }
+  if (state_ == FAIL) {
+    return ERROR;
+  }
+  if (state_ == HEAD) {
+    Result rt = parseHead(ba);
+    if (rt != DONE) {
+      return rt;
+    }
+  }
+  if (state_ == BODY) {
+    return parseBody(ba);
+  }
+  if (state_ != FINISH) {
+    return parseChunked(ba);
+  }
+  return DONE;
+}
+
+HttpParser::Result HttpParser::parseHead(ByteArray& ba) {
+  uint64_t max_size = s_max_header_size;
+  std::vector<iovec> iovs;
+  size_t head_size = 0;
+  while (head_size == 0) {
+    size_t readable = ba.get_readable_size();
+    if (scanned_ >= readable) {
+      break;
+    }
+    // 只扫描新到的数据
+    iovs.clear();
+    ba.get_read_buffers(iovs, readable - scanned_, ba.get_rw_position() + scanned_);
+    bool restart = false;
+    for (size_t i = 0; i < iovs.size() && head_size == 0 && !restart; ++i) {
+      const char* begin = (const char*)iovs[i].iov_base;
+      const char* end = begin + iovs[i].iov_len;
+      const char* p = begin;
+      while (p < end) {
+        const char* nl = (const char*)memchr(p, '\n', end - p);
+        if (!nl) {
+          scanned_ += end - p;
+          last_ = end[-1];
+          break;
+        }
+        size_t pos = scanned_ + (nl - p);
+        char prev = nl > begin? nl[-1]: last_;
+        size_t line_len = pos - line_start_;
+        scanned_ = pos + 1;
+        last_ = '\n';
+        p = nl + 1;
+        if (line_len > 1 || (line_len == 1 && prev != '\r')) {
+          line_start_ = scanned_;
+          continue;
+        }
+        if (line_start_ == 0) {
+          // 消息之前的空行直接忽略(RFC 7230 3.5)
+          ba.set_rw_position(ba.get_rw_position() + scanned_);
+          scanned_ = 0;
+          restart = true;
+        } else {
+          head_size = scanned_;
+        }
+        break;
+      }
+    }
+  }
+  if (head_size == 0) {
+    if (scanned_ > max_size) {
+      return fail(HttpStatus::REQUEST_HEADER_FIELDS_TOO_LARGE, "header too large");
+    }
+    return AGAIN;
+  }
+  if (head_size > max_size) {
+    return fail(HttpStatus::REQUEST_HEADER_FIELDS_TOO_LARGE, "header too large");
+  }
+
+  // 头部在一个节点内时直接引用节点内存，跨越节点时拷贝一次
+  ByteSlice head = ba.readSlice(head_size);
+  const char* base = head.data();
+  if (base) {
+    msg_->head_ = std::move(head);
+  } else {
+    msg_->head_copy_ = head.toString();
+    base = msg_->head_copy_.data();
+  }
+  scanned_ = 0;
+  line_start_ = 0;
+  last_ = 0;
+
+  const char* end = base + head_size;
+  const char* nl = (const char*)memchr(base, '\n', head_size);
+  if (!parseStartLine(base, TrimCR(base, nl))) {
+    return ERROR;
+  }
+  if (!parseHeaders(nl + 1, end) || !parseMessageInfo()) {
+    return ERROR;
+  }
+  return DONE;
+}
+
+bool HttpParser::parseStartLine(const char* begin, const char* end) {
+  const char* sp1 = (const char*)memchr(begin, ' ', end - begin);
+  if (!sp1 || sp1 == begin) {
+    fail(HttpStatus::BAD_REQUEST, "invalid start line");
+    return false;
+  }
+  if (type_ == RESPONSE) {
+    // HTTP/1.1 200 OK
+    msg_->version_ = ParseVersion(begin, sp1);
+    const char* code = sp1 + 1;
+    if ((msg_->version_ >> 4) != 1 || end - code < 3 || !isdigit(code[0])
+        || !isdigit(code[1]) || !isdigit(code[2]) || (end - code > 3 && code[3] != ' ')) {
+      fail(HttpStatus::BAD_REQUEST, "invalid status line");
+      return false;
+    }
+    reply_->status_ = (code[0] - '0') * 100 + (code[1] - '0') * 10 + (code[2] - '0');
+    if (end - code > 4) {
+      reply_->reason_ = StringRef(code + 4, end - code - 4);
+    }
+    if (msg_->version_ > 0x11) {
+      msg_->version_ = 0x11;
+    }
+    return true;
+  }
+
+  // GET /path?query#fragment HTTP/1.1
+  const char* uri = sp1 + 1;
+  const char* sp2 = (const char*)memchr(uri, ' ', end - uri);
+  if (!sp2 || sp2 == uri) {
+    fail(HttpStatus::BAD_REQUEST, "invalid request line");
+    return false;
+  }
+  msg_->version_ = ParseVersion(sp2 + 1, end);
+  if (msg_->version_ == 0) {
+    fail(HttpStatus::BAD_REQUEST, "invalid http version");
+    return false;
+  }
+  if ((msg_->version_ >> 4) != 1) {
+    fail(HttpStatus::HTTP_VERSION_NOT_SUPPORTED, "http version not supported");
+    return false;
+  }
+  if (msg_->version_ > 0x11) {
+    // 同一个主版本按支持的最高次版本处理
+    msg_->version_ = 0x11;
+  }
+  request_->method_str_ = StringRef(begin, sp1 - begin);
+  request_->method_ = StringToHttpMethod(begin, sp1 - begin);
+  if (request_->method_ == HttpMethod::INVALID_METHOD) {
+    fail(HttpStatus::NOT_IMPLEMENTED, "unknown method");
+    return false;
+  }
+
+  request_->uri_ = StringRef(uri, sp2 - uri);
+  const char* path = uri;
+  if (*uri != '/' && *uri != '*') {
+    // absolute-form: http://host:port/path
+    const char* scheme = (const char*)memmem(uri, sp2 - uri, "://", 3);
+    if (!scheme) {
+      fail(HttpStatus::BAD_REQUEST, "invalid uri");
+      return false;
+    }
+    path = (const char*)memchr(scheme + 3, '/', sp2 - scheme - 3);
+    if (!path) {
+      request_->path_ = StringRef("/", 1);
+      return true;
+    }
+  }
+  const char* path_end = sp2;
+  const char* hash = (const char*)memchr(path, '#', sp2 - path);
+  if (hash) {
+    request_->fragment_ = StringRef(hash + 1, sp2 - hash - 1);
+    path_end = hash;
+  }
+  const char* question = (const char*)memchr(path, '?', path_end - path);
+  if (question) {
+    request_->query_ = StringRef(question + 1, path_end - question - 1);
+    path_end = question;
+  }
+  request_->path_ = StringRef(path, path_end - path);
+  return true;
+}
+
+bool HttpParser::parseHeaders(const char* begin, const char* end) {
+  const char* p = begin;
+  while (p < end) {
+    const char* nl = (const char*)memchr(p, '\n', end - p);
+    const char* line_end = TrimCR(p, nl);
+    if (line_end == p) {
+      // 头部结束的空行
+      break;
+    }
+    if (IsSpace(*p)) {
+      // 不支持折行(obs-fold)，RFC 7230 3.2.4要求拒绝
+      fail(HttpStatus::BAD_REQUEST, "obsolete line folding");
+      return false;
+    }
+    const char* colon = (const char*)memchr(p, ':', line_end - p);
+    if (!colon || colon == p || IsSpace(colon[-1])) {
+      fail(HttpStatus::BAD_REQUEST, "invalid header line");
+      return false;
+    }
+    const char* value = colon + 1;
+    const char* value_end = line_end;
+    while (value < value_end && IsSpace(*value)) {
+      ++value;
+    }
+    while (value_end > value && IsSpace(value_end[-1])) {
+      --value_end;
+    }
+    msg_->headers_.push_back({StringRef(p, colon - p), StringRef(value, value_end - value)});
+    p = nl + 1;
+  }
+  return true;
+}
+
+bool HttpParser::parseMessageInfo() {
+  bool has_length = false;
+  uint64_t length = 0;
+  bool has_te = false;
+  bool conn_close = false;
+  bool conn_keep_alive = false;
+  for (auto& i : msg_->headers_) {
+    if (i.name.equalsIgnoreCase("Content-Length")) {
+      uint64_t v = 0;
+      if (i.value.empty() || i.value.size > 18) {
+        fail(HttpStatus::BAD_REQUEST, "invalid content-length");
+        return false;
+      }
+      for (size_t n = 0; n < i.value.size; ++n) {
+        if (!isdigit(i.value.data[n])) {
+          fail(HttpStatus::BAD_REQUEST, "invalid content-length");
+          return false;
+        }
+        v = v * 10 + (i.value.data[n] - '0');
+      }
+      if (has_length && v != length) {
+        fail(HttpStatus::BAD_REQUEST, "conflicting content-length");
+        return false;
+      }
+      has_length = true;
+      length = v;
+    } else if (i.name.equalsIgnoreCase("Transfer-Encoding")) {
+      // 以最后一个编码为准
+      has_te = true;
+      msg_->chunked_ = HasToken(i.value, "chunked", true);
+    } else if (i.name.equalsIgnoreCase("Connection")) {
+      conn_close = conn_close || HasToken(i.value, "close");
+      conn_keep_alive = conn_keep_alive || HasToken(i.value, "keep-alive");
+    }
+  }
+  // HTTP/1.1默认长连接，HTTP/1.0需要显式指定keep-alive
+  msg_->keep_alive_ = !conn_close && (msg_->version_ >= 0x11 || conn_keep_alive);
+
+  if (has_te) {
+    if (has_length) {
+      // 同时存在时可能是请求走私，直接拒绝
+      fail(HttpStatus::BAD_REQUEST, "both content-length and transfer-encoding");
+      return false;
+    }
+    if (!msg_->chunked_) {
+      fail(HttpStatus::NOT_IMPLEMENTED, "unsupported transfer-encoding");
+      return false;
+    }
+  }
+  if (has_length && length > s_max_body_size) {
+    fail(HttpStatus::PAYLOAD_TOO_LARGE, "body too large");
+    return false;
+  }
+
+  if (type_ == RESPONSE) {
+    int status = reply_->status_;
+    if (head_only_ || status < 200 || status == 204 || status == 304) {
+      msg_->chunked_ = false;
+      state_ = FINISH;
+      return true;
+    }
+    if (!has_te && !has_length) {
+      // 以关闭连接结束的消息体不支持，当作空消息体并且不再复用连接
+      msg_->keep_alive_ = false;
+      state_ = FINISH;
+      return true;
+    }
+  }
+  if (msg_->chunked_) {
+    state_ = CHUNK_SIZE;
+  } else if (length > 0) {
+    remain_ = length;
+    state_ = BODY;
+  } else {
+    state_ = FINISH;
+  }
+  return true;
+}
+
+HttpParser::Result HttpParser::parseBody(ByteArray& ba) {
+  size_t n = ba.get_readable_size();
+  n = n > remain_? remain_: n;
+  if (n > 0) {
+    msg_->body_.append(ba.readSlice(n));
+    remain_ -= n;
+  }
+  if (remain_ > 0) {
+    return AGAIN;
+  }
+  state_ = FINISH;
+  return DONE;
+}
+
+int HttpParser::readLine(ByteArray& ba, std::string& line, size_t max) {
+  std::vector<iovec> iovs;
+  uint64_t len = ba.get_read_buffers(iovs, max);
+  size_t pos = 0;
+  for (auto& i : iovs) {
+    const char* nl = (const char*)memchr(i.iov_base, '\n', i.iov_len);
+    if (nl) {
+      pos += nl - (const char*)i.iov_base;
+      line.resize(pos + 1);
+      ba.read(&line[0], pos + 1);
+      line.resize(TrimCR(line.data(), line.data() + pos) - line.data());
+      return 1;
+    }
+    pos += i.iov_len;
+  }
+  return len >= max? -1: 0;
+}
+
+HttpParser::Result HttpParser::parseChunked(ByteArray& ba) {
+  std::string line;
+  while (true) {
+    switch (state_) {
+      case CHUNK_SIZE: {
+        int rt = readLine(ba, line, s_max_chunk_line);
+        if (rt <= 0) {
+          return rt == 0? AGAIN: fail(HttpStatus::BAD_REQUEST, "chunk size line too long");
+        }
+        uint64_t size = 0;
+        size_t n = 0;
+        for (; n < line.size() && isxdigit(line[n]); ++n) {
+          char c = line[n];
+          size = size * 16 + (isdigit(c)? c - '0': (tolower(c) - 'a' + 10));
+        }
+        // 块大小之后只能是块扩展(忽略)
+        if (n == 0 || n > 15 || (n < line.size() && line[n] != ';' && !IsSpace(line[n]))) {
+          return fail(HttpStatus::BAD_REQUEST, "invalid chunk size");
+        }
+        if (size == 0) {
+          state_ = TRAILER;
+          break;
+        }
+        if (msg_->body_.size() + size > s_max_body_size) {
+          return fail(HttpStatus::PAYLOAD_TOO_LARGE, "body too large");
+        }
+        remain_ = size;
+        state_ = CHUNK_DATA;
+        break;
+      }
+      case CHUNK_DATA: {
+        size_t n = ba.get_readable_size();
+        n = n > remain_? remain_: n;
+        if (n == 0) {
+          return AGAIN;
+        }
+        msg_->body_.append(ba.readSlice(n));
+        remain_ -= n;
+        if (remain_ > 0) {
+          return AGAIN;
+        }
+        state_ = CHUNK_CRLF;
+        break;
+      }
+      case CHUNK_CRLF: {
+        int rt = readLine(ba, line, 2);
+        if (rt == 0) {
+          return AGAIN;
+        }
+        if (rt < 0 || !line.empty()) {
+          return fail(HttpStatus::BAD_REQUEST, "missing chunk crlf");
+        }
+        state_ = CHUNK_SIZE;
+        break;
+      }
+      case TRAILER: {
+        // trailer中的头部不使用，读到空行结束
+        int rt = readLine(ba, line, s_max_header_size);
+        if (rt == 0) {
+          return AGAIN;
+        }
+        trailer_size_ += line.size() + 2;
+        if (rt < 0 || trailer_size_ > s_max_header_size) {
+          return fail(HttpStatus::REQUEST_HEADER_FIELDS_TOO_LARGE, "trailer too large");
+        }
+        if (line.empty()) {
+          state_ = FINISH;
+          return DONE;
+        }
+        break;
+      }
+      default:
+        return DONE;
+    }
+  }
+}
+
+}
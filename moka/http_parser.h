@@ -0,0 +1,83 @@
+#ifndef __MOKA_HTTP_PARSER_H__
+#define __MOKA_HTTP_PARSER_H__
+
+#include <stdint.h>
+#include <string>
+
+#include "http.h"
+#include "bytearray.h"
+
+namespace moka {
+
+// HTTP/1.x增量解析器，直接在ByteArray的节点链表上解析(从读写位置开始)
+// 数据不完整时返回AGAIN，已经扫描过的头部不会重复扫描，追加数据(写在get_size()之后)后再次调用即可
+// 解析完成时读写位置移动到消息末尾，缓冲区中剩余的数据属于下一条消息(流水线)
+// 头部和消息体通过ByteSlice引用节点内存，只有头部跨越节点时才拷贝一次
+class HttpParser {
+ public:
+  enum Type {
+    REQUEST,
+    RESPONSE
+  };
+  enum Result {
+    DONE,     // 解析出一条完整的消息
+    AGAIN,    // 数据不完整
+    ERROR     // 格式错误或超过限制，连接不能继续使用
+  };
+
+  HttpParser(Type type);
+
+  // 上一次返回DONE之后再调用会自动开始解析下一条消息
+  Result execute(ByteArray& ba);
+  // 丢弃解析到一半的消息
+  void reset();
+
+  HttpRequest::ptr get_request() const { return request_; }
+  HttpReply::ptr get_reply() const { return reply_; }
+  // 解析的是HEAD请求的响应(没有消息体)，每条响应解析前设置
+  void set_head_only(bool v) { head_only_ = v; }
+  const std::string& get_error() const { return error_; }
+  // 出错时应该回复的状态码
+  HttpStatus get_error_status() const { return error_status_; }
+
+ private:
+  enum State {
+    HEAD,
+    BODY,
+    CHUNK_SIZE,
+    CHUNK_DATA,
+    CHUNK_CRLF,
+    TRAILER,
+    FINISH,
+    FAIL
+  };
+
+  Result parseHead(ByteArray& ba);
+  bool parseStartLine(const char* begin, const char* end);
+  bool parseHeaders(const char* begin, const char* end);
+  bool parseMessageInfo();
+  Result parseBody(ByteArray& ba);
+  Result parseChunked(ByteArray& ba);
+  // 从读写位置读取一行(不含换行符)，1表示读到，0表示数据不完整，-1表示超过max
+  int readLine(ByteArray& ba, std::string& line, size_t max);
+  Result fail(HttpStatus status, const char* error);
+
+ private:
+  Type type_;
+  State state_ = HEAD;
+  bool head_only_ = false;
+  size_t scanned_ = 0;        // 已经扫描过的头部长度(相对读写位置)
+  size_t line_start_ = 0;     // 当前行的开始位置(相对读写位置)
+  char last_ = 0;             // 扫描过的最后一个字符
+  uint64_t remain_ = 0;       // 消息体/当前块剩余的长度
+  uint32_t trailer_size_ = 0; // 已经读取的trailer长度
+  HttpMessage* msg_ = nullptr;
+  HttpRequest::ptr request_;
+  HttpReply::ptr reply_;
+  HttpStatus error_status_ = HttpStatus::BAD_REQUEST;
+  std::string error_;
+};
+
+}
+
+#endif
@@ -0,0 +1,75 @@
+#include "http_server.h"
+#include "http_parser.h"
+#include "config.h"
+#include "log.h"
+
+namespace moka {
+
+static moka::Logger::ptr g_logger = MOKA_LOG_NAME("system");
+
+// 接收缓冲区的节点大小，也是每次recv的最大长度
+static ConfigVar<uint32_t>::ptr g_http_server_buffer_size =
+  Config::Lookup<uint32_t>("http_server.buffer_size", 4096, "http server connection recv buffer node size");
+
+HttpServer::HttpServer(IOManager* io_worker, IOManager* accept_worker)
+    : TcpServer(io_worker, accept_worker),
+      dispatch_(new ServletDispatch) {
+}
+
+void HttpServer::handleClient(Socket::ptr client) {
+  size_t buffer_size = g_http_server_buffer_size->get_value();
+  ByteArray in(buffer_size);
+  ByteArray out(buffer_size);
+  HttpParser parser(HttpParser::REQUEST);
+  bool close = false;
+  while (!close) {
+    // 处理缓冲区中所有完整的请求(流水线)，响应依次写入out
+    while (!close) {
+      HttpParser::Result rt = parser.execute(in);
+      if (rt == HttpParser::AGAIN) {
+        break;
+      }
+      if (rt == HttpParser::ERROR) {
+        HttpResponse rsp(0x11, false);
+        rsp.set_status(parser.get_error_status());
+        rsp.set_header("Server", get_name());
+        rsp.serialize(out);
+        MOKA_LOG_DEBUG(g_logger) << "bad request from " << client->get_remote_address()->toString()
+                                 << ": " << parser.get_error();
+        close = true;
+        break;
+      }
+      HttpRequest::ptr req = parser.get_request();
+      HttpResponse::ptr rsp(new HttpResponse(req->get_version(), req->is_keep_alive() && !is_stop()));
+      rsp->set_header("Server", get_name());
+      dispatch_->handle(req, rsp);
+      rsp->serialize(out, req->get_method() != HttpMethod::HEAD);
+      close = !rsp->is_keep_alive();
+    }
+
+    if (out.get_size() > 0) {
+      out.set_rw_position(0);
+      int rt = client->send(out);
+      if (rt != (int)out.get_size()) {
+        break;
+      }
+      out.clear();
+    }
+    if (close) {
+      break;
+    }
+
+    // 释放已经解析完的节点，追加接收到缓冲区末尾(解析器从读写位置继续)
+    in.discardRead();
+    size_t pos = in.get_rw_position();
+    in.set_rw_position(in.get_size());
+    int rt = client->recv(in, buffer_size);
+    in.set_rw_position(pos);
+    if (rt <= 0) {
+      break;
+    }
+  }
+  client->close();
+}
+
+}
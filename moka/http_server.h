@@ -0,0 +1,32 @@
+#ifndef __MOKA_HTTP_SERVER_H__
+#define __MOKA_HTTP_SERVER_H__
+
+#include <memory>
+
+#include "tcp_server.h"
+#include "servlet.h"
+
+namespace moka {
+
+// HTTP/1.1服务器: 每个连接一个协程，支持长连接和流水线
+// 接收缓冲区中已经到达的请求全部处理完后，响应合并为一次send发出
+class HttpServer : public TcpServer {
+ public:
+  using ptr = std::shared_ptr<HttpServer>;
+
+  HttpServer(IOManager* io_worker = IOManager::GetThis(),
+             IOManager* accept_worker = IOManager::GetThis());
+
+  ServletDispatch::ptr get_dispatch() const { return dispatch_; }
+  void set_dispatch(ServletDispatch::ptr v) { dispatch_ = v; }
+
+ protected:
+  virtual void handleClient(Socket::ptr client) override;
+
+ private:
+  ServletDispatch::ptr dispatch_;
+};
+
+}
+
+#endif
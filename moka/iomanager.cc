@@ -1,52 +1,104 @@
 #include <string.h>
+#include <algorithm>
 #include <sys/epoll.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
 #include "iomanager.h"
+#include "hook.h"
+#include "uring.h"
 #include "macro.h"
 #include "log.h"
+#include "config.h"
 
 namespace moka {
 
 static moka::Logger::ptr g_logger = MOKA_LOG_NAME("system");
 
+static ConfigVar<bool>::ptr g_iomanager_io_uring =
+  Config::Lookup<bool>("iomanager.io_uring", false, "iomanager use io_uring instead of epoll");
+static ConfigVar<uint32_t>::ptr g_iomanager_io_uring_entries =
+  Config::Lookup<uint32_t>("iomanager.io_uring_entries", 1024, "iomanager io_uring sq entries");
+static ConfigVar<bool>::ptr g_iomanager_thread_timer =
+  Config::Lookup<bool>("iomanager.thread_timer", true, "iomanager per-thread timers fired on the arming thread");
+
+// io_uring请求的user_data: 低2位为0时是IoRequest的地址(第3位为1时是它链接的link_timeout)
+// 为1/2时是读/写事件的poll请求
+// poll请求: fd(高32位) | seq(30位) | 事件类型(低2位)
+static const uint64_t s_uring_ignore_data = 3;   // 不需要处理完成事件的请求(poll_remove/link_timeout)
+static const uint64_t s_uring_notify_data = 7;   // 监听notify_fd_的poll请求
+
+// 当前线程正在其idle中处理事件的IOManager(它的idle_thread_nums_包含了当前线程)
+static thread_local IOManager* t_in_idle = nullptr;
+
+static uint64_t EncodePollData(int fd, uint32_t seq, IOManager::Event event) {
+  return ((uint64_t)fd << 32) | ((uint64_t)(seq & 0x3fffffff) << 2)
+         | (event == IOManager::READ? 1: 2);
+}
+
 IOManager::IOManager(size_t thread_nums, bool use_caller, const std::string& name) 
     : Scheduler(thread_nums, use_caller, name) {
-  // 使用epoll_wait监听管道读端(调用notify会往管道中写入1字节数据唤醒)
+  if (g_iomanager_io_uring->get_value()) {
+    ring_.reset(new IoUring);
+    if (!ring_->init(g_iomanager_io_uring_entries->get_value())) {
+      MOKA_LOG_ERROR(g_logger) << "IOManager io_uring init failed, fallback to epoll";
+      ring_.reset();
+    }
+  }
+
+  // 使用epoll_wait监听eventfd(调用notify会给eventfd的计数加上需要唤醒的线程数)
   epfd_ = epoll_create(5);   // 创建epoll的实例，返回epfd，size参数2.6以后就被忽略了
   MOKA_ASSERT(epfd_ >= 0);
 
-  // 创建管道
-  int ret = pipe(notify_fds_);
-  MOKA_ASSERT(!ret);
+  // 信号量模式下每次read只会把计数减1，一次唤醒只会被一个线程消费
+  notify_fd_ = eventfd_f(0, EFD_NONBLOCK | EFD_SEMAPHORE | EFD_CLOEXEC);
+  MOKA_ASSERT(notify_fd_ >= 0);
 
   epoll_event event;
   bzero(&event, sizeof(epoll_event));
-  // 初始化epoll事件
-  event.events = EPOLLIN | EPOLLET;
-  // 初始化用户数据，检测管道读端的io事件
-  event.data.fd = notify_fds_[0];     
-
-  // 设置管道读端为非阻塞(配合边沿触发)
-  ret = fcntl(notify_fds_[0], F_SETFL, O_NONBLOCK);
-  MOKA_ASSERT(ret != -1);
+  // 水平触发: 计数不为0时会继续唤醒其他等待的线程
+  event.events = EPOLLIN;
+  // data.ptr为空表示notify_fd_(其他fd的data.ptr为fd上下文)
+  event.data.ptr = nullptr;
 
-  // 往epoll内核事件表中插入管道读端以及其相关的事件
-  ret = epoll_ctl(epfd_, EPOLL_CTL_ADD, notify_fds_[0], &event);
+  // 往epoll内核事件表中插入eventfd以及其相关的事件
+  int ret = epoll_ctl(epfd_, EPOLL_CTL_ADD, notify_fd_, &event);
   MOKA_ASSERT(!ret);
 
   // 初始化socket事件的上下文容器
   contextResize(32);
 
+  if (g_iomanager_thread_timer->get_value()) {
+    // 调度线程在第一次使用时认领其中一个(caller线程只在stop时参与调度，使用共享的定时器堆)
+    thread_timers_.resize(thread_nums_);
+    for (size_t i = 0; i < thread_nums_; ++i) {
+      thread_timers_[i] = new ThreadTimers(this);
+    }
+  }
+
+  if (ring_) {
+    // io_uring模式下通过poll请求监听eventfd(每次触发后重新提交)
+    Mutex::LockGuard lock(sq_mutex_);
+    io_uring_sqe* sqe = uringGetSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = notify_fd_;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = s_uring_notify_data;
+    ring_->flush();
+  }
+
   start();   // 开始调度
 }
 
 IOManager::~IOManager() {
   stop();    // 停止调度器
   close(epfd_);
-  close(notify_fds_[0]);
-  close(notify_fds_[1]);
+  close(notify_fd_);
+  for (auto timers : thread_timers_) {
+    delete timers;
+  }
   // 释放堆空间
   for (size_t i = 0; i < fd_contexts_.size(); ++i) {
     if (fd_contexts_[i]) {
@@ -58,6 +110,14 @@ IOManager::~IOManager() {
 // 0 success, -1 error
 // 没有第三个参数，则表示添加的事件对应的任务，为当前协程(而不是函数)，并放入事件上下文
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
+  return doAddEvent(fd, event, std::move(cb), nullptr, true);
+}
+
+int IOManager::tryAddEvent(int fd, Event event, std::function<void()> cb, const void* owner) {
+  return doAddEvent(fd, event, std::move(cb), owner, false);
+}
+
+int IOManager::doAddEvent(int fd, Event event, std::function<void()> cb, const void* owner, bool exclusive) {
   // 将文件描述符对应的事件加入到epoll内核事件表中(通过自定义的fd上下文，指针存储在data联合体中)
   RWmutex::ReadLock lock(mutex_);
   FdContext* fd_ctx = nullptr;
@@ -75,6 +135,10 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
   }
   // 对fd上下文加锁
   Mutex::LockGuard lock2(fd_ctx->mutex);
+  if (!exclusive && (fd_ctx->events & event)) {
+    errno = EEXIST;
+    return -1;
+  }
   if (fd_ctx->events & event) {
     // epoll监听集合中已经存在该event，意味着可能有两个不同线程在操作该方法
     MOKA_LOG_ERROR(g_logger) << "addEvenet assert fd=" << fd
@@ -83,21 +147,26 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
     MOKA_ASSERT(!(fd_ctx->events & event));
   }
 
-  int op = fd_ctx->events? EPOLL_CTL_MOD: EPOLL_CTL_ADD;
-  epoll_event epevent;
-  // 将对应的fd上下文的指针和事件类型存储到epoll事件结构体中
-  // 如果该事件发生则从对应的epoll事件结构体中将它取出
-  epevent.events = EPOLLET | fd_ctx->events | event;
-  // 数据
-  // epoll_data_t是一个联合体
-  epevent.data.ptr = fd_ctx;
-  // 更新epoll内核事件表
-  int ret = epoll_ctl(epfd_, op, fd, &epevent);
-  if (ret) {
-    MOKA_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd_ << ", "
-                             << op << ", " << fd << ", " << epevent.events << "):"
-                             << ret << " (" << errno << ") (" << strerror(errno) << ")";
-    return -1;
+  if (ring_) {
+    // 提交一次性的poll请求(在idle中和等待一起提交给内核)
+    uringPollAdd(fd_ctx, event);
+  } else {
+    int op = fd_ctx->events? EPOLL_CTL_MOD: EPOLL_CTL_ADD;
+    epoll_event epevent;
+    // 将对应的fd上下文的指针和事件类型存储到epoll事件结构体中
+    // 如果该事件发生则从对应的epoll事件结构体中将它取出
+    epevent.events = EPOLLET | fd_ctx->events | event;
+    // 数据
+    // epoll_data_t是一个联合体
+    epevent.data.ptr = fd_ctx;
+    // 更新epoll内核事件表
+    int ret = epoll_ctl(epfd_, op, fd, &epevent);
+    if (ret) {
+      MOKA_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd_ << ", "
+                               << op << ", " << fd << ", " << epevent.events << "):"
+                               << ret << " (" << errno << ") (" << strerror(errno) << ")";
+      return -1;
+    }
   }
   // 待执行的事件数量
   ++pending_event_counts_;
@@ -110,6 +179,7 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
   MOKA_ASSERT(!(event_ctx.scheduler || event_ctx.fiber || event_ctx.cb));
   // 初始化事件上下文
   event_ctx.scheduler = Scheduler::GetThis();  // 初始化事件的调度器
+  event_ctx.owner = owner;
   if (cb) {
     event_ctx.cb = std::move(cb);
   } else {
@@ -120,7 +190,7 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
   return 0;
 }
 
-int IOManager::delEvent(int fd, Event event) {
+int IOManager::delEvent(int fd, Event event, const void* owner) {
   RWmutex::ReadLock lock(mutex_);
   if ((int)fd_contexts_.size() <= fd) {
     return -1;
@@ -132,19 +202,27 @@ int IOManager::delEvent(int fd, Event event) {
     // 没有该事件
     return -1;
   }
-  Event new_events = (Event)(fd_ctx->events & ~event);  // 更新fd的event事件
-  int op = new_events? EPOLL_CTL_MOD: EPOLL_CTL_DEL;
-  epoll_event epevent;
-  epevent.events = new_events | EPOLLET;
-  epevent.data.ptr = fd_ctx;
-  
-  int ret = epoll_ctl(epfd_, op, fd, &epevent);
-  if (!ret) {
-    MOKA_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd_ << ", "
-                             << op << ", " << fd << ", " << epevent.events << "):"
-                             << ret << " (" << errno << ") (" << strerror(errno) << ")";
+  if (owner && fd_ctx->get_context(event).owner != owner) {
+    // 已经触发过，现在是别人注册的事件
     return -1;
   }
+  Event new_events = (Event)(fd_ctx->events & ~event);  // 更新fd的event事件
+  if (ring_) {
+    uringPollRemove(fd_ctx, event);
+  } else {
+    int op = new_events? EPOLL_CTL_MOD: EPOLL_CTL_DEL;
+    epoll_event epevent;
+    epevent.events = new_events | EPOLLET;
+    epevent.data.ptr = fd_ctx;
+
+    int ret = epoll_ctl(epfd_, op, fd, &epevent);
+    if (ret) {
+      MOKA_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd_ << ", "
+                               << op << ", " << fd << ", " << epevent.events << "):"
+                               << ret << " (" << errno << ") (" << strerror(errno) << ")";
+      return -1;
+    }
+  }
   --pending_event_counts_;
 
   fd_ctx->events = new_events;
@@ -167,18 +245,22 @@ int IOManager::cancelEvent(int fd, Event event) {
   }
   // 将该事件从在epoll上注册的事件集合删除
   Event new_events = (Event)(fd_ctx->events & ~event);
-  // 如果当前fd在epoll上还剩有监听的事件则为MOD操作
-  int op = new_events? EPOLL_CTL_MOD: EPOLL_CTL_DEL;
-  epoll_event epevent;
-  epevent.events = new_events | EPOLLET;
-  epevent.data.ptr = fd_ctx;
-  
-  int ret = epoll_ctl(epfd_, op, fd, &epevent);
-  if (ret == -1) {
-    MOKA_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd_ << ", "
-                             << op << ", " << fd << ", " << epevent.events << "):"
-                             << ret << " (" << errno << ") (" << strerror(errno) << ")";
-    return -1;
+  if (ring_) {
+    uringPollRemove(fd_ctx, event);
+  } else {
+    // 如果当前fd在epoll上还剩有监听的事件则为MOD操作
+    int op = new_events? EPOLL_CTL_MOD: EPOLL_CTL_DEL;
+    epoll_event epevent;
+    epevent.events = new_events | EPOLLET;
+    epevent.data.ptr = fd_ctx;
+
+    int ret = epoll_ctl(epfd_, op, fd, &epevent);
+    if (ret == -1) {
+      MOKA_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd_ << ", "
+                               << op << ", " << fd << ", " << epevent.events << "):"
+                               << ret << " (" << errno << ") (" << strerror(errno) << ")";
+      return -1;
+    }
   }
   // 获取当前fd事件的事件上下文
   FdContext::EventContext& event_ctx = fd_ctx->get_context(event);
@@ -198,22 +280,43 @@ int IOManager::cancelAll(int fd) {
   FdContext* fd_ctx = fd_contexts_[fd];
   lock.unlock();
   Mutex::LockGuard lock_guard(fd_ctx->mutex);
+  if (ring_ && fd_ctx->uring_ops > 0) {
+    // 取消fd上所有直接提交给内核的IO操作(等待的协程会以ECANCELED返回)
+    // 需要在fd关闭之前提交，否则内核找不到对应的fd
+    Mutex::LockGuard lock(sq_mutex_);
+    io_uring_sqe* sqe = uringGetSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = s_uring_ignore_data;
+    ring_->flush();
+    ring_->enter(0, 0);
+  }
   if (!(fd_ctx->events)) {
     // 不存在监听的事件
     return -1;
   }
-  int op = EPOLL_CTL_DEL;
-  epoll_event epevent;
-  epevent.events = 0;
-  epevent.data.ptr = fd_ctx;
-  
-  // 从epoll内核事件表中删除fd的所有事件
-  int ret = epoll_ctl(epfd_, op, fd, &epevent);
-  if (ret == -1) {
-    MOKA_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd_ << ", "
-                             << op << ", " << fd << ", " << epevent.events << "):"
-                             << ret << " (" << errno << ") (" << strerror(errno) << ")";
-    return -1;
+  if (ring_) {
+    if (fd_ctx->events & READ) {
+      uringPollRemove(fd_ctx, READ);
+    }
+    if (fd_ctx->events & WRITE) {
+      uringPollRemove(fd_ctx, WRITE);
+    }
+  } else {
+    int op = EPOLL_CTL_DEL;
+    epoll_event epevent;
+    epevent.events = 0;
+    epevent.data.ptr = fd_ctx;
+
+    // 从epoll内核事件表中删除fd的所有事件
+    int ret = epoll_ctl(epfd_, op, fd, &epevent);
+    if (ret == -1) {
+      MOKA_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd_ << ", "
+                               << op << ", " << fd << ", " << epevent.events << "):"
+                               << ret << " (" << errno << ") (" << strerror(errno) << ")";
+      return -1;
+    }
   }
   if (fd_ctx->events & READ) {
     fd_ctx->trigger(READ);     // 强制触发事件的回调函数执行
@@ -261,6 +364,7 @@ IOManager::FdContext::EventContext& IOManager::FdContext::get_context(Event even
 void IOManager::FdContext::resetContext(EventContext& ctx) {
   ctx.cb = nullptr;
   ctx.scheduler = nullptr;
+  ctx.owner = nullptr;
   ctx.fiber.reset();
 }
 
@@ -278,16 +382,43 @@ void IOManager::FdContext::trigger(Event event) {
     event_ctx.scheduler->schedule(&(event_ctx.fiber));  // 传递智能指针的指针，这样原有的智能指针不需要reset了
   }
   event_ctx.scheduler = nullptr;
+  event_ctx.owner = nullptr;
 }
 
-void IOManager::notify() {
+void IOManager::notify(size_t n) {
   MOKA_LOG_INFO(g_logger) << "notify";
-  if (!hasIdleThreads()) {
-    // 如果没有空闲线程则不进行唤醒
+  // 只唤醒还没有被唤醒的空闲线程，已经有足够的唤醒在等待被消费时不再写eventfd
+  size_t idle = idle_thread_nums_;
+  if (t_in_idle == this && idle && n) {
+    // 在idle中添加的任务，当前线程回到调度协程后自己就会执行其中一个
+    --idle;
+    --n;
+  }
+  size_t pending = pending_wakeups_;
+  size_t count = 0;
+  do {
+    if (pending >= idle || !n) {
+      ++wakeups_skipped_;
+      return;
+    }
+    count = std::min(n, idle - pending);
+  } while (!pending_wakeups_.compare_exchange_weak(pending, pending + count));
+  uint64_t value = count;
+  int ret = write(notify_fd_, &value, sizeof(value));
+  MOKA_ASSERT(ret == sizeof(value));
+  wakeups_sent_ += count;
+}
+
+void IOManager::onNotified() {
+  uint64_t value = 0;
+  if (read(notify_fd_, &value, sizeof(value)) != sizeof(value)) {
+    // 唤醒已经被其他线程消费
     return;
   }
-  int ret = write(notify_fds_[1], "T", 1);
-  MOKA_ASSERT(ret == 1);
+  --pending_wakeups_;
+  if (hasPendingTasks() || Scheduler::stopping()) {
+    ++wakeups_needed_;
+  }
 }
 
 bool IOManager::stopping() {
@@ -298,13 +429,109 @@ bool IOManager::stopping() {
   
 bool IOManager::stopping(uint64_t& timeout) {
   timeout = get_expire();
-  return timeout == UINT64_MAX &&
+  bool has_timer = timeout != UINT64_MAX;
+  if (!thread_timers_.empty()) {
+    ThreadTimers* timers = getThreadTimers();
+    if (timers) {
+      timeout = std::min(timeout, timers->get_expire());
+    }
+    // 其他调度线程还有定时器时也不能停止(所属线程处理完之后退出idle时会唤醒其他线程)
+    for (size_t i = 0; i < thread_timers_.size() && !has_timer; ++i) {
+      has_timer = thread_timers_[i]->hasTimer();
+    }
+  }
+  return !has_timer &&
          pending_event_counts_ == 0 &&
          Scheduler::stopping();
 }
 
+Timer::ptr IOManager::addTimer(uint64_t interval, std::function<void()> cb, bool recur) {
+  if (thread_timers_.empty()) {
+    return TimerManager::addTimer(interval, cb, recur);
+  }
+  ThreadTimers* timers = getThreadTimers();
+  if (timers) {
+    // 当前调度线程自己的定时器堆(只有cancel/reset时其他线程才会竞争锁)
+    return timers->addTimer(interval, cb, recur);
+  }
+  size_t index = next_timer_thread_++ % thread_timers_.size();
+  return thread_timers_[index]->postTimer(interval, cb, recur);
+}
+
+Timer::ptr IOManager::addConditionalTimer(uint64_t interval, std::function<void()> cb,
+                                          std::weak_ptr<void> weak_cond, bool recur) {
+  if (thread_timers_.empty()) {
+    return TimerManager::addConditionalTimer(interval, cb, weak_cond, recur);
+  }
+  return addTimer(interval, [weak_cond, cb]() {
+    // 条件存在时才调用回调函数
+    std::shared_ptr<void> tmp = weak_cond.lock();
+    if (tmp) {
+      cb();
+    }
+  }, recur);
+}
+
+IOManager::ThreadTimers* IOManager::getThreadTimers() {
+  if (thread_timers_.empty() || Scheduler::GetThis() != this) {
+    return nullptr;
+  }
+  // 调度线程和IOManager同时销毁，缓存不会失效
+  static thread_local IOManager* s_owner = nullptr;
+  static thread_local ThreadTimers* s_timers = nullptr;
+  if (s_owner == this) {
+    return s_timers;
+  }
+  pid_t tid = moka::GetThreadId();
+  if (tid == thread_id_) {
+    return nullptr;
+  }
+  ThreadTimers* found = nullptr;
+  for (auto timers : thread_timers_) {
+    pid_t expected = -1;
+    if (timers->thread_id == tid || timers->thread_id.compare_exchange_strong(expected, tid)) {
+      found = timers;
+      break;
+    }
+  }
+  MOKA_ASSERT(found);
+  s_owner = this;
+  s_timers = found;
+  return found;
+}
+
+void IOManager::scheduleExpiredTimers(ThreadTimers* timers) {
+  std::vector<std::function<void()>> cbs;
+  // 获取已经超时的回调函数列表，并显式加入到调度器中进行调度
+  listExpiredCb(cbs);
+  if (!cbs.empty()) {
+    schedule(cbs.begin(), cbs.end());
+    cbs.clear();
+  }
+  if (timers) {
+    timers->listExpiredCb(cbs);
+    if (!cbs.empty()) {
+      // 在设置定时器的线程上执行回调函数
+      schedule(cbs.begin(), cbs.end(), moka::GetThreadId());
+    }
+  }
+}
+
+void IOManager::ThreadTimers::onTimerInsertedAtFront() {
+  if (moka::GetThreadId() == thread_id) {
+    // 所属线程正在执行任务，回到idle时会重新计算等待时间
+    return;
+  }
+  // 无法只唤醒所属线程，唤醒所有空闲线程(只在其他线程添加/重置定时器时发生)
+  iom_->notify(iom_->thread_nums_);
+}
+
 void IOManager::idle() {
   MOKA_LOG_INFO(g_logger) << "idle";
+  if (ring_) {
+    idleUring();
+    return;
+  }
   // 作为epoll_wait的传出epoll事件数组
   // TODO:epoll事件数组的大小需要进行调整
   epoll_event* events = new epoll_event[64];
@@ -314,11 +541,20 @@ void IOManager::idle() {
     delete[] ptr;
   });
 
+  ThreadTimers* timers = getThreadTimers();
   // while循环保证idle协程yield之后再sched时能过够继续从循环处开始执行
   while (true) {
+    if (timers) {
+      // 其他线程添加到当前线程的定时器
+      timers->drainPosted();
+    }
     uint64_t next_timeout = 0;
     if (stopping(next_timeout)) {
       MOKA_LOG_INFO(g_logger) << "name=" << Scheduler::get_name() << " idle stopping exit";
+      if (timers) {
+        // 其他线程可能在等待当前线程的定时器处理完，唤醒它们重新检查
+        notify(thread_nums_);
+      }
       break;
     }
 
@@ -334,7 +570,7 @@ void IOManager::idle() {
         next_timeout = MAX_TIMEOUT;
       }
       // epoll_wait超时返回(如果在等待时间内有事件发生，则立即返回处理)
-      ret = epoll_wait(epfd_, events, 64, (int)next_timeout);
+      ret = epoll_wait_f(epfd_, events, 64, (int)next_timeout);
       // MOKA_LOG_DEBUG(g_logger) << "ret=" << ret;
       if (ret < 0 && errno == EINTR) {
       } else {
@@ -342,31 +578,24 @@ void IOManager::idle() {
       }
     } while (true);
 
-    std::vector<std::function<void()>> cbs;    
-    // 获取已经超时的回调函数列表，并显式加入到调度器中进行调度
-    listExpiredCb(cbs);
-    if (!cbs.empty()) {
-      schedule(cbs.begin(), cbs.end());
-      cbs.clear();
-    }
+    t_in_idle = this;
+    scheduleExpiredTimers(timers);
 
     // 对就绪的fd进行处理
     for (int i = 0; i < ret; ++i) {
       // 遍历就绪fd
       epoll_event& event = events[i];
-      if (event.data.fd == notify_fds_[0]) {
-         // 外部有消息notify的
-        uint8_t dummy;
-        // ET(要一直读到没有数据)
-        while (read(notify_fds_[0], &dummy, 1) == 1);
+      if (!event.data.ptr) {
+        // 外部有消息notify的(每个线程只消费一次唤醒)
+        onNotified();
         continue;
       }
       // 取出文件描述符的上下文
       FdContext* fd_ctx = static_cast<FdContext*>(event.data.ptr);
       Mutex::LockGuard lock(fd_ctx->mutex);
       if (event.events & (EPOLLERR | EPOLLHUP)) {
-        // 错误或中断(也要进行读/写事件的触发)
-        event.events |= EPOLLIN | EPOLLOUT;
+        // 错误或中断(也要进行读/写事件的触发，但只触发已经注册的事件)
+        event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
       } 
       int real_events = NONE;
       if (event.events & EPOLLIN) {
@@ -401,6 +630,7 @@ void IOManager::idle() {
         --pending_event_counts_;
       }
     }
+    t_in_idle = nullptr;
     // 让出执行权给scheduler
     // 直接回到run事件循环中，在事件循环中被设置为HOLD状态(进入idle时还会被调度)
     Fiber::ptr cur = Fiber::GetThis();
@@ -410,8 +640,227 @@ void IOManager::idle() {
   }
 }
 
+io_uring_sqe* IOManager::uringGetSqe() {
+  io_uring_sqe* sqe = ring_->getSqe();
+  while (!sqe) {
+    // sq已满，先提交给内核
+    ring_->enter(0, 0);
+    sqe = ring_->getSqe();
+  }
+  return sqe;
+}
+
+void IOManager::uringPollAdd(FdContext* fd_ctx, Event event) {
+  // 调用者持有fd_ctx->mutex
+  FdContext::EventContext& event_ctx = fd_ctx->get_context(event);
+  ++event_ctx.seq;
+  Mutex::LockGuard lock(sq_mutex_);
+  io_uring_sqe* sqe = uringGetSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd_ctx->fd;
+  sqe->poll32_events = event == READ? POLLIN: POLLOUT;
+  sqe->user_data = EncodePollData(fd_ctx->fd, event_ctx.seq, event);
+  uringFlush();
+}
+
+void IOManager::uringPollRemove(FdContext* fd_ctx, Event event) {
+  // 调用者持有fd_ctx->mutex
+  FdContext::EventContext& event_ctx = fd_ctx->get_context(event);
+  uint64_t data = EncodePollData(fd_ctx->fd, event_ctx.seq, event);
+  // 序号改变之后，被删除的poll请求即使已经完成也会被忽略
+  ++event_ctx.seq;
+  Mutex::LockGuard lock(sq_mutex_);
+  io_uring_sqe* sqe = uringGetSqe();
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->addr = data;
+  sqe->user_data = s_uring_ignore_data;
+  uringFlush();
+}
+
+void IOManager::uringFlush() {
+  ring_->flush();
+  if (Scheduler::GetThis() != this || GetThreadId() == thread_id_) {
+    // 不是调度线程(或者是caller线程)时唤醒一个空闲的调度线程提交，否则要等到它从idle超时返回(最多3s)
+    // 不能在当前线程直接提交: poll请求完成时的task_work由提交的线程执行，当前线程阻塞时完成事件会被推迟
+    notify();
+  }
+}
+
+bool IOManager::isUringOpSupported(uint8_t opcode) const {
+  return ring_ && ring_->supportsOp(opcode);
+}
+
+ssize_t IOManager::submitIO(int fd, const UringOp& op, uint64_t timeout_ms) {
+  MOKA_ASSERT(ring_);
+  // 请求保存在当前协程栈上，完成事件处理之前当前协程不会被唤醒
+  IoRequest req;
+  RWmutex::ReadLock lock(mutex_);
+  if ((int)fd_contexts_.size() > fd) {
+    req.fd_ctx = fd_contexts_[fd];
+    lock.unlock();
+  } else {
+    lock.unlock();
+    RWmutex::WriteLock lock2(mutex_);
+    contextResize(fd * 1.5);
+    req.fd_ctx = fd_contexts_[fd];
+  }
+  req.scheduler = Scheduler::GetThis();
+  req.fiber = Fiber::GetThis();
+  MOKA_ASSERT(req.fiber->get_state() == Fiber::state::EXEC);
+  __kernel_timespec ts;
+  if (timeout_ms != (uint64_t)-1) {
+    // 等IO操作和link_timeout的cqe都收到之后再唤醒，之后不会再访问请求
+    req.cqes = 2;
+  }
+  ++pending_event_counts_;
+  ++req.fd_ctx->uring_ops;
+  {
+    Mutex::LockGuard lock2(sq_mutex_);
+    uint32_t need = timeout_ms != (uint64_t)-1? 2: 1;
+    while (ring_->space() < need) {
+      ring_->enter(0, 0);
+    }
+    io_uring_sqe* sqe = ring_->getSqe();
+    sqe->opcode = op.opcode;
+    sqe->fd = fd;
+    sqe->addr = op.addr;
+    sqe->len = op.len;
+    sqe->off = op.off;
+    sqe->rw_flags = op.op_flags;
+    sqe->user_data = (uint64_t)&req;
+    if (need == 2) {
+      // 超时由内核通过链接的timeout请求取消IO操作
+      ts.tv_sec = timeout_ms / 1000;
+      ts.tv_nsec = timeout_ms % 1000 * 1000000;
+      sqe->flags |= IOSQE_IO_LINK;
+      io_uring_sqe* tsqe = ring_->getSqe();
+      tsqe->opcode = IORING_OP_LINK_TIMEOUT;
+      tsqe->addr = (uint64_t)&ts;
+      tsqe->len = 1;
+      tsqe->user_data = (uint64_t)&req | 4;
+    }
+    ring_->flush();
+  }
+  // 让出执行权，请求会在idle中和等待一起提交(同一批次的请求只需要一次系统调用)
+  Fiber::YieldToHoldSched();
+  if (req.res < 0) {
+    // 只有超时取消的才是ETIMEDOUT，close时cancelAll取消的仍然返回ECANCELED
+    errno = (req.res == -ECANCELED && req.timed_out)? ETIMEDOUT: -req.res;
+    return -1;
+  }
+  return req.res;
+}
+
+void IOManager::handleCqe(const io_uring_cqe& cqe) {
+  uint64_t data = cqe.user_data;
+  if ((data & 3) == 0) {
+    // IO操作完成，唤醒发起操作的协程
+    IoRequest* req = (IoRequest*)(data & ~(uint64_t)7);
+    if (data & 4) {
+      // link_timeout到期时结果为-ETIME，IO操作先完成时为-ECANCELED
+      req->timed_out = cqe.res == -ETIME;
+    } else {
+      req->res = cqe.res;
+    }
+    if (--req->cqes > 0) {
+      // 两个cqe可能在不同的线程中处理，最后一个处理的负责唤醒
+      return;
+    }
+    Scheduler* scheduler = req->scheduler;
+    --req->fd_ctx->uring_ops;
+    --pending_event_counts_;
+    // 调度之后请求可能已经被释放，不能再访问req
+    scheduler->schedule(&req->fiber);
+    return;
+  }
+  if (data == s_uring_notify_data) {
+    // 外部有消息notify，消费一次唤醒后重新监听(还有唤醒时会马上再次完成，唤醒其他线程)
+    onNotified();
+    Mutex::LockGuard lock(sq_mutex_);
+    io_uring_sqe* sqe = uringGetSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = notify_fd_;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = s_uring_notify_data;
+    ring_->flush();
+    if (pending_wakeups_ > 0) {
+      // 还有其他线程需要唤醒，马上提交
+      ring_->enter(0, 0);
+    }
+    return;
+  }
+  if ((data & 3) == 3 || cqe.res == -ECANCELED) {
+    return;
+  }
+  // poll请求完成，触发对应的读写事件
+  int fd = data >> 32;
+  uint32_t seq = (data >> 2) & 0x3fffffff;
+  Event event = (data & 3) == 1? READ: WRITE;
+  RWmutex::ReadLock lock(mutex_);
+  if ((int)fd_contexts_.size() <= fd) {
+    return;
+  }
+  FdContext* fd_ctx = fd_contexts_[fd];
+  lock.unlock();
+  Mutex::LockGuard lock2(fd_ctx->mutex);
+  if (!(fd_ctx->events & event) || (fd_ctx->get_context(event).seq & 0x3fffffff) != seq) {
+    // 事件已经被删除/取消
+    return;
+  }
+  fd_ctx->trigger(event);
+  --pending_event_counts_;
+}
+
+void IOManager::idleUring() {
+  static const uint32_t MAX_CQES = 256;
+  std::vector<io_uring_cqe> cqes(MAX_CQES);
+  ThreadTimers* timers = getThreadTimers();
+  while (true) {
+    if (timers) {
+      timers->drainPosted();
+    }
+    uint64_t next_timeout = 0;
+    if (stopping(next_timeout)) {
+      MOKA_LOG_INFO(g_logger) << "name=" << Scheduler::get_name() << " idle stopping exit";
+      if (timers) {
+        // 其他线程可能在等待当前线程的定时器处理完，唤醒它们重新检查
+        notify(thread_nums_);
+      }
+      break;
+    }
+    static const int MAX_TIMEOUT = 3000;
+    if (next_timeout != UINT64_MAX) {
+      next_timeout = (int)next_timeout > MAX_TIMEOUT? MAX_TIMEOUT: next_timeout;
+    } else {
+      next_timeout = MAX_TIMEOUT;
+    }
+    // 一次系统调用提交所有积累的请求并等待完成事件
+    ring_->enter(1, next_timeout);
+
+    t_in_idle = this;
+    scheduleExpiredTimers(timers);
+
+    uint32_t n = 0;
+    do {
+      {
+        Mutex::LockGuard lock(cq_mutex_);
+        n = ring_->peekCqes(&cqes[0], MAX_CQES);
+      }
+      for (uint32_t i = 0; i < n; ++i) {
+        handleCqe(cqes[i]);
+      }
+    } while (n == MAX_CQES);
+    t_in_idle = nullptr;
+
+    Fiber::ptr cur = Fiber::GetThis();
+    Fiber* row = cur.get();
+    cur.reset();
+    row->back();
+  }
+}
+
 void IOManager::onTimerInsertedAtFront() {
-  notify();  // 往管道中写触发管道读事件，epoll_wait立即从阻塞态返回
+  notify();  // 写eventfd触发读事件，epoll_wait立即从阻塞态返回
 }
 
 }
\ No newline at end of file
@@ -4,8 +4,13 @@
 #include "scheduler.h"
 #include "timer.h"
 
+struct io_uring_sqe;
+struct io_uring_cqe;
+
 namespace moka {
 
+class IoUring;
+
 class IOManager: public Scheduler, public TimerManager {
  public:
   using ptr = std::shared_ptr<IOManager>;
@@ -17,6 +22,15 @@ class IOManager: public Scheduler, public TimerManager {
     WRITE = 0x4      // EPOLLOUT
   };
 
+  // io_uring模式下直接提交给内核的IO操作(对应io_uring_sqe中的字段)
+  struct UringOp {
+    uint8_t opcode;         // IORING_OP_XXX
+    uint64_t addr;          // 缓冲区/iovec/msghdr/sockaddr地址
+    uint32_t len;           // 缓冲区长度/iovec数量
+    uint64_t off;           // 偏移量(accept时为addrlen的地址，connect时为addrlen)
+    uint32_t op_flags;      // msg_flags/rw_flags/accept_flags
+  };
+
  private:
   // 文件描述符的上下文
   struct FdContext {
@@ -30,6 +44,8 @@ class IOManager: public Scheduler, public TimerManager {
       Scheduler* scheduler;        // 事件执行的调度器
       Fiber::ptr fiber;            // 事件协程
       std::function<void()> cb;    // 事件回调函数
+      const void* owner = nullptr; // 注册者(tryAddEvent传入)
+      uint32_t seq = 0;            // io_uring模式下poll请求的序号(用于忽略已经删除的poll请求)
     };
     EventContext& get_context(Event event); // 根据宏获取fd上下文对应的事件上下文对象
     void resetContext(EventContext& ctx);   // 重置事件上下文
@@ -39,6 +55,7 @@ class IOManager: public Scheduler, public TimerManager {
     EventContext read;    // 读事件上下文
     EventContext write;   // 写事件上下文
     Event events = NONE;  // 当前文件描述符注册的掩码集合(epoll监听事件的集合)
+    std::atomic<int> uring_ops = {0};  // io_uring模式下正在执行的IO操作数量
     Mutex mutex;          // 互斥锁
   };
 
@@ -47,28 +64,99 @@ class IOManager: public Scheduler, public TimerManager {
   ~IOManager();
   // 0 success, -1 eeror
   int addEvent(int fd, Event event, std::function<void()> cb = nullptr);  // 增加回调事件
-  int delEvent(int fd, Event event);                            // 删除回调事件
+  // 和addEvent相同，但事件已经被注册(其他协程在等待)时不断言，返回-1并设置errno为EEXIST
+  // owner标记注册者，delEvent传入owner时只删除同一个注册者的事件(已经触发后被别人重新注册的不删除)
+  int tryAddEvent(int fd, Event event, std::function<void()> cb, const void* owner);
+  int delEvent(int fd, Event event, const void* owner = nullptr);  // 删除回调事件
   int cancelEvent(int fd, Event event);                         // 找到fd上对应的事件强制触发执行
   int cancelAll(int fd);                                        // 强制触发fd上的所有事件
 
+  // 添加定时器(隐藏TimerManager中的同名函数)
+  // iomanager.thread_timer开启时(默认)调度线程添加的定时器放入该线程自己的定时器堆，回调函数也在该线程上执行
+  // 其他线程添加的定时器通过无锁邮箱轮流交给各个调度线程
+  Timer::ptr addTimer(uint64_t interval, std::function<void()> cb, bool recur = false);
+  Timer::ptr addConditionalTimer(uint64_t interval, std::function<void()> cb,
+          std::weak_ptr<void> weak_cond, bool recur = false);
+  bool isThreadTimer() const { return !thread_timers_.empty(); }  // 是否每个调度线程使用自己的定时器堆
+
+  // io_uring模式下提交IO操作并挂起当前协程，操作完成后返回结果，失败返回-1并设置errno
+  // timeout_ms为-1表示不超时，超时时errno为ETIMEDOUT
+  ssize_t submitIO(int fd, const UringOp& op, uint64_t timeout_ms = -1);
+  bool isUring() const { return ring_ != nullptr; }             // 是否使用io_uring
+  bool isUringOpSupported(uint8_t opcode) const;                // io_uring模式下内核是否支持该操作码
+
+  // 唤醒空闲线程的统计: 实际发送的唤醒次数/被唤醒后确实有任务(或者需要停止)的次数/被合并跳过的notify次数
+  uint64_t get_wakeups_sent() const { return wakeups_sent_; }
+  uint64_t get_wakeups_needed() const { return wakeups_needed_; }
+  uint64_t get_wakeups_skipped() const { return wakeups_skipped_; }
+
   static IOManager* GetThis();                                  // 获取当前IO协程调度器
 
  protected:
-  virtual void notify() override; 
+  virtual void notify(size_t n = 1) override;
   virtual bool stopping() override;
   virtual void idle() override;
   // 用于有更早超时的定期器插入到定时器堆中，这时候需要通知对epoll的超时时间进行调整
   virtual void onTimerInsertedAtFront() override; 
 
   void contextResize(size_t size);                  // 对fd上下文数组扩容
+  // 注册事件，exclusive为true时事件已经存在则断言失败，否则返回-1
+  int doAddEvent(int fd, Event event, std::function<void()> cb, const void* owner, bool exclusive);
   bool stopping(uint64_t& timeout);                 // IO调度器判断停止的条件
+  void onNotified();                                // notify_fd_可读时消费一次唤醒
+
+  // io_uring模式
+  void idleUring();
+  void handleCqe(const io_uring_cqe& cqe);
+  io_uring_sqe* uringGetSqe();                      // 获取空闲的sqe(需要持有sq_mutex_)
+  void uringPollAdd(FdContext* fd_ctx, Event event);
+  void uringPollRemove(FdContext* fd_ctx, Event event);
+  void uringFlush();                                // 让sqe对内核可见(需要持有sq_mutex_)
 
  private:
+  // 调度线程(不包括caller线程)自己的定时器堆，由所属线程在idle中处理
+  class ThreadTimers : public TimerManager {
+   public:
+    ThreadTimers(IOManager* iom) : iom_(iom) {}
+    using TimerManager::hasTimer;
+    using TimerManager::drainPosted;
+
+    std::atomic<pid_t> thread_id = {-1};  // 所属的调度线程(第一次使用时认领)
+   protected:
+    virtual void onTimerInsertedAtFront() override;
+   private:
+    IOManager* iom_;
+  };
+
+  // 获取当前线程的定时器堆，不是调度线程(或者是caller线程)时返回nullptr
+  ThreadTimers* getThreadTimers();
+  // 在idle中调度已经超时的定时器(当前线程自己的定时器固定在当前线程上执行)
+  void scheduleExpiredTimers(ThreadTimers* timers);
+
+  // io_uring模式下正在等待完成的IO操作(保存在发起操作的协程栈上)
+  struct IoRequest {
+    FdContext* fd_ctx = nullptr;
+    Scheduler* scheduler = nullptr;
+    Fiber::ptr fiber;
+    int res = 0;                                    // cqe的结果
+    std::atomic<int> cqes = {1};                    // 还没有收到的cqe数量(带超时时还有link_timeout的cqe)
+    bool timed_out = false;                         // link_timeout是否到期(到期时IO操作被取消)
+  };
+
   int epfd_ = 0;
-  int notify_fds_[2];                               // pipe对应的fd
+  int notify_fd_ = -1;                              // 唤醒空闲线程的eventfd(信号量模式)
+  std::atomic<size_t> pending_wakeups_ = {0};       // 已经发送但还没有被消费的唤醒次数
+  std::atomic<uint64_t> wakeups_sent_ = {0};
+  std::atomic<uint64_t> wakeups_needed_ = {0};
+  std::atomic<uint64_t> wakeups_skipped_ = {0};
   std::atomic<size_t> pending_event_counts_ = {0};  // 记录正在等待执行的事件数量
   RWmutex mutex_;
   std::vector<FdContext*> fd_contexts_;             // socket事件的上下文容器
+  std::unique_ptr<IoUring> ring_;                   // io_uring实例(为空时使用epoll)
+  Mutex sq_mutex_;                                  // 保护io_uring的sq
+  Mutex cq_mutex_;                                  // 保护io_uring的cq
+  std::vector<ThreadTimers*> thread_timers_;        // 每个调度线程的定时器堆(为空时所有定时器都在TimerManager中)
+  std::atomic<size_t> next_timer_thread_ = {0};     // 其他线程添加定时器时轮流选择调度线程
 };
 
 }
@@ -1,5 +1,20 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+
 #include "log.h"
+#include "binlog.h"
 #include "config.h"
+#include "hook.h"
+#include "macro.h"
 
 namespace moka {
 
@@ -82,6 +97,33 @@ std::stringstream &LogEventWrap::get_ss() {
   return event_->get_ss();
 }
 
+LogEventStackWrap::LogEventStackWrap(const std::shared_ptr<Logger>& logger, LogLevel::level level,
+                                     const char* file, uint32_t line)
+    : event_(file, 0, line, GetThreadId(), GetFiberId(), GetThreadName(), time(0), logger, level) {
+}
+
+LogEventStackWrap::~LogEventStackWrap() {
+  // 别名构造的shared_ptr不分配控制块，也不会释放事件
+  LogEvent::ptr event(LogEvent::ptr(), &event_);
+  event_.get_logger()->log(event_.get_level(), event);
+}
+
+void LogAppender::logBinary(const std::shared_ptr<Logger>& logger, const BinLogSite& site,
+                            const char* types, const char* data, size_t len) {
+  if (site.level < level_) {
+    return;
+  }
+  LogEvent event(site.file, 0, site.line, GetThreadId(), GetFiberId(), GetThreadName(),
+                 time(0), logger, site.level);
+  event.get_ss() << BinLogFormat(site.fmt, types, data, len);
+  log(site.level, LogEvent::ptr(LogEvent::ptr(), &event));
+}
+
+void LogAppender::set_level(LogLevel::level level) {
+  level_ = level;
+  Logger::LevelChanged();
+}
+
 void LogAppender::set_formatter(LogFormatter::ptr formatter, bool is_own_fmt) {
   Spinlock::LockGuard lock(mutex_);
   formatter_ = formatter;
@@ -109,9 +151,28 @@ Logger::Logger(const std::string& name)
   formatter_.reset(new LogFormatter("[%d{%Y-%m-%d %H:%M:%S}]%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));  // 初始化日志器的默认格式器
 }
 
+uint64_t Logger::s_level_version = 1;
+
+void Logger::updateEffectiveLevel() {
+  // 先读版本号再计算，计算期间发生的修改会在下一次检查时重新计算
+  uint64_t version = __atomic_load_n(&s_level_version, __ATOMIC_ACQUIRE);
+  int level = 100;  // 没有任何输出地时所有级别都不输出
+  {
+    RWmutex::ReadLock lock(mutex_);
+    for (auto& i : appenders_) {
+      level = std::min(level, (int)i->get_level());
+    }
+    if (appenders_.empty() && root_) {
+      level = root_->get_effective_level();
+    }
+  }
+  __atomic_store_n(&effective_level_, std::max(level, (int)level_), __ATOMIC_RELAXED);
+  __atomic_store_n(&level_version_, version, __ATOMIC_RELEASE);
+}
+
 void Logger::log(LogLevel::level level, LogEvent::ptr event) {
   if (level >= level_) {    // 判断level是否有输出？若输出的日志级别大于当前的日志器级别即可输出
-    Spinlock::LockGuard lock(mutex_);
+    RWmutex::ReadLock lock(mutex_);
     for (auto& i : appenders_) {
       i->log(level, event);  // 调用appender的log输出
     }
@@ -122,6 +183,19 @@ void Logger::log(LogLevel::level level, LogEvent::ptr event) {
   }
 }
 
+void Logger::logBinary(const Logger::ptr& logger, const BinLogSite& site,
+                       const char* types, const char* data, size_t len) {
+  if (site.level >= level_) {
+    RWmutex::ReadLock lock(mutex_);
+    for (auto& i : appenders_) {
+      i->logBinary(logger, site, types, data, len);
+    }
+    if (appenders_.empty() && root_) {
+      root_->logBinary(logger, site, types, data, len);
+    }
+  }
+}
+
 void Logger::debug(LogEvent::ptr event) {
   log(LogLevel::DEBUG, event);
 }
@@ -143,36 +217,39 @@ void Logger::fatal(LogEvent::ptr event) {
 }
 
 void Logger::addAppender(LogAppender::ptr appender) {
-  Spinlock::LockGuard lock(mutex_);
+  RWmutex::WriteLock lock(mutex_);
   if (!(appender->has_fmt())) {
     // 如果没有指定格式串则把当前日志器的格式串给日志输出器
     appender->set_formatter(formatter_, false);  // false表示appender用的是日志器的fmt
   }
   appenders_.push_back(appender);
+  LevelChanged();
 }
 
 void Logger::delAppender(LogAppender::ptr appender) {
-  Spinlock::LockGuard lock(mutex_);
+  RWmutex::WriteLock lock(mutex_);
   for (auto it = appenders_.begin(); it != appenders_.end(); ++it) {
     if (*it == appender) {
       appenders_.erase(it); // 会出现迭代器失效
       break;
     }
   }
+  LevelChanged();
 }
 
 void Logger::clearAppenders() {
-  Spinlock::LockGuard lock(mutex_);
+  RWmutex::WriteLock lock(mutex_);
   appenders_.clear();
+  LevelChanged();
 }
 
 void Logger::set_formatter(LogFormatter::ptr fmt) {
-  Spinlock::LockGuard lock(mutex_);
+  RWmutex::WriteLock lock(mutex_);
   formatter_ = fmt;
   updateAppenderFmt();
 }
 void Logger::set_formatter(const std::string& val) {
-  Spinlock::LockGuard lock(mutex_);
+  RWmutex::WriteLock lock(mutex_);
   moka::LogFormatter::ptr fmt(new moka::LogFormatter(val));
   if (fmt->isError()) {
     std::cout << "log setformatter name" << name_ << "value=" << val << " invalid formatter" << std::endl;
@@ -183,12 +260,12 @@ void Logger::set_formatter(const std::string& val) {
 }
 
 LogFormatter::ptr Logger::get_formatter() {
-  Spinlock::LockGuard lock(mutex_);
+  RWmutex::ReadLock lock(mutex_);
   return formatter_;
 }
 
 std::string Logger::toYamlString() {
-  Spinlock::LockGuard lock(mutex_);
+  RWmutex::ReadLock lock(mutex_);
   YAML::Node node;
   node["name"] = name_;
   node["level"] = LogLevel::ToString(level_);
@@ -234,23 +311,158 @@ std::string StdoutLogAppender::toYamlString() {
   return ss.str();
 }
 
-FileLogAppender::FileLogAppender(const std::string filename)
-    : filename_(filename) {  // 冒号前空4行(style)
+// 每次收到重新打开的请求加1，各个文件输出器在写日志时与自己记录的值比较
+static std::atomic<uint32_t> s_reopen_generation = {0};
+
+// 计算now之后下一个轮转时间点(本地时间的整点/零点)
+static time_t next_rotate_time(time_t now, FileLogAppender::Rotate rotate) {
+  struct tm tm;
+  localtime_r(&now, &tm);
+  tm.tm_min = 0;
+  tm.tm_sec = 0;
+  if (rotate == FileLogAppender::HOURLY) {
+    tm.tm_hour += 1;
+  } else {
+    tm.tm_hour = 0;
+    tm.tm_mday += 1;
+  }
+  tm.tm_isdst = -1;
+  return mktime(&tm);
+}
+
+const char* FileLogAppender::RotateToString(Rotate rotate) {
+  switch (rotate) {
+    case HOURLY:
+      return "hourly";
+    case DAILY:
+      return "daily";
+    default:
+      return "none";
+  }
+}
+
+FileLogAppender::Rotate FileLogAppender::RotateFromString(const std::string& str) {
+  if (str == "hourly") {
+    return HOURLY;
+  }
+  if (str == "daily") {
+    return DAILY;
+  }
+  return NONE;
+}
+
+void FileLogAppender::ReopenAll() {
+  ++s_reopen_generation;
+}
+
+FileLogAppender::FileLogAppender(const std::string filename, uint64_t max_size, Rotate rotate,
+                                 size_t buffer_size)
+    : filename_(filename), max_size_(max_size), rotate_(rotate), buffer_size_(buffer_size) {  // 冒号前空4行(style)
+  buffer_.reserve(buffer_size_);
+  reopen_generation_ = s_reopen_generation;
+  if (rotate_ != NONE) {
+    next_rotate_ = next_rotate_time(time(0), rotate_);
+  }
+  Spinlock::LockGuard lock(mutex_);
   reopen();
 }
 
+FileLogAppender::~FileLogAppender() {
+  flushBuffer();
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
 void FileLogAppender::log(LogLevel::level level, LogEvent::ptr event) {
   if (level >= level_) {
-    uint64_t now = time(0);
-    if (now != last_time_) {  // 每秒钟reopen一次
+    Spinlock::LockGuard lock(mutex_);
+    std::string msg = formatter_->format(event);  // 根据不同的item输出不同的内容
+    time_t now = event->get_timestamp();
+    if (MOKA_UNLIKELY(s_reopen_generation != reopen_generation_)) {
+      reopen_generation_ = s_reopen_generation;
+      flushBuffer();
       reopen();
+    }
+    if (MOKA_UNLIKELY((rotate_ != NONE && now >= next_rotate_) ||
+                      (max_size_ && file_size_ && file_size_ + msg.size() > max_size_))) {
+      rotate(now);
+    }
+    file_size_ += msg.size();
+    if (buffer_size_ == 0) {
+      writeFile(msg.c_str(), msg.size());
+      return;
+    }
+    if (buffer_.size() + msg.size() > buffer_size_ || now != last_time_) {
+      // 跨秒时写出缓冲区，最多延迟到下一秒的第一条日志
+      flushBuffer();
       last_time_ = now;
     }
-    Spinlock::LockGuard lock(mutex_);
-    filestream_ << formatter_->format(event);  // 输出到文件流中(根据不同的item输出不同的内容)
+    if (msg.size() >= buffer_size_) {
+      writeFile(msg.c_str(), msg.size());
+    } else {
+      buffer_.append(msg);
+    }
+    if (level >= LogLevel::FATAL) {
+      flushBuffer();
+    }
+  }
+}
+
+void FileLogAppender::flush() {
+  Spinlock::LockGuard lock(mutex_);
+  flushBuffer();
+}
+
+void FileLogAppender::flushBuffer() {
+  if (!buffer_.empty()) {
+    writeFile(buffer_.c_str(), buffer_.size());
+    buffer_.clear();
   }
 }
 
+void FileLogAppender::writeFile(const char* data, size_t len) {
+  if (fd_ < 0) {
+    return;
+  }
+  // 持有mutex_时不能走hook(卸载到线程池会切走协程，同一线程的其他协程写日志时会自旋死锁)
+  while (len > 0) {
+    ssize_t n = write_f(fd_, data, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      // 磁盘满等错误时丢弃，不能阻塞写日志的线程
+      return;
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+void FileLogAppender::rotate(time_t now) {
+  flushBuffer();
+  if (file_size_ > 0) {
+    // 旧文件重命名为 文件名.年月日-时分秒，同一秒内多次轮转时再加序号
+    char buf[32];
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(buf, sizeof(buf), ".%Y%m%d-%H%M%S", &tm);
+    std::string name = filename_ + buf;
+    for (int i = 1; access(name.c_str(), F_OK) == 0; ++i) {
+      name = filename_ + buf + "." + std::to_string(i);
+    }
+    if (rename(filename_.c_str(), name.c_str())) {
+      std::cout << "log file rotate " << filename_ << " to " << name << " errno=" << errno
+                << " errstr=" << strerror(errno) << std::endl;
+    }
+  }
+  if (rotate_ != NONE) {
+    next_rotate_ = next_rotate_time(now, rotate_);
+  }
+  reopen();
+}
+
 std::string FileLogAppender::toYamlString() {
   Spinlock::LockGuard lock(mutex_);
   YAML::Node node;
@@ -263,25 +475,533 @@ std::string FileLogAppender::toYamlString() {
     // 如果是继承的日志器的fmt则不输出(即appender没有自己的fmt)
     node["formatter"] = formatter_->get_pattern();
   }
+  if (max_size_) {
+    node["max_size"] = max_size_;
+  }
+  if (rotate_ != NONE) {
+    node["rotate"] = RotateToString(rotate_);
+  }
+  node["buffer_size"] = buffer_size_;
   std::stringstream ss;
   ss << node;
   return ss.str();
 }
 
 bool FileLogAppender::reopen() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  // 如果没有文件生成文件；如果有文件追加写入
+  fd_ = open_f(filename_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    std::cout << "log file open " << filename_ << " errno=" << errno
+              << " errstr=" << strerror(errno) << std::endl;
+    file_size_ = 0;
+    return false;
+  }
+  struct stat st;
+  file_size_ = fstat(fd_, &st) == 0? st.st_size: 0;
+  return true;
+}
+
+// 线程私有的单生产者单消费者环形缓冲区
+// 每条记录为8字节对齐的[头部|格式化后的日志]，fd为-1的记录用于填充缓冲区尾部
+struct LogRecordHeader {
+  uint32_t size;   // 日志长度(不含头部)
+  int32_t fd;      // 输出的文件描述符
+};
+
+struct LogRing {
+  LogRing(size_t size)
+      : capacity(size), buffer(new char[size]) {
+  }
+  ~LogRing() {
+    delete[] buffer;
+  }
+
+  const size_t capacity;               // 2的幂
+  char* buffer;
+  std::atomic<uint64_t> head = {0};    // 后台线程写出到的位置
+  std::atomic<uint64_t> tail = {0};    // 生产线程写入到的位置
+  std::atomic<bool> closed = {false};  // 所属线程已退出，写完后由后台线程释放
+};
+
+static moka::ConfigVar<uint32_t>::ptr g_log_async_buffer_size =
+  moka::Config::Lookup<uint32_t>("log.async.buffer_size", 1024 * 1024, "per-thread async log ring buffer size");
+
+static moka::ConfigVar<uint32_t>::ptr g_log_async_interval =
+  moka::Config::Lookup<uint32_t>("log.async.interval", 1, "async log batch interval ms");
+
+static size_t align_record(size_t size) {
+  return (sizeof(LogRecordHeader) + size + 7) & ~(size_t)7;
+}
+
+// 线程退出时标记缓冲区，缓冲区本身由后台线程在写完后释放
+// 析构之后其他thread_local对象的析构函数仍可能写日志，此时不能再使用(或重新创建)缓冲区
+struct LogRingHolder {
+  ~LogRingHolder() {
+    if (ring) {
+      ring->closed.store(true, std::memory_order_release);
+      ring = nullptr;
+    }
+    destroyed = true;
+  }
+  LogRing* ring = nullptr;
+  bool destroyed = false;
+};
+
+static thread_local LogRingHolder t_log_ring;
+
+// 异步日志后台，所有AsyncLogAppender共用一个写线程
+// 不随进程退出析构(其他线程可能仍在写日志)，退出时由atexit把缓冲区中的日志写完
+class AsyncLogWriter {
+ public:
+  static AsyncLogWriter* GetInstance() {
+    static AsyncLogWriter* s_writer = new AsyncLogWriter;
+    return s_writer;
+  }
+  // 是否有过异步输出器(没有时不需要启动后台线程)
+  static bool IsStarted() { return s_started; }
+
+  // 写入当前线程的缓冲区，空间不足且wait为false时返回false
+  // 当前线程的缓冲区已经析构时直接写出
+  bool push(int fd, const char* data, size_t len, bool wait);
+  // 等待调用前写入的日志全部写出
+  void flush();
+
+ private:
+  AsyncLogWriter();
+  LogRing* getRing();             // 线程退出阶段缓冲区已析构时返回nullptr
+  bool writeDirect(int fd, const char* data, size_t len);  // 不经过缓冲区直接写出
+  void wakeup();
+  void run();
+  bool drain();                   // 写出所有缓冲区的日志，没有日志时返回false
+  bool hasPending();
+  void flushIov(int fd);          // writev写出iovs_中的日志
+  static void OnExit();
+
+ private:
+  static std::atomic<bool> s_started;
+  Mutex rings_mutex_;
+  std::vector<LogRing*> rings_;             // 所有线程的缓冲区
+  std::mutex mutex_;
+  std::condition_variable cond_;            // 后台线程休眠/flush等待
+  std::atomic<bool> sleeping_ = {false};    // 后台线程是否在空闲休眠(生产者据此决定是否唤醒)
+  std::atomic<bool> urgent_ = {false};      // 有缓冲区超过一半，需要提前写出
+  std::atomic<uint64_t> flush_requests_ = {0};
+  uint64_t flushed_ = 0;                    // 已完成的flush请求(mutex_保护)
+  std::vector<struct iovec> iovs_;          // 以下只由后台线程访问
+  std::vector<std::pair<LogRing*, uint64_t>> heads_;
+  Thread::ptr thread_;
+};
+
+std::atomic<bool> AsyncLogWriter::s_started = {false};
+
+AsyncLogWriter::AsyncLogWriter() {
+  s_started = true;
+  iovs_.reserve(IOV_MAX);
+  thread_.reset(new Thread(std::bind(&AsyncLogWriter::run, this), "async_log"));
+  atexit(&AsyncLogWriter::OnExit);
+}
+
+void AsyncLogWriter::OnExit() {
+  GetInstance()->flush();
+}
+
+LogRing* AsyncLogWriter::getRing() {
+  if (MOKA_UNLIKELY(!t_log_ring.ring && !t_log_ring.destroyed)) {
+    size_t size = 4096;
+    while (size < g_log_async_buffer_size->get_value()) {
+      size <<= 1;
+    }
+    LogRing* ring = new LogRing(size);
+    Mutex::LockGuard lock(rings_mutex_);
+    rings_.push_back(ring);
+    t_log_ring.ring = ring;
+  }
+  return t_log_ring.ring;
+}
+
+bool AsyncLogWriter::writeDirect(int fd, const char* data, size_t len) {
+  // 先等之前的日志写出保证顺序
+  flush();
+  while (len > 0) {
+    ssize_t n = write_f(fd, data, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool AsyncLogWriter::push(int fd, const char* data, size_t len, bool wait) {
+  LogRing* ring = getRing();
+  if (MOKA_UNLIKELY(!ring)) {
+    return writeDirect(fd, data, len);
+  }
+  size_t need = align_record(len);
+  if (MOKA_UNLIKELY(need > ring->capacity / 2)) {
+    // 超长的日志不经过缓冲区
+    return writeDirect(fd, data, len);
+  }
+  uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+  size_t offset = tail & (ring->capacity - 1);
+  // 尾部剩余空间放不下时，用一条填充记录跳到缓冲区开头
+  size_t pad = ring->capacity - offset < need? ring->capacity - offset: 0;
+  while (tail + pad + need - ring->head.load(std::memory_order_acquire) > ring->capacity) {
+    if (!wait) {
+      return false;
+    }
+    // 不能用hook后的usleep，协程被切走后可能在别的线程恢复
+    wakeup();
+    sched_yield();
+  }
+  if (pad) {
+    LogRecordHeader* header = (LogRecordHeader*)(ring->buffer + offset);
+    header->size = pad - sizeof(LogRecordHeader);
+    header->fd = -1;
+    tail += pad;
+    offset = 0;
+  }
+  LogRecordHeader* header = (LogRecordHeader*)(ring->buffer + offset);
+  header->size = len;
+  header->fd = fd;
+  memcpy(header + 1, data, len);
+  ring->tail.store(tail + need, std::memory_order_release);
+
+  // 与后台线程的sleeping_/tail检查配对，保证不会漏掉唤醒
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping_.load(std::memory_order_relaxed)) {
+    wakeup();
+  } else if (tail + need - ring->head.load(std::memory_order_relaxed) > ring->capacity / 2
+             && !urgent_.exchange(true)) {
+    // 后台线程在攒批的间隔中，缓冲区过半时不再等待
+    wakeup();
+  }
+  return true;
+}
+
+void AsyncLogWriter::wakeup() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  sleeping_.store(false, std::memory_order_relaxed);
+  cond_.notify_all();
+}
+
+void AsyncLogWriter::flush() {
+  uint64_t request = ++flush_requests_;
+  std::unique_lock<std::mutex> lock(mutex_);
+  sleeping_.store(false, std::memory_order_relaxed);
+  cond_.notify_all();
+  while (flushed_ < request) {
+    cond_.wait(lock);
+  }
+}
+
+bool AsyncLogWriter::hasPending() {
+  Mutex::LockGuard lock(rings_mutex_);
+  for (auto ring : rings_) {
+    if (ring->head.load(std::memory_order_relaxed) != ring->tail.load(std::memory_order_acquire)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void AsyncLogWriter::run() {
+  while (true) {
+    // 先读取flush请求再写出日志，请求之前写入的日志一定会在本轮写出
+    uint64_t request = flush_requests_.load();
+    bool busy = drain();
+    if (request != flushed_) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      flushed_ = request;
+      cond_.notify_all();
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (busy) {
+      // 仍在持续写日志时等待一个间隔再写出，攒成更大的批次，期间生产者不需要唤醒后台线程
+      if (flush_requests_.load() == flushed_ && !urgent_.load()) {
+        cond_.wait_for(lock, std::chrono::milliseconds(g_log_async_interval->get_value()));
+      }
+      urgent_.store(false);
+      continue;
+    }
+    sleeping_.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (hasPending() || flush_requests_.load() != flushed_) {
+      sleeping_.store(false, std::memory_order_relaxed);
+      continue;
+    }
+    // 超时只是兜底，同时回收已退出线程的缓冲区
+    cond_.wait_for(lock, std::chrono::seconds(1));
+    sleeping_.store(false, std::memory_order_relaxed);
+  }
+}
+
+bool AsyncLogWriter::drain() {
+  std::vector<LogRing*> rings;
+  {
+    Mutex::LockGuard lock(rings_mutex_);
+    rings = rings_;
+  }
+  bool busy = false;
+  int fd = -1;
+  for (auto ring : rings) {
+    bool closed = ring->closed.load(std::memory_order_acquire);
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t tail = ring->tail.load(std::memory_order_acquire);
+    if (head == tail) {
+      if (closed) {
+        Mutex::LockGuard lock(rings_mutex_);
+        rings_.erase(std::find(rings_.begin(), rings_.end(), ring));
+        delete ring;
+      }
+      continue;
+    }
+    busy = true;
+    while (head != tail) {
+      LogRecordHeader* header = (LogRecordHeader*)(ring->buffer + (head & (ring->capacity - 1)));
+      if (header->fd >= 0) {
+        // 相邻的同一fd的日志合并为一次writev
+        if (header->fd != fd || iovs_.size() == IOV_MAX) {
+          flushIov(fd);
+          fd = header->fd;
+        }
+        struct iovec iov;
+        iov.iov_base = header + 1;
+        iov.iov_len = header->size;
+        iovs_.push_back(iov);
+      }
+      head += align_record(header->size);
+    }
+    heads_.push_back(std::make_pair(ring, head));
+  }
+  flushIov(fd);
+  // 写出之后才能归还缓冲区空间
+  for (auto& i : heads_) {
+    i.first->head.store(i.second, std::memory_order_release);
+  }
+  heads_.clear();
+  return busy;
+}
+
+void AsyncLogWriter::flushIov(int fd) {
+  struct iovec* iov = &iovs_[0];
+  int cnt = iovs_.size();
+  while (cnt > 0) {
+    ssize_t n = ::writev(fd, iov, cnt);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // 不能写日志(可能写回自己的缓冲区)
+      std::cout << "async log writev fd=" << fd << " errno=" << errno
+                << " errstr=" << strerror(errno) << std::endl;
+      break;
+    }
+    while (cnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+      --cnt;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (char*)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  iovs_.clear();
+}
+
+const char* AsyncLogAppender::OverflowToString(Overflow overflow) {
+  switch (overflow) {
+    case DROP:
+      return "drop";
+    case DROP_BELOW:
+      return "drop_below";
+    default:
+      return "block";
+  }
+}
+
+AsyncLogAppender::Overflow AsyncLogAppender::OverflowFromString(const std::string& str) {
+  if (str == "drop") {
+    return DROP;
+  }
+  if (str == "drop_below") {
+    return DROP_BELOW;
+  }
+  return BLOCK;
+}
+
+AsyncLogAppender::AsyncLogAppender(const std::string& filename, Overflow overflow,
+                                   LogLevel::level overflow_level)
+    : filename_(filename), overflow_(overflow), overflow_level_(overflow_level) {
+  if (filename_.empty()) {
+    fd_ = STDOUT_FILENO;
+  } else {
+    fd_ = open(filename_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+      std::cout << "async log appender open " << filename_ << " errno=" << errno
+                << " errstr=" << strerror(errno) << std::endl;
+    }
+  }
+  AsyncLogWriter::GetInstance();  // 提前启动后台线程
+}
+
+AsyncLogAppender::~AsyncLogAppender() {
+  if (fd_ >= 0) {
+    // 关闭fd之前必须写完缓冲区中属于它的日志
+    AsyncLogWriter::GetInstance()->flush();
+    if (fd_ != STDOUT_FILENO) {
+      close(fd_);
+    }
+  }
+}
+
+void AsyncLogAppender::log(LogLevel::level level, LogEvent::ptr event) {
+  if (level < level_ || fd_ < 0) {
+    return;
+  }
+  LogFormatter::ptr formatter;
+  {
+    Spinlock::LockGuard lock(mutex_);
+    formatter = formatter_;
+  }
+  // 在调用线程中格式化，后台线程只负责写出
+  std::string msg = formatter->format(event);
+  bool wait = overflow_ == BLOCK || (overflow_ == DROP_BELOW && level >= overflow_level_);
+  AsyncLogWriter* writer = AsyncLogWriter::GetInstance();
+  if (!writer->push(fd_, msg.c_str(), msg.size(), wait)) {
+    ++dropped_;
+  }
+  if (level >= LogLevel::FATAL) {
+    writer->flush();
+  }
+}
+
+void AsyncLogAppender::Flush() {
+  if (AsyncLogWriter::IsStarted()) {
+    AsyncLogWriter::GetInstance()->flush();
+  }
+}
+
+std::string AsyncLogAppender::toYamlString() {
   Spinlock::LockGuard lock(mutex_);
-  if (filestream_) {
-    filestream_.close();
+  YAML::Node node;
+  node["type"] = filename_.empty()? "StdoutLogAppender": "FileLogAppender";
+  if (!filename_.empty()) {
+    node["file"] = filename_;
+  }
+  node["async"] = true;
+  node["overflow"] = OverflowToString(overflow_);
+  if (overflow_ == DROP_BELOW) {
+    node["overflow_level"] = LogLevel::ToString(overflow_level_);
+  }
+  if (level_ != LogLevel::UNKNOW) {
+    node["level"] = LogLevel::ToString(level_);
+  }
+  if (is_own_fmt_) {
+    node["formatter"] = formatter_->get_pattern();
   }
-  filestream_.open(filename_, std::ios::app);   // 如果没有文件生成文件；如果有文件追加写入
-  return !!filestream_;
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
 }
 
-LogFormatter::LogFormatter(const std::string &pattern) : pattern_(pattern) {
+static std::atomic<uint64_t> s_formatter_id = {0};
+
+LogFormatter::LogFormatter(const std::string &pattern)
+    : pattern_(pattern), id_(++s_formatter_id) {
   init();  // 初始化items
 }
 
 std::string LogFormatter::format(LogEvent::ptr event) {
+  std::string out;
+  out.reserve(256);
+  format(out, event);
+  return out;
+}
+
+// 无符号整数转十进制追加到out中
+static void append_uint(std::string& out, uint64_t v) {
+  char buf[24];
+  char* p = buf + sizeof(buf);
+  do {
+    *--p = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  out.append(p, buf + sizeof(buf) - p);
+}
+
+// 每个线程缓存最近格式化过的日期，同一秒内的日志直接复制
+struct DateTimeCache {
+  uint64_t key = 0;     // 格式器编号和日期格式下标
+  time_t time = -1;
+  size_t len = 0;
+  char buf[64];
+};
+
+static thread_local DateTimeCache t_datetime_cache[4];
+
+void LogFormatter::appendDateTime(std::string& out, uint32_t idx, time_t t) {
+  uint64_t key = (id_ << 8) | idx;
+  DateTimeCache& cache = t_datetime_cache[key % 4];
+  if (cache.key != key || cache.time != t) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    cache.len = strftime(cache.buf, sizeof(cache.buf), date_formats_[idx].c_str(), &tm);
+    cache.key = key;
+    cache.time = t;
+  }
+  out.append(cache.buf, cache.len);
+}
+
+void LogFormatter::format(std::string& out, LogEvent::ptr event) {
+  for (auto& op : ops_) {
+    switch (op.type) {
+      case Op::LITERAL:
+        out.append(literals_, op.arg, op.len);
+        break;
+      case Op::MESSAGE:
+        out.append(event->get_content());
+        break;
+      case Op::LEVEL:
+        out.append(LogLevel::ToString(event->get_level()));
+        break;
+      case Op::ELAPSE:
+        append_uint(out, event->get_elapse());
+        break;
+      case Op::NAME:
+        out.append(event->get_logger()->get_name());
+        break;
+      case Op::THREAD_ID:
+        append_uint(out, event->get_thread_id());
+        break;
+      case Op::THREAD_NAME:
+        out.append(event->get_thread_name());
+        break;
+      case Op::FIBER_ID:
+        append_uint(out, event->get_fiber_id());
+        break;
+      case Op::DATETIME:
+        appendDateTime(out, op.arg, event->get_timestamp());
+        break;
+      case Op::FILENAME:
+        out.append(event->get_filename());
+        break;
+      case Op::LINE:
+        append_uint(out, event->get_line_num());
+        break;
+    }
+  }
+}
+
+std::string LogFormatter::formatItems(LogEvent::ptr event) {
   std::stringstream ss;     // 用于存储string流缓冲
   for (auto& i : items_) {  // 遍历日志格式items
     i->format(ss, event);   // 多态，调用子类重写了的具体的虚函数format，并信息将放入string流中
@@ -289,6 +1009,17 @@ std::string LogFormatter::format(LogEvent::ptr event) {
   return ss.str();          // 返回字符流中的内容
 }
 
+void LogFormatter::addLiteral(const std::string& str) {
+  if (!ops_.empty() && ops_.back().type == Op::LITERAL) {
+    // 与前一条普通字符指令合并(literals_是顺序追加的，两段一定相邻)
+    ops_.back().len += str.size();
+  } else {
+    Op op = {Op::LITERAL, (uint32_t)literals_.size(), (uint32_t)str.size()};
+    ops_.push_back(op);
+  }
+  literals_.append(str);
+}
+
 // 仿造log4jcpp的日志格式解析
 // %(xxx) %xxx{xxx} %%
 void LogFormatter::init() {
@@ -398,19 +1129,47 @@ void LogFormatter::init() {
         XX(F, FiberIdFormatItem),
 #undef XX
   };//   };
+  // 格式符对应的编译指令(%n和%T作为普通字符处理)
+  static std::unordered_map<std::string, Op::Type> s_format_ops = {
+        {"m", Op::MESSAGE},
+        {"p", Op::LEVEL},
+        {"r", Op::ELAPSE},
+        {"c", Op::NAME},
+        {"t", Op::THREAD_ID},
+        {"N", Op::THREAD_NAME},
+        {"d", Op::DATETIME},
+        {"f", Op::FILENAME},
+        {"l", Op::LINE},
+        {"F", Op::FIBER_ID},
+  };
   for(auto& i : vec) {  // 遍历tuple数组
     if(std::get<2>(i) == 0) {
       // 若不是格式符，则调用Stingformat使用输出流打印出来
       items_.push_back(FormatterItem::ptr(new StringFormatItem(std::get<0>(i))));
+      addLiteral(std::get<0>(i));
     } else {
       // 查找格式符对应的格式符对象
       auto it = s_format_items.find(std::get<0>(i));
       if(it == s_format_items.end()) {
         // 若不存在该格式符类型，则输出error
         items_.push_back(FormatterItem::ptr(new StringFormatItem("<<error_format %" + std::get<0>(i) + ">>")));
+        addLiteral("<<error_format %" + std::get<0>(i) + ">>");
         error_ = true;
       } else {
         items_.push_back(it->second(std::get<1>(i)));  // 将对应格式符类型的对象放入items数组中
+        if (std::get<0>(i) == "n") {
+          addLiteral("\n");
+        } else if (std::get<0>(i) == "T") {
+          addLiteral("\t");
+        } else {
+          Op op = {s_format_ops[std::get<0>(i)], 0, 0};
+          if (op.type == Op::DATETIME) {
+            // 与DateTimeFormatItem相同的默认日期格式
+            op.arg = date_formats_.size();
+            date_formats_.push_back(std::get<1>(i).empty()? "%Y-%m-%d %H:%M:%S": std::get<1>(i));
+          }
+          ops_.push_back(op);
+        }
       }
     }
     // DEBUG
@@ -452,16 +1211,30 @@ std::string LoggerManager::toYamlString() {
 
 // 日志输出器结构
 struct LogAppenderDefine {
-  int type = 0;  // 1 File 2 Stdout，根据该标识来决定输出到文件/终端
+  int type = 0;  // 1 File 2 Stdout 3 Binary，根据该标识来决定输出到文件/终端/二进制文件
   LogLevel::level level = LogLevel::UNKNOW;
   std::string formatter;   // 输出器的格式器
   std::string file;        // 文件名称
+  bool async = false;      // 是否异步输出
+  AsyncLogAppender::Overflow overflow = AsyncLogAppender::BLOCK;  // 异步缓冲区满时的处理策略
+  LogLevel::level overflow_level = LogLevel::WARN;                // drop_below策略下不丢弃的最低级别
+  uint64_t max_size = 0;   // 文件轮转大小
+  FileLogAppender::Rotate rotate = FileLogAppender::NONE;         // 文件按时间轮转的周期
+  uint32_t buffer_size = 64 * 1024;                               // 文件输出的用户态缓冲区大小
+  uint64_t map_size = 16 * 1024 * 1024;                           // 二进制文件每次映射的大小
 
   bool operator==(const LogAppenderDefine& oth) const {
     return type == oth.type &&
            level == oth.level &&
            formatter == oth.formatter &&
-           file == oth.file;
+           file == oth.file &&
+           async == oth.async &&
+           overflow == oth.overflow &&
+           overflow_level == oth.overflow_level &&
+           max_size == oth.max_size &&
+           rotate == oth.rotate &&
+           buffer_size == oth.buffer_size &&
+           map_size == oth.map_size;
   }
 };
 
@@ -531,6 +1304,30 @@ public:
                   if(n_a["formatter"].IsDefined()) {
                       lad.formatter = n_a["formatter"].as<std::string>();
                   }
+                  if(n_a["max_size"].IsDefined()) {
+                      lad.max_size = n_a["max_size"].as<uint64_t>();
+                  }
+                  if(n_a["rotate"].IsDefined()) {
+                      lad.rotate = FileLogAppender::RotateFromString(n_a["rotate"].as<std::string>());
+                  }
+                  if(n_a["buffer_size"].IsDefined()) {
+                      lad.buffer_size = n_a["buffer_size"].as<uint32_t>();
+                  }
+                } else if(type == "BinaryLogAppender") {
+                  // 以二进制文件为输出地，由moka_logdump还原为文本
+                  lad.type = 3;
+                  if(!n_a["file"].IsDefined()) {
+                      std::cout << "log config error: binaryappender file is null, " << n_a
+                            << std::endl;
+                      continue;
+                  }
+                  lad.file = n_a["file"].as<std::string>();
+                  if(n_a["formatter"].IsDefined()) {
+                      lad.formatter = n_a["formatter"].as<std::string>();
+                  }
+                  if(n_a["map_size"].IsDefined()) {
+                      lad.map_size = n_a["map_size"].as<uint64_t>();
+                  }
                 } else if(type == "StdoutLogAppender") {
                   // 以终端为输出地
                   lad.type = 2;
@@ -542,6 +1339,15 @@ public:
                               << std::endl;
                     continue;
                 }
+                if(n_a["async"].IsDefined()) {
+                    lad.async = n_a["async"].as<bool>();
+                }
+                if(n_a["overflow"].IsDefined()) {
+                    lad.overflow = AsyncLogAppender::OverflowFromString(n_a["overflow"].as<std::string>());
+                }
+                if(n_a["overflow_level"].IsDefined()) {
+                    lad.overflow_level = LogLevel::FromString(n_a["overflow_level"].as<std::string>());
+                }
                 ld.appenders.push_back(lad);
             }
         }
@@ -568,8 +1374,19 @@ public:
               n_a["type"] = "FileLogAppender";
               // 如果是文件则初始化文件名
               n_a["file"] = a.file;
+              if(a.max_size) {
+                  n_a["max_size"] = a.max_size;
+              }
+              if(a.rotate != FileLogAppender::NONE) {
+                  n_a["rotate"] = FileLogAppender::RotateToString(a.rotate);
+              }
+              n_a["buffer_size"] = a.buffer_size;
           } else if(a.type == 2) {
               n_a["type"] = "StdoutLogAppender";
+          } else if(a.type == 3) {
+              n_a["type"] = "BinaryLogAppender";
+              n_a["file"] = a.file;
+              n_a["map_size"] = a.map_size;
           }
           if(a.level != LogLevel::UNKNOW) {
               n_a["level"] = LogLevel::ToString(a.level);
@@ -578,6 +1395,13 @@ public:
           if(!a.formatter.empty()) {
               n_a["formatter"] = a.formatter;
           }
+          if(a.async) {
+              n_a["async"] = true;
+              n_a["overflow"] = AsyncLogAppender::OverflowToString(a.overflow);
+              if(a.overflow == AsyncLogAppender::DROP_BELOW) {
+                  n_a["overflow_level"] = LogLevel::ToString(a.overflow_level);
+              }
+          }
 
           n["appenders"].push_back(n_a);
       }
@@ -593,6 +1417,25 @@ public:
 moka::ConfigVar<std::set<LogDefine>>::ptr g_log_defines =
   moka::Config::Lookup("logs", std::set<LogDefine>(), "logs config");
 
+// 收到该信号时所有文件输出器重新打开文件(SIGHUP/SIGUSR1/SIGUSR2，为空表示不处理)
+static moka::ConfigVar<std::string>::ptr g_log_reopen_signal =
+  moka::Config::Lookup<std::string>("log.reopen_signal", "", "signal to reopen log files");
+
+static void on_reopen_signal(int sig) {
+  FileLogAppender::ReopenAll();
+}
+
+static int signal_from_string(const std::string& str) {
+  if (str == "SIGHUP") {
+    return SIGHUP;
+  } else if (str == "SIGUSR1") {
+    return SIGUSR1;
+  } else if (str == "SIGUSR2") {
+    return SIGUSR2;
+  }
+  return 0;
+}
+
 struct LogIniter {
   LogIniter() {
     // 在main函数初始化前注册log配置更改的事件
@@ -623,9 +1466,15 @@ struct LogIniter {
         // 初始化logger的appenders集合
         for (auto a : log_def.appenders) {
           moka::LogAppender::ptr ap;
-          if (a.type == 1) {
+          if (a.type == 3) {
+            // 二进制文件直接写入映射内存，不需要异步
+            ap.reset(new BinaryLogAppender(a.file, a.map_size));
+          } else if (a.async) {
+            // 文件和终端都可以异步输出，终端对应空文件名
+            ap.reset(new AsyncLogAppender(a.type == 1? a.file: "", a.overflow, a.overflow_level));
+          } else if (a.type == 1) {
             // file
-            ap.reset(new FileLogAppender(a.file));
+            ap.reset(new FileLogAppender(a.file, a.max_size, a.rotate, a.buffer_size));
           } else if (a.type == 2) {
             // stdOut
             ap.reset(new StdoutLogAppender);
@@ -652,6 +1501,24 @@ struct LogIniter {
         }
       }
     });
+
+    g_log_reopen_signal->addListener(0xF1E232, [](const std::string& old_val,
+      const std::string& new_val) {
+      int old_sig = signal_from_string(old_val);
+      if (old_sig) {
+        signal(old_sig, SIG_DFL);
+      }
+      int new_sig = signal_from_string(new_val);
+      if (new_sig) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_reopen_signal;
+        sa.sa_flags = SA_RESTART;
+        sigaction(new_sig, &sa, nullptr);
+      } else if (!new_val.empty()) {
+        std::cout << "log config error: invalid reopen signal " << new_val << std::endl;
+      }
+    });
   }
 };
 
@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdarg.h>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <list>
@@ -19,10 +20,10 @@
 #include "thread.h"
 
 // 测试宏(get_ss()返回当前event的stringstream类，用于流式输出字符串缓冲区的内容)
+// 日志器和所有输出器都不会输出该级别时只有一次比较，不会构造日志事件
 #define MOKA_LOG_LEVEL(logger, level) \
-  if(logger->get_level() <= level) \
-    moka::LogEventWrap(moka::LogEvent::ptr(new moka::LogEvent(__FILE__, 0, __LINE__, moka::GetThreadId(), \
-                 moka::GetFiberId(), moka::GetThreadName(), time(0), logger, level))).get_ss()
+  if(logger->isEnabled(level)) \
+    moka::LogEventStackWrap(logger, level, __FILE__, __LINE__).get_ss()
           
 #define MOKA_LOG_DEBUG(logger) MOKA_LOG_LEVEL(logger, moka::LogLevel::DEBUG)
 #define MOKA_LOG_INFO(logger) MOKA_LOG_LEVEL(logger, moka::LogLevel::INFO)
@@ -32,9 +33,8 @@
 
 // 支持格式符打印输出
 #define MOKA_LOG_FMT_LEVEL(logger, level, fmt, ...) \
-  if (logger->get_level() <= level) \
-    moka::LogEventWrap(moka::LogEvent::ptr(new moka::LogEvent(__FILE__, 0, __LINE__, moka::GetThreadId(), \
-                 moka::GetFiberId(), moka::GetThreadName(), time(0), logger, level))).get_event()->format(fmt, __VA_ARGS__)
+  if (logger->isEnabled(level)) \
+    moka::LogEventStackWrap(logger, level, __FILE__, __LINE__).get_event().format(fmt, __VA_ARGS__)
 
 #define MOKA_LOG_FMT_DEBUG(logger, fmt, ...) MOKA_LOG_FMT_LEVEL(logger, moka::LogLevel::DEBUG, fmt, __VA_ARGS__)
 #define MOKA_LOG_FMT_INFO(logger, fmt, ...) MOKA_LOG_FMT_LEVEL(logger, moka::LogLevel::INFO, fmt, __VA_ARGS__)
@@ -50,6 +50,7 @@ namespace moka {
 
 
 class Logger;
+struct BinLogSite;
 
 // 日志级别
 class LogLevel {
@@ -113,12 +114,27 @@ class LogEventWrap {
   LogEvent::ptr event_;
 };
 
+// 日志宏使用的包装类，日志事件直接放在栈上，不需要new和引用计数
+// (传给输出器的LogEvent::ptr不拥有事件，输出器不能在log()返回后继续持有)
+class LogEventStackWrap : public Noncopyable {
+ public:
+  LogEventStackWrap(const std::shared_ptr<Logger>& logger, LogLevel::level level,
+                    const char* file, uint32_t line);
+  ~LogEventStackWrap();
+  std::stringstream& get_ss() { return event_.get_ss(); }
+  LogEvent& get_event() { return event_; }
+ private:
+  LogEvent event_;
+};
+
 // 日志格式器
 class LogFormatter {
  public:
   using ptr = std::shared_ptr<LogFormatter>;
   LogFormatter(const std::string& pattern);  // 根据pattern的格式来解析信息
   std::string format(LogEvent::ptr event);   // 将日志事件格式化为字符串
+  void format(std::string& out, LogEvent::ptr event);  // 格式化后追加到out中(out可以复用，避免重复分配)
+  std::string formatItems(LogEvent::ptr event);        // 逐个调用FormatterItem输出到stringstream(用于对比)
 
  public:
   class FormatterItem {                      // 工厂模式，实现对针对各个格式符进行不同的输出
@@ -132,9 +148,34 @@ class LogFormatter {
   std::string get_pattern() { return pattern_; }
 
  private:
+  // pattern编译后的指令，format时顺序执行，直接追加到字符串中
+  struct Op {
+    enum Type {
+      LITERAL,      // literals_[arg, arg+len)，相邻的普通字符、%n、%T会合并成一条
+      MESSAGE,
+      LEVEL,
+      ELAPSE,
+      NAME,
+      THREAD_ID,
+      THREAD_NAME,
+      FIBER_ID,
+      DATETIME,     // date_formats_[arg]
+      FILENAME,
+      LINE
+    };
+    Type type;
+    uint32_t arg;
+    uint32_t len;
+  };
   void init();                              // 基于状态机完成日志格式的解析
+  void addLiteral(const std::string& str);
+  void appendDateTime(std::string& out, uint32_t idx, time_t t);
   std::string pattern_;                     // formatter输出格式
   std::vector<FormatterItem::ptr> items_;   // 存储多个格式项(解析的格式符和其他字符)
+  std::vector<Op> ops_;                     // 编译后的指令
+  std::string literals_;                    // 所有普通字符
+  std::vector<std::string> date_formats_;   // %d的日期格式
+  uint64_t id_;                             // 格式器的唯一编号(线程缓存的日期以此区分格式器)
   bool error_ = false;                      // 判断formatter格式pattern是否有错
 };
 
@@ -145,11 +186,14 @@ class LogAppender {
   virtual ~LogAppender() {}
   virtual void log(LogLevel::level level, LogEvent::ptr event) = 0;   // 调用日志格式器的format方法遍历items输出字符串
   virtual std::string toYamlString() = 0;                             // 方便调试
+  // 二进制日志(MOKA_LOG_BIN_*)，默认还原为文本后调用log()
+  virtual void logBinary(const std::shared_ptr<Logger>& logger, const BinLogSite& site,
+                         const char* types, const char* data, size_t len);
   void set_formatter(LogFormatter::ptr formatter, bool is_own_fmt);
   void set_formatter(const std::string& val, bool is_own_fmt);
   LogFormatter::ptr get_formatter();
   LogLevel::level get_level() { return level_; }
-  void set_level(LogLevel::level level) { level_ = level; }
+  void set_level(LogLevel::level level);
   bool has_fmt() { return is_own_fmt_; }
 
  protected:      // 派生类可访问
@@ -172,15 +216,32 @@ class Logger {
   void warn(LogEvent::ptr event);
   void error(LogEvent::ptr event);
   void fatal(LogEvent::ptr event);
+  // 输出二进制日志(参数已编码，见binlog.h)，logger为产生日志的日志器(使用root输出时仍是原日志器)
+  void logBinary(const Logger::ptr& logger, const BinLogSite& site,
+                 const char* types, const char* data, size_t len);
 
   void addAppender(LogAppender::ptr appender);
   void delAppender(LogAppender::ptr appender);
   void clearAppenders();
 
   LogLevel::level get_level() const { return level_; }
-  void set_level(LogLevel::level level) { level_ = level; }
+  void set_level(LogLevel::level level) { level_ = level; LevelChanged(); }
   const std::string& get_name() const { return name_; }
-  void set_root(Logger::ptr root) { root_ = root; }
+  void set_root(Logger::ptr root) { root_ = root; LevelChanged(); }
+
+  // 该级别的日志是否会被输出(综合日志器和所有输出器的级别)
+  // 级别相关的配置没有变化时只需要比较缓存的最低输出级别
+  bool isEnabled(LogLevel::level level) { return level >= get_effective_level(); }
+  // (用__atomic内建函数而不是std::atomic，-O0编译时也不会产生函数调用)
+  int get_effective_level() {
+    if (__builtin_expect(__atomic_load_n(&level_version_, __ATOMIC_RELAXED) !=
+                         __atomic_load_n(&s_level_version, __ATOMIC_RELAXED), 0)) {
+      updateEffectiveLevel();
+    }
+    return __atomic_load_n(&effective_level_, __ATOMIC_RELAXED);
+  }
+  // 日志器/输出器的级别或输出器集合发生变化，所有日志器的缓存级别失效
+  static void LevelChanged() { __atomic_add_fetch(&s_level_version, 1, __ATOMIC_RELEASE); }
 
   void set_formatter(LogFormatter::ptr fmt);
   void set_formatter(const std::string& val);
@@ -188,9 +249,13 @@ class Logger {
   std::string toYamlString();  // 方便调试
  private:
   void updateAppenderFmt();                 // (在setfmt中调用)当日志器的fmt发生改变时，更新继承了日志器的fmt的appender的fmt
+  void updateEffectiveLevel();              // 重新计算effective_level_
+  static uint64_t s_level_version;          // 级别配置的版本号
+  uint64_t level_version_ = 0;              // effective_level_对应的版本号
+  int effective_level_ = 0;                 // 实际会输出的最低级别
   std::string name_;                        // 日志名称
   LogLevel::level level_;                   // 日志级别(日志默认级别，若日志事件的级别大于日志器的级别则输出)
-  Spinlock mutex_;
+  RWmutex mutex_;                           // 写日志只加读锁，修改appender等配置时加写锁
   std::list<LogAppender::ptr> appenders_;   // appender集合(一个日志可以有多个输出地，如：文件、终端)
   LogFormatter::ptr formatter_;             // 格式器(日志默认格式)
   Logger::ptr root_;                        // 根日志器
@@ -206,17 +271,76 @@ class StdoutLogAppender : public LogAppender {
 };
 
 // 输出到文件的日志输出器
+// 以O_APPEND打开文件后一直使用同一个fd，只在轮转或收到重新打开的信号时才重新打开
 class FileLogAppender : public LogAppender {
  public:
   using ptr = std::shared_ptr<FileLogAppender>;
-  FileLogAppender(const std::string filename);
+  // 按时间轮转的周期
+  enum Rotate {
+    NONE = 0,
+    HOURLY = 1,
+    DAILY = 2
+  };
+  static const char* RotateToString(Rotate rotate);
+  static Rotate RotateFromString(const std::string& str);
+
+  // max_size: 文件超过该大小时轮转(0表示不限制)
+  // buffer_size: 用户态缓冲区大小，缓冲区满、日志时间跨秒或FATAL日志时写入文件(0表示每条日志直接write)
+  FileLogAppender(const std::string filename, uint64_t max_size = 0, Rotate rotate = NONE,
+                  size_t buffer_size = 64 * 1024);
+  ~FileLogAppender();
   virtual void log(LogLevel::level level, LogEvent::ptr event) override;
   virtual std::string toYamlString() override;
+  void flush();         // 将缓冲区中的日志写入文件
+
+  // 所有文件输出器在写下一条日志时重新打开文件(配合logrotate等外部工具)
+  // 只修改一个原子变量，可以在信号处理函数中调用
+  static void ReopenAll();
+ private:
+  bool reopen();        // 根据文件名成员重新打开文件，文件打开成功返回true
+  void rotate(time_t now);
+  void flushBuffer();
+  void writeFile(const char* data, size_t len);
+  std::string filename_;
+  int fd_ = -1;
+  uint64_t max_size_ = 0;
+  Rotate rotate_ = NONE;
+  uint64_t file_size_ = 0;        // 当前文件大小(包括缓冲区中的日志)
+  time_t next_rotate_ = 0;        // 下一次按时间轮转的时间
+  time_t last_time_ = 0;          // 上一条日志的时间(跨秒时写出缓冲区)
+  size_t buffer_size_ = 0;
+  std::string buffer_;
+  uint32_t reopen_generation_ = 0;
+};
+
+// 异步日志输出器：日志在调用线程格式化后写入线程私有的无锁环形缓冲区，
+// 再由后台日志线程批量writev到文件(文件名为空时输出到标准输出)
+class AsyncLogAppender : public LogAppender {
+ public:
+  using ptr = std::shared_ptr<AsyncLogAppender>;
+  // 缓冲区写满时的处理策略
+  enum Overflow {
+    BLOCK = 0,        // 等待后台线程腾出空间
+    DROP = 1,         // 直接丢弃
+    DROP_BELOW = 2    // 低于overflow_level的日志丢弃，其余等待
+  };
+  static const char* OverflowToString(Overflow overflow);
+  static Overflow OverflowFromString(const std::string& str);
+
+  AsyncLogAppender(const std::string& filename, Overflow overflow = BLOCK,
+                   LogLevel::level overflow_level = LogLevel::WARN);
+  ~AsyncLogAppender();
+  virtual void log(LogLevel::level level, LogEvent::ptr event) override;  // FATAL日志会等待全部日志写出后返回
+  virtual std::string toYamlString() override;
+  uint64_t get_dropped() const { return dropped_; }
+
+  static void Flush();  // 等待此前写入缓冲区的日志全部写出
  private:
-  bool reopen();  // 根据文件名成员重新打开文件，文件打开成功返回true
   std::string filename_;
-  std::ofstream filestream_;
-  uint64_t last_time_;
+  int fd_ = -1;
+  Overflow overflow_;
+  LogLevel::level overflow_level_;
+  std::atomic<uint64_t> dropped_ = {0};  // 因缓冲区满丢弃的日志条数
 };
 
 // 负责管理所有的日志器(单例模式)
@@ -20,6 +20,7 @@
     MOKA_LOG_ERROR(MOKA_LOG_ROOT()) << "ASSERTION: " #x \
       << "\nbacktrace:\n" \
       << moka::BacktraceToString(100, 2, "    "); \
+      moka::AsyncLogAppender::Flush(); \
       assert(x); \
   }
 
@@ -29,6 +30,7 @@
       << "\n" << #w \
       << "\nbacktrace:\n" \
       << moka::BacktraceToString(100, 2, "    "); \
+      moka::AsyncLogAppender::Flush(); \
       assert(x); \
   }
 
@@ -0,0 +1,101 @@
+#ifndef __MOKA_RUN_QUEUE_H__
+#define __MOKA_RUN_QUEUE_H__
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "noncopyable.h"
+
+namespace moka {
+
+// 每个调度线程私有的无锁任务队列(单生产者多消费者的环形缓冲区)
+// 只有所属线程可以push，所属线程和其他窃取线程都可以从队首取任务(CAS竞争head_)
+// 队列满时push返回false，由调用者将任务放回全局队列
+template<class T, uint32_t N = 256>
+class RunQueue : public Noncopyable {
+ public:
+  static_assert((N & (N - 1)) == 0, "RunQueue size must be power of 2");
+
+  RunQueue() {
+    for (uint32_t i = 0; i < N; ++i) {
+      buf_[i].store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  // 只能由所属线程调用
+  bool push(T* item) {
+    uint32_t t = tail_.load(std::memory_order_relaxed);
+    uint32_t h = head_.load(std::memory_order_acquire);
+    if (t - h >= N) {
+      // 队列已满
+      return false;
+    }
+    buf_[t & (N - 1)].store(item, std::memory_order_relaxed);
+    // release保证窃取线程看到tail_时也能看到写入的任务
+    tail_.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // 只能由所属线程调用(FIFO，保证任务的公平性)
+  T* pop() {
+    while (true) {
+      uint32_t h = head_.load(std::memory_order_acquire);
+      uint32_t t = tail_.load(std::memory_order_relaxed);
+      if (t == h) {
+        return nullptr;
+      }
+      T* item = buf_[h & (N - 1)].load(std::memory_order_relaxed);
+      if (head_.compare_exchange_weak(h, h + 1, std::memory_order_release,
+                                      std::memory_order_relaxed)) {
+        return item;
+      }
+    }
+  }
+
+  // 由其他线程调用，从当前队列窃取一半的任务放入out数组中，返回窃取的数量
+  uint32_t steal(T** out, uint32_t max) {
+    while (true) {
+      uint32_t h = head_.load(std::memory_order_acquire);
+      uint32_t t = tail_.load(std::memory_order_acquire);
+      uint32_t n = t - h;
+      n = n - n / 2;
+      if (n == 0) {
+        return 0;
+      }
+      if (n > max) {
+        n = max;
+      }
+      for (uint32_t i = 0; i < n; ++i) {
+        out[i] = buf_[(h + i) & (N - 1)].load(std::memory_order_relaxed);
+      }
+      // head_没有被推进说明[h, h + n)这段槽位没有被覆盖，读取的任务有效
+      if (head_.compare_exchange_weak(h, h + n, std::memory_order_release,
+                                      std::memory_order_relaxed)) {
+        return n;
+      }
+    }
+  }
+
+  // 近似值，仅用于判断是否有任务可以窃取
+  uint32_t size() const {
+    uint32_t h = head_.load(std::memory_order_acquire);
+    uint32_t t = tail_.load(std::memory_order_acquire);
+    return t - h;
+  }
+
+  bool empty() const { return size() == 0; }
+
+ private:
+  // head_和tail_用填充字节分开放在不同的缓存行，避免伪共享
+  // (c++11的new不保证alignas的过对齐，因此使用填充而不是alignas)
+  std::atomic<uint32_t> head_ = {0};   // 消费者竞争
+  char pad1_[64 - sizeof(std::atomic<uint32_t>)];
+  std::atomic<uint32_t> tail_ = {0};   // 仅所属线程修改
+  char pad2_[64 - sizeof(std::atomic<uint32_t>)];
+  std::atomic<T*> buf_[N];
+};
+
+}
+
+#endif
@@ -4,13 +4,25 @@
 #include "macro.h"
 #include "hook.h"
 #include "log.h"
+#include "config.h"
 
 namespace moka {
 
 static moka::Logger::ptr g_logger = MOKA_LOG_NAME("system");
 
+// 是否为每个调度线程使用本地无锁队列并允许空闲线程窃取任务(默认使用全局任务队列)
+static ConfigVar<bool>::ptr g_scheduler_work_stealing =
+  Config::Lookup<bool>("scheduler.work_stealing", false, "scheduler per-thread run queue with work stealing");
+
 static thread_local Scheduler* t_scheduler = nullptr;      // 当前线程的调度器
 static thread_local Fiber* t_sched_fiber = nullptr;        // 当前线程的调度协程
+static thread_local Fiber* t_idle_fiber = nullptr;         // 当前线程的idle协程
+static thread_local int t_worker_index = -1;               // 当前调度线程在workers_中的下标(工作窃取模式)
+
+thread_local std::list<Scheduler::ScheduleTask>* Scheduler::t_self_tasks = nullptr;
+
+// 一次从全局队列/其他线程中最多搬运的任务数量
+static const uint32_t s_steal_batch = 128;
 
 Scheduler* Scheduler::GetThis() {
   return t_scheduler;
@@ -20,9 +32,21 @@ Fiber* Scheduler::GetSchedFiber() {
   return t_sched_fiber;
 }
 
+Fiber* Scheduler::GetIdleFiber() {
+  return t_idle_fiber;
+}
+
 // use_caller为true表示使用调用者的线程作为调度线程
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name) : name_(name) {
   MOKA_ASSERT(threads > 0);
+  work_stealing_ = g_scheduler_work_stealing->get_value();
+  if (work_stealing_) {
+    // 每个调度线程(包括caller线程)一个Worker
+    workers_.resize(threads);
+    for (size_t i = 0; i < threads; ++i) {
+      workers_[i] = new Worker;
+    }
+  }
   if (use_caller) {
     // 当前线程作为调度线程
     // 在当前线程中新建一个调度线程的主协程(注意这个主协程并不是调度协程)
@@ -50,6 +74,12 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name) :
     thread_id_ = moka::GetThreadId();
     // 将当前线程id放入集合中
     thread_id_set_.push_back(thread_id_);
+
+    if (work_stealing_) {
+      // caller线程固定使用0号Worker
+      t_worker_index = 0;
+      workers_[0]->thread_id = thread_id_;
+    }
   } else {
     // 没有使用caller线程作为调度线程，在run方法中新建线程作为调度线程
     thread_id_ = -1; 
@@ -62,6 +92,18 @@ Scheduler::~Scheduler() {
   if (GetThis() == this) {
     // 清空当前的调度器标记
     t_scheduler = nullptr;  
+    t_worker_index = -1;
+  }
+  for (auto w : workers_) {
+    // 正常停止时队列中不会残留任务，这里防止泄漏
+    ScheduleTask* task = nullptr;
+    while ((task = w->run_queue.pop())) {
+      delete task;
+    }
+    for (auto t : w->pinned_tasks) {
+      delete t;
+    }
+    delete w;
   }
 }
 
@@ -79,15 +121,36 @@ void Scheduler::start() {
 
     // 预留线程池空间
     thread_pool_.resize(thread_nums_);
+    // 使用了caller线程时，0号Worker属于caller线程
+    size_t offset = workers_.size() - thread_nums_;
     for (size_t i = 0; i < thread_nums_; ++i) {
       // 初始化线程池中的线程，新建的线程会执行run函数，并指定线程名称
-      thread_pool_[i].reset(new Thread(std::bind(&Scheduler::run, this),
-                            name_ + "_" + std::to_string(i)));
+      if (work_stealing_) {
+        int index = offset + i;
+        thread_pool_[i].reset(new Thread([this, index]() {
+                                t_worker_index = index;
+                                run();
+                              }, name_ + "_" + std::to_string(i)));
+        workers_[index]->thread_id = thread_pool_[i]->get_id();
+      } else {
+        thread_pool_[i].reset(new Thread(std::bind(&Scheduler::run, this),
+                              name_ + "_" + std::to_string(i)));
+      }
       thread_id_set_.push_back(thread_pool_[i]->get_id());
     }
   }
 }
 
+std::vector<pid_t> Scheduler::get_worker_thread_ids() const {
+  std::vector<pid_t> ids;
+  for (auto id : thread_id_set_) {
+    if (id != thread_id_) {
+      ids.push_back(id);
+    }
+  }
+  return ids;
+}
+
 void Scheduler::stop() {
   is_auto_stopping_ = true;
   if (caller_sched_fiber_ && thread_nums_ == 0 
@@ -119,16 +182,8 @@ void Scheduler::stop() {
     caller_sched_fiber_->sched();  // 当前运行start函数的上下文为主协程
   }
 
-  // 等待其他调度线程的调度协程退出调度
-  for (size_t i = 0; i < thread_nums_; ++i) {
-    notify();  // 使线程唤醒，结束资源
-  }
-  
-  // 如果使用了caller线程
-  if (caller_sched_fiber_) {
-    // 等待caller线程的调度协程返回
-    notify();
-  }
+  // 唤醒所有调度线程(包括caller线程的调度协程)退出调度，结束资源
+  notify(thread_nums_ + (caller_sched_fiber_? 1: 0));
 
   // 这里一定要join等待调度线程执行任务结束后调度器才停止
   for (auto& i : thread_pool_) {
@@ -160,16 +215,30 @@ void Scheduler::run() {
   // 因为run为调度协程执行的函数，因此idle_fiber要执行结束后要返回调度协程(而不是main协程)
   // idle协程默认返回到调度协程
   Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
+  t_idle_fiber = idle_fiber.get();
   
   // 用于执行回调函数的协程(可以使用reset成员函数重复利用)
   Fiber::ptr cb_fiber;
 
+  // 指定在当前线程执行、并且由当前线程添加的任务(如定时器回调)
+  std::list<ScheduleTask> self_tasks;
+  t_self_tasks = &self_tasks;
+
   ScheduleTask task;         // 任务结构体，用于暂存任务队列中的任务
   while (true) {
     task.reset();            // 初始化任务为空(协程，回调函数函数，调度线程为空)
     bool notify_me = false;  // 是否notify其他线程进行任务调度
     bool is_active = false;
-    {
+    if (!self_tasks.empty()) {
+      task = std::move(self_tasks.front());
+      self_tasks.pop_front();
+      // 先增加active_thread_nums_再减少pending_task_nums_(见stopping)
+      ++active_thread_nums_;
+      --pending_task_nums_;
+      is_active = true;
+    } else if (work_stealing_) {
+      is_active = takeTaskSteal(task, notify_me);
+    } else {
       Mutex::LockGuard lock(mutex_);
       auto it = tasks_.begin();
       // 遍历任务队列
@@ -213,6 +282,9 @@ void Scheduler::run() {
               && task.fiber->get_state() != Fiber::EXCEPT) {
         // 让出执行的状态就是hold状态
         task.fiber->set_state(Fiber::HOLD);
+      } else {
+        // 执行结束的协程如果没有其他地方引用，回收到协程对象池中复用
+        FiberPool::Put(task.fiber);
       }
       task.reset();
     } else if (task.cb) {
@@ -221,8 +293,8 @@ void Scheduler::run() {
         // 调用Fiber::reset，重复利用之前的协程资源
         cb_fiber->reset(task.cb);
       } else {
-        // 第一次使用，则初始化
-        cb_fiber.reset(new Fiber(task.cb));
+        // 第一次使用(或者上一个协程被挂起)，从协程对象池中获取
+        cb_fiber = FiberPool::Get(task.cb);
       }
       // 每次任务处理结束就重置任务结构体
       task.reset();
@@ -254,6 +326,8 @@ void Scheduler::run() {
 
       if (idle_fiber->get_state() == Fiber::TERM) {
         MOKA_LOG_INFO(g_logger) << "idle fiber term";
+        t_self_tasks = nullptr;
+        t_idle_fiber = nullptr;
         break;
       }
 
@@ -273,15 +347,198 @@ void Scheduler::set_this() {
   t_scheduler = this;
 }
 
-void Scheduler::notify() {
+void Scheduler::notify(size_t n) {
   MOKA_LOG_INFO(g_logger) << "notify";
 }
 
+bool Scheduler::hasPendingTasks() {
+  if (pending_task_nums_ > 0) {
+    return true;
+  }
+  Mutex::LockGuard lock(mutex_);
+  return !tasks_.empty();
+}
+
 bool Scheduler::stopping() {
   Mutex::LockGuard lock(mutex_);
   // 只有所有的任务都被执行完了，调度器才可以停止
+  // 取任务时先增加active_thread_nums_再减少pending_task_nums_，因此这里要先检查pending_task_nums_
   return is_auto_stopping_ && is_stopping_
-      && tasks_.empty() && active_thread_nums_ == 0;
+      && tasks_.empty() && pending_task_nums_ == 0 && active_thread_nums_ == 0
+      && external_waiter_nums_ == 0;
+}
+
+bool Scheduler::isSelfThread(int thread) {
+  return thread != -1 && t_self_tasks && t_scheduler == this && thread == moka::GetThreadId();
+}
+
+void Scheduler::scheduleSelf(ScheduleTask&& task) {
+  if (task.fiber || task.cb) {
+    ++pending_task_nums_;
+    t_self_tasks->push_back(std::move(task));
+  }
+}
+
+Scheduler::Worker* Scheduler::getWorker(pid_t thread_id) {
+  for (auto w : workers_) {
+    if (w->thread_id == thread_id) {
+      return w;
+    }
+  }
+  return nullptr;
+}
+
+void Scheduler::scheduleSteal(ScheduleTask* task) {
+  if (!task->fiber && !task->cb) {
+    delete task;
+    return;
+  }
+  if (task->thread_id != -1) {
+    // 指定线程的任务直接放入所属线程的队列
+    Worker* w = getWorker(task->thread_id);
+    if (w) {
+      ++pending_task_nums_;
+      Mutex::LockGuard lock(w->mutex);
+      w->pinned_tasks.push_back(task);
+      ++w->pinned_nums;
+      return;
+    }
+  } else if (t_scheduler == this && t_worker_index >= 0) {
+    // 调度线程自己产生的任务放入本地队列
+    ++pending_task_nums_;
+    if (workers_[t_worker_index]->run_queue.push(task)) {
+      return;
+    }
+    --pending_task_nums_;
+  }
+  // 外部线程添加的任务或者本地队列已满，放入全局队列
+  Mutex::LockGuard lock(mutex_);
+  tasks_.push_back(std::move(*task));
+  delete task;
+}
+
+bool Scheduler::takeTaskSteal(ScheduleTask& task, bool& notify_me) {
+  MOKA_ASSERT(t_worker_index >= 0);
+  Worker* self = workers_[t_worker_index];
+  ScheduleTask* t = nullptr;
+  bool pinned = false;
+
+  // 1. 指定了当前线程的任务
+  if (self->pinned_nums > 0) {
+    Mutex::LockGuard lock(self->mutex);
+    if (!self->pinned_tasks.empty()) {
+      t = self->pinned_tasks.front();
+      self->pinned_tasks.pop_front();
+      --self->pinned_nums;
+      pinned = true;
+    }
+  }
+  // 2. 本地队列
+  if (!t) {
+    t = self->run_queue.pop();
+  }
+  // 3. 全局队列(外部线程添加的任务)，顺带搬运一批任务到本地队列
+  if (!t) {
+    Mutex::LockGuard lock(mutex_);
+    bool found = false;
+    uint32_t moved = 0;
+    auto it = tasks_.begin();
+    while (it != tasks_.end() && moved < s_steal_batch) {
+      if (it->thread_id != -1 && it->thread_id != moka::GetThreadId()) {
+        ++it;
+        notify_me = true;
+        continue;
+      }
+      if (it->fiber && it->fiber->get_state() == Fiber::EXEC) {
+        ++it;
+        continue;
+      }
+      if (!found) {
+        task = std::move(*it);
+        found = true;
+      } else {
+        ++pending_task_nums_;
+        ScheduleTask* extra = new ScheduleTask(std::move(*it));
+        if (extra->thread_id != -1) {
+          // 指定了当前线程的任务不能放入本地队列(会被其他线程窃取)
+          Mutex::LockGuard self_lock(self->mutex);
+          self->pinned_tasks.push_back(extra);
+          ++self->pinned_nums;
+        } else {
+          // 本地队列此时为空，搬运的数量不超过其容量的一半，一定能放下
+          bool ok = self->run_queue.push(extra);
+          MOKA_ASSERT(ok);
+        }
+        ++moved;
+      }
+      it = tasks_.erase(it);
+    }
+    if (found) {
+      // 全局队列中的任务没有计入pending_task_nums_
+      ++active_thread_nums_;
+      return true;
+    }
+  }
+  // 4. 从其他调度线程的本地队列窃取
+  if (!t) {
+    ScheduleTask* stolen[s_steal_batch];
+    size_t n = workers_.size();
+    // 随机选择窃取的起点，避免所有空闲线程都去窃取同一个线程
+    static thread_local unsigned int s_seed = moka::GetThreadId();
+    size_t start = (size_t)rand_r(&s_seed) % n;
+    for (size_t i = 0; i < n && !t; ++i) {
+      Worker* victim = workers_[(start + i) % n];
+      if (victim == self) {
+        continue;
+      }
+      if (victim->pinned_nums > 0) {
+        // 其他线程有指定的任务，唤醒它
+        notify_me = true;
+      }
+      uint32_t cnt = victim->run_queue.steal(stolen, s_steal_batch);
+      if (cnt == 0) {
+        continue;
+      }
+      // 本地队列中只有未指定线程的任务
+      for (uint32_t j = 0; j < cnt; ++j) {
+        MOKA_ASSERT(stolen[j]->thread_id == -1);
+      }
+      // 执行最早的任务，剩余的任务按原顺序放入本地队列(窃取的数量不超过队列容量的一半，本地队列为空时一定能放下)
+      t = stolen[0];
+      for (uint32_t j = 1; j < cnt; ++j) {
+        if (!self->run_queue.push(stolen[j])) {
+          --pending_task_nums_;
+          Mutex::LockGuard lock(mutex_);
+          tasks_.push_back(std::move(*stolen[j]));
+          delete stolen[j];
+        }
+      }
+    }
+  }
+  if (!t) {
+    return false;
+  }
+
+  ++active_thread_nums_;
+  --pending_task_nums_;
+  if (t->fiber && t->fiber->get_state() == Fiber::EXEC) {
+    // 该协程还在其他线程上执行(还没有让出)，放回队列稍后重试
+    ++pending_task_nums_;
+    if (pinned) {
+      Mutex::LockGuard lock(self->mutex);
+      self->pinned_tasks.push_back(t);
+      ++self->pinned_nums;
+    } else if (!self->run_queue.push(t)) {
+      --pending_task_nums_;
+      Mutex::LockGuard lock(mutex_);
+      tasks_.push_back(std::move(*t));
+      delete t;
+    }
+    return true;
+  }
+  task = std::move(*t);
+  delete t;
+  return true;
 }
 
 void Scheduler::idle() {
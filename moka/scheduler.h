@@ -9,6 +9,7 @@
 
 #include "fiber.h"
 #include "thread.h"
+#include "run_queue.h"
 
 namespace moka {
 
@@ -22,9 +23,12 @@ class Scheduler {
   virtual ~Scheduler();
 
   const std::string& get_name() const { return name_; }
+  // 调度线程(不包括caller线程)的id，在start之后有效
+  std::vector<pid_t> get_worker_thread_ids() const;
   
   static Scheduler* GetThis();   // 获得当前的调度器
   static Fiber* GetSchedFiber();  // 获得调度器的调度协程
+  static Fiber* GetIdleFiber();   // 获得当前调度线程的idle协程
 
   void start();  // 启动调度
   void stop();   // 停止调度
@@ -32,8 +36,25 @@ class Scheduler {
   // caller线程的辅助方法
   void call();
 
+  // 挂起在调度器之外等待的协程(如卸载到后台线程的文件操作)，恢复执行之前调度器不能停止
+  void addExternalWaiter() { ++external_waiter_nums_; }
+  void delExternalWaiter() { --external_waiter_nums_; }
+
   template<class FiberOrCb>
   void schedule(FiberOrCb fc, int thread = -1) {
+    if (isSelfThread(thread)) {
+      // 指定当前调度线程执行的任务放入线程私有的队列，其他线程看不到，也不需要唤醒其他线程
+      scheduleSelf(ScheduleTask(fc, thread));
+      return;
+    }
+    if (work_stealing_) {
+      // 工作窃取模式下不经过全局锁，直接放入调度线程的本地队列
+      scheduleSteal(new ScheduleTask(fc, thread));
+      if (hasIdleThreads()) {
+        notify();
+      }
+      return;
+    }
     bool need_notify = false;
     {
       Mutex::LockGuard lock(mutex_);
@@ -45,32 +66,54 @@ class Scheduler {
   }
 
   // 往调度器中添加任务(保存到任务队列中)，但不立刻执行
-  // 使用范围迭代器添加STL中的任务
+  // 使用范围迭代器添加STL中的任务，thread为-1表示任意线程
   template<class InputIterator>
-  void schedule(InputIterator begin, InputIterator end) {
+  void schedule(InputIterator begin, InputIterator end, int thread = -1) {
+    size_t count = 0;      // 添加的任务数量(最多唤醒同样数量的空闲线程)
+    if (isSelfThread(thread)) {
+      while (begin != end) {
+        scheduleSelf(ScheduleTask(&(*begin), thread));
+        ++begin;
+      }
+      return;
+    }
+    if (work_stealing_) {
+      while (begin != end) {
+        scheduleSteal(new ScheduleTask(&(*begin), thread));
+        ++begin;
+        ++count;
+      }
+      if (hasIdleThreads()) {
+        notify(count);
+      }
+      return;
+    }
     bool need_notify = false;
     {
       Mutex::LockGuard lock(mutex_);
       while (begin != end) {
-        // 仅需要在一开始往任务队列中添加任务时notify，-1表示任意线程
-        need_notify = scheduleNoLock(&(*begin), -1) || need_notify;
+        // 仅需要在一开始往任务队列中添加任务时notify
+        need_notify = scheduleNoLock(&(*begin), thread) || need_notify;
         ++begin;
+        ++count;
       }
     }
     if (need_notify) {
-      notify();
+      notify(count);
     }
   }
 
  protected:
   // 这三个虚函数实际上都需要到IO协程调度器中完善
-  virtual void notify();
+  virtual void notify(size_t n = 1);   // 通知空闲线程有n个新任务
   virtual bool stopping();
   virtual void idle();     // 协程idle
 
   void run();              // 调度协程执行的函数
   void set_this();         // 设置当前的调度器标记
   bool hasIdleThreads() { return idle_thread_nums_ > 0; }
+  bool hasPendingTasks();  // 是否有等待执行的任务
+  bool isWorkStealing() const { return work_stealing_; }
 
  private:
   // 无锁版本，使用FiberOrCb模板参数将函数和协程统一起来，构造任务时会调用对应的调度器构造函数
@@ -108,6 +151,28 @@ class Scheduler {
     }
   };
 
+  // 工作窃取模式下每个调度线程的任务队列
+  struct Worker {
+    RunQueue<ScheduleTask> run_queue;         // 本地无锁队列(只有所属线程push，其他线程可以窃取)
+    Mutex mutex;                              // 保护pinned_tasks
+    std::list<ScheduleTask*> pinned_tasks;    // 指定了该线程执行的任务(不可被窃取)
+    std::atomic<size_t> pinned_nums = {0};    // pinned_tasks的大小(避免每次都加锁检查)
+    std::atomic<pid_t> thread_id = {-1};      // 所属调度线程的id
+  };
+
+  // 工作窃取模式下添加任务(任务的所有权转移给调度器)
+  void scheduleSteal(ScheduleTask* task);
+  // 工作窃取模式下为当前调度线程取出一个任务，取到任务(包括需要重试的情况)返回true
+  bool takeTaskSteal(ScheduleTask& task, bool& notify_me);
+  // 根据线程id找到对应的Worker
+  Worker* getWorker(pid_t thread_id);
+  // 任务是否指定在当前调度线程上执行(当前线程正在run中，回到调度协程后自己就会执行)
+  bool isSelfThread(int thread);
+  // 将任务放入当前调度线程私有的队列
+  void scheduleSelf(ScheduleTask&& task);
+  // 当前调度线程私有的任务队列(指向run中的局部变量，不在run中时为空)
+  static thread_local std::list<ScheduleTask>* t_self_tasks;
+
  protected:
   std::vector<pid_t> thread_id_set_;               // 线程号集合
   size_t thread_nums_ = 0;                         // 线程总数
@@ -123,6 +188,11 @@ class Scheduler {
   Mutex mutex_;
   std::string name_;                      // 调度器所属的线程名称
   Fiber::ptr caller_sched_fiber_;         // caller线程的调度协程(如果未使用caller则为空)
+
+  bool work_stealing_ = false;                     // 是否使用工作窃取模式(构造时由配置决定)
+  std::vector<Worker*> workers_;                   // 每个调度线程的任务队列(下标为调度线程的序号)
+  std::atomic<size_t> pending_task_nums_ = {0};    // 本地队列(包括线程私有队列)中等待执行的任务数量
+  std::atomic<size_t> external_waiter_nums_ = {0}; // 在调度器之外挂起等待的协程数量
 };
 
 }
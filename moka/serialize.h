@@ -0,0 +1,515 @@
+#ifndef __MOKA_SERIALIZE_H__
+#define __MOKA_SERIALIZE_H__
+
+#include <string.h>
+#include <stdint.h>
+#include <byteswap.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <set>
+#include <map>
+#include <unordered_set>
+#include <unordered_map>
+#include <tuple>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+
+#include "bytearray.h"
+
+// 在结构体中按顺序声明参与序列化的字段(放在字段声明之后)
+// struct Point {
+//   int32_t x;
+//   int32_t y;
+//   MOKA_SERIALIZE_FIELDS(x, y)
+// };
+#define MOKA_SERIALIZE_FIELDS(...) \
+  auto moka_fields() -> decltype(std::tie(__VA_ARGS__)) { return std::tie(__VA_ARGS__); } \
+  auto moka_fields() const -> decltype(std::tie(__VA_ARGS__)) { return std::tie(__VA_ARGS__); }
+
+namespace moka {
+
+// 编码格式(与手写ByteArray调用的格式相同):
+// 算术类型/枚举: 定长，按ByteArray设置的字节序(同writeXxxF)
+// std::string: varint长度+内容(同writeStringIntV)
+// 容器: varint元素个数+依次每个元素，map依次写key和value
+// 结构体: 依次每个字段，没有额外的头部
+// 连续的定长字段(包括全部字段都是定长的嵌套结构体)在编译期计算出总长度和偏移，
+// 先编码到栈上的缓冲区再一次write/read，只做一次边界检查和拷贝
+
+template<class T>
+struct SerializeVoid {
+  typedef void type;
+};
+
+// 是否用MOKA_SERIALIZE_FIELDS声明了字段
+template<class T, class Enable = void>
+struct SerializeHasFields : public std::false_type {};
+
+template<class T>
+struct SerializeHasFields<T, typename SerializeVoid<decltype(std::declval<const T&>().moka_fields())>::type>
+    : public std::true_type {};
+
+template<class T>
+struct SerializeIsScalar {
+  static const bool value = std::is_arithmetic<T>::value || std::is_enum<T>::value;
+};
+
+// 定长类型: value表示是否定长，size为编码后的字节数
+template<class T, class Enable = void>
+struct SerializeFixed {
+  static const bool value = false;
+  static const size_t size = 0;
+};
+
+template<class T>
+struct SerializeFixed<T, typename std::enable_if<SerializeIsScalar<T>::value>::type> {
+  static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8,
+                "unsupported scalar size");
+  static const bool value = true;
+  static const size_t size = sizeof(T);
+};
+
+template<class... Ts>
+struct SerializeFixedAll {
+  static const bool value = true;
+  static const size_t size = 0;
+};
+
+template<class T, class... Ts>
+struct SerializeFixedAll<T, Ts...> {
+  typedef SerializeFixed<typename std::decay<T>::type> First;
+  static const bool value = First::value && SerializeFixedAll<Ts...>::value;
+  static const size_t size = First::size + SerializeFixedAll<Ts...>::size;
+};
+
+template<class Tuple>
+struct SerializeTupleFixed;
+
+template<class... Ts>
+struct SerializeTupleFixed<std::tuple<Ts...>> : public SerializeFixedAll<Ts...> {};
+
+template<class T>
+struct SerializeFixed<T, typename std::enable_if<SerializeHasFields<T>::value>::type>
+    : public SerializeTupleFixed<decltype(std::declval<const T&>().moka_fields())> {};
+
+// 按字节数选择交换字节序的整数类型
+template<size_t N>
+struct SerializeUint;
+
+template<>
+struct SerializeUint<1> {
+  typedef uint8_t type;
+  static type Swap(type v) { return v; }
+};
+
+template<>
+struct SerializeUint<2> {
+  typedef uint16_t type;
+  static type Swap(type v) { return bswap_16(v); }
+};
+
+template<>
+struct SerializeUint<4> {
+  typedef uint32_t type;
+  static type Swap(type v) { return bswap_32(v); }
+};
+
+template<>
+struct SerializeUint<8> {
+  typedef uint64_t type;
+  static type Swap(type v) { return bswap_64(v); }
+};
+
+// ByteArray的字节序与本机不同时需要交换，每次write/read只判断一次
+inline bool SerializeSwap(const ByteArray& ba) {
+  return (ba.isLitteEndian()? __ORDER_LITTLE_ENDIAN__: __ORDER_BIG_ENDIAN__) != __BYTE_ORDER__;
+}
+
+// 定长类型在内存中的编解码，Swap在编译期确定
+template<class T, class Enable = void>
+struct SerializeCodec;
+
+template<class T>
+struct SerializeCodec<T, typename std::enable_if<SerializeIsScalar<T>::value>::type> {
+  typedef SerializeUint<sizeof(T)> Uint;
+
+  template<bool Swap>
+  static void Encode(char* p, const T& v) {
+    typename Uint::type u;
+    memcpy(&u, &v, sizeof(u));
+    if (Swap) {
+      u = Uint::Swap(u);
+    }
+    memcpy(p, &u, sizeof(u));
+  }
+
+  template<bool Swap>
+  static void Decode(const char* p, T& v) {
+    typename Uint::type u;
+    memcpy(&u, p, sizeof(u));
+    if (Swap) {
+      u = Uint::Swap(u);
+    }
+    memcpy(&v, &u, sizeof(u));
+  }
+};
+
+// 字段元组中[I, End)的定长字段依次编解码到连续内存
+template<class Tuple, size_t I, size_t End>
+struct SerializeRange {
+  typedef typename std::decay<typename std::tuple_element<I, Tuple>::type>::type Elem;
+
+  template<bool Swap>
+  static void Encode(char* p, const Tuple& t) {
+    SerializeCodec<Elem>::template Encode<Swap>(p, std::get<I>(t));
+    SerializeRange<Tuple, I + 1, End>::template Encode<Swap>(p + SerializeFixed<Elem>::size, t);
+  }
+
+  template<bool Swap>
+  static void Decode(const char* p, const Tuple& t) {
+    SerializeCodec<Elem>::template Decode<Swap>(p, std::get<I>(t));
+    SerializeRange<Tuple, I + 1, End>::template Decode<Swap>(p + SerializeFixed<Elem>::size, t);
+  }
+};
+
+template<class Tuple, size_t End>
+struct SerializeRange<Tuple, End, End> {
+  template<bool Swap>
+  static void Encode(char* p, const Tuple& t) {}
+  template<bool Swap>
+  static void Decode(const char* p, const Tuple& t) {}
+};
+
+// 全部字段都是定长的结构体
+template<class T>
+struct SerializeCodec<T, typename std::enable_if<SerializeHasFields<T>::value
+                                                 && SerializeFixed<T>::value>::type> {
+  template<bool Swap>
+  static void Encode(char* p, const T& v) {
+    typedef decltype(v.moka_fields()) Tuple;
+    SerializeRange<Tuple, 0, std::tuple_size<Tuple>::value>::template Encode<Swap>(p, v.moka_fields());
+  }
+
+  template<bool Swap>
+  static void Decode(const char* p, T& v) {
+    typedef decltype(v.moka_fields()) Tuple;
+    SerializeRange<Tuple, 0, std::tuple_size<Tuple>::value>::template Decode<Swap>(p, v.moka_fields());
+  }
+};
+
+// 从第I个字段开始的连续定长字段: end为第一个非定长字段的下标，bytes为总字节数
+template<class Tuple, size_t I, size_t N = std::tuple_size<Tuple>::value>
+struct SerializeRun {
+  typedef SerializeFixed<typename std::decay<typename std::tuple_element<I, Tuple>::type>::type> Fixed;
+  static const size_t end = Fixed::value? SerializeRun<Tuple, I + 1, N>::end: I;
+  static const size_t bytes = Fixed::value? Fixed::size + SerializeRun<Tuple, I + 1, N>::bytes: 0;
+};
+
+template<class Tuple, size_t N>
+struct SerializeRun<Tuple, N, N> {
+  static const size_t end = N;
+  static const size_t bytes = 0;
+};
+
+template<class T, class Enable = void>
+class Serializer {
+  static_assert(sizeof(T) == 0, "type is not serializable, declare its fields with MOKA_SERIALIZE_FIELDS");
+};
+
+template<class T>
+void Serialize(ByteArray& ba, const T& v) {
+  Serializer<T>::Write(ba, v);
+}
+
+template<class T>
+void Deserialize(ByteArray& ba, T& v) {
+  Serializer<T>::Read(ba, v);
+}
+
+template<class T>
+T Deserialize(ByteArray& ba) {
+  T v;
+  Serializer<T>::Read(ba, v);
+  return v;
+}
+
+// 结构体字段的序列化: 连续的定长字段合并成一次write/read，其他字段逐个处理
+template<class Tuple, size_t I, size_t N = std::tuple_size<Tuple>::value>
+class SerializeFieldList {
+ public:
+  typedef typename std::decay<typename std::tuple_element<I, Tuple>::type>::type Elem;
+  typedef SerializeRun<Tuple, I> Run;
+  typedef std::integral_constant<bool, SerializeFixed<Elem>::value> IsFixed;
+
+  static void Write(ByteArray& ba, const Tuple& t) { Write(ba, t, IsFixed()); }
+  static void Read(ByteArray& ba, const Tuple& t) { Read(ba, t, IsFixed()); }
+
+ private:
+  static void Write(ByteArray& ba, const Tuple& t, std::true_type) {
+    char buf[Run::bytes];
+    if (SerializeSwap(ba)) {
+      SerializeRange<Tuple, I, Run::end>::template Encode<true>(buf, t);
+    } else {
+      SerializeRange<Tuple, I, Run::end>::template Encode<false>(buf, t);
+    }
+    ba.write(buf, sizeof(buf));
+    SerializeFieldList<Tuple, Run::end, N>::Write(ba, t);
+  }
+
+  static void Write(ByteArray& ba, const Tuple& t, std::false_type) {
+    Serializer<Elem>::Write(ba, std::get<I>(t));
+    SerializeFieldList<Tuple, I + 1, N>::Write(ba, t);
+  }
+
+  static void Read(ByteArray& ba, const Tuple& t, std::true_type) {
+    char buf[Run::bytes];
+    ba.read(buf, sizeof(buf));
+    if (SerializeSwap(ba)) {
+      SerializeRange<Tuple, I, Run::end>::template Decode<true>(buf, t);
+    } else {
+      SerializeRange<Tuple, I, Run::end>::template Decode<false>(buf, t);
+    }
+    SerializeFieldList<Tuple, Run::end, N>::Read(ba, t);
+  }
+
+  static void Read(ByteArray& ba, const Tuple& t, std::false_type) {
+    Serializer<Elem>::Read(ba, std::get<I>(t));
+    SerializeFieldList<Tuple, I + 1, N>::Read(ba, t);
+  }
+};
+
+template<class Tuple, size_t N>
+class SerializeFieldList<Tuple, N, N> {
+ public:
+  static void Write(ByteArray& ba, const Tuple& t) {}
+  static void Read(ByteArray& ba, const Tuple& t) {}
+};
+
+// 算术类型/枚举
+template<class T>
+class Serializer<T, typename std::enable_if<SerializeIsScalar<T>::value>::type> {
+ public:
+  static void Write(ByteArray& ba, const T& v) {
+    char buf[sizeof(T)];
+    if (SerializeSwap(ba)) {
+      SerializeCodec<T>::template Encode<true>(buf, v);
+    } else {
+      SerializeCodec<T>::template Encode<false>(buf, v);
+    }
+    ba.write(buf, sizeof(buf));
+  }
+
+  static void Read(ByteArray& ba, T& v) {
+    char buf[sizeof(T)];
+    ba.read(buf, sizeof(buf));
+    if (SerializeSwap(ba)) {
+      SerializeCodec<T>::template Decode<true>(buf, v);
+    } else {
+      SerializeCodec<T>::template Decode<false>(buf, v);
+    }
+  }
+};
+
+// 用MOKA_SERIALIZE_FIELDS声明了字段的结构体
+template<class T>
+class Serializer<T, typename std::enable_if<SerializeHasFields<T>::value>::type> {
+ public:
+  static void Write(ByteArray& ba, const T& v) {
+    typedef decltype(v.moka_fields()) Tuple;
+    SerializeFieldList<Tuple, 0>::Write(ba, v.moka_fields());
+  }
+
+  static void Read(ByteArray& ba, T& v) {
+    typedef decltype(v.moka_fields()) Tuple;
+    SerializeFieldList<Tuple, 0>::Read(ba, v.moka_fields());
+  }
+};
+
+template<>
+class Serializer<std::string> {
+ public:
+  static void Write(ByteArray& ba, const std::string& v) {
+    ba.writeStringIntV(v);
+  }
+
+  static void Read(ByteArray& ba, std::string& v) {
+    v = ba.readStringIntV();
+  }
+};
+
+// 读取容器的元素个数，每个元素至少min_size字节，明显超过剩余数据时直接报错，避免按错误的长度分配内存
+inline uint64_t SerializeReadCount(ByteArray& ba, size_t min_size) {
+  uint64_t count = ba.readUint64V();
+  if (min_size > 0 && count > ba.get_readable_size() / min_size) {
+    throw std::out_of_range("not enough len");
+  }
+  return count;
+}
+
+// 定长元素的数组: 分块编码到栈上的缓冲区再写入，本机字节序相同的算术类型直接整块拷贝
+template<class T>
+class SerializeArray {
+ public:
+  static const size_t kSize = SerializeFixed<T>::size;
+  static const size_t kChunk = 4096;
+  static const size_t kPerChunk = kChunk / kSize > 0? kChunk / kSize: 1;
+
+  static void Write(ByteArray& ba, const T* values, size_t count) {
+    bool swap = SerializeSwap(ba);
+    if (SerializeIsScalar<T>::value && (!swap || kSize == 1)) {
+      ba.write(values, count * kSize);
+      return;
+    }
+    char buf[kPerChunk * kSize];
+    for (size_t i = 0; i < count; i += kPerChunk) {
+      size_t n = count - i < kPerChunk? count - i: kPerChunk;
+      if (swap) {
+        Encode<true>(buf, values + i, n);
+      } else {
+        Encode<false>(buf, values + i, n);
+      }
+      ba.write(buf, n * kSize);
+    }
+  }
+
+  static void Read(ByteArray& ba, T* values, size_t count) {
+    bool swap = SerializeSwap(ba);
+    if (SerializeIsScalar<T>::value && (!swap || kSize == 1)) {
+      ba.read(values, count * kSize);
+      return;
+    }
+    char buf[kPerChunk * kSize];
+    for (size_t i = 0; i < count; i += kPerChunk) {
+      size_t n = count - i < kPerChunk? count - i: kPerChunk;
+      ba.read(buf, n * kSize);
+      if (swap) {
+        Decode<true>(buf, values + i, n);
+      } else {
+        Decode<false>(buf, values + i, n);
+      }
+    }
+  }
+
+ private:
+  template<bool Swap>
+  static void Encode(char* p, const T* values, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      SerializeCodec<T>::template Encode<Swap>(p + i * kSize, values[i]);
+    }
+  }
+
+  template<bool Swap>
+  static void Decode(const char* p, T* values, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      SerializeCodec<T>::template Decode<Swap>(p + i * kSize, values[i]);
+    }
+  }
+};
+
+// list/set/unordered_set等逐个元素处理的容器
+template<class C>
+class SerializeSequence {
+ public:
+  typedef typename C::value_type Elem;
+
+  static void Write(ByteArray& ba, const C& v) {
+    ba.writeUint64V(v.size());
+    for (const auto& i : v) {
+      Serializer<Elem>::Write(ba, i);
+    }
+  }
+
+  static void Read(ByteArray& ba, C& v) {
+    v.clear();
+    uint64_t count = SerializeReadCount(ba, SerializeFixed<Elem>::size);
+    for (uint64_t i = 0; i < count; ++i) {
+      Elem e;
+      Serializer<Elem>::Read(ba, e);
+      v.insert(v.end(), std::move(e));
+    }
+  }
+};
+
+// map/unordered_map
+template<class C>
+class SerializeMap {
+ public:
+  typedef typename C::key_type Key;
+  typedef typename C::mapped_type Value;
+
+  static void Write(ByteArray& ba, const C& v) {
+    ba.writeUint64V(v.size());
+    for (auto& i : v) {
+      Serializer<Key>::Write(ba, i.first);
+      Serializer<Value>::Write(ba, i.second);
+    }
+  }
+
+  static void Read(ByteArray& ba, C& v) {
+    v.clear();
+    uint64_t count = SerializeReadCount(ba, SerializeFixed<Key>::size + SerializeFixed<Value>::size);
+    for (uint64_t i = 0; i < count; ++i) {
+      Key key;
+      Value value;
+      Serializer<Key>::Read(ba, key);
+      Serializer<Value>::Read(ba, value);
+      v.insert(v.end(), typename C::value_type(std::move(key), std::move(value)));
+    }
+  }
+};
+
+// vector: 定长元素整块处理(vector<bool>没有连续的存储，逐个处理)
+template<class T>
+class Serializer<std::vector<T>> {
+ public:
+  typedef std::integral_constant<bool, SerializeFixed<T>::value
+                                       && !std::is_same<T, bool>::value> IsArray;
+
+  static void Write(ByteArray& ba, const std::vector<T>& v) { Write(ba, v, IsArray()); }
+  static void Read(ByteArray& ba, std::vector<T>& v) { Read(ba, v, IsArray()); }
+
+ private:
+  static void Write(ByteArray& ba, const std::vector<T>& v, std::true_type) {
+    ba.writeUint64V(v.size());
+    if (!v.empty()) {
+      SerializeArray<T>::Write(ba, &v[0], v.size());
+    }
+  }
+
+  static void Read(ByteArray& ba, std::vector<T>& v, std::true_type) {
+    uint64_t count = SerializeReadCount(ba, SerializeFixed<T>::size);
+    v.resize(count);
+    if (count > 0) {
+      SerializeArray<T>::Read(ba, &v[0], count);
+    }
+  }
+
+  static void Write(ByteArray& ba, const std::vector<T>& v, std::false_type) {
+    SerializeSequence<std::vector<T>>::Write(ba, v);
+  }
+
+  static void Read(ByteArray& ba, std::vector<T>& v, std::false_type) {
+    SerializeSequence<std::vector<T>>::Read(ba, v);
+  }
+};
+
+template<class T>
+class Serializer<std::list<T>> : public SerializeSequence<std::list<T>> {};
+
+template<class T>
+class Serializer<std::set<T>> : public SerializeSequence<std::set<T>> {};
+
+template<class T>
+class Serializer<std::unordered_set<T>> : public SerializeSequence<std::unordered_set<T>> {};
+
+template<class K, class V>
+class Serializer<std::map<K, V>> : public SerializeMap<std::map<K, V>> {};
+
+template<class K, class V>
+class Serializer<std::unordered_map<K, V>> : public SerializeMap<std::unordered_map<K, V>> {};
+
+}
+
+#endif
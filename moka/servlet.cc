@@ -0,0 +1,115 @@
+#include "servlet.h"
+
+#include <fnmatch.h>
+
+namespace moka {
+
+FunctionServlet::FunctionServlet(callback cb)
+    : Servlet("FunctionServlet"),
+      cb_(cb) {
+}
+
+int32_t FunctionServlet::handle(HttpRequest::ptr request, HttpResponse::ptr response) {
+  return cb_(request, response);
+}
+
+NotFoundServlet::NotFoundServlet(const std::string& server_name)
+    : Servlet("NotFoundServlet") {
+  content_ = "<html><head><title>404 Not Found</title></head><body><center><h1>404 Not Found"
+             "</h1></center><hr><center>" + server_name + "</center></body></html>";
+}
+
+int32_t NotFoundServlet::handle(HttpRequest::ptr request, HttpResponse::ptr response) {
+  response->set_status(HttpStatus::NOT_FOUND);
+  response->set_header("Content-Type", "text/html");
+  response->set_body(content_);
+  return 0;
+}
+
+ServletDispatch::ServletDispatch()
+    : Servlet("ServletDispatch"),
+      default_(new NotFoundServlet("moka/1.0.0")) {
+}
+
+int32_t ServletDispatch::handle(HttpRequest::ptr request, HttpResponse::ptr response) {
+  // 路径引用的是接收缓冲区，复用线程局部的字符串避免每个请求都分配内存
+  static thread_local std::string s_path;
+  StringRef path = request->get_path();
+  s_path.assign(path.data, path.size);
+  Servlet::ptr slt = getMatchedServlet(s_path);
+  if (slt) {
+    return slt->handle(request, response);
+  }
+  return 0;
+}
+
+void ServletDispatch::addServlet(const std::string& uri, Servlet::ptr servlet) {
+  RWmutexType::WriteLock lock(mutex_);
+  datas_[uri] = servlet;
+}
+
+void ServletDispatch::addServlet(const std::string& uri, FunctionServlet::callback cb) {
+  addServlet(uri, Servlet::ptr(new FunctionServlet(cb)));
+}
+
+void ServletDispatch::addGlobServlet(const std::string& uri, Servlet::ptr servlet) {
+  RWmutexType::WriteLock lock(mutex_);
+  for (auto it = globs_.begin(); it != globs_.end(); ++it) {
+    if (it->first == uri) {
+      globs_.erase(it);
+      break;
+    }
+  }
+  globs_.push_back(std::make_pair(uri, servlet));
+}
+
+void ServletDispatch::addGlobServlet(const std::string& uri, FunctionServlet::callback cb) {
+  addGlobServlet(uri, Servlet::ptr(new FunctionServlet(cb)));
+}
+
+void ServletDispatch::delServlet(const std::string& uri) {
+  RWmutexType::WriteLock lock(mutex_);
+  datas_.erase(uri);
+}
+
+void ServletDispatch::delGlobServlet(const std::string& uri) {
+  RWmutexType::WriteLock lock(mutex_);
+  for (auto it = globs_.begin(); it != globs_.end(); ++it) {
+    if (it->first == uri) {
+      globs_.erase(it);
+      break;
+    }
+  }
+}
+
+Servlet::ptr ServletDispatch::getServlet(const std::string& uri) {
+  RWmutexType::ReadLock lock(mutex_);
+  auto it = datas_.find(uri);
+  return it == datas_.end()? nullptr: it->second;
+}
+
+Servlet::ptr ServletDispatch::getGlobServlet(const std::string& uri) {
+  RWmutexType::ReadLock lock(mutex_);
+  for (auto& i : globs_) {
+    if (i.first == uri) {
+      return i.second;
+    }
+  }
+  return nullptr;
+}
+
+Servlet::ptr ServletDispatch::getMatchedServlet(const std::string& uri) {
+  RWmutexType::ReadLock lock(mutex_);
+  auto it = datas_.find(uri);
+  if (it != datas_.end()) {
+    return it->second;
+  }
+  for (auto& i : globs_) {
+    if (fnmatch(i.first.c_str(), uri.c_str(), 0) == 0) {
+      return i.second;
+    }
+  }
+  return default_;
+}
+
+}
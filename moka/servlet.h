@@ -0,0 +1,91 @@
+#ifndef __MOKA_SERVLET_H__
+#define __MOKA_SERVLET_H__
+
+#include <stdint.h>
+#include <memory>
+#include <functional>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "http.h"
+#include "thread.h"
+
+namespace moka {
+
+// 处理一个HTTP请求，填充响应
+class Servlet {
+ public:
+  using ptr = std::shared_ptr<Servlet>;
+
+  Servlet(const std::string& name) : name_(name) {}
+  virtual ~Servlet() {}
+
+  virtual int32_t handle(HttpRequest::ptr request, HttpResponse::ptr response) = 0;
+
+  const std::string& get_name() const { return name_; }
+
+ protected:
+  std::string name_;
+};
+
+// 用回调函数处理请求
+class FunctionServlet : public Servlet {
+ public:
+  using ptr = std::shared_ptr<FunctionServlet>;
+  using callback = std::function<int32_t(HttpRequest::ptr request, HttpResponse::ptr response)>;
+
+  FunctionServlet(callback cb);
+  virtual int32_t handle(HttpRequest::ptr request, HttpResponse::ptr response) override;
+
+ private:
+  callback cb_;
+};
+
+// 没有匹配的路由时返回404
+class NotFoundServlet : public Servlet {
+ public:
+  using ptr = std::shared_ptr<NotFoundServlet>;
+
+  NotFoundServlet(const std::string& server_name);
+  virtual int32_t handle(HttpRequest::ptr request, HttpResponse::ptr response) override;
+
+ private:
+  std::string content_;
+};
+
+// 按路径分发请求: 先精确匹配，再按添加顺序匹配通配符(fnmatch)，都没有匹配时交给默认servlet
+class ServletDispatch : public Servlet {
+ public:
+  using ptr = std::shared_ptr<ServletDispatch>;
+  using RWmutexType = RWmutex;
+
+  ServletDispatch();
+  virtual int32_t handle(HttpRequest::ptr request, HttpResponse::ptr response) override;
+
+  void addServlet(const std::string& uri, Servlet::ptr servlet);
+  void addServlet(const std::string& uri, FunctionServlet::callback cb);
+  void addGlobServlet(const std::string& uri, Servlet::ptr servlet);
+  void addGlobServlet(const std::string& uri, FunctionServlet::callback cb);
+
+  void delServlet(const std::string& uri);
+  void delGlobServlet(const std::string& uri);
+
+  Servlet::ptr get_default() const { return default_; }
+  void set_default(Servlet::ptr v) { default_ = v; }
+
+  Servlet::ptr getServlet(const std::string& uri);
+  Servlet::ptr getGlobServlet(const std::string& uri);
+  // 按精确匹配、通配符、默认servlet的顺序查找
+  Servlet::ptr getMatchedServlet(const std::string& uri);
+
+ private:
+  RWmutexType mutex_;
+  std::unordered_map<std::string, Servlet::ptr> datas_;
+  std::vector<std::pair<std::string, Servlet::ptr>> globs_;
+  Servlet::ptr default_;
+};
+
+}
+
+#endif
@@ -1,3 +1,5 @@
+#include <limits.h>
+#include <algorithm>
 #include <netinet/tcp.h>
 #include "socket.h"
 #include "fd_manager.h"
@@ -122,6 +124,14 @@ Socket::ptr Socket::accept() {
   return nullptr;
 }
 
+bool Socket::set_reuse_port() {
+  if (!is_valid() && !newSock()) {
+    return false;
+  }
+  int optval = 1;
+  return set_option(SOL_SOCKET, SO_REUSEPORT, optval);
+}
+
 bool Socket::init(int sockfd) {
   // 初始化连接fd的信息到当前Socket的对象的属性
   FdCtx::ptr ctx = FdMgr::GetInstance()->get(sockfd);
@@ -241,6 +251,36 @@ int Socket::send(const iovec* buffer, size_t len, int flags) {
   return -1;
 }
 
+int Socket::send(ByteArray& buffer, size_t len, int flags) {
+  if (!is_connected_) {
+    return -1;
+  }
+  std::vector<iovec> iovs;
+  len = buffer.get_read_buffers(iovs, len);
+  size_t sent = 0;
+  size_t idx = 0;
+  while (sent < len) {
+    int rt = send(&iovs[idx], std::min(iovs.size() - idx, (size_t)IOV_MAX), flags);
+    if (rt <= 0) {
+      // 已经发送了一部分时返回已发送的字节数，错误留给下一次调用
+      return sent? sent: rt;
+    }
+    sent += rt;
+    buffer.advance(rt);
+    // 跳过已经发送完的iovec，调整发送了一半的iovec
+    size_t n = rt;
+    while (n > 0 && n >= iovs[idx].iov_len) {
+      n -= iovs[idx].iov_len;
+      ++idx;
+    }
+    if (n > 0) {
+      iovs[idx].iov_base = (char*)iovs[idx].iov_base + n;
+      iovs[idx].iov_len -= n;
+    }
+  }
+  return sent;
+}
+
 int Socket::sendto(const void* buffer, size_t len, const Address::ptr to, int flags) {
   if (is_connected_) {
     return ::sendto(sockfd_, buffer, len, flags, to->get_addr(), to->get_addrlen());
@@ -279,6 +319,22 @@ int Socket::recv(iovec* buffer, size_t len, int flags) {
   return -1;
 }
 
+int Socket::recv(ByteArray& buffer, size_t len, int flags) {
+  if (!is_connected_) {
+    return -1;
+  }
+  if (len == 0) {
+    return 0;
+  }
+  std::vector<iovec> iovs;
+  buffer.get_write_buffers(iovs, len);
+  int rt = recv(&iovs[0], std::min(iovs.size(), (size_t)IOV_MAX), flags);
+  if (rt > 0) {
+    buffer.advance(rt);
+  }
+  return rt;
+}
+
 int Socket::recvfrom(void* buffer, size_t len, Address::ptr from, int flags) {
   if (is_connected_) {
     socklen_t len = from->get_addrlen();
@@ -425,9 +481,10 @@ bool Socket::cancelAll() {
 void Socket::initSock() {
   // optval需要一个非零的整数值
   int optval = 1;
-  // 设置可以在同一端口上重新绑定被使用的地址，连接关闭后不需要等待2MSL
-  set_option(SOL_SOCKET, SO_REUSEADDR, optval);
   if (type_ == SOCK_STREAM) {
+    // 设置可以在同一端口上重新绑定被使用的地址，连接关闭后不需要等待2MSL
+    // UDP没有TIME_WAIT，设置后反而会让内核给自动绑定的socket分配其他UDP socket正在使用的端口
+    set_option(SOL_SOCKET, SO_REUSEADDR, optval);
     // 如果是TCP连接，则启用Nagle算法，提高传输效率
     set_option(IPPROTO_TCP, TCP_NODELAY, optval);
   }
@@ -4,6 +4,7 @@
 #include <memory>
 #include <iostream>
 #include "address.h"
+#include "bytearray.h"
 #include "noncopyable.h"
 
 namespace moka {
@@ -57,6 +58,9 @@ class Socket : public std::enable_shared_from_this<Socket>, Noncopyable {
   }
 
   Socket::ptr accept();
+
+  // 允许多个socket绑定同一个地址(SO_REUSEPORT)，内核在这些监听socket之间分发连接，需要在bind之前调用
+  bool set_reuse_port();
   
   bool bind(const Address::ptr addr);
   bool connect(const Address::ptr addr, uint64_t timeout = -1);
@@ -72,6 +76,13 @@ class Socket : public std::enable_shared_from_this<Socket>, Noncopyable {
 
   int recv(void* buffer, size_t len, int flags = 0);
   int recv(iovec* buffer, size_t len, int flags = 0);
+
+  // 直接在ByteArray的节点链表上sendmsg/recvmsg(不经过中间缓冲区拷贝)
+  // send从读写位置发送最多len字节，部分发送时继续发送剩余部分，直到发完或出错，返回已发送的字节数
+  // recv从读写位置接收最多len字节(按需扩容)，只调用一次recvmsg
+  // 两者都会把读写位置后移实际发送/接收的字节数
+  int send(ByteArray& buffer, size_t len = ~0ull, int flags = 0);
+  int recv(ByteArray& buffer, size_t len, int flags = 0);
   // recvfrom指定一个Address对象指针
   int recvfrom(void* buffer, size_t len, Address::ptr from, int flags = 0);
   int recvfrom(iovec* buffer, size_t len, Address::ptr from, int flags = 0);
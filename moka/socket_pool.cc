@@ -0,0 +1,381 @@
+#include "socket_pool.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "hook.h"
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+
+namespace moka {
+
+static moka::Logger::ptr g_logger = MOKA_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_socket_pool_max_connections =
+  Config::Lookup<uint32_t>("socket_pool.max_connections", 64, "socket pool max connections per address");
+
+static ConfigVar<uint64_t>::ptr g_socket_pool_connect_timeout =
+  Config::Lookup<uint64_t>("socket_pool.connect_timeout", 3000, "socket pool connect timeout(ms)");
+
+static ConfigVar<uint64_t>::ptr g_socket_pool_idle_timeout =
+  Config::Lookup<uint64_t>("socket_pool.idle_timeout", 60 * 1000, "socket pool idle connection timeout(ms)");
+
+// sockaddr的内容作为键
+static std::string AddressKey(Address::ptr addr) {
+  return std::string((const char*)addr->get_addr(), addr->get_addrlen());
+}
+
+// 空闲连接上不应该有数据: 对端关闭时recv返回0，有未读数据说明上次的响应没有读完，都不能再使用
+// 直接调用原始的recv，避免hook在没有数据时挂起协程
+static bool IsHealthy(Socket::ptr sock) {
+  if (!sock->is_connected()) {
+    return false;
+  }
+  char c;
+  int rt = recv_f(sock->get_socketfd(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  return rt < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+SocketPool::SocketPool(IOManager* iom)
+    : iom_(iom),
+      max_connections_(g_socket_pool_max_connections->get_value()),
+      connect_timeout_(g_socket_pool_connect_timeout->get_value()),
+      idle_timeout_(g_socket_pool_idle_timeout->get_value()) {
+  for (auto id : iom_->get_worker_thread_ids()) {
+    subs_[id] = new SubPool;
+  }
+  uint64_t interval = idle_timeout_ / 2;
+  sweep_timer_ = iom_->addTimer(interval? interval: 1, std::bind(&SocketPool::onSweep, this), true);
+}
+
+SocketPool::~SocketPool() {
+  sweep_timer_->cancel();
+  for (auto& i : subs_) {
+    for (auto& h : i.second->idles) {
+      for (auto& idle : h.second) {
+        idle.sock->close();
+      }
+    }
+    delete i.second;
+  }
+  for (auto& h : shared_sub_.idles) {
+    for (auto& idle : h.second) {
+      idle.sock->close();
+    }
+  }
+  for (auto i : host_list_) {
+    MOKA_ASSERT(i->waiters.empty());
+    delete i;
+  }
+}
+
+SocketPool::Host* SocketPool::getHost(Address::ptr addr) {
+  std::string key = AddressKey(addr);
+  {
+    RWmutex::ReadLock lock(hosts_mutex_);
+    auto it = hosts_.find(key);
+    if (it != hosts_.end()) {
+      return it->second;
+    }
+  }
+  RWmutex::WriteLock lock(hosts_mutex_);
+  Host*& host = hosts_[key];
+  if (!host) {
+    host = new Host;
+    host->addr = addr;
+    host_list_.push_back(host);
+  }
+  return host;
+}
+
+SocketPool::SubPool* SocketPool::getSubPool() {
+  auto it = subs_.find(GetThreadId());
+  return it == subs_.end()? &shared_sub_: it->second;
+}
+
+Socket::ptr SocketPool::takeIdle(SubPool* sub, Host* host) {
+  Spinlock::LockGuard lock(sub->mutex);
+  auto it = sub->idles.find(host);
+  if (it == sub->idles.end() || it->second.empty()) {
+    return nullptr;
+  }
+  // 后进先出，最近用过的连接最可能还有效
+  Socket::ptr sock = std::move(it->second.back().sock);
+  it->second.pop_back();
+  return sock;
+}
+
+Socket::ptr SocketPool::takeAnyIdle(SubPool* local, Host* host) {
+  Socket::ptr sock;
+  if (local) {
+    sock = takeIdle(local, host);
+  }
+  if (!sock && local != &shared_sub_) {
+    sock = takeIdle(&shared_sub_, host);
+  }
+  for (auto it = subs_.begin(); !sock && it != subs_.end(); ++it) {
+    if (it->second != local) {
+      sock = takeIdle(it->second, host);
+    }
+  }
+  return sock;
+}
+
+bool SocketPool::hasIdle(Host* host) {
+  auto check = [host](SubPool* sub) {
+    Spinlock::LockGuard lock(sub->mutex);
+    auto it = sub->idles.find(host);
+    return it != sub->idles.end() && !it->second.empty();
+  };
+  if (check(&shared_sub_)) {
+    return true;
+  }
+  for (auto& i : subs_) {
+    if (check(i.second)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Socket::ptr SocketPool::connect(Host* host) {
+  Socket::ptr sock = Socket::CreateTCP(host->addr);
+  if (!sock->connect(host->addr, connect_timeout_)) {
+    ++connect_fails_;
+    MOKA_LOG_DEBUG(g_logger) << "socket pool connect " << host->addr->toString()
+                             << " failed errno=" << errno << " errstr=" << strerror(errno);
+    discard(host, sock);
+    return nullptr;
+  }
+  ++creates_;
+  // put时按对端地址查找Host，getpeername得到的地址与传入的不一定逐字节相同(例如填充字段)
+  std::string key = AddressKey(sock->get_remote_address());
+  {
+    RWmutex::ReadLock lock(hosts_mutex_);
+    if (hosts_.count(key)) {
+      return sock;
+    }
+  }
+  RWmutex::WriteLock lock(hosts_mutex_);
+  hosts_.insert(std::make_pair(key, host));
+  return sock;
+}
+
+void SocketPool::wake(Waiter::ptr waiter) {
+  waiter->scheduler->schedule(waiter->fiber);
+}
+
+void SocketPool::discard(Host* host, Socket::ptr sock) {
+  sock->close();
+  host->connections.fetch_sub(1);
+  if (host->waiting.load() == 0) {
+    return;
+  }
+  // 连接数减少了，唤醒一个等待者去新建连接
+  Waiter::ptr waiter;
+  {
+    Mutex::LockGuard lock(host->mutex);
+    if (host->waiters.empty()) {
+      return;
+    }
+    waiter = host->waiters.front();
+    host->waiters.pop_front();
+    host->waiting.fetch_sub(1);
+  }
+  wake(waiter);
+}
+
+void SocketPool::handoff(Host* host) {
+  while (true) {
+    Waiter::ptr waiter;
+    {
+      Mutex::LockGuard lock(host->mutex);
+      if (host->waiters.empty()) {
+        return;
+      }
+      Socket::ptr sock = takeAnyIdle(nullptr, host);
+      if (!sock) {
+        return;
+      }
+      waiter = host->waiters.front();
+      host->waiters.pop_front();
+      host->waiting.fetch_sub(1);
+      waiter->sock = sock;
+    }
+    wake(waiter);
+  }
+}
+
+Socket::ptr SocketPool::get(Address::ptr addr, uint64_t timeout_ms) {
+  ++gets_;
+  Host* host = getHost(addr);
+  SubPool* local = getSubPool();
+  uint64_t wait_begin = 0;
+  Socket::ptr sock;
+  while (true) {
+    sock = takeAnyIdle(local, host);
+    if (sock) {
+      if (IsHealthy(sock)) {
+        ++hits_;
+        break;
+      }
+      ++unhealthy_;
+      discard(host, sock);
+      sock.reset();
+      continue;
+    }
+    if (host->connections.fetch_add(1) < max_connections_) {
+      sock = connect(host);
+      break;
+    }
+    host->connections.fetch_sub(1);
+
+    // 连接数达到上限，等待其他协程归还或关闭连接
+    uint64_t now = GetCurrentUs();
+    if (wait_begin == 0) {
+      wait_begin = now;
+      ++waits_;
+    }
+    uint64_t used_ms = (now - wait_begin) / 1000;
+    if (timeout_ms != (uint64_t)-1 && used_ms >= timeout_ms) {
+      ++wait_timeouts_;
+      break;
+    }
+    Scheduler* scheduler = Scheduler::GetThis();
+    MOKA_ASSERT(scheduler);
+    Waiter::ptr waiter(new Waiter);
+    waiter->fiber = Fiber::GetThis();
+    waiter->scheduler = scheduler;
+    {
+      Mutex::LockGuard lock(host->mutex);
+      host->waiting.fetch_add(1);
+      // 先增加等待者数量再检查，与put/discard中先修改再检查等待者数量的顺序配合，不会错过唤醒
+      if (host->connections.load() < max_connections_ || hasIdle(host)) {
+        host->waiting.fetch_sub(1);
+        continue;
+      }
+      host->waiters.push_back(waiter);
+    }
+
+    Timer::ptr timer;
+    if (timeout_ms != (uint64_t)-1) {
+      IOManager* iom = IOManager::GetThis()? IOManager::GetThis(): iom_;
+      std::weak_ptr<Waiter> weak_waiter(waiter);
+      timer = iom->addTimer(timeout_ms - used_ms, [this, host, weak_waiter]() {
+        Waiter::ptr waiter = weak_waiter.lock();
+        if (!waiter) {
+          return;
+        }
+        {
+          Mutex::LockGuard lock(host->mutex);
+          auto it = std::find(host->waiters.begin(), host->waiters.end(), waiter);
+          if (it == host->waiters.end()) {
+            // 已经被唤醒
+            return;
+          }
+          host->waiters.erase(it);
+          host->waiting.fetch_sub(1);
+          waiter->timeout = true;
+        }
+        wake(waiter);
+      });
+    }
+    Fiber::YieldToHoldSched();
+    if (timer) {
+      timer->cancel();
+    }
+    if (waiter->sock) {
+      sock = waiter->sock;
+      if (IsHealthy(sock)) {
+        ++hits_;
+        break;
+      }
+      ++unhealthy_;
+      discard(host, sock);
+      sock.reset();
+    } else if (waiter->timeout) {
+      ++wait_timeouts_;
+      break;
+    }
+  }
+  if (wait_begin) {
+    wait_us_ += GetCurrentUs() - wait_begin;
+  }
+  return sock;
+}
+
+void SocketPool::put(Socket::ptr sock, bool reuse) {
+  Address::ptr addr = sock->get_remote_address();
+  Host* host = nullptr;
+  {
+    RWmutex::ReadLock lock(hosts_mutex_);
+    auto it = hosts_.find(AddressKey(addr));
+    if (it != hosts_.end()) {
+      host = it->second;
+    }
+  }
+  if (!host) {
+    MOKA_LOG_ERROR(g_logger) << "socket pool put unknown socket, remote=" << addr->toString();
+    sock->close();
+    return;
+  }
+  if (!reuse || !sock->is_connected()) {
+    discard(host, sock);
+    return;
+  }
+  SubPool* sub = getSubPool();
+  {
+    Spinlock::LockGuard lock(sub->mutex);
+    sub->idles[host].push_back({sock, GetCurrentMs()});
+  }
+  // 先放入子池再检查等待者数量(与get中的顺序相反)
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (host->waiting.load() > 0) {
+    handoff(host);
+  }
+}
+
+void SocketPool::onSweep() {
+  uint64_t expire = GetCurrentMs() - idle_timeout_;
+  std::vector<std::pair<Host*, Socket::ptr>> expired;
+  auto sweep = [expire, &expired](SubPool* sub) {
+    Spinlock::LockGuard lock(sub->mutex);
+    for (auto& i : sub->idles) {
+      // 队首是最早归还的
+      while (!i.second.empty() && i.second.front().time <= expire) {
+        expired.push_back(std::make_pair(i.first, std::move(i.second.front().sock)));
+        i.second.pop_front();
+      }
+    }
+  };
+  sweep(&shared_sub_);
+  for (auto& i : subs_) {
+    sweep(i.second);
+  }
+  for (auto& i : expired) {
+    ++expired_;
+    discard(i.first, i.second);
+  }
+}
+
+SocketPool::Stats SocketPool::get_stats() const {
+  Stats stats;
+  stats.gets = gets_;
+  stats.hits = hits_;
+  stats.creates = creates_;
+  stats.connect_fails = connect_fails_;
+  stats.unhealthy = unhealthy_;
+  stats.expired = expired_;
+  stats.waits = waits_;
+  stats.wait_timeouts = wait_timeouts_;
+  stats.wait_us = wait_us_;
+  return stats;
+}
+
+uint32_t SocketPool::get_connections(Address::ptr addr) {
+  return getHost(addr)->connections;
+}
+
+}
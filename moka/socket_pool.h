@@ -0,0 +1,136 @@
+#ifndef __MOKA_SOCKET_POOL_H__
+#define __MOKA_SOCKET_POOL_H__
+
+#include <stdint.h>
+#include <memory>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "address.h"
+#include "socket.h"
+#include "iomanager.h"
+#include "thread.h"
+#include "noncopyable.h"
+
+namespace moka {
+
+// 出站TCP连接池，按目标地址复用连接
+// 空闲连接放在归还连接的调度线程的子池中(每个线程一个子池，取出和归还通常不跨线程竞争)，
+// 本线程没有空闲连接时再从其他线程的子池中取
+// 每个地址的连接数(包括空闲和使用中的)有上限，达到上限时挂起当前协程等待其他协程归还或超时
+// 空闲连接由定时器定期检查，超过socket_pool.idle_timeout未使用的连接会被关闭
+// get和put必须在协程中调用(等待时会让出协程)
+class SocketPool : Noncopyable {
+ public:
+  using ptr = std::shared_ptr<SocketPool>;
+
+  // 统计信息
+  struct Stats {
+    uint64_t gets = 0;            // get调用次数
+    uint64_t hits = 0;            // 复用空闲连接的次数
+    uint64_t creates = 0;         // 新建连接的次数
+    uint64_t connect_fails = 0;   // 新建连接失败的次数
+    uint64_t unhealthy = 0;       // 取出时发现对端已经关闭(或有未读数据)而丢弃的连接数
+    uint64_t expired = 0;         // 空闲超时关闭的连接数
+    uint64_t waits = 0;           // 因连接数达到上限而等待的次数
+    uint64_t wait_timeouts = 0;   // 等待超时的次数
+    uint64_t wait_us = 0;         // 等待的总时间(微秒)
+
+    double hit_rate() const { return gets? (double)hits / gets: 0; }
+  };
+
+  SocketPool(IOManager* iom = IOManager::GetThis());
+  ~SocketPool();
+
+  // 取出到addr的连接: 优先复用空闲连接(检查是否可用)，没有则新建连接
+  // 连接数达到上限时等待最多timeout_ms毫秒，超时或连接失败返回nullptr
+  Socket::ptr get(Address::ptr addr, uint64_t timeout_ms = -1);
+  // 归还连接，reuse为false(读写出错或者对端要求关闭)时直接关闭
+  void put(Socket::ptr sock, bool reuse = true);
+
+  Stats get_stats() const;
+  // 当前到addr的连接数(包括空闲和使用中的)
+  uint32_t get_connections(Address::ptr addr);
+  uint32_t get_max_connections() const { return max_connections_; }
+  void set_max_connections(uint32_t v) { max_connections_ = v; }
+  uint64_t get_connect_timeout() const { return connect_timeout_; }
+  void set_connect_timeout(uint64_t v) { connect_timeout_ = v; }
+  uint64_t get_idle_timeout() const { return idle_timeout_; }
+
+ private:
+  struct Waiter {
+    using ptr = std::shared_ptr<Waiter>;
+    Fiber::ptr fiber;
+    Scheduler* scheduler;
+    Socket::ptr sock;         // 归还的连接直接交给等待者
+    bool timeout = false;
+  };
+
+  // 一个目标地址
+  struct Host {
+    Address::ptr addr;
+    std::atomic<uint32_t> connections = {0};
+    std::atomic<uint32_t> waiting = {0};   // 等待者数量，没有等待者时归还连接不需要加锁
+    Mutex mutex;
+    std::list<Waiter::ptr> waiters;
+  };
+
+  struct Idle {
+    Socket::ptr sock;
+    uint64_t time;            // 归还的时间(毫秒)
+  };
+
+  // 一个线程的空闲连接
+  struct SubPool {
+    Spinlock mutex;
+    std::unordered_map<Host*, std::deque<Idle>> idles;
+  };
+
+  Host* getHost(Address::ptr addr);
+  SubPool* getSubPool();
+  // 从子池中取出一个空闲连接(最近归还的)
+  Socket::ptr takeIdle(SubPool* sub, Host* host);
+  // 依次从本线程和其他线程的子池中取
+  Socket::ptr takeAnyIdle(SubPool* local, Host* host);
+  bool hasIdle(Host* host);
+  Socket::ptr connect(Host* host);
+  // 关闭连接并释放连接数，唤醒一个等待者重新尝试
+  void discard(Host* host, Socket::ptr sock);
+  // 把空闲连接交给等待者
+  void handoff(Host* host);
+  void wake(Waiter::ptr waiter);
+  // 定时关闭空闲超时的连接
+  void onSweep();
+
+ private:
+  IOManager* iom_;
+  std::atomic<uint32_t> max_connections_;
+  std::atomic<uint64_t> connect_timeout_;
+  uint64_t idle_timeout_;
+  Timer::ptr sweep_timer_;
+
+  RWmutex hosts_mutex_;
+  std::unordered_map<std::string, Host*> hosts_;    // 地址(sockaddr的内容)到Host，同一个Host可能有多个键
+  std::vector<Host*> host_list_;
+
+  std::unordered_map<pid_t, SubPool*> subs_;        // 创建后不再修改，查找不需要加锁
+  SubPool shared_sub_;                              // 不属于调度线程的线程使用
+
+  std::atomic<uint64_t> gets_ = {0};
+  std::atomic<uint64_t> hits_ = {0};
+  std::atomic<uint64_t> creates_ = {0};
+  std::atomic<uint64_t> connect_fails_ = {0};
+  std::atomic<uint64_t> unhealthy_ = {0};
+  std::atomic<uint64_t> expired_ = {0};
+  std::atomic<uint64_t> waits_ = {0};
+  std::atomic<uint64_t> wait_timeouts_ = {0};
+  std::atomic<uint64_t> wait_us_ = {0};
+};
+
+}
+
+#endif
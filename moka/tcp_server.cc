@@ -0,0 +1,153 @@
+#include "tcp_server.h"
+#include "fd_manager.h"
+#include "config.h"
+#include "log.h"
+#include "util.h"
+
+namespace moka {
+
+static moka::Logger::ptr g_logger = MOKA_LOG_NAME("system");
+
+static ConfigVar<uint64_t>::ptr g_tcp_server_recv_timeout =
+  Config::Lookup<uint64_t>("tcp_server.recv_timeout", 2 * 60 * 1000, "tcp server connection recv timeout(ms)");
+
+static ConfigVar<uint64_t>::ptr g_tcp_server_send_timeout =
+  Config::Lookup<uint64_t>("tcp_server.send_timeout", 2 * 60 * 1000, "tcp server connection send timeout(ms)");
+
+// 关闭后每个地址只有一个监听socket，由一个accept协程处理
+static ConfigVar<bool>::ptr g_tcp_server_reuse_port =
+  Config::Lookup<bool>("tcp_server.reuse_port", true, "tcp server listens with SO_REUSEPORT on every accept thread");
+
+static ConfigVar<int>::ptr g_tcp_server_backlog =
+  Config::Lookup<int>("tcp_server.backlog", SOMAXCONN, "tcp server listen backlog");
+
+TcpServer::TcpServer(IOManager* io_worker, IOManager* accept_worker)
+    : io_worker_(io_worker),
+      accept_worker_(accept_worker),
+      recv_timeout_(g_tcp_server_recv_timeout->get_value()),
+      send_timeout_(g_tcp_server_send_timeout->get_value()),
+      name_("moka/1.0.0") {
+}
+
+TcpServer::~TcpServer() {
+  for (auto& i : acceptors_) {
+    // fd信息是bind时手动加入的，不一定在hook的线程上析构，这里手动删除
+    FdMgr::GetInstance()->del(i.sock->get_socketfd());
+    i.sock->close();
+  }
+  acceptors_.clear();
+}
+
+bool TcpServer::bind(Address::ptr addr) {
+  std::vector<Address::ptr> addrs;
+  std::vector<Address::ptr> fails;
+  addrs.push_back(addr);
+  return bind(addrs, fails);
+}
+
+bool TcpServer::bind(const std::vector<Address::ptr>& addrs, std::vector<Address::ptr>& fails) {
+  // 每个调度线程一个监听socket，只有caller线程时(不在调度中)只创建一个，不固定线程
+  std::vector<pid_t> threads = accept_worker_->get_worker_thread_ids();
+  if (threads.empty()) {
+    threads.push_back(-1);
+  }
+  bool reuse_port = g_tcp_server_reuse_port->get_value();
+  int backlog = g_tcp_server_backlog->get_value();
+  for (auto& addr : addrs) {
+    size_t count = (reuse_port && addr->get_family() != AF_UNIX)? threads.size(): 1;
+    Address::ptr bind_addr = addr;
+    for (size_t i = 0; i < count; ++i) {
+      Socket::ptr sock = Socket::CreateTCP(addr);
+      if ((count > 1 && !sock->set_reuse_port()) || !sock->bind(bind_addr) || !sock->listen(backlog)) {
+        MOKA_LOG_ERROR(g_logger) << "bind fail errno=" << errno << " errstr=" << strerror(errno)
+            << " addr=[" << addr->toString() << "]";
+        fails.push_back(addr);
+        break;
+      }
+      if (i == 0) {
+        // 端口为0时由内核分配，其他socket绑定同一个端口
+        bind_addr = sock->get_local_address();
+      }
+      // 不在调度线程中创建的socket没有经过hook，这里补上fd信息(设置为非阻塞)，accept协程才能挂起等待
+      FdMgr::GetInstance()->get(sock->get_socketfd(), true);
+      acceptors_.push_back({sock, count > 1? threads[i]: -1});
+    }
+  }
+
+  if (!fails.empty()) {
+    for (auto& i : acceptors_) {
+      FdMgr::GetInstance()->del(i.sock->get_socketfd());
+      i.sock->close();
+    }
+    acceptors_.clear();
+    return false;
+  }
+
+  for (auto& i : acceptors_) {
+    MOKA_LOG_INFO(g_logger) << "server bind success: " << i.sock->get_local_address()->toString()
+        << " sockfd=" << i.sock->get_socketfd();
+  }
+  return true;
+}
+
+bool TcpServer::start() {
+  if (!is_stop_) {
+    return true;
+  }
+  is_stop_ = false;
+  for (auto& i : acceptors_) {
+    accept_worker_->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), i.sock), i.thread);
+  }
+  return true;
+}
+
+void TcpServer::stop() {
+  if (is_stop_.exchange(true)) {
+    return;
+  }
+  // shutdown会唤醒阻塞在accept上的协程(可以在任意线程调用)，之后监听socket不再接受连接
+  // socket在析构时关闭，避免accept协程退出时关闭的fd被复用后又被这里shutdown
+  for (auto& i : acceptors_) {
+    ::shutdown(i.sock->get_socketfd(), SHUT_RDWR);
+  }
+}
+
+std::vector<Socket::ptr> TcpServer::get_sockets() const {
+  std::vector<Socket::ptr> socks;
+  for (auto& i : acceptors_) {
+    socks.push_back(i.sock);
+  }
+  return socks;
+}
+
+void TcpServer::handleClient(Socket::ptr client) {
+  MOKA_LOG_INFO(g_logger) << "handleClient: " << client->get_remote_address()->toString();
+}
+
+void TcpServer::startAccept(Socket::ptr sock) {
+  while (!is_stop_) {
+    Socket::ptr client = sock->accept();
+    if (!client) {
+      continue;
+    }
+    FdCtx::ptr ctx = FdMgr::GetInstance()->get(client->get_socketfd());
+    if (ctx) {
+      ctx->set_timeout(SO_RCVTIMEO, recv_timeout_);
+      ctx->set_timeout(SO_SNDTIMEO, send_timeout_);
+    }
+    ++connections_;
+    if (io_worker_ == accept_worker_) {
+      // 连接留在accept它的线程上
+      io_worker_->schedule(std::bind(&TcpServer::runClient, shared_from_this(), client), GetThreadId());
+    } else {
+      io_worker_->schedule(std::bind(&TcpServer::runClient, shared_from_this(), client));
+    }
+  }
+}
+
+void TcpServer::runClient(Socket::ptr client) {
+  handleClient(client);
+  --connections_;
+}
+
+}
@@ -0,0 +1,78 @@
+#ifndef __MOKA_TCP_SERVER_H__
+#define __MOKA_TCP_SERVER_H__
+
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <string>
+
+#include "address.h"
+#include "iomanager.h"
+#include "socket.h"
+#include "noncopyable.h"
+
+namespace moka {
+
+// TCP服务器: 绑定一组地址，在accept调度器的每个调度线程上各运行一个accept协程
+// 开启tcp_server.reuse_port时每个地址为每个调度线程创建一个SO_REUSEPORT的监听socket，
+// 由内核在这些socket之间分发连接，accept协程固定在各自的线程上，
+// io调度器与accept调度器相同时新连接也留在accept它的线程上处理(不跨线程)
+// 必须用shared_ptr管理(accept协程和连接处理协程持有服务器的引用)
+class TcpServer : public std::enable_shared_from_this<TcpServer>, Noncopyable {
+ public:
+  using ptr = std::shared_ptr<TcpServer>;
+
+  TcpServer(IOManager* io_worker = IOManager::GetThis(),
+            IOManager* accept_worker = IOManager::GetThis());
+  virtual ~TcpServer();
+
+  // 绑定并监听地址，失败返回false
+  virtual bool bind(Address::ptr addr);
+  // 绑定并监听一组地址，失败的地址放入fails，有失败时已经绑定的地址也会释放
+  virtual bool bind(const std::vector<Address::ptr>& addrs, std::vector<Address::ptr>& fails);
+  // 启动accept协程
+  virtual bool start();
+  // 停止accept并关闭监听socket，已经建立的连接继续处理(handleClient中可以通过is_stop判断是否需要结束)
+  virtual void stop();
+
+  uint64_t get_recv_timeout() const { return recv_timeout_; }
+  void set_recv_timeout(uint64_t v) { recv_timeout_ = v; }
+  uint64_t get_send_timeout() const { return send_timeout_; }
+  void set_send_timeout(uint64_t v) { send_timeout_ = v; }
+  const std::string& get_name() const { return name_; }
+  void set_name(const std::string& v) { name_ = v; }
+  bool is_stop() const { return is_stop_; }
+  // 正在处理的连接数
+  size_t get_connections() const { return connections_; }
+  // 监听socket(开启reuse_port时同一个地址有多个)
+  std::vector<Socket::ptr> get_sockets() const;
+
+ protected:
+  // 处理新连接，子类重写(默认直接关闭连接)
+  virtual void handleClient(Socket::ptr client);
+  // accept协程
+  virtual void startAccept(Socket::ptr sock);
+
+ private:
+  void runClient(Socket::ptr client);
+
+ private:
+  // 监听socket和运行其accept协程的线程(-1表示不指定)
+  struct Acceptor {
+    Socket::ptr sock;
+    int thread;
+  };
+
+  std::vector<Acceptor> acceptors_;
+  IOManager* io_worker_;                   // 处理连接的调度器
+  IOManager* accept_worker_;               // 运行accept协程的调度器
+  uint64_t recv_timeout_;                  // 连接的接收超时时间(毫秒)
+  uint64_t send_timeout_;                  // 连接的发送超时时间(毫秒)
+  std::string name_;
+  std::atomic<bool> is_stop_ = {true};
+  std::atomic<size_t> connections_ = {0};
+};
+
+}
+
+#endif
@@ -1,9 +1,15 @@
+#include <string.h>
+#include <algorithm>
+
 #include "timer.h"
 #include "util.h"
 #include "log.h"
+#include "config.h"
 
 namespace moka {
 
+static ConfigVar<bool>::ptr g_timer_wheel =
+  Config::Lookup<bool>("timer.wheel", false, "timer manager use hierarchical timing wheel instead of set");
 
 Timer::Timer(uint64_t interval, std::function<void()> cb, bool recur, TimerManager* manager) 
     : recur_(recur), interval_(interval), cb_(cb), manager_(manager) {
@@ -11,8 +17,6 @@ Timer::Timer(uint64_t interval, std::function<void()> cb, bool recur, TimerManag
   expire_ = moka::GetCurrentMs() + interval_;
 }
 
-Timer::Timer(uint64_t expire) : expire_(expire) {}
-
 bool Timer::Comparator::operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const {
   // 由小到大排序
   if (lhs == nullptr && rhs == nullptr) {
@@ -38,8 +42,7 @@ bool Timer::cancel() {
   RWmutex::WriteLock lock(manager_->mutex_);
   if (cb_) {
     cb_ = nullptr;
-    auto it = manager_->timers_.find(shared_from_this());
-    manager_->timers_.erase(it);
+    manager_->eraseTimer(this);
     return true;
   }
   // 已经超时的定时器会自动erase
@@ -53,17 +56,18 @@ bool Timer::resetExpire() {
     // 已经超时的定时器不能重新设置到期时间(在listAllCbs中被设置)
     return false;
   }
-  auto it = manager_->timers_.find(shared_from_this());
-  if (it == manager_->timers_.end()) {
+  // 这里不能直接修改set中排序的key，得先删除再添加
+  // 还在邮箱中的定时器可以直接修改，加入定时器堆时使用新的到期时间
+  if (!posted_ && !manager_->eraseTimer(this)) {
     // 当前定时器不在定时堆中
     return false;
   }
-  // 这里不能直接修改set中排序的key，得先删除再添加
-  manager_->timers_.erase(it);
   // 更新当前定时器的到期时间
   // 等价于resetIntervalAndExpire(interval_, true);
   this->expire_ = moka::GetCurrentMs() + interval_;
-  manager_->timers_.insert(shared_from_this());
+  if (!posted_) {
+    manager_->insertTimer(shared_from_this());
+  }
   return true;
 }
 
@@ -78,12 +82,10 @@ bool Timer::resetIntervalAndExpire(uint64_t interval, bool from_now) {
     return false;
   }
 
-  // 从定时器堆中找到当前定时器
-  auto it = manager_->timers_.find(shared_from_this());
-  if (it == manager_->timers_.end()) {
+  // 从定时器堆中删除当前定时器
+  if (!posted_ && !manager_->eraseTimer(this)) {
     return false;
   }
-  manager_->timers_.erase(it);
   uint64_t start = 0;
   // 获取定时器的设置的时间点
   if (from_now) {
@@ -97,17 +99,216 @@ bool Timer::resetIntervalAndExpire(uint64_t interval, bool from_now) {
   // 更新到期时间
   this->expire_ = start + interval_;
   // 将重置的定时器加入定时堆中
-  this->manager_->addTimer(shared_from_this());
+  if (!posted_) {
+    this->manager_->addTimer(shared_from_this());
+  }
   return true;
 }
 
 
+TimerWheel::TimerWheel(uint64_t now_ms) : current_(now_ms) {
+  memset(slots_, 0, sizeof(slots_));
+  memset(bitmap_, 0, sizeof(bitmap_));
+}
+
+TimerWheel::~TimerWheel() {
+  // 释放定时器对自身的引用
+  std::vector<Timer::ptr> timers;
+  removeAll(timers);
+}
+
+int TimerWheel::slotFor(uint64_t expire) const {
+  // 已经到期的定时器放到下一个要处理的槽中
+  if (expire < current_) {
+    expire = current_;
+  }
+  uint64_t delta = expire - current_;
+  if (delta < kRootSize) {
+    return slotOf(0, expire & (kRootSize - 1));
+  }
+  if (delta > UINT32_MAX) {
+    // 超出时间轮的范围，先放在最高层，降级时会重新计算位置
+    expire = current_ + UINT32_MAX;
+    delta = UINT32_MAX;
+  }
+  int level = 1;
+  while (delta >= (1ull << (shiftOf(level) + kLevelBits))) {
+    ++level;
+  }
+  return slotOf(level, (expire >> shiftOf(level)) & (kLevelSize - 1));
+}
+
+void TimerWheel::link(Timer* timer, int slot) {
+  // 插入到槽的链表头部
+  timer->wheel_slot_ = slot;
+  timer->wheel_prev_ = nullptr;
+  timer->wheel_next_ = slots_[slot];
+  if (slots_[slot]) {
+    slots_[slot]->wheel_prev_ = timer;
+  }
+  slots_[slot] = timer;
+  bitmap_[slot >> 6] |= 1ull << (slot & 63);
+}
+
+Timer* TimerWheel::takeSlot(int slot) {
+  Timer* head = slots_[slot];
+  slots_[slot] = nullptr;
+  bitmap_[slot >> 6] &= ~(1ull << (slot & 63));
+  return head;
+}
+
+void TimerWheel::add(const Timer::ptr& timer) {
+  link(timer.get(), slotFor(timer->expire_));
+  timer->wheel_self_ = timer;
+  ++size_;
+}
+
+void TimerWheel::remove(Timer* timer) {
+  int slot = timer->wheel_slot_;
+  if (timer->wheel_prev_) {
+    timer->wheel_prev_->wheel_next_ = timer->wheel_next_;
+  } else {
+    slots_[slot] = timer->wheel_next_;
+  }
+  if (timer->wheel_next_) {
+    timer->wheel_next_->wheel_prev_ = timer->wheel_prev_;
+  }
+  if (!slots_[slot]) {
+    bitmap_[slot >> 6] &= ~(1ull << (slot & 63));
+  }
+  timer->wheel_slot_ = -1;
+  timer->wheel_prev_ = nullptr;
+  timer->wheel_next_ = nullptr;
+  --size_;
+  // 最后才释放引用(可能是最后一个引用)
+  Timer::ptr self;
+  self.swap(timer->wheel_self_);
+}
+
+int TimerWheel::findSlot(int level, int from) const {
+  int base = slotOf(level, 0);
+  int size = level == 0? kRootSize: kLevelSize;
+  // 每一层在位图中都是按64位对齐的
+  for (int i = from; i < size;) {
+    int g = base + i;
+    uint64_t word = bitmap_[g >> 6] >> (g & 63);
+    if (word) {
+      return i + __builtin_ctzll(word);
+    }
+    i += 64 - (g & 63);
+  }
+  return -1;
+}
+
+uint64_t TimerWheel::nextExpire() const {
+  if (size_ == 0) {
+    return UINT64_MAX;
+  }
+  int idx = current_ & (kRootSize - 1);
+  uint64_t base = current_ - idx;
+  // 第0层在这一圈内的定时器一定比其他层的早
+  int slot = findSlot(0, idx);
+  if (slot >= 0) {
+    return base + slot;
+  }
+  uint64_t next = UINT64_MAX;
+  slot = findSlot(0, 0);
+  if (slot >= 0) {
+    next = base + kRootSize + slot;
+  }
+  // 其他层返回槽降级的时间点
+  for (int level = 1; level < kLevels; ++level) {
+    int shift = shiftOf(level);
+    uint64_t span = current_ >> shift;
+    int cur = span & (kLevelSize - 1);
+    slot = findSlot(level, cur + 1);
+    if (slot >= 0) {
+      next = std::min(next, (span - cur + slot) << shift);
+      continue;
+    }
+    slot = findSlot(level, 0);
+    if (slot >= 0) {
+      next = std::min(next, (span - cur + kLevelSize + slot) << shift);
+    }
+  }
+  return next;
+}
+
+void TimerWheel::cascade(uint64_t tick) {
+  for (int level = 1; level < kLevels; ++level) {
+    int idx = (tick >> shiftOf(level)) & (kLevelSize - 1);
+    Timer* timer = takeSlot(slotOf(level, idx));
+    while (timer) {
+      Timer* next = timer->wheel_next_;
+      link(timer, slotFor(timer->expire_));
+      timer = next;
+    }
+    if (idx != 0) {
+      // 当前层还没有转完一圈，更高层不需要降级
+      break;
+    }
+  }
+}
+
+void TimerWheel::advance(uint64_t now_ms, std::vector<Timer::ptr>& expired) {
+  while (current_ <= now_ms) {
+    if (size_ == 0) {
+      current_ = now_ms + 1;
+      break;
+    }
+    int idx = current_ & (kRootSize - 1);
+    if (idx == 0) {
+      cascade(current_);
+    }
+    Timer* timer = takeSlot(slotOf(0, idx));
+    while (timer) {
+      Timer* next = timer->wheel_next_;
+      timer->wheel_slot_ = -1;
+      timer->wheel_prev_ = nullptr;
+      timer->wheel_next_ = nullptr;
+      expired.push_back(std::move(timer->wheel_self_));
+      --size_;
+      timer = next;
+    }
+    // 跳过第0层中的空槽，但不能跳过下一次降级的时间点
+    int slot = findSlot(0, idx + 1);
+    uint64_t target = current_ - idx + (slot < 0? kRootSize: slot);
+    current_ = std::min(target, now_ms + 1);
+  }
+}
+
+void TimerWheel::removeAll(std::vector<Timer::ptr>& timers) {
+  for (int slot = 0; slot < kSlots; ++slot) {
+    Timer* timer = takeSlot(slot);
+    while (timer) {
+      Timer* next = timer->wheel_next_;
+      timer->wheel_slot_ = -1;
+      timer->wheel_prev_ = nullptr;
+      timer->wheel_next_ = nullptr;
+      timers.push_back(std::move(timer->wheel_self_));
+      timer = next;
+    }
+  }
+  size_ = 0;
+}
+
+
 TimerManager::TimerManager() {
   // 记录定时器管理器创建时的系统时间点(方便检测系统时间是否被调整)
   previous_time_ = moka::GetCurrentMs();
+  if (g_timer_wheel->get_value()) {
+    wheel_.reset(new TimerWheel(previous_time_));
+  }
 }
 
-TimerManager::~TimerManager() {}
+TimerManager::~TimerManager() {
+  PostedTimer* node = posted_.exchange(nullptr);
+  while (node) {
+    PostedTimer* next = node->next;
+    delete node;
+    node = next;
+  }
+}
 
 Timer::ptr TimerManager::addTimer(uint64_t interval, std::function<void()> cb, bool recur) {
   Timer::ptr timer(new Timer(interval, cb, recur, this));
@@ -117,10 +318,18 @@ Timer::ptr TimerManager::addTimer(uint64_t interval, std::function<void()> cb, b
 }
 
 void TimerManager::addTimer(Timer::ptr timer) {
-  // insert::first获取到插入位置的迭代器
-  auto it = timers_.insert(timer).first;
-  // 插入到最前面说明时间是最早的定时器
-  bool at_front = (it == timers_.begin()) && !ticked_;
+  bool at_front = false;
+  if (wheel_) {
+    // 比时间轮中最近需要处理的时间点还早
+    at_front = timer->expire_ < wheel_->nextExpire();
+    wheel_->add(timer);
+  } else {
+    // insert::first获取到插入位置的迭代器
+    auto it = timers_.insert(timer).first;
+    // 插入到最前面说明时间是最早的定时器
+    at_front = (it == timers_.begin());
+  }
+  at_front = at_front && !ticked_;
   if (at_front) {
     ticked_ = true;
   }
@@ -131,6 +340,70 @@ void TimerManager::addTimer(Timer::ptr timer) {
   }
 }
 
+Timer::ptr TimerManager::postTimer(uint64_t interval, std::function<void()> cb, bool recur) {
+  Timer::ptr timer(new Timer(interval, cb, recur, this));
+  timer->posted_ = true;
+  PostedTimer* node = new PostedTimer;
+  node->timer = timer;
+  node->next = posted_.load(std::memory_order_relaxed);
+  while (!posted_.compare_exchange_weak(node->next, node,
+                                        std::memory_order_release, std::memory_order_relaxed)) {
+  }
+  // 不知道是否是最早的定时器，总是通知处理定时器的线程
+  onTimerInsertedAtFront();
+  return timer;
+}
+
+void TimerManager::drainPosted() {
+  if (!posted_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  PostedTimer* node = posted_.exchange(nullptr, std::memory_order_acquire);
+  // 栈中的顺序和添加的顺序相反，先反转
+  PostedTimer* head = nullptr;
+  while (node) {
+    PostedTimer* next = node->next;
+    node->next = head;
+    head = node;
+    node = next;
+  }
+  RWmutex::WriteLock lock(mutex_);
+  while (head) {
+    PostedTimer* next = head->next;
+    head->timer->posted_ = false;
+    if (head->timer->cb_) {
+      // 加入定时器堆之前已经被cancel的定时器直接丢弃
+      addTimer(head->timer);
+    }
+    delete head;
+    head = next;
+  }
+}
+
+void TimerManager::insertTimer(const Timer::ptr& timer) {
+  if (wheel_) {
+    wheel_->add(timer);
+  } else {
+    timers_.insert(timer);
+  }
+}
+
+bool TimerManager::eraseTimer(Timer* timer) {
+  if (wheel_) {
+    if (!wheel_->contains(timer)) {
+      return false;
+    }
+    wheel_->remove(timer);
+    return true;
+  }
+  auto it = timers_.find(timer->shared_from_this());
+  if (it == timers_.end()) {
+    return false;
+  }
+  timers_.erase(it);
+  return true;
+}
+
 static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
   // 将weak_ptr转换shared_ptr，并增加引用计数
   std::shared_ptr<void> tmp = weak_cond.lock();
@@ -150,19 +423,25 @@ uint64_t TimerManager::get_expire() {
   RWmutex::ReadLock lock(mutex_);
   // 即将更新epoll_wait等待的时间时，即可以继续触发onTimerIntertedAtFront
   ticked_ = false;
-  if (timers_.empty()) {
+  uint64_t expire = UINT64_MAX;
+  if (wheel_) {
+    // 时间轮返回的可能是高层的槽降级的时间点，提前醒来只会多推进一次时间轮
+    expire = wheel_->nextExpire();
+  } else if (!timers_.empty()) {
+    // 获取最近一个定时器(定时器堆是有序的按绝对到期时间由小到大排序)
+    expire = (*timers_.begin())->expire_;
+  }
+  if (expire == UINT64_MAX) {
     return UINT64_MAX;  // 返回一个最大值(表示没有定时器)
   }
-  
-  // 获取最近一个定时器(定时器堆是有序的按绝对到期时间由小到大排序)
-  const Timer::ptr& cur = *timers_.begin();
+
   uint64_t now_ms = moka::GetCurrentMs();
-  if (now_ms >= cur->expire_) {
+  if (now_ms >= expire) {
     // 定时器已经超时，说明该定时器未执行(在epoll事件循环中epoll_wait会立刻返回)
     return 0;
   } else {
     // 返回当前时间到最近一个定时器的到期时间的间隔
-    return cur->expire_ - now_ms;
+    return expire - now_ms;
   }
 }
 
@@ -170,47 +449,46 @@ uint64_t TimerManager::get_expire() {
 void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs) {
   uint64_t now_ms = moka::GetCurrentMs();
   std::vector<Timer::ptr> expired;
-  {
-    RWmutex::ReadLock lock(mutex_);
-    if (timers_.empty()) {
-      // 定时器堆为空直接返回
-      return;
-    }
+  if (!hasTimer()) {
+    // 定时器堆为空直接返回
+    return;
   }
   RWmutex::WriteLock lock(mutex_);
   bool rollover = detectClockRollover(now_ms);
-  // ->优先级比*高
-  if (!rollover && (*(timers_.begin()))->expire_ > now_ms) {
-    // 如果没有超时的定时器，且没有计算机本地时间没有发生变动
-    return;
-  }
-
-  // 使用当前时间初始化一个定时器，用于lower_bound的比较
-  Timer::ptr now_timer(new Timer(now_ms));
-  // 使用Timer的比较器进行比较(因为在set中已经指定了比较器)
-  // 比较expire(即找到第一个到期的定时器)
-  // 找到第一个小于等于now_timer的Timer对象的迭代器
-
-  // 如果系统时间发生了调整到一个小时之前，则触发全部定时器
-  auto it = rollover? timers_.end(): timers_.lower_bound(now_timer);
-  while (it != timers_.end() && (*it)->expire_ == now_ms) {
-    // 继续向后移动迭代器，直到找到一个定时器的时间大于now_timer
-    ++it;
+  if (wheel_) {
+    if (rollover) {
+      // 系统时间被调整到一个小时之前，触发全部定时器并以现在的时间重建时间轮
+      wheel_->removeAll(expired);
+      wheel_.reset(new TimerWheel(now_ms));
+    } else {
+      wheel_->advance(now_ms, expired);
+    }
+  } else {
+    // ->优先级比*高
+    if (timers_.empty() || (!rollover && (*(timers_.begin()))->expire_ > now_ms)) {
+      // 如果没有超时的定时器，且没有计算机本地时间没有发生变动
+      return;
+    }
+    // 找到第一个到期时间大于now_ms的定时器
+    // 如果系统时间发生了调整到一个小时之前，则触发全部定时器
+    auto it = timers_.begin();
+    while (it != timers_.end() && (rollover || (*it)->expire_ <= now_ms)) {
+      ++it;
+    }
+    // 将小于等于当前到期时间的定时器都加入到返回的定时器列表中(范围插入)
+    expired.insert(expired.begin(), timers_.begin(), it);
+    // 更新定时器堆(范围删除)
+    timers_.erase(timers_.begin(), it);
   }
-  // 将timers_数组中[begin, it)插入到expire中
-  // 将小于等于当前到期时间的定时器都加入到返回的定时器列表中(范围插入)
-  expired.insert(expired.begin(), timers_.begin(), it);
-  // 更新定时器堆(范围删除)
-  timers_.erase(timers_.begin(), it);
 
-  cbs.reserve(expired.size());
+  cbs.reserve(cbs.size() + expired.size());
   // 将超时定时器的回调函数放入传出参数中
   for (auto& timer : expired) {
     cbs.push_back(timer->cb_);
     if (timer->recur_) {
       // 如果是循环定时，再将其插入到定时器堆中
       timer->expire_ = now_ms + timer->interval_;
-      timers_.insert(timer);
+      insertTimer(timer);
     } else {
       // 因为function可能使用智能指针来进行管理，置为nullptr可以减少其引用计数
       timer->cb_ = nullptr;
@@ -233,8 +511,11 @@ bool TimerManager::detectClockRollover(uint64_t now_ms) {
 }
 
 bool TimerManager::hasTimer() {
+  if (posted_.load(std::memory_order_relaxed)) {
+    return true;
+  }
   RWmutex::ReadLock lock(mutex_);
-  return !timers_.empty();
+  return wheel_? !wheel_->empty(): !timers_.empty();
 }
 
-}
\ No newline at end of file
+}
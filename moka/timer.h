@@ -2,6 +2,7 @@
 #define __MOKA_TIMER_H__
 
 #include <memory>
+#include <atomic>
 #include <set>
 #include <functional>
 #include <vector>
@@ -11,9 +12,11 @@
 namespace moka {
 
 class TimerManager;
+class TimerWheel;
 
 class Timer : public std::enable_shared_from_this<Timer> {
   friend class TimerManager;
+  friend class TimerWheel;
  public:
   using ptr = std::shared_ptr<Timer>;
   bool cancel();                                      // 从定时器堆中移除当前定时器
@@ -23,7 +26,6 @@ class Timer : public std::enable_shared_from_this<Timer> {
 
  private:
   Timer(uint64_t interval, std::function<void()> cb, bool recur, TimerManager* manager);
-  Timer(uint64_t expire);             // 用于lower_bound的比较(比较时只关心到期时间)
 
  private:
   bool recur_ = false;                // 是否循环定时
@@ -31,12 +33,70 @@ class Timer : public std::enable_shared_from_this<Timer> {
   uint64_t expire_ = 0;               // 到期时间(绝对时间)
   std::function<void()> cb_;          // 回调函数
   TimerManager* manager_ = nullptr;   // 定时器管理器
+  bool posted_ = false;               // 是否还在TimerManager的邮箱中(没有加入定时器堆)
+  // 时间轮使用的侵入式双向链表(不在时间轮中时wheel_slot_为-1)
+  Timer* wheel_prev_ = nullptr;
+  Timer* wheel_next_ = nullptr;
+  int wheel_slot_ = -1;
+  Timer::ptr wheel_self_;             // 在时间轮中时持有自身的引用(等价于set中保存的智能指针)
   // set比较器(根据绝对到期时间)
   struct Comparator {
     bool operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const;
   };
 };
 
+// 分层时间轮(毫秒精度)，插入和删除都是O(1)
+// 第0层256个槽，每个槽1ms；第1~4层各64个槽，每个槽的跨度依次为2^8/2^14/2^20/2^26ms
+// 高层的槽在低层转完一圈时降级(cascade)到低层，超过2^32ms(约49天)的定时器先放在最高层
+// 不加锁，由TimerManager的锁保护
+class TimerWheel {
+ public:
+  TimerWheel(uint64_t now_ms);
+  ~TimerWheel();
+
+  void add(const Timer::ptr& timer);
+  void remove(Timer* timer);
+  bool contains(const Timer* timer) const { return timer->wheel_slot_ >= 0; }
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+  // 最近一个需要处理的时间点(绝对时间)，可能早于实际的到期时间(高层的槽降级的时间)，没有定时器时返回UINT64_MAX
+  uint64_t nextExpire() const;
+  // 推进时间轮到now_ms，将到期的定时器放入expired
+  void advance(uint64_t now_ms, std::vector<Timer::ptr>& expired);
+  // 取出所有的定时器(时间回滚时使用)
+  void removeAll(std::vector<Timer::ptr>& timers);
+
+ private:
+  static const int kLevels = 5;
+  static const int kRootBits = 8;
+  static const int kLevelBits = 6;
+  static const int kRootSize = 1 << kRootBits;
+  static const int kLevelSize = 1 << kLevelBits;
+  static const int kSlots = kRootSize + (kLevels - 1) * kLevelSize;
+
+  // 根据到期时间计算定时器应该放在哪个槽
+  int slotFor(uint64_t expire) const;
+  void link(Timer* timer, int slot);
+  // 取出一个槽中的所有定时器，返回链表头
+  Timer* takeSlot(int slot);
+  // 第level层的时间跨度的位移
+  static int shiftOf(int level) { return kRootBits + (level - 1) * kLevelBits; }
+  // 第level层第idx个槽的全局下标
+  static int slotOf(int level, int idx) {
+    return level == 0? idx: kRootSize + (level - 1) * kLevelSize + idx;
+  }
+  // 在第level层的占用位图中查找[from, size)中第一个非空槽，没有时返回-1
+  int findSlot(int level, int from) const;
+  void cascade(uint64_t tick);
+
+ private:
+  uint64_t current_;                    // 下一个要处理的时间点(毫秒)
+  size_t size_ = 0;
+  Timer* slots_[kSlots];
+  // 每个槽是否非空，第0层4个字，其余每层1个字
+  uint64_t bitmap_[kRootSize / 64 + kLevels - 1];
+};
+
 class TimerManager {
  friend class Timer;
  public:
@@ -48,20 +108,35 @@ class TimerManager {
   // 当条件存在时才触发
   Timer::ptr addConditionalTimer(uint64_t interval, std::function<void()> cb,
           std::weak_ptr<void> weak_cond, bool recur = false);
+  // 从其他线程添加定时器: 先放入无锁邮箱，由处理定时器的线程调用drainPosted之后才加入定时器堆
+  // 加入定时器堆之前也可以cancel/reset
+  Timer::ptr postTimer(uint64_t interval, std::function<void()> cb, bool recur = false);
   uint64_t get_expire();                                        // 获取当前时间到"最近一个"定时器的到期时间的间隔
   void listExpiredCb(std::vector<std::function<void()>>& cbs);  // 获取已经超时的定时器的回调函数列表，作为传出参数
   
  protected:
   virtual void onTimerInsertedAtFront() = 0;         // 当有新的定时器插入到定时器首部，执行该函数
   void addTimer(Timer::ptr timer);                   // 往定时器堆中加入定时器(可以供有条件和无条件版本使用)
-  bool hasTimer();                                   // 定时器堆中是否存在定时器
+  bool hasTimer();                                   // 定时器堆(包括邮箱)中是否存在定时器
+  void drainPosted();                                // 将邮箱中的定时器加入定时器堆
  private:
+  // 邮箱中的节点(多生产者单消费者的无锁栈)
+  struct PostedTimer {
+    Timer::ptr timer;
+    PostedTimer* next = nullptr;
+  };
+
   // 检测电脑的时间改变，并适应
   bool detectClockRollover(uint64_t now_ms);
+  // 根据使用的实现插入/删除定时器(需要持有写锁)
+  void insertTimer(const Timer::ptr& timer);
+  bool eraseTimer(Timer* timer);
  private:
   RWmutex mutex_;
   // set自定义比较器类
   std::set<Timer::ptr, Timer::Comparator> timers_;  // 定时器最小堆
+  std::unique_ptr<TimerWheel> wheel_;     // 配置timer.wheel为true时使用时间轮代替set
+  std::atomic<PostedTimer*> posted_ = {nullptr};  // 其他线程添加的定时器
   bool ticked_ = false;                   // 避免还没更新epoll定时时间时就频繁触发onTimerInsertedAtFront
   uint64_t previous_time_ = 0;            // 记录创建定时管理器时的系统时间
 };
@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+#include "log.h"
+
+namespace moka {
+
+static moka::Logger::ptr g_logger = MOKA_LOG_NAME("system");
+
+static int sys_io_uring_setup(uint32_t entries, io_uring_params* p) {
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_register(int fd, uint32_t opcode, void* arg, uint32_t nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int sys_io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+                              uint32_t flags, const void* arg, size_t argsz) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+IoUring::~IoUring() {
+  if (sqes_) {
+    munmap(sqes_, sq_entries_ * sizeof(io_uring_sqe));
+  }
+  if (cq_ring_ && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_) {
+    munmap(sq_ring_, sq_ring_size_);
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+}
+
+bool IoUring::init(uint32_t entries) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd_ = sys_io_uring_setup(entries, &params);
+  if (ring_fd_ < 0) {
+    MOKA_LOG_ERROR(g_logger) << "io_uring_setup(" << entries << ") errno="
+                             << errno << " errstr=" << strerror(errno);
+    return false;
+  }
+  // 等待时的超时时间需要通过IORING_ENTER_EXT_ARG传递(5.11)
+  if (!(params.features & IORING_FEAT_EXT_ARG)) {
+    MOKA_LOG_ERROR(g_logger) << "io_uring not support IORING_FEAT_EXT_ARG features="
+                             << params.features;
+    return false;
+  }
+  sq_entries_ = params.sq_entries;
+  cq_entries_ = params.cq_entries;
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap && cq_ring_size_ > sq_ring_size_) {
+    sq_ring_size_ = cq_ring_size_;
+  }
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    sq_ring_ = nullptr;
+    MOKA_LOG_ERROR(g_logger) << "io_uring mmap sq ring errno=" << errno
+                             << " errstr=" << strerror(errno);
+    return false;
+  }
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      cq_ring_ = nullptr;
+      MOKA_LOG_ERROR(g_logger) << "io_uring mmap cq ring errno=" << errno
+                               << " errstr=" << strerror(errno);
+      return false;
+    }
+  }
+  void* sqes = mmap(nullptr, sq_entries_ * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    MOKA_LOG_ERROR(g_logger) << "io_uring mmap sqes errno=" << errno
+                             << " errstr=" << strerror(errno);
+    return false;
+  }
+  sqes_ = (io_uring_sqe*)sqes;
+
+  char* sq = (char*)sq_ring_;
+  sq_head_ = (uint32_t*)(sq + params.sq_off.head);
+  sq_tail_ = (uint32_t*)(sq + params.sq_off.tail);
+  sq_mask_ = *(uint32_t*)(sq + params.sq_off.ring_mask);
+  sq_array_ = (uint32_t*)(sq + params.sq_off.array);
+  // sq数组与sqe一一对应，之后不再修改
+  for (uint32_t i = 0; i < sq_entries_; ++i) {
+    sq_array_[i] = i;
+  }
+  sqe_tail_ = *sq_tail_;
+
+  char* cq = (char*)cq_ring_;
+  cq_head_ = (uint32_t*)(cq + params.cq_off.head);
+  cq_tail_ = (uint32_t*)(cq + params.cq_off.tail);
+  cq_mask_ = *(uint32_t*)(cq + params.cq_off.ring_mask);
+  cqes_ = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+  // 查询内核支持的操作码
+  static const uint32_t s_probe_ops = 256;
+  size_t probe_size = sizeof(io_uring_probe) + s_probe_ops * sizeof(io_uring_probe_op);
+  io_uring_probe* probe = (io_uring_probe*)calloc(1, probe_size);
+  if (sys_io_uring_register(ring_fd_, IORING_REGISTER_PROBE, probe, s_probe_ops) == 0) {
+    for (uint32_t i = 0; i < probe->ops_len && i < s_probe_ops; ++i) {
+      if (probe->ops[i].flags & IO_URING_OP_SUPPORTED) {
+        ops_[probe->ops[i].op / 64] |= 1ull << (probe->ops[i].op % 64);
+      }
+    }
+  } else {
+    // 无法查询时认为都支持，不支持的操作由调用者根据-EINVAL退回
+    MOKA_LOG_ERROR(g_logger) << "io_uring probe errno=" << errno << " errstr=" << strerror(errno);
+    memset(ops_, 0xff, sizeof(ops_));
+  }
+  free(probe);
+  return true;
+}
+
+io_uring_sqe* IoUring::getSqe() {
+  if (!space()) {
+    return nullptr;
+  }
+  io_uring_sqe* sqe = &sqes_[sqe_tail_ & sq_mask_];
+  ++sqe_tail_;
+  memset(sqe, 0, sizeof(io_uring_sqe));
+  return sqe;
+}
+
+uint32_t IoUring::space() const {
+  uint32_t head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  return sq_entries_ - (sqe_tail_ - head);
+}
+
+void IoUring::flush() {
+  // release保证内核看到tail时sqe已经填充完成
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+}
+
+int IoUring::enter(uint32_t wait_nr, uint64_t timeout_ms) {
+  uint32_t flags = 0;
+  io_uring_getevents_arg arg;
+  __kernel_timespec ts;
+  memset(&arg, 0, sizeof(arg));
+  if (wait_nr) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = timeout_ms % 1000 * 1000000;
+    arg.ts = (uint64_t)&ts;
+    flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+  }
+  // to_submit必须是实际待提交的数量，内核提交的数量少于to_submit时不会等待完成事件
+  // (多个线程同时enter时其中一个可能提交不到请求而直接返回，调用者会重新进入)
+  uint32_t to_submit = __atomic_load_n(sq_tail_, __ATOMIC_RELAXED)
+                       - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  int ret = sys_io_uring_enter(ring_fd_, to_submit, wait_nr, flags,
+                               wait_nr? &arg: nullptr, wait_nr? sizeof(arg): 0);
+  if (ret < 0) {
+    if (errno == EINTR || errno == ETIME || errno == EBUSY || errno == EAGAIN) {
+      return 0;
+    }
+    MOKA_LOG_ERROR(g_logger) << "io_uring_enter(" << ring_fd_ << ", " << wait_nr
+                             << ") errno=" << errno << " errstr=" << strerror(errno);
+  }
+  return ret;
+}
+
+uint32_t IoUring::peekCqes(io_uring_cqe* cqes, uint32_t max) {
+  uint32_t head = *cq_head_;
+  uint32_t tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  uint32_t n = 0;
+  while (head != tail && n < max) {
+    cqes[n++] = cqes_[head & cq_mask_];
+    ++head;
+  }
+  if (n) {
+    // 释放cq中的位置给内核
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+  return n;
+}
+
+}
@@ -0,0 +1,68 @@
+#ifndef __MOKA_URING_H__
+#define __MOKA_URING_H__
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "noncopyable.h"
+
+namespace moka {
+
+// io_uring的简单封装(直接使用系统调用，不依赖liburing)
+// sq的生产者需要外部加锁(getSqe/flush/space)，cq的消费者也需要外部加锁(peekCqes)
+// enter可以由多个线程同时调用
+class IoUring : public Noncopyable {
+ public:
+  IoUring() = default;
+  ~IoUring();
+
+  // 创建io_uring实例，entries为sq的长度，内核不支持时返回false
+  bool init(uint32_t entries);
+
+  // 获取一个空闲的sqe(已经清零)，sq已满时返回nullptr
+  io_uring_sqe* getSqe();
+  // sq中剩余的空闲sqe数量
+  uint32_t space() const;
+  // 将getSqe获取并填充好的sqe对内核可见(调用enter时才会真正提交)
+  void flush();
+
+  // 提交sq中所有的请求，wait_nr不为0时最多等待timeout_ms毫秒直到至少有wait_nr个完成事件
+  // 返回提交的请求数量，失败返回-1(被信号中断或者超时不算失败)
+  int enter(uint32_t wait_nr, uint64_t timeout_ms);
+
+  // 从cq中取出最多max个完成事件，返回取出的数量
+  uint32_t peekCqes(io_uring_cqe* cqes, uint32_t max);
+
+  // 内核是否支持该操作码(旧内核或者受限的环境会以-EINVAL拒绝不支持的操作)
+  bool supportsOp(uint8_t opcode) const { return ops_[opcode / 64] & (1ull << (opcode % 64)); }
+
+ private:
+  int ring_fd_ = -1;
+  uint32_t sq_entries_ = 0;
+  uint32_t cq_entries_ = 0;
+
+  // sq环形队列
+  void* sq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  uint32_t* sq_head_ = nullptr;    // 内核修改
+  uint32_t* sq_tail_ = nullptr;    // 用户修改
+  uint32_t sq_mask_ = 0;
+  uint32_t* sq_array_ = nullptr;
+  io_uring_sqe* sqes_ = nullptr;
+  uint32_t sqe_tail_ = 0;          // 已经获取但还没有flush的sqe的尾部
+
+  // cq环形队列(内核支持IORING_FEAT_SINGLE_MMAP时与sq共用一块映射)
+  void* cq_ring_ = nullptr;
+  size_t cq_ring_size_ = 0;
+  uint32_t* cq_head_ = nullptr;    // 用户修改
+  uint32_t* cq_tail_ = nullptr;    // 内核修改
+  uint32_t cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+
+  uint64_t ops_[4] = {0};          // 支持的操作码(IORING_REGISTER_PROBE)
+};
+
+}
+
+#endif
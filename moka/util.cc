@@ -8,15 +8,28 @@
 namespace moka {
 static moka::Logger::ptr g_logger = MOKA_LOG_NAME("system");
 
+// 线程id缓存在线程局部变量中，避免每次调用gettid系统调用(日志每条都会获取)
+static thread_local pid_t t_thread_id = 0;
+
+static void reset_thread_id() {
+  // fork后子进程中的线程id变了
+  t_thread_id = 0;
+}
+
 pid_t GetThreadId() {
-  return syscall(SYS_gettid);
+  if (__builtin_expect(t_thread_id == 0, 0)) {
+    static int s_atfork = pthread_atfork(nullptr, nullptr, reset_thread_id);
+    (void)s_atfork;
+    t_thread_id = syscall(SYS_gettid);
+  }
+  return t_thread_id;
 }
 
 uint64_t GetFiberId() {
   return moka::Fiber::GetFiberId();
 }
 
-std::string GetThreadName() {
+const std::string& GetThreadName() {
   return moka::Thread::GetName();
 }
 
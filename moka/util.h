@@ -12,7 +12,7 @@
 namespace moka {
 pid_t GetThreadId();
 uint64_t GetFiberId();
-std::string GetThreadName();
+const std::string& GetThreadName();
 
 void Backtrace(std::vector<std::string>& bt, int size, int skip);  // skip跳过不需要打印出来的bt
 std::string BacktraceToString(int size = 64, int skip = 2, const std::string& prefix = "");
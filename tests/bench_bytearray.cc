@@ -0,0 +1,116 @@
+#include <vector>
+
+#include "../moka/bytearray.h"
+#include "../moka/config.h"
+#include "../moka/macro.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+static moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static const size_t s_count = 1000000;   // 每轮编解码的值的个数
+static const int s_rounds = 10;
+
+// 生成的值中大约有percent%是单字节的，其余随机分布在各个长度
+template<class T>
+static std::vector<T> gen_values(int percent) {
+  std::vector<T> values;
+  for (size_t i = 0; i < s_count; ++i) {
+    int bits = rand() % 100 < percent? 7: rand() % (sizeof(T) * 8) + 1;
+    uint64_t v = ((uint64_t)rand() << 32 | rand()) & (bits == 64? ~0ull: ((1ull << bits) - 1));
+    values.push_back(v);
+  }
+  return values;
+}
+
+// 返回每秒编码/解码的值的个数
+template<class T>
+static void bench(const char* name, int percent) {
+  std::vector<T> values = gen_values<T>(percent);
+  std::vector<T> out(values.size());
+  moka::ByteArray ba;
+
+#define XX(label, write_code, read_code) { \
+    uint64_t write_us = 0; \
+    uint64_t read_us = 0; \
+    for (int r = 0; r < s_rounds; ++r) { \
+      ba.clear(); \
+      uint64_t begin = moka::GetCurrentUs(); \
+      write_code; \
+      write_us += moka::GetCurrentUs() - begin; \
+      ba.set_rw_position(0); \
+      begin = moka::GetCurrentUs(); \
+      read_code; \
+      read_us += moka::GetCurrentUs() - begin; \
+      MOKA_ASSERT(out == values); \
+    } \
+    MOKA_LOG_INFO(g_logger) << name << " single_byte=" << percent << "% " << label \
+        << " bytes=" << ba.get_size() \
+        << " write=" << (uint64_t)(s_count * s_rounds * 1000000.0 / write_us) << " values/s" \
+        << " read=" << (uint64_t)(s_count * s_rounds * 1000000.0 / read_us) << " values/s"; \
+  }
+
+  if (sizeof(T) == sizeof(uint32_t)) {
+    XX("one_by_one", for (auto v : values) ba.writeUint32V(v),
+       for (auto& v : out) v = ba.readUint32V());
+  } else {
+    XX("one_by_one", for (auto v : values) ba.writeUint64V(v),
+       for (auto& v : out) v = ba.readUint64V());
+  }
+  for (bool simd : {false, true}) {
+    moka::Config::Lookup<bool>("bytearray.varint_simd", true)->set_value(simd);
+    if (sizeof(T) == sizeof(uint32_t)) {
+      XX(moka::ByteArray::VarintKernelName(),
+         ba.writeUint32VArray((const uint32_t*)&values[0], values.size()),
+         ba.readUint32VArray((uint32_t*)&out[0], out.size()));
+    } else {
+      XX(moka::ByteArray::VarintKernelName(),
+         ba.writeUint64VArray((const uint64_t*)&values[0], values.size()),
+         ba.readUint64VArray((uint64_t*)&out[0], out.size()));
+    }
+  }
+#undef XX
+}
+
+// 读入文件并遍历一遍数据: readFromFile拷贝到节点 vs mapFromFile直接使用映射
+static void bench_file(size_t size) {
+  const char* filename = "/tmp/bench_bytearray_file.dat";
+  {
+    moka::ByteArray ba(1024 * 1024);
+    std::string chunk(1024 * 1024, 'm');
+    for (size_t i = 0; i < size; i += chunk.size()) {
+      ba.write(chunk.c_str(), chunk.size());
+    }
+    ba.set_rw_position(0);
+    MOKA_ASSERT(ba.writeToFile(filename));
+  }
+  for (int mapped = 0; mapped < 2; ++mapped) {
+    moka::ByteArray ba(64 * 1024);
+    uint64_t begin = moka::GetCurrentUs();
+    MOKA_ASSERT(mapped? ba.mapFromFile(filename): ba.readFromFile(filename));
+    ba.set_rw_position(0);
+    std::vector<iovec> iovs;
+    ba.get_read_buffers(iovs);
+    uint64_t sum = 0;
+    for (auto& iov : iovs) {
+      for (size_t i = 0; i < iov.iov_len; i += 4096) {
+        sum += ((const char*)iov.iov_base)[i];
+      }
+    }
+    uint64_t us = moka::GetCurrentUs() - begin;
+    MOKA_LOG_INFO(g_logger) << (mapped? "mapFromFile": "readFromFile")
+        << " size=" << ba.get_size() << " iovecs=" << iovs.size()
+        << " time=" << us / 1000 << "ms sum=" << sum;
+  }
+  remove(filename);
+}
+
+int main(int argc, char** argv) {
+  int percents[] = {100, 90, 50};
+  for (auto p : percents) {
+    bench<uint32_t>("uint32", p);
+    bench<uint64_t>("uint64", p);
+  }
+  bench_file(256 * 1024 * 1024);
+  return 0;
+}
@@ -0,0 +1,167 @@
+#include <atomic>
+#include <list>
+#include <vector>
+
+#include "../moka/channel.h"
+#include "../moka/iomanager.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+// 两个协程通过两个channel来回传递一个数，返回每秒往返次数
+double bench_ping_pong(size_t threads, size_t capacity) {
+  static const int s_rounds = 100000;
+  moka::Channel<int> ping(capacity);
+  moka::Channel<int> pong(capacity);
+  uint64_t begin = moka::GetCurrentUs();
+  {
+    moka::IOManager iom(threads, false, "pingpong");
+    iom.schedule([&]() {
+      int v = 0;
+      for (int i = 0; i < s_rounds; ++i) {
+        ping.push(i);
+        pong.pop(v);
+      }
+    });
+    iom.schedule([&]() {
+      int v = 0;
+      for (int i = 0; i < s_rounds; ++i) {
+        ping.pop(v);
+        pong.push(v);
+      }
+    });
+  }
+  uint64_t used = moka::GetCurrentUs() - begin;
+  return s_rounds * 1000000.0 / used;
+}
+
+static const int s_producers = 16;
+static const int s_items = 50000;        // 每个生产者发送的数量
+
+// 多个生产者发送给一个消费者，返回每秒传递的消息数
+double bench_fan_in(size_t threads, size_t capacity) {
+  moka::Channel<int> ch(capacity);
+  std::atomic<int> producers = {s_producers};
+  int64_t sum = 0;
+  uint64_t begin = moka::GetCurrentUs();
+  {
+    moka::IOManager iom(threads, false, "fanin");
+    iom.schedule([&]() {
+      int v;
+      while (ch.pop(v)) {
+        sum += v;
+      }
+    });
+    for (int p = 0; p < s_producers; ++p) {
+      iom.schedule([&]() {
+        for (int i = 0; i < s_items; ++i) {
+          ch.push(1);
+        }
+        if (--producers == 0) {
+          ch.close();
+        }
+      });
+    }
+  }
+  uint64_t used = moka::GetCurrentUs() - begin;
+  return sum * 1000000.0 / used;
+}
+
+// 对照: std::list + Mutex保存消息，每条消息schedule一个回调去处理(一次加锁和一次通知)
+double bench_fan_in_list(size_t threads) {
+  moka::Mutex mutex;
+  std::list<int> queue;
+  std::atomic<int64_t> sum = {0};
+  const int64_t total = (int64_t)s_producers * s_items;
+  uint64_t begin = moka::GetCurrentUs();
+  {
+    moka::IOManager iom(threads, false, "fanin");
+    for (int p = 0; p < s_producers; ++p) {
+      iom.schedule([&]() {
+        for (int i = 0; i < s_items; ++i) {
+          {
+            moka::Mutex::LockGuard lock(mutex);
+            queue.push_back(1);
+          }
+          iom.schedule([&]() {
+            int v;
+            {
+              moka::Mutex::LockGuard lock(mutex);
+              v = queue.front();
+              queue.pop_front();
+            }
+            sum += v;
+          });
+        }
+      });
+    }
+  }
+  uint64_t used = moka::GetCurrentUs() - begin;
+  return total * 1000000.0 / used;
+}
+
+// 一个消费者select四个channel，每个channel一个生产者
+double bench_select(size_t threads) {
+  static const int s_channels = 4;
+  std::vector<std::unique_ptr<moka::Channel<int>>> chs;
+  for (int i = 0; i < s_channels; ++i) {
+    chs.emplace_back(new moka::Channel<int>(64));
+  }
+  int64_t count = 0;
+  uint64_t begin = moka::GetCurrentUs();
+  {
+    moka::IOManager iom(threads, false, "select");
+    iom.schedule([&]() {
+      int v;
+      // 关闭的channel之后每次都会立刻返回，从select中去掉
+      std::vector<moka::Channel<int>*> open;
+      for (auto& ch : chs) {
+        open.push_back(ch.get());
+      }
+      while (!open.empty()) {
+        moka::ChannelSelect select;
+        for (auto ch : open) {
+          select.recv(*ch, v);
+        }
+        int idx = select.wait();
+        if (select.is_closed()) {
+          open.erase(open.begin() + idx);
+          continue;
+        }
+        ++count;
+      }
+    });
+    for (auto& ch : chs) {
+      moka::Channel<int>* c = ch.get();
+      iom.schedule([c]() {
+        for (int i = 0; i < s_items; ++i) {
+          c->push(i);
+        }
+        c->close();
+      });
+    }
+  }
+  uint64_t used = moka::GetCurrentUs() - begin;
+  return count * 1000000.0 / used;
+}
+
+int main(int argc, char** argv) {
+  MOKA_LOG_NAME("system")->set_level(moka::LogLevel::ERROR);
+  size_t threads[] = {1, 4};
+  for (auto n : threads) {
+    MOKA_LOG_INFO(g_logger) << "ping-pong threads=" << n
+                            << " unbuffered=" << (uint64_t)bench_ping_pong(n, 0) << " round trips/s"
+                            << " capacity_1=" << (uint64_t)bench_ping_pong(n, 1) << " round trips/s";
+  }
+  for (auto n : threads) {
+    MOKA_LOG_INFO(g_logger) << "fan-in threads=" << n << " producers=" << s_producers
+                            << " channel=" << (uint64_t)bench_fan_in(n, 1024) << " msgs/s"
+                            << " list_mutex_schedule=" << (uint64_t)bench_fan_in_list(n) << " msgs/s";
+  }
+  for (auto n : threads) {
+    MOKA_LOG_INFO(g_logger) << "select threads=" << n << " channels=4"
+                            << " " << (uint64_t)bench_select(n) << " msgs/s";
+  }
+  return 0;
+}
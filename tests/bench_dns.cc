@@ -0,0 +1,145 @@
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "../moka/dns.h"
+#include "../moka/socket.h"
+#include "../moka/iomanager.h"
+#include "../moka/macro.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static std::atomic<bool> s_stop = {false};
+static std::atomic<uint16_t> s_port = {0};
+
+// 本地DNS服务器: 任何域名都返回一个A或AAAA记录(TTL 300s)
+static void stub_server() {
+  moka::Socket::ptr sock = moka::Socket::CreateUDPSocket();
+  MOKA_ASSERT(sock->bind(moka::Address::ptr(new moka::IPv4Address("127.0.0.1", 0))));
+  sock->set_recv_timeout(100);
+  s_port = std::static_pointer_cast<moka::IPAddress>(sock->get_local_address())->get_port();
+  int fd = sock->get_socketfd();
+  char buf[512];
+  while (!s_stop) {
+    sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    int n = recvfrom(fd, buf, sizeof(buf), 0, (sockaddr*)&from, &from_len);
+    if (n <= 12) {
+      continue;
+    }
+    // 问题部分在报文末尾，qtype在最后4个字节的前两个
+    uint16_t qtype = ((uint8_t)buf[n - 4] << 8) | (uint8_t)buf[n - 3];
+    std::string resp(buf, n);
+    resp[2] = (char)0x81;
+    resp[3] = (char)0x80;
+    resp[7] = 1;
+    static const char s_answer_a[] = "\xc0\x0c\x00\x01\x00\x01\x00\x00\x01\x2c\x00\x04\x0a\x00\x00\x01";
+    static const char s_answer_aaaa[] = "\xc0\x0c\x00\x1c\x00\x01\x00\x00\x01\x2c\x00\x10"
+        "\xfd\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x01";
+    if (qtype == 1) {
+      resp.append(s_answer_a, sizeof(s_answer_a) - 1);
+    } else {
+      resp.append(s_answer_aaaa, sizeof(s_answer_aaaa) - 1);
+    }
+    sendto(fd, resp.data(), resp.size(), 0, (sockaddr*)&from, from_len);
+  }
+}
+
+// 每次查询一个新的域名(不命中缓存)，返回平均延迟(微秒)
+static double bench_uncached(moka::DnsResolver& resolver, int count) {
+  uint64_t used = 0;
+  {
+    moka::IOManager iom(1, false, "dns");
+    iom.schedule([&]() {
+      uint64_t begin = moka::GetCurrentUs();
+      for (int i = 0; i < count; ++i) {
+        std::vector<moka::IPAddress::ptr> addrs;
+        MOKA_ASSERT(resolver.resolve("host" + std::to_string(i) + ".uncached.test", addrs));
+      }
+      used = moka::GetCurrentUs() - begin;
+    });
+  }
+  return (double)used / count;
+}
+
+// 重复查询同一个域名(命中缓存)，返回平均延迟(微秒)
+static double bench_cached(moka::DnsResolver& resolver, int count) {
+  uint64_t used = 0;
+  {
+    moka::IOManager iom(1, false, "dns");
+    iom.schedule([&]() {
+      std::vector<moka::IPAddress::ptr> addrs;
+      MOKA_ASSERT(resolver.resolve("cached.test", addrs));
+      uint64_t begin = moka::GetCurrentUs();
+      for (int i = 0; i < count; ++i) {
+        addrs.clear();
+        resolver.resolve("cached.test", addrs, 80);
+      }
+      used = moka::GetCurrentUs() - begin;
+    });
+  }
+  return (double)used / count;
+}
+
+// 多个协程同时查询不同的域名，返回每秒完成的查询数
+static double bench_concurrent(moka::DnsResolver& resolver, int fibers, int count) {
+  uint64_t begin = moka::GetCurrentUs();
+  {
+    moka::IOManager iom(1, false, "dns");
+    for (int f = 0; f < fibers; ++f) {
+      iom.schedule([&resolver, f, count]() {
+        for (int i = 0; i < count; ++i) {
+          std::vector<moka::IPAddress::ptr> addrs;
+          resolver.resolve("host" + std::to_string(i) + ".f" + std::to_string(f) + ".test", addrs);
+        }
+      });
+    }
+  }
+  uint64_t used = moka::GetCurrentUs() - begin;
+  return fibers * count * 1000000.0 / used;
+}
+
+// 对照: 线程中直接调用getaddrinfo解析localhost(hosts文件)
+static double bench_getaddrinfo(int count) {
+  uint64_t begin = moka::GetCurrentUs();
+  for (int i = 0; i < count; ++i) {
+    struct addrinfo hints;
+    struct addrinfo* res = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo("localhost", "80", &hints, &res) == 0) {
+      freeaddrinfo(res);
+    }
+  }
+  return (double)(moka::GetCurrentUs() - begin) / count;
+}
+
+int main(int argc, char** argv) {
+  MOKA_LOG_NAME("system")->set_level(moka::LogLevel::ERROR);
+  // 本地DNS服务器运行在单独的IOManager上，每个测试用自己的IOManager执行查询
+  moka::IOManager stub(1, false, "dns_stub");
+  stub.schedule(stub_server);
+  while (s_port == 0) {
+    usleep(1000);
+  }
+  std::vector<moka::Address::ptr> servers = {moka::Address::ptr(new moka::IPv4Address("127.0.0.1", s_port))};
+  moka::DnsResolver resolver(servers, "");
+
+  MOKA_LOG_INFO(g_logger) << "uncached lookup(A+AAAA via local udp server)="
+                          << bench_uncached(resolver, 10000) << " us";
+  MOKA_LOG_INFO(g_logger) << "cached lookup=" << bench_cached(resolver, 1000000) << " us";
+  MOKA_LOG_INFO(g_logger) << "concurrent uncached lookups fibers=64 "
+                          << (uint64_t)bench_concurrent(resolver, 64, 500) << " lookups/s";
+  MOKA_LOG_INFO(g_logger) << "getaddrinfo(localhost, hosts file)=" << bench_getaddrinfo(10000) << " us";
+  moka::DnsResolver::Stats stats = resolver.get_stats();
+  MOKA_LOG_INFO(g_logger) << "queries=" << stats.queries << " timeouts=" << stats.timeouts
+                          << " cache_hits=" << stats.cache_hits;
+  s_stop = true;
+  return 0;
+}
@@ -0,0 +1,138 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdlib.h>
+#include <atomic>
+
+#include "../moka/iomanager.h"
+#include "../moka/config.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static int s_conns = 64;            // 客户端连接数
+static int s_rounds = 2000;         // 每个连接的请求次数
+static const size_t s_msg_size = 64;
+static std::atomic<int> s_done_conns = {0};
+static int s_listen_fd = -1;
+static sockaddr_in s_addr;
+
+static void echo_conn(int fd) {
+  char buf[4096];
+  while (true) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      break;
+    }
+    if (send(fd, buf, n, 0) != n) {
+      break;
+    }
+  }
+  close(fd);
+}
+
+static void echo_server() {
+  while (true) {
+    int fd = accept(s_listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      // 监听套接字被shutdown
+      break;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    moka::IOManager::GetThis()->schedule(std::bind(echo_conn, fd));
+  }
+  close(s_listen_fd);
+}
+
+static void client_done(int fd) {
+  close(fd);
+  if (++s_done_conns == s_conns) {
+    // 所有客户端结束后唤醒accept(阻塞在accept上时直接close会丢失事件)
+    shutdown(s_listen_fd, SHUT_RDWR);
+  }
+}
+
+static void echo_client() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(fd, (sockaddr*)&s_addr, sizeof(s_addr))) {
+    MOKA_LOG_ERROR(g_logger) << "connect errno=" << errno << " errstr=" << strerror(errno);
+    client_done(fd);
+    return;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  char msg[s_msg_size];
+  memset(msg, 'm', sizeof(msg));
+  char buf[s_msg_size];
+  for (int i = 0; i < s_rounds; ++i) {
+    if (send(fd, msg, sizeof(msg), 0) != (ssize_t)sizeof(msg)) {
+      break;
+    }
+    size_t got = 0;
+    while (got < sizeof(buf)) {
+      ssize_t n = recv(fd, buf + got, sizeof(buf) - got, 0);
+      if (n <= 0) {
+        break;
+      }
+      got += n;
+    }
+  }
+  client_done(fd);
+}
+
+// 返回每秒完成的请求数(一次send+recv)
+static double bench(bool io_uring, size_t threads) {
+  moka::Config::Lookup<bool>("iomanager.io_uring", false)->set_value(io_uring);
+  s_done_conns = 0;
+  uint64_t used = 0;
+  {
+    moka::IOManager iom(threads, false, "echo");
+    iom.schedule([]() {
+      s_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+      int one = 1;
+      setsockopt(s_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      memset(&s_addr, 0, sizeof(s_addr));
+      s_addr.sin_family = AF_INET;
+      s_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      s_addr.sin_port = 0;
+      bind(s_listen_fd, (sockaddr*)&s_addr, sizeof(s_addr));
+      socklen_t len = sizeof(s_addr);
+      getsockname(s_listen_fd, (sockaddr*)&s_addr, &len);
+      listen(s_listen_fd, 1024);
+      moka::IOManager::GetThis()->schedule(echo_server);
+      for (int i = 0; i < s_conns; ++i) {
+        moka::IOManager::GetThis()->schedule(echo_client);
+      }
+    });
+    uint64_t begin = moka::GetCurrentUs();
+    // 不统计调度器停止的时间
+    while (s_done_conns < s_conns) {
+      usleep(100);
+    }
+    used = moka::GetCurrentUs() - begin;
+  }
+  return (double)s_conns * s_rounds * 1000000.0 / used;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    s_conns = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    s_rounds = atoi(argv[2]);
+  }
+  MOKA_LOG_NAME("system")->set_level(moka::LogLevel::ERROR);
+  size_t threads[] = {1, 4};
+  for (auto n : threads) {
+    double epoll = bench(false, n);
+    double uring = bench(true, n);
+    MOKA_LOG_INFO(g_logger) << "threads=" << n << " conns=" << s_conns << " rounds=" << s_rounds
+                            << " epoll=" << (uint64_t)epoll << " req/s"
+                            << " io_uring=" << (uint64_t)uring << " req/s";
+  }
+  return 0;
+}
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "../moka/fiber.h"
+#include "../moka/config.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static void empty_cb() {}
+
+// 进程当前占用的物理内存(KB)
+static uint64_t get_rss_kb() {
+  FILE* fp = fopen("/proc/self/statm", "r");
+  if (!fp) {
+    return 0;
+  }
+  uint64_t size = 0, resident = 0;
+  if (fscanf(fp, "%lu %lu", &size, &resident) != 2) {
+    resident = 0;
+  }
+  fclose(fp);
+  return resident * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+static void set_allocator(const std::string& name) {
+  moka::Config::Lookup<std::string>("fiber.stack_allocator", "mmap")->set_value(name);
+}
+
+// 每秒创建(并执行结束、销毁)的协程数量
+static double bench_create(int n, bool use_pool) {
+  uint64_t begin = moka::GetCurrentUs();
+  for (int i = 0; i < n; ++i) {
+    moka::Fiber::ptr fiber = use_pool? moka::FiberPool::Get(empty_cb, true)
+                                     : moka::Fiber::ptr(new moka::Fiber(empty_cb, true));
+    fiber->sched();
+    if (use_pool) {
+      moka::FiberPool::Put(fiber);
+    }
+  }
+  uint64_t used = moka::GetCurrentUs() - begin;
+  return n * 1000000.0 / used;
+}
+
+// 同时存活n个协程(每个协程都执行过一次)时的RSS
+static void bench_rss(const std::string& allocator, int n) {
+  set_allocator(allocator);
+  uint64_t rss_begin = get_rss_kb();
+  std::vector<moka::Fiber::ptr> fibers;
+  fibers.reserve(n);
+  try {
+    for (int i = 0; i < n; ++i) {
+      fibers.push_back(moka::Fiber::ptr(new moka::Fiber(empty_cb, true)));
+      fibers.back()->sched();
+    }
+  } catch (std::bad_alloc& e) {
+    MOKA_LOG_ERROR(g_logger) << allocator << " alloc failed after " << fibers.size()
+        << " fibers (guard pages need 2 mappings per stack, check vm.max_map_count)";
+  }
+  uint64_t rss_end = get_rss_kb();
+  MOKA_LOG_INFO(g_logger) << "allocator=" << allocator << " live_fibers=" << fibers.size()
+                          << " rss=" << (rss_end - rss_begin) / 1024 << "MB";
+}
+
+int main(int argc, char** argv) {
+  int live = argc > 1? atoi(argv[1]): 100000;
+  uint32_t stack_size = argc > 2? atoi(argv[2]): 64 * 1024;
+  MOKA_LOG_NAME("system")->set_level(moka::LogLevel::ERROR);
+  moka::Config::Lookup<uint32_t>("fiber.stack_size", 1024 * 1024)->set_value(stack_size);
+  moka::Fiber::GetThis();
+
+  const int n = 200000;
+  set_allocator("malloc");
+  double malloc_rate = bench_create(n, false);
+  set_allocator("mmap");
+  double mmap_rate = bench_create(n, false);
+  double pool_rate = bench_create(n, true);
+  MOKA_LOG_INFO(g_logger) << "stack_size=" << stack_size
+                          << " malloc=" << (uint64_t)malloc_rate << " fibers/s"
+                          << " mmap=" << (uint64_t)mmap_rate << " fibers/s"
+                          << " pool=" << (uint64_t)pool_rate << " fibers/s";
+
+  bench_rss("malloc", live);
+  bench_rss("mmap", live);
+  return 0;
+}
@@ -0,0 +1,89 @@
+#include <atomic>
+
+#include "../moka/fiber_sync.h"
+#include "../moka/iomanager.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static const int s_fibers = 10000;       // 竞争同一把锁的协程数
+static const int s_loops = 20;           // 每个协程加锁的次数
+static std::atomic<int> s_done = {0};
+static std::atomic<bool> s_stop = {false};
+static uint64_t s_counter = 0;
+
+static void spin(uint64_t us) {
+  uint64_t end = moka::GetCurrentUs() + us;
+  while (moka::GetCurrentUs() < end) {
+  }
+}
+
+// 同一调度器中的探测协程反复sleep 1ms，统计被唤醒的最大延迟
+// 线程阻塞在锁上时探测协程得不到运行
+static void probe(int64_t* max_late) {
+  while (!s_stop) {
+    uint64_t begin = moka::GetCurrentUs();
+    usleep(1000);
+    int64_t late = (int64_t)(moka::GetCurrentUs() - begin) - 1000;
+    if (late > *max_late) {
+      *max_late = late;
+    }
+  }
+  ++s_done;
+}
+
+// hold_us为临界区中忙等的时间
+template <class MutexType>
+void bench(const char* name, uint64_t hold_us) {
+  MutexType mutex;
+  int64_t max_late = 0;
+  s_done = 0;
+  s_stop = false;
+  s_counter = 0;
+  uint64_t begin = moka::GetCurrentUs();
+  {
+    moka::IOManager iom(4, false, "bench");
+    iom.schedule(std::bind(&probe, &max_late));
+    for (int i = 0; i < s_fibers; ++i) {
+      iom.schedule([&mutex, hold_us]() {
+        for (int j = 0; j < s_loops; ++j) {
+          {
+            typename MutexType::LockGuard lock(mutex);
+            ++s_counter;
+            if (hold_us) {
+              spin(hold_us);
+            }
+          }
+          if (j % 4 == 0) {
+            moka::Fiber::YieldToReady();
+          }
+        }
+        ++s_done;
+      });
+    }
+    while (s_done < s_fibers) {
+      usleep(100);
+    }
+    s_stop = true;
+    while (s_done < s_fibers + 1) {
+      usleep(100);
+    }
+  }
+  uint64_t used = moka::GetCurrentUs() - begin;
+  MOKA_LOG_INFO(g_logger) << name << " hold=" << hold_us << "us"
+                          << " ops=" << s_counter
+                          << " throughput=" << (uint64_t)(s_counter * 1000000.0 / used) << " locks/s"
+                          << " used=" << used / 1000 << "ms"
+                          << " probe_max_late=" << max_late << "us";
+}
+
+int main(int argc, char** argv) {
+  MOKA_LOG_NAME("system")->set_level(moka::LogLevel::ERROR);
+  uint64_t holds[] = {0, 5, 20};
+  for (auto hold : holds) {
+    bench<moka::Mutex>("Mutex", hold);
+    bench<moka::FiberMutex>("FiberMutex", hold);
+  }
+  return 0;
+}
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <ucontext.h>
+
+#include "../moka/fiber.h"
+#include "../moka/context.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static const size_t s_stack_size = 128 * 1024;
+static int s_rounds = 10000000;
+
+// ucontext: 每次切换都要保存全部寄存器并调用rt_sigprocmask
+static ucontext_t s_main_uc;
+static ucontext_t s_child_uc;
+
+static void uc_func() {
+  while (true) {
+    swapcontext(&s_child_uc, &s_main_uc);
+  }
+}
+
+static double bench_ucontext() {
+  void* stack = malloc(s_stack_size);
+  getcontext(&s_child_uc);
+  s_child_uc.uc_link = nullptr;
+  s_child_uc.uc_stack.ss_sp = stack;
+  s_child_uc.uc_stack.ss_size = s_stack_size;
+  makecontext(&s_child_uc, uc_func, 0);
+
+  uint64_t begin = moka::GetCurrentUs();
+  for (int i = 0; i < s_rounds; ++i) {
+    swapcontext(&s_main_uc, &s_child_uc);
+  }
+  uint64_t used = moka::GetCurrentUs() - begin;
+  free(stack);
+  return used * 1000.0 / s_rounds;
+}
+
+#if MOKA_HAVE_ASM_CONTEXT
+// 汇编实现: 只保存callee-saved寄存器
+static void* s_main_sp = nullptr;
+static void* s_child_sp = nullptr;
+
+static void asm_func() {
+  while (true) {
+    moka_swap_context(&s_child_sp, s_main_sp);
+  }
+}
+
+static double bench_asm() {
+  void* stack = malloc(s_stack_size);
+  s_child_sp = moka::MakeAsmContext(stack, s_stack_size, asm_func);
+
+  uint64_t begin = moka::GetCurrentUs();
+  for (int i = 0; i < s_rounds; ++i) {
+    moka_swap_context(&s_main_sp, s_child_sp);
+  }
+  uint64_t used = moka::GetCurrentUs() - begin;
+  free(stack);
+  return used * 1000.0 / s_rounds;
+}
+#endif
+
+// Fiber::sched/YieldToHold(使用编译时选择的上下文切换方式)
+static bool s_running = true;
+
+static void fiber_func() {
+  while (s_running) {
+    moka::Fiber::YieldToHold();
+  }
+}
+
+static double bench_fiber() {
+  moka::Fiber::GetThis();
+  moka::Fiber::ptr fiber(new moka::Fiber(fiber_func, true));
+  uint64_t begin = moka::GetCurrentUs();
+  for (int i = 0; i < s_rounds; ++i) {
+    fiber->sched();
+  }
+  uint64_t used = moka::GetCurrentUs() - begin;
+  // 让协程执行结束后再析构
+  s_running = false;
+  fiber->sched();
+  return used * 1000.0 / s_rounds;
+}
+
+// 输出一次往返切换(切入+切出)的耗时(纳秒)
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    s_rounds = atoi(argv[1]);
+  }
+  MOKA_LOG_NAME("system")->set_level(moka::LogLevel::ERROR);
+  MOKA_LOG_INFO(g_logger) << "rounds=" << s_rounds;
+  MOKA_LOG_INFO(g_logger) << "ucontext: " << bench_ucontext() << " ns/round-trip";
+#if MOKA_HAVE_ASM_CONTEXT
+  MOKA_LOG_INFO(g_logger) << "asm: " << bench_asm() << " ns/round-trip";
+#endif
+  MOKA_LOG_INFO(g_logger) << "fiber(" << moka::GetContextBackend() << "): "
+                          << bench_fiber() << " ns/round-trip";
+  return 0;
+}
@@ -0,0 +1,145 @@
+#include <unistd.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include "../moka/log.h"
+#include "../moka/binlog.h"
+#include "../moka/thread.h"
+#include "../moka/util.h"
+
+moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static const int s_total = 400000;                 // 每轮写入的日志总条数
+static const char* s_file = "bench_log.txt";
+
+// 返回每秒写入的日志条数(异步模式包含最后等待写完的时间)
+static double bench(size_t threads, bool async) {
+  moka::Logger::ptr logger(new moka::Logger("bench"));
+  if (async) {
+    logger->addAppender(moka::LogAppender::ptr(new moka::AsyncLogAppender(s_file)));
+  } else {
+    logger->addAppender(moka::LogAppender::ptr(new moka::FileLogAppender(s_file)));
+  }
+  int lines = s_total / threads;
+  uint64_t begin = moka::GetCurrentUs();
+  std::vector<moka::Thread::ptr> workers;
+  for (size_t i = 0; i < threads; ++i) {
+    workers.push_back(moka::Thread::ptr(new moka::Thread([logger, lines]() {
+      for (int j = 0; j < lines; ++j) {
+        MOKA_LOG_INFO(logger) << "bench log line " << j;
+      }
+    }, "bench_" + std::to_string(i))));
+  }
+  for (auto& i : workers) {
+    i->join();
+  }
+  moka::AsyncLogAppender::Flush();
+  uint64_t used = moka::GetCurrentUs() - begin;
+  unlink(s_file);
+  return lines * threads * 1000000.0 / used;
+}
+
+// 默认格式下编译后的格式器与逐个调用FormatterItem的对比，返回每秒格式化的条数
+static void bench_formatter() {
+  static const int s_count = 1000000;
+  moka::Logger::ptr logger(new moka::Logger("bench"));
+  moka::LogFormatter::ptr fmt = logger->get_formatter();
+  moka::LogEvent::ptr event(new moka::LogEvent(__FILE__, 0, __LINE__, moka::GetThreadId(),
+      moka::GetFiberId(), "main", time(0), logger, moka::LogLevel::INFO));
+  event->get_ss() << "bench formatter line";
+  if (fmt->format(event) != fmt->formatItems(event)) {
+    MOKA_LOG_ERROR(g_logger) << "formatter mismatch: " << fmt->format(event) << fmt->formatItems(event);
+  }
+
+  size_t bytes = 0;
+  uint64_t begin = moka::GetCurrentUs();
+  for (int i = 0; i < s_count; ++i) {
+    bytes += fmt->formatItems(event).size();
+  }
+  uint64_t items = moka::GetCurrentUs() - begin;
+
+  std::string out;
+  begin = moka::GetCurrentUs();
+  for (int i = 0; i < s_count; ++i) {
+    out.clear();
+    fmt->format(out, event);
+    bytes += out.size();
+  }
+  uint64_t compiled = moka::GetCurrentUs() - begin;
+  MOKA_LOG_INFO(g_logger) << "formatter items=" << (uint64_t)(s_count * 1000000.0 / items) << " lines/s"
+                          << " compiled=" << (uint64_t)(s_count * 1000000.0 / compiled) << " lines/s"
+                          << " bytes=" << bytes;
+}
+
+// 不输出的日志语句的开销(纳秒/条)，appender_level为true时由输出器的级别过滤
+static void bench_disabled(bool appender_level) {
+  static const int s_count = 10000000;
+  moka::Logger::ptr logger(new moka::Logger("bench"));
+  moka::LogAppender::ptr appender(new moka::FileLogAppender(s_file));
+  logger->addAppender(appender);
+  if (appender_level) {
+    appender->set_level(moka::LogLevel::INFO);
+  } else {
+    logger->set_level(moka::LogLevel::INFO);
+  }
+  uint64_t begin = moka::GetCurrentUs();
+  for (int i = 0; i < s_count; ++i) {
+    MOKA_LOG_DEBUG(logger) << "disabled " << i;
+  }
+  uint64_t used = moka::GetCurrentUs() - begin;
+  unlink(s_file);
+  MOKA_LOG_INFO(g_logger) << "disabled debug filtered_by=" << (appender_level? "appender": "logger")
+                          << " " << used * 1000.0 / s_count << " ns/line";
+}
+
+// 单线程下文本输出和二进制输出的对比(每秒条数和文件大小)
+static void bench_binary() {
+  static const int s_count = 1000000;
+  static const char* s_bin_file = "bench_log.blog";
+  uint64_t used[2];
+  off_t size[2];
+  for (int binary = 0; binary < 2; ++binary) {
+    const char* file = binary? s_bin_file: s_file;
+    {
+      moka::Logger::ptr logger(new moka::Logger("bench"));
+      if (binary) {
+        logger->addAppender(moka::LogAppender::ptr(new moka::BinaryLogAppender(file)));
+      } else {
+        logger->addAppender(moka::LogAppender::ptr(new moka::FileLogAppender(file)));
+      }
+      uint64_t begin = moka::GetCurrentUs();
+      for (int i = 0; i < s_count; ++i) {
+        if (binary) {
+          MOKA_LOG_BIN_INFO(logger, "bench log line %d value %.2f", i, i * 0.5);
+        } else {
+          MOKA_LOG_FMT_INFO(logger, "bench log line %d value %.2f", i, i * 0.5);
+        }
+      }
+      used[binary] = moka::GetCurrentUs() - begin;
+    }
+    struct stat st;
+    size[binary] = stat(file, &st) == 0? st.st_size: 0;
+    unlink(file);
+  }
+  MOKA_LOG_INFO(g_logger) << "text=" << (uint64_t)(s_count * 1000000.0 / used[0]) << " lines/s "
+                          << size[0] << " bytes"
+                          << " binary=" << (uint64_t)(s_count * 1000000.0 / used[1]) << " lines/s "
+                          << size[1] << " bytes";
+}
+
+int main(int argc, char** argv) {
+  MOKA_LOG_NAME("system")->set_level(moka::LogLevel::ERROR);
+  bench_formatter();
+  bench_disabled(false);
+  bench_disabled(true);
+  bench_binary();
+  size_t threads[] = {1, 2, 4, 8, 16, 32};
+  for (auto n : threads) {
+    double sync = bench(n, false);
+    double async = bench(n, true);
+    MOKA_LOG_INFO(g_logger) << "threads=" << n
+                            << " file=" << (uint64_t)sync << " lines/s"
+                            << " async=" << (uint64_t)async << " lines/s";
+  }
+  return 0;
+}
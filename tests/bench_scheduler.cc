@@ -0,0 +1,124 @@
+#include <atomic>
+
+#include "../moka/iomanager.h"
+#include "../moka/config.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static const int s_roots = 256;          // 外部线程添加的任务数
+static const int s_children = 400;       // 每个任务在调度线程中继续派生的任务数
+static std::atomic<int> s_done = {0};
+
+void child() {
+  ++s_done;
+}
+
+void root() {
+  // 调度线程中产生的任务(工作窃取模式下进入本地队列)
+  for (int i = 0; i < s_children; ++i) {
+    moka::Scheduler::GetThis()->schedule(&child);
+  }
+  ++s_done;
+}
+
+// 返回每秒执行的任务数
+double bench(size_t threads, bool work_stealing) {
+  moka::Config::Lookup<bool>("scheduler.work_stealing", false)->set_value(work_stealing);
+  s_done = 0;
+  const int total = s_roots * (s_children + 1);
+  uint64_t begin = moka::GetCurrentUs();
+  {
+    moka::IOManager iom(threads, false, "bench");
+    for (int i = 0; i < s_roots; ++i) {
+      iom.schedule(&root);
+    }
+    while (s_done < total) {
+      usleep(100);
+    }
+  }
+  uint64_t used = moka::GetCurrentUs() - begin;
+  return total * 1000000.0 / used;
+}
+
+// 大量定时器同时到期时，idle会通过schedule(begin, end)一次性添加一批任务
+// 输出eventfd实际发送的唤醒次数、被唤醒后确实有任务的次数以及被合并的notify次数
+void bench_timer_burst(size_t threads) {
+  static const int s_timers = 20000;
+  moka::Config::Lookup<bool>("scheduler.work_stealing", false)->set_value(false);
+  s_done = 0;
+  moka::IOManager iom(threads, false, "timer");
+  for (int i = 0; i < s_timers; ++i) {
+    // 到期时间集中在20个时间点上
+    iom.addTimer(10 + (i % 20) * 5, []() {
+      ++s_done;
+    });
+  }
+  while (s_done < s_timers) {
+    usleep(100);
+  }
+  MOKA_LOG_INFO(g_logger) << "timer burst threads=" << threads
+                          << " wakeups_sent=" << iom.get_wakeups_sent()
+                          << " wakeups_needed=" << iom.get_wakeups_needed()
+                          << " wakeups_skipped=" << iom.get_wakeups_skipped();
+}
+
+// 协程在hook的usleep中挂起，统计被唤醒后换了线程的比例
+static std::atomic<int> s_migrations = {0};
+
+void sleeper() {
+  for (int i = 0; i < 20; ++i) {
+    pid_t before = moka::GetThreadId();
+    usleep(1000);
+    if (moka::GetThreadId() != before) {
+      ++s_migrations;
+    }
+  }
+  ++s_done;
+}
+
+void bench_sleep(size_t threads, bool thread_timer) {
+  static const int s_sleepers = 256;
+  moka::Config::Lookup<bool>("scheduler.work_stealing", false)->set_value(false);
+  moka::Config::Lookup<bool>("iomanager.thread_timer", true)->set_value(thread_timer);
+  s_done = 0;
+  s_migrations = 0;
+  uint64_t begin = moka::GetCurrentUs();
+  {
+    moka::IOManager iom(threads, false, "sleep");
+    for (int i = 0; i < s_sleepers; ++i) {
+      iom.schedule(&sleeper);
+    }
+    while (s_done < s_sleepers) {
+      usleep(100);
+    }
+  }
+  uint64_t used = moka::GetCurrentUs() - begin;
+  MOKA_LOG_INFO(g_logger) << "sleep threads=" << threads
+                          << " thread_timer=" << thread_timer
+                          << " migrations=" << s_migrations << "/" << s_sleepers * 20
+                          << " used=" << used / 1000 << "ms";
+  moka::Config::Lookup<bool>("iomanager.thread_timer", true)->set_value(true);
+}
+
+int main(int argc, char** argv) {
+  // 关闭调度器内部的日志输出，避免影响测试结果
+  MOKA_LOG_NAME("system")->set_level(moka::LogLevel::ERROR);
+  size_t threads[] = {1, 4, 16, 64};
+  for (auto n : threads) {
+    double global = bench(n, false);
+    double steal = bench(n, true);
+    MOKA_LOG_INFO(g_logger) << "threads=" << n
+                            << " global_queue=" << (uint64_t)global << " tasks/s"
+                            << " work_stealing=" << (uint64_t)steal << " tasks/s";
+  }
+  for (auto n : threads) {
+    bench_timer_burst(n);
+  }
+  for (auto n : threads) {
+    bench_sleep(n, false);
+    bench_sleep(n, true);
+  }
+  return 0;
+}
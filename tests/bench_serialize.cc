@@ -0,0 +1,99 @@
+#include <vector>
+
+#include "../moka/serialize.h"
+#include "../moka/macro.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+static moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static const int s_count = 100000;   // 每轮的结构体个数
+static const int s_rounds = 10;
+
+struct Quote {
+  int64_t id;
+  int32_t bid;
+  int32_t ask;
+  uint32_t bid_size;
+  uint32_t ask_size;
+  double timestamp;
+  uint16_t venue;
+  std::string symbol;
+  std::vector<int32_t> levels;
+  MOKA_SERIALIZE_FIELDS(id, bid, ask, bid_size, ask_size, timestamp, venue, symbol, levels)
+
+  bool operator==(const Quote& oth) const {
+    return id == oth.id && bid == oth.bid && ask == oth.ask && bid_size == oth.bid_size
+        && ask_size == oth.ask_size && timestamp == oth.timestamp && venue == oth.venue
+        && symbol == oth.symbol && levels == oth.levels;
+  }
+};
+
+// 手写的ByteArray调用
+static void write_quote(moka::ByteArray& ba, const Quote& q) {
+  ba.writeInt64F(q.id);
+  ba.writeInt32F(q.bid);
+  ba.writeInt32F(q.ask);
+  ba.writeUint32F(q.bid_size);
+  ba.writeUint32F(q.ask_size);
+  ba.writeDouble(q.timestamp);
+  ba.writeUint16F(q.venue);
+  ba.writeStringIntV(q.symbol);
+  ba.writeUint64V(q.levels.size());
+  for (auto v : q.levels) {
+    ba.writeInt32F(v);
+  }
+}
+
+static void read_quote(moka::ByteArray& ba, Quote& q) {
+  q.id = ba.readInt64F();
+  q.bid = ba.readInt32F();
+  q.ask = ba.readInt32F();
+  q.bid_size = ba.readUint32F();
+  q.ask_size = ba.readUint32F();
+  q.timestamp = ba.readDouble();
+  q.venue = ba.readUint16F();
+  q.symbol = ba.readStringIntV();
+  q.levels.resize(ba.readUint64V());
+  for (auto& v : q.levels) {
+    v = ba.readInt32F();
+  }
+}
+
+int main(int argc, char** argv) {
+  std::vector<Quote> quotes(s_count);
+  for (auto& q : quotes) {
+    q = {rand(), rand(), rand(), (uint32_t)rand(), (uint32_t)rand(), rand() / 3.0,
+         (uint16_t)rand(), "MOKA", std::vector<int32_t>(rand() % 10, rand())};
+  }
+  std::vector<Quote> out(s_count);
+
+#define XX(label, write_code, read_code) { \
+    moka::ByteArray ba; \
+    uint64_t write_us = 0; \
+    uint64_t read_us = 0; \
+    for (int r = 0; r < s_rounds; ++r) { \
+      ba.clear(); \
+      uint64_t begin = moka::GetCurrentUs(); \
+      for (auto& q : quotes) { \
+        write_code; \
+      } \
+      write_us += moka::GetCurrentUs() - begin; \
+      ba.set_rw_position(0); \
+      begin = moka::GetCurrentUs(); \
+      for (auto& q : out) { \
+        read_code; \
+      } \
+      read_us += moka::GetCurrentUs() - begin; \
+      MOKA_ASSERT(out == quotes); \
+    } \
+    MOKA_LOG_INFO(g_logger) << label << " bytes=" << ba.get_size() \
+        << " write=" << (uint64_t)(s_count * s_rounds * 1000000.0 / write_us) << " structs/s" \
+        << " read=" << (uint64_t)(s_count * s_rounds * 1000000.0 / read_us) << " structs/s"; \
+  }
+
+  XX("hand_written", write_quote(ba, q), read_quote(ba, q));
+  XX("serialize", moka::Serialize(ba, q), moka::Deserialize(ba, q));
+#undef XX
+  return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+#include "../moka/socket.h"
+#include "../moka/bytearray.h"
+#include "../moka/iomanager.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static size_t s_msg_size = 4 * 1024 * 1024;   // 每条消息的大小
+static int s_msgs = 200;                      // 每轮发送的消息条数
+static const size_t s_recv_size = 256 * 1024; // 每次接收的最大字节数
+
+static void sender(moka::Address::ptr addr, bool zero_copy) {
+  moka::Socket::ptr sock = moka::Socket::CreateTCP(addr);
+  if (!sock->connect(addr)) {
+    MOKA_LOG_ERROR(g_logger) << "connect failed";
+    return;
+  }
+  moka::ByteArray ba;
+  std::string msg(s_msg_size, 'm');
+  ba.write(msg.c_str(), msg.size());
+  std::vector<char> buf(s_msg_size);
+  for (int i = 0; i < s_msgs; ++i) {
+    ba.set_rw_position(0);
+    if (zero_copy) {
+      if (sock->send(ba) != (int)s_msg_size) {
+        break;
+      }
+    } else {
+      ba.read(&buf[0], buf.size());
+      size_t sent = 0;
+      while (sent < buf.size()) {
+        int rt = sock->send(&buf[sent], buf.size() - sent);
+        if (rt <= 0) {
+          return;
+        }
+        sent += rt;
+      }
+    }
+  }
+}
+
+static void receiver(bool zero_copy, size_t* total) {
+  // 在IOManager中创建套接字才会被hook为非阻塞
+  moka::IPAddress::ptr addr(new moka::IPv4Address("127.0.0.1", 0));
+  moka::Socket::ptr listen_sock = moka::Socket::CreateTCP(addr);
+  if (!listen_sock->bind(addr) || !listen_sock->listen()) {
+    MOKA_LOG_ERROR(g_logger) << "bind/listen failed";
+    return;
+  }
+  moka::IOManager::GetThis()->schedule(std::bind(sender, listen_sock->get_local_address(), zero_copy));
+  moka::Socket::ptr sock = listen_sock->accept();
+  if (!sock) {
+    return;
+  }
+  moka::ByteArray ba;
+  std::vector<char> buf(s_recv_size);
+  for (int i = 0; i < s_msgs; ++i) {
+    ba.clear();
+    size_t got = 0;
+    while (got < s_msg_size) {
+      size_t len = std::min(s_recv_size, s_msg_size - got);
+      int rt = 0;
+      if (zero_copy) {
+        rt = sock->recv(ba, len);
+      } else {
+        rt = sock->recv(&buf[0], len);
+        if (rt > 0) {
+          ba.write(&buf[0], rt);
+        }
+      }
+      if (rt <= 0) {
+        return;
+      }
+      got += rt;
+      *total += rt;
+    }
+  }
+}
+
+// 发送方和接收方都在ByteArray中保存消息，zero_copy为false时经过连续的临时缓冲区拷贝
+// 返回每秒传输的字节数
+static double bench(bool zero_copy) {
+  size_t total = 0;
+  uint64_t begin = moka::GetCurrentUs();
+  {
+    moka::IOManager iom(1, false, "socket");
+    iom.schedule(std::bind(receiver, zero_copy, &total));
+  }
+  uint64_t used = moka::GetCurrentUs() - begin;
+  return total * 1000000.0 / used;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    s_msg_size = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    s_msgs = atoi(argv[2]);
+  }
+  MOKA_LOG_NAME("system")->set_level(moka::LogLevel::ERROR);
+  for (int i = 0; i < 2; ++i) {
+    double copy = bench(false);
+    double zero_copy = bench(true);
+    MOKA_LOG_INFO(g_logger) << "msg_size=" << s_msg_size << " msgs=" << s_msgs
+                            << " copy=" << (uint64_t)(copy / 1024 / 1024) << " MB/s"
+                            << " zero_copy=" << (uint64_t)(zero_copy / 1024 / 1024) << " MB/s";
+  }
+  return 0;
+}
@@ -0,0 +1,122 @@
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+
+#include "../moka/socket_pool.h"
+#include "../moka/tcp_server.h"
+#include "../moka/macro.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+static moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static int s_clients = 64;           // 并发的客户端协程数
+static int s_rounds = 500;           // 每个客户端协程的请求数
+static const size_t s_msg_size = 64;
+static std::atomic<int> s_done = {0};
+static std::atomic<int> s_errors = {0};
+
+class EchoServer : public moka::TcpServer {
+ public:
+  EchoServer(moka::IOManager* worker) : moka::TcpServer(worker, worker) {}
+
+ protected:
+  virtual void handleClient(moka::Socket::ptr client) override {
+    char buf[4096];
+    while (true) {
+      int n = client->recv(buf, sizeof(buf));
+      if (n <= 0 || client->send(buf, n) != n) {
+        break;
+      }
+    }
+    client->close();
+  }
+};
+
+static bool request(moka::Socket::ptr sock) {
+  char msg[s_msg_size];
+  memset(msg, 'm', sizeof(msg));
+  if (sock->send(msg, sizeof(msg)) != (int)sizeof(msg)) {
+    return false;
+  }
+  char buf[s_msg_size];
+  return sock->recv(buf, sizeof(buf), MSG_WAITALL) == (int)sizeof(buf);
+}
+
+// 每次请求都新建连接
+static void fresh_client(moka::Address::ptr addr) {
+  for (int i = 0; i < s_rounds; ++i) {
+    moka::Socket::ptr sock = moka::Socket::CreateTCP(addr);
+    if (!sock->connect(addr) || !request(sock)) {
+      ++s_errors;
+    }
+    // 直接RST，客户端不进入TIME_WAIT，避免耗尽本地端口
+    struct linger lg = {1, 0};
+    sock->set_option(SOL_SOCKET, SO_LINGER, lg);
+    sock->close();
+  }
+  ++s_done;
+}
+
+// 从连接池取连接
+static void pool_client(moka::SocketPool* pool, moka::Address::ptr addr) {
+  for (int i = 0; i < s_rounds; ++i) {
+    moka::Socket::ptr sock = pool->get(addr);
+    if (!sock) {
+      ++s_errors;
+      continue;
+    }
+    bool ok = request(sock);
+    if (!ok) {
+      ++s_errors;
+    }
+    pool->put(sock, ok);
+  }
+  ++s_done;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    s_clients = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    s_rounds = atoi(argv[2]);
+  }
+  uint32_t max_conns[] = {0, 64, 16, 4};
+  moka::IOManager server_iom(1, false, "server");
+  std::shared_ptr<EchoServer> server(new EchoServer(&server_iom));
+  MOKA_ASSERT(server->bind(moka::Address::ptr(new moka::IPv4Address("127.0.0.1", 0))));
+  server->start();
+  moka::Address::ptr addr = server->get_sockets()[0]->get_local_address();
+
+  for (auto max_conn : max_conns) {
+    s_done = 0;
+    s_errors = 0;
+    moka::IOManager client_iom(2, false, "client");
+    moka::SocketPool pool(&client_iom);
+    pool.set_max_connections(max_conn);
+    uint64_t begin = moka::GetCurrentUs();
+    for (int i = 0; i < s_clients; ++i) {
+      if (max_conn == 0) {
+        client_iom.schedule(std::bind(fresh_client, addr));
+      } else {
+        client_iom.schedule(std::bind(pool_client, &pool, addr));
+      }
+    }
+    while (s_done < s_clients) {
+      usleep(100);
+    }
+    uint64_t used = moka::GetCurrentUs() - begin;
+    moka::SocketPool::Stats stats = pool.get_stats();
+    uint64_t waits = stats.waits? stats.wait_us / stats.waits: 0;
+    MOKA_LOG_INFO(g_logger) << (max_conn? "pool max_connections=" + std::to_string(max_conn): std::string("no pool"))
+                            << " clients=" << s_clients << " rounds=" << s_rounds
+                            << " " << (uint64_t)(s_clients * s_rounds * 1000000.0 / used) << " req/s"
+                            << " hit_rate=" << stats.hit_rate() << " creates=" << stats.creates
+                            << " waits=" << stats.waits << " avg_wait_us=" << waits
+                            << " errors=" << s_errors;
+  }
+  server->stop();
+  return 0;
+}
@@ -0,0 +1,141 @@
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+
+#include "../moka/tcp_server.h"
+#include "../moka/config.h"
+#include "../moka/macro.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+static moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static int s_conns = 64;             // 并发的客户端协程数
+static int s_rounds = 500;           // 每个客户端协程的连接数(短连接)/请求数(长连接)
+static const size_t s_msg_size = 64;
+static std::atomic<int> s_done = {0};
+
+class EchoServer : public moka::TcpServer {
+ public:
+  using ptr = std::shared_ptr<EchoServer>;
+  EchoServer(moka::IOManager* worker) : moka::TcpServer(worker, worker) {}
+
+ protected:
+  virtual void handleClient(moka::Socket::ptr client) override {
+    char buf[4096];
+    while (true) {
+      int n = client->recv(buf, sizeof(buf));
+      if (n <= 0) {
+        break;
+      }
+      if (client->send(buf, n) != n) {
+        break;
+      }
+    }
+    client->close();
+  }
+};
+
+// 发送一个请求并等待回显
+static bool request(moka::Socket::ptr sock) {
+  char msg[s_msg_size];
+  memset(msg, 'm', sizeof(msg));
+  if (sock->send(msg, sizeof(msg)) != (int)sizeof(msg)) {
+    return false;
+  }
+  char buf[s_msg_size];
+  size_t got = 0;
+  while (got < sizeof(buf)) {
+    int n = sock->recv(buf + got, sizeof(buf) - got);
+    if (n <= 0) {
+      return false;
+    }
+    got += n;
+  }
+  return memcmp(buf, msg, sizeof(msg)) == 0;
+}
+
+// 短连接: 每次请求都新建连接
+static void short_client(moka::Address::ptr addr) {
+  for (int i = 0; i < s_rounds; ++i) {
+    moka::Socket::ptr sock = moka::Socket::CreateTCP(addr);
+    if (!sock->connect(addr) || !request(sock)) {
+      MOKA_LOG_ERROR(g_logger) << "short request failed errno=" << errno;
+      break;
+    }
+    // 直接RST，客户端不进入TIME_WAIT，避免耗尽本地端口
+    struct linger lg = {1, 0};
+    sock->set_option(SOL_SOCKET, SO_LINGER, lg);
+    sock->close();
+  }
+  ++s_done;
+}
+
+// 长连接: 一个连接上连续请求
+static void long_client(moka::Address::ptr addr) {
+  moka::Socket::ptr sock = moka::Socket::CreateTCP(addr);
+  if (sock->connect(addr)) {
+    for (int i = 0; i < s_rounds; ++i) {
+      if (!request(sock)) {
+        MOKA_LOG_ERROR(g_logger) << "long request failed errno=" << errno;
+        break;
+      }
+    }
+  }
+  sock->close();
+  ++s_done;
+}
+
+// 返回每秒完成的连接数(短连接)或请求数(长连接)
+static double bench(bool reuse_port, size_t threads, bool short_conn) {
+  moka::Config::Lookup<bool>("tcp_server.reuse_port", true)->set_value(reuse_port);
+  s_done = 0;
+  uint64_t used = 0;
+  moka::IOManager server_iom(threads, false, "server");
+  {
+    EchoServer::ptr server(new EchoServer(&server_iom));
+    MOKA_ASSERT(server->bind(moka::Address::ptr(new moka::IPv4Address("127.0.0.1", 0))));
+    MOKA_ASSERT(server->get_sockets().size() == (reuse_port? threads: 1));
+    server->start();
+    moka::Address::ptr addr = server->get_sockets()[0]->get_local_address();
+    {
+      moka::IOManager client_iom(4, false, "client");
+      uint64_t begin = moka::GetCurrentUs();
+      for (int i = 0; i < s_conns; ++i) {
+        client_iom.schedule(std::bind(short_conn? short_client: long_client, addr));
+      }
+      while (s_done < s_conns) {
+        usleep(100);
+      }
+      used = moka::GetCurrentUs() - begin;
+    }
+    server->stop();
+    while (server->get_connections() > 0) {
+      usleep(100);
+    }
+  }
+  return (double)s_conns * s_rounds * 1000000.0 / used;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    s_conns = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    s_rounds = atoi(argv[2]);
+  }
+  MOKA_LOG_NAME("system")->set_level(moka::LogLevel::ERROR);
+  size_t threads[] = {1, 4};
+  for (auto n : threads) {
+    for (int reuse_port = 0; reuse_port < 2; ++reuse_port) {
+      double conns = bench(reuse_port, n, true);
+      double reqs = bench(reuse_port, n, false);
+      MOKA_LOG_INFO(g_logger) << "threads=" << n << " reuse_port=" << reuse_port
+                              << " clients=" << s_conns << " rounds=" << s_rounds
+                              << " short=" << (uint64_t)conns << " conn/s"
+                              << " long=" << (uint64_t)reqs << " req/s";
+    }
+  }
+  return 0;
+}
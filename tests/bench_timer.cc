@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../moka/timer.h"
+#include "../moka/config.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static int s_timers = 1000000;
+static int s_fired = 0;
+
+// 只测试定时器本身，不需要唤醒epoll_wait
+class BenchTimerManager : public moka::TimerManager {
+ protected:
+  void onTimerInsertedAtFront() override {}
+};
+
+static double per_sec(uint64_t used_us) {
+  return (double)s_timers * 1000000.0 / (used_us? used_us: 1);
+}
+
+static void bench(bool wheel) {
+  moka::Config::Lookup<bool>("timer.wheel", false)->set_value(wheel);
+  BenchTimerManager manager;
+  std::vector<moka::Timer::ptr> timers;
+  timers.reserve(s_timers);
+
+  // 插入: 到期时间分布在1分钟内(时间轮会用到多层)
+  uint64_t begin = moka::GetCurrentUs();
+  for (int i = 0; i < s_timers; ++i) {
+    timers.push_back(manager.addTimer(1 + rand() % 60000, []() { ++s_fired; }));
+  }
+  double insert = per_sec(moka::GetCurrentUs() - begin);
+
+  // 删除
+  begin = moka::GetCurrentUs();
+  for (auto& timer : timers) {
+    timer->cancel();
+  }
+  double cancel = per_sec(moka::GetCurrentUs() - begin);
+  timers.clear();
+
+  // 到期: 到期时间分布在100ms内，等待全部到期后一次取出
+  for (int i = 0; i < s_timers; ++i) {
+    manager.addTimer(rand() % 100, []() { ++s_fired; });
+  }
+  usleep(200 * 1000);
+  s_fired = 0;
+  std::vector<std::function<void()>> cbs;
+  begin = moka::GetCurrentUs();
+  manager.listExpiredCb(cbs);
+  for (auto& cb : cbs) {
+    cb();
+  }
+  double expire = per_sec(moka::GetCurrentUs() - begin);
+
+  MOKA_LOG_INFO(g_logger) << (wheel? "wheel": "set  ") << " timers=" << s_timers
+                          << " insert=" << (uint64_t)insert << "/s"
+                          << " cancel=" << (uint64_t)cancel << "/s"
+                          << " expire=" << (uint64_t)expire << "/s"
+                          << " fired=" << s_fired;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    s_timers = atoi(argv[1]);
+  }
+  MOKA_LOG_NAME("system")->set_level(moka::LogLevel::ERROR);
+  bench(false);
+  bench(true);
+  return 0;
+}
@@ -1,6 +1,10 @@
 #include <iostream>
 #include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
 #include <pthread.h>
+#include <unistd.h>
 #include "../moka/log.h"
 #include "../moka/util.h"
 #include "../moka/macro.h"
@@ -93,8 +97,43 @@ void test_logger() {
   MOKA_ASSERT(moka::LoggerMgr::GetInstance()->get_root()->get_name() == "root");
 }
 
+// 线程退出阶段，在日志缓冲区析构之后析构的thread_local对象仍然可以写异步日志
+static moka::Logger::ptr s_async_logger;
+
+struct ExitLogger {
+  ~ExitLogger() {
+    // 等后台线程回收已关闭的缓冲区
+    usleep(20 * 1000);
+    MOKA_LOG_INFO(s_async_logger) << "log after ring destroyed";
+  }
+};
+
+void test_async_thread_exit() {
+  const std::string file = "/tmp/moka_test_async_exit.log";
+  unlink(file.c_str());
+  s_async_logger.reset(new moka::Logger("async_exit"));
+  s_async_logger->addAppender(moka::LogAppender::ptr(new moka::AsyncLogAppender(file)));
+  std::thread t([]() {
+    // 先于缓冲区构造，因此后于缓冲区析构
+    static thread_local ExitLogger s_exit_logger;
+    (void)s_exit_logger;
+    MOKA_LOG_INFO(s_async_logger) << "log before exit";
+  });
+  t.join();
+  moka::AsyncLogAppender::Flush();
+
+  std::ifstream ifs(file);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  MOKA_ASSERT(ss.str().find("log before exit") != std::string::npos);
+  MOKA_ASSERT(ss.str().find("log after ring destroyed") != std::string::npos);
+  s_async_logger.reset();
+  unlink(file.c_str());
+}
+
 int main() {
   test_logger();
   test_macro();
+  test_async_thread_exit();
   return 0;
 }
\ No newline at end of file
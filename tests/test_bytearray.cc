@@ -1,6 +1,9 @@
+#include <algorithm>
+
 #include "../moka/bytearray.h"
 #include "../moka/macro.h"
 #include "../moka/log.h"
+#include "../moka/config.h"
 
 static moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
 
@@ -51,7 +54,130 @@ void test() {
 #undef XX
 }
 
+// 切片共享节点内存，discardRead释放读完的节点后切片和剩余数据都不受影响
+void test_slice() {
+  for (size_t base_len = 1; base_len <= 64; base_len *= 3) {
+    std::string data;
+    for (int i = 0; i < 1000; ++i) {
+      data.push_back(rand());
+    }
+    moka::ByteArray::ptr ba(new moka::ByteArray(base_len));
+    ba->write(data.c_str(), data.size());
+    ba->set_rw_position(0);
+    std::vector<moka::ByteSlice> slices;
+    size_t pos = 0;
+    while (ba->get_readable_size() > 0) {
+      size_t len = std::min<size_t>(rand() % 100 + 1, ba->get_readable_size());
+      slices.push_back(ba->readSlice(len));
+      MOKA_ASSERT(slices.back().toString() == data.substr(pos, len));
+      pos += len;
+      size_t readable = ba->get_readable_size();
+      ba->discardRead();
+      MOKA_ASSERT(ba->get_readable_size() == readable);
+      MOKA_ASSERT(ba->get_rw_position() < base_len);
+    }
+    // 清空后继续写入不能改写切片的数据
+    ba->clear();
+    ba->write(std::string(data.size(), 'x').c_str(), data.size());
+    std::string joined;
+    for (auto& i : slices) {
+      moka::ByteSlice copy = i;
+      joined += copy.toString();
+    }
+    MOKA_ASSERT(joined == data);
+    ba->set_rw_position(0);
+    MOKA_ASSERT(ba->toString() == std::string(data.size(), 'x'));
+  }
+  MOKA_LOG_INFO(g_logger) << "test_slice ok";
+}
+
+// 批量varint与逐个编解码的结果一致(包括跨节点的值)
+void test_varint_array() {
+  for (bool simd : {false, true}) {
+    moka::Config::Lookup<bool>("bytearray.varint_simd", true)->set_value(simd);
+    for (size_t base_len : {1, 7, 100, 4096}) {
+      std::vector<uint32_t> v32;
+      std::vector<uint64_t> v64;
+      for (int i = 0; i < 3000; ++i) {
+        // 大部分是单字节的值，穿插各种长度
+        int bits = i % 5? 7: rand() % 64;
+        uint64_t v = ((uint64_t)rand() << 32 | rand()) & (bits == 64? ~0ull: ((1ull << bits) - 1));
+        v64.push_back(v);
+        v32.push_back(v);
+      }
+      moka::ByteArray::ptr ba(new moka::ByteArray(base_len));
+      ba->writeUint32VArray(&v32[0], v32.size());
+      for (auto i : v64) {
+        ba->writeUint64V(i);
+      }
+      moka::ByteArray::ptr ba2(new moka::ByteArray(base_len));
+      for (auto i : v32) {
+        ba2->writeUint32V(i);
+      }
+      ba2->writeUint64VArray(&v64[0], v64.size());
+      ba->set_rw_position(0);
+      ba2->set_rw_position(0);
+      MOKA_ASSERT(ba->toString() == ba2->toString());
+
+      std::vector<uint32_t> r32(v32.size());
+      std::vector<uint64_t> r64(v64.size());
+      ba->readUint32VArray(&r32[0], r32.size());
+      ba->readUint64VArray(&r64[0], r64.size());
+      MOKA_ASSERT(r32 == v32 && r64 == v64);
+      MOKA_ASSERT(ba->get_readable_size() == 0);
+    }
+    MOKA_LOG_INFO(g_logger) << "test_varint_array " << moka::ByteArray::VarintKernelName() << " ok";
+  }
+}
+
+void test_mmap() {
+  const char* filename = "/tmp/test_bytearray_mmap.dat";
+  for (size_t base_len = 4096; base_len <= 65536; base_len *= 4) {
+    std::string data;
+    for (int i = 0; i < 100000; ++i) {
+      data.push_back(rand());
+    }
+    moka::ByteArray::ptr file(new moka::ByteArray(base_len));
+    file->write(data.c_str(), data.size());
+    file->set_rw_position(0);
+    MOKA_ASSERT(file->writeToFile(filename));
+
+    moka::ByteArray::ptr ba(new moka::ByteArray(base_len));
+    ba->writeUint32F(1);
+    MOKA_ASSERT(ba->mapFromFile(filename));
+    MOKA_ASSERT(ba->get_rw_position() == 0);
+    MOKA_ASSERT(ba->get_size() == data.size());
+    MOKA_ASSERT(ba->toString() == data);
+    // 映射的内存连续，合并成一个iovec
+    std::vector<iovec> iovs;
+    MOKA_ASSERT(ba->get_read_buffers(iovs) == data.size());
+    MOKA_ASSERT(iovs.size() == 1);
+
+    // 切片在ByteArray释放后仍然有效
+    ba->set_rw_position(100);
+    moka::ByteSlice slice = ba->readSlice(50000);
+    ba.reset();
+    MOKA_ASSERT(slice.toString() == data.substr(100, 50000));
+
+    // 写时复制，追加超过映射长度的数据
+    ba.reset(new moka::ByteArray(base_len));
+    MOKA_ASSERT(ba->mapFromFile(filename));
+    ba->write(std::string(data.size() + base_len, 'x').c_str(), data.size() + base_len);
+    ba->set_rw_position(0);
+    MOKA_ASSERT(ba->toString() == std::string(data.size() + base_len, 'x'));
+
+    moka::ByteArray::ptr check(new moka::ByteArray(base_len));
+    MOKA_ASSERT(check->readFromFile(filename));
+    check->set_rw_position(0);
+    MOKA_ASSERT(check->toString() == data);
+  }
+  MOKA_LOG_INFO(g_logger) << "test_mmap ok";
+}
+
 int main(int argc, char** argv) {
   test();
+  test_slice();
+  test_varint_array();
+  test_mmap();
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "../moka/channel.h"
+#include "../moka/iomanager.h"
+#include "../moka/macro.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+static moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+// 缓冲区内先进先出，满了之后try_push失败
+void test_buffered() {
+  moka::Channel<int> ch(4);
+  for (int i = 0; i < 4; ++i) {
+    MOKA_ASSERT(ch.try_push(i));
+  }
+  MOKA_ASSERT(!ch.try_push(4));
+  MOKA_ASSERT(ch.size() == 4);
+  int v;
+  for (int i = 0; i < 4; ++i) {
+    MOKA_ASSERT(ch.try_pop(v) && v == i);
+  }
+  MOKA_ASSERT(!ch.try_pop(v));
+  MOKA_LOG_INFO(g_logger) << "test_buffered ok";
+}
+
+// 无缓冲的channel直接交给挂起的对端
+void test_unbuffered() {
+  moka::Channel<std::string> ch(0);
+  MOKA_ASSERT(!ch.try_push("x"));
+  {
+    moka::IOManager iom(4, false, "channel");
+    iom.schedule([&ch]() {
+      for (int i = 0; i < 100; ++i) {
+        MOKA_ASSERT(ch.push(std::to_string(i)));
+      }
+    });
+    iom.schedule([&ch]() {
+      std::string v;
+      for (int i = 0; i < 100; ++i) {
+        MOKA_ASSERT(ch.pop(v) && v == std::to_string(i));
+      }
+    });
+  }
+  MOKA_LOG_INFO(g_logger) << "test_unbuffered ok";
+}
+
+void test_timeout() {
+  moka::Channel<int> ch(1);
+  {
+    moka::IOManager iom(4, false, "channel");
+    iom.schedule([&ch]() {
+      int v;
+      uint64_t begin = moka::GetCurrentMs();
+      MOKA_ASSERT(!ch.pop(v, 30));
+      MOKA_ASSERT(moka::GetCurrentMs() - begin >= 30);
+      MOKA_ASSERT(ch.push(1, 30));
+      begin = moka::GetCurrentMs();
+      MOKA_ASSERT(!ch.push(2, 30));
+      MOKA_ASSERT(moka::GetCurrentMs() - begin >= 30);
+      MOKA_ASSERT(ch.pop(v, 30) && v == 1);
+    });
+  }
+  MOKA_LOG_INFO(g_logger) << "test_timeout ok";
+}
+
+// 关闭后唤醒挂起的协程，缓冲区中剩余的数据仍然可以取出
+void test_close() {
+  moka::Channel<int> empty(1);
+  moka::Channel<int> full(1);
+  MOKA_ASSERT(full.try_push(1));
+  {
+    moka::IOManager iom(4, false, "channel");
+    for (int i = 0; i < 3; ++i) {
+      iom.schedule([&empty]() {
+        int v;
+        MOKA_ASSERT(!empty.pop(v));
+      });
+    }
+    iom.schedule([&full]() {
+      MOKA_ASSERT(!full.push(2));
+    });
+    usleep(20 * 1000);
+    empty.close();
+    full.close();
+  }
+  int v;
+  MOKA_ASSERT(full.is_closed() && !full.try_push(3));
+  MOKA_ASSERT(full.try_pop(v) && v == 1);
+  MOKA_ASSERT(!full.try_pop(v));
+  MOKA_LOG_INFO(g_logger) << "test_close ok";
+}
+
+void test_select() {
+  moka::Channel<int> a(0);
+  moka::Channel<std::string> b(0);
+  moka::Channel<int> out(1);
+  {
+    moka::IOManager iom(4, false, "channel");
+    iom.schedule([&]() {
+      int av = 0;
+      std::string bv;
+      int got_a = 0, got_b = 0;
+      while (got_a + got_b < 20) {
+        moka::ChannelSelect select;
+        select.recv(a, av);
+        select.recv(b, bv);
+        int idx = select.wait(1000);
+        MOKA_ASSERT(idx >= 0 && !select.is_closed());
+        if (idx == 0) {
+          MOKA_ASSERT(av == got_a);
+          ++got_a;
+        } else {
+          MOKA_ASSERT(bv == std::to_string(got_b));
+          ++got_b;
+        }
+      }
+      // 超时
+      moka::ChannelSelect select;
+      select.recv(a, av);
+      select.recv(b, bv);
+      MOKA_ASSERT(select.wait(20) == -1);
+
+      // 发送分支: out已满，a稍后由另一个协程接收
+      MOKA_ASSERT(out.try_push(0));
+      moka::ChannelSelect send;
+      send.send(out, 1);
+      send.send(a, 100);
+      MOKA_ASSERT(send.wait(1000) == 1);
+
+      // 关闭的channel
+      b.close();
+      moka::ChannelSelect closed;
+      closed.recv(a, av);
+      closed.recv(b, bv);
+      MOKA_ASSERT(closed.wait() == 1 && closed.is_closed());
+    });
+    iom.schedule([&]() {
+      for (int i = 0; i < 10; ++i) {
+        MOKA_ASSERT(a.push(i));
+      }
+    });
+    iom.schedule([&]() {
+      for (int i = 0; i < 10; ++i) {
+        MOKA_ASSERT(b.push(std::to_string(i)));
+      }
+      usleep(50 * 1000);
+      int v;
+      MOKA_ASSERT(a.pop(v) && v == 100);
+    });
+  }
+  MOKA_LOG_INFO(g_logger) << "test_select ok";
+}
+
+// 多生产者多消费者，检查每个数据恰好被收到一次
+void test_mpmc() {
+  static const int s_producers = 8;
+  static const int s_consumers = 8;
+  static const int s_items = 20000;
+  moka::Channel<int> ch(16);
+  std::atomic<int64_t> sum = {0};
+  std::atomic<int> count = {0};
+  std::atomic<int> producers = {s_producers};
+  {
+    moka::IOManager iom(4, false, "channel");
+    for (int p = 0; p < s_producers; ++p) {
+      iom.schedule([&, p]() {
+        for (int i = 0; i < s_items; ++i) {
+          MOKA_ASSERT(ch.push(p * s_items + i));
+        }
+        if (--producers == 0) {
+          ch.close();
+        }
+      });
+    }
+    for (int c = 0; c < s_consumers; ++c) {
+      iom.schedule([&]() {
+        int v;
+        while (ch.pop(v)) {
+          sum += v;
+          ++count;
+        }
+      });
+    }
+  }
+  int64_t n = (int64_t)s_producers * s_items;
+  MOKA_ASSERT(count == n);
+  MOKA_ASSERT(sum == n * (n - 1) / 2);
+  MOKA_LOG_INFO(g_logger) << "test_mpmc ok";
+}
+
+int main(int argc, char** argv) {
+  MOKA_LOG_NAME("system")->set_level(moka::LogLevel::ERROR);
+  test_buffered();
+  test_unbuffered();
+  test_timeout();
+  test_close();
+  test_select();
+  test_mpmc();
+  return 0;
+}
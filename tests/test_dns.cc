@@ -0,0 +1,306 @@
+#include <arpa/inet.h>
+#include <string.h>
+#include <fstream>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "../moka/dns.h"
+#include "../moka/socket.h"
+#include "../moka/iomanager.h"
+#include "../moka/fiber_sync.h"
+#include "../moka/config.h"
+#include "../moka/macro.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+static moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static std::atomic<bool> s_stop = {false};
+static std::atomic<int> s_queries = {0};      // 本地DNS服务器收到的查询数量
+static std::vector<std::string> s_names;      // 本地DNS服务器收到的A查询的域名(只在服务器所在的线程访问)
+static uint32_t s_ttl = 1;
+
+static void AppendUint16(std::string& out, uint16_t v) {
+  out.push_back((char)(v >> 8));
+  out.push_back((char)(v & 0xff));
+}
+
+static void AppendUint32(std::string& out, uint32_t v) {
+  AppendUint16(out, v >> 16);
+  AppendUint16(out, v & 0xffff);
+}
+
+// 从查询报文中取出域名
+static std::string QueryName(const std::string& query, size_t& end) {
+  std::string name;
+  size_t pos = 12;
+  while (pos < query.size() && query[pos]) {
+    size_t len = (uint8_t)query[pos];
+    if (!name.empty()) {
+      name += '.';
+    }
+    name.append(query, pos + 1, len);
+    pos += len + 1;
+  }
+  end = pos + 1;
+  return name;
+}
+
+// 本地DNS服务器: .test下的域名都有一个A和一个AAAA记录，slow.test延迟50ms响应
+// nx.开头或者不在.test下的域名返回NXDOMAIN，drop.test不响应，cname.test先返回一个CNAME记录
+static void stub_server(std::atomic<uint16_t>* port) {
+  // 在协程中创建socket，recvfrom超时时只挂起协程
+  moka::Socket::ptr sock = moka::Socket::CreateUDPSocket();
+  moka::Address::ptr addr(new moka::IPv4Address("127.0.0.1", 0));
+  MOKA_ASSERT(sock->bind(addr));
+  sock->set_recv_timeout(100);
+  *port = std::static_pointer_cast<moka::IPAddress>(sock->get_local_address())->get_port();
+  int fd = sock->get_socketfd();
+  std::string buf(512, '\0');
+  while (!s_stop) {
+    sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    int n = recvfrom(fd, &buf[0], buf.size(), 0, (sockaddr*)&from, &from_len);
+    if (n <= 0) {
+      continue;
+    }
+    ++s_queries;
+    std::string query = buf.substr(0, n);
+    size_t end = 0;
+    std::string name = QueryName(query, end);
+    uint16_t qtype = ((uint8_t)query[end] << 8) | (uint8_t)query[end + 1];
+    if (qtype == 1) {
+      s_names.push_back(name);
+    }
+    if (name == "drop.test") {
+      continue;
+    }
+    if (name == "slow.test") {
+      usleep(50 * 1000);
+    }
+    std::string resp = query.substr(0, end + 4);
+    bool nx = name.compare(0, 3, "nx.") == 0
+            || name.size() < 5 || name.compare(name.size() - 5, 5, ".test") != 0;
+    resp[2] = (char)0x81;                 // QR RD
+    resp[3] = (char)(0x80 | (nx? 3: 0));  // RA rcode
+    std::string answers;
+    int ancount = 0;
+    if (name == "cname.test") {
+      AppendUint16(answers, 0xc00c);
+      AppendUint16(answers, 5);
+      AppendUint16(answers, 1);
+      AppendUint32(answers, 300);
+      AppendUint16(answers, 2);
+      AppendUint16(answers, 0xc00c);      // 随便指向一个域名，解析器只会跳过
+      ++ancount;
+    }
+    if (!nx) {
+      AppendUint16(answers, 0xc00c);
+      AppendUint16(answers, qtype);
+      AppendUint16(answers, 1);
+      AppendUint32(answers, s_ttl);
+      if (qtype == 1) {
+        AppendUint16(answers, 4);
+        answers.append("\x0a\x00\x00\x01", 4);      // 10.0.0.1
+      } else {
+        AppendUint16(answers, 16);
+        answers.append("\xfd\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x01", 16);
+      }
+      ++ancount;
+    }
+    resp[6] = 0;
+    resp[7] = (char)ancount;
+    resp += answers;
+    sendto(fd, resp.data(), resp.size(), 0, (sockaddr*)&from, from_len);
+  }
+}
+
+// 启动本地DNS服务器，返回服务器地址
+static moka::Address::ptr start_stub(moka::IOManager& iom) {
+  static std::atomic<uint16_t> s_port;
+  s_port = 0;
+  s_stop = false;
+  iom.schedule(std::bind(stub_server, &s_port));
+  while (s_port == 0) {
+    usleep(1000);
+  }
+  return moka::Address::ptr(new moka::IPv4Address("127.0.0.1", s_port));
+}
+
+// 服务器协程从recvfrom超时返回后退出，IOManager析构时等待它结束
+static void stop_stub() {
+  s_stop = true;
+}
+
+void test_resolve() {
+  moka::Config::Lookup<uint64_t>("dns.timeout", 2000)->set_value(200);
+  moka::Config::Lookup<uint32_t>("dns.attempts", 2)->set_value(1);
+  const char* hosts = "/tmp/moka_test_dns_hosts";
+  {
+    std::ofstream ofs(hosts);
+    ofs << "# comment\n10.1.2.3  myhost.test alias.test\nfd00::2 myhost.test  # v6\n";
+  }
+  {
+    moka::IOManager iom(1, false, "dns");
+    std::vector<moka::Address::ptr> servers = {start_stub(iom)};
+    // 协程可能在IOManager析构等待时仍在运行，解析器不能先于IOManager析构
+    moka::DnsResolver::ptr resolver(new moka::DnsResolver(servers, hosts));
+    iom.schedule([resolver, &iom]() {
+      std::vector<moka::IPAddress::ptr> addrs;
+      // 第一次查询发送A和AAAA，IPv4地址在前，端口设置为指定的值
+      MOKA_ASSERT(resolver->resolve("a.test", addrs, 80));
+      MOKA_ASSERT(addrs.size() == 2);
+      MOKA_ASSERT(addrs[0]->toString() == "10.0.0.1/32:80");
+      MOKA_ASSERT(addrs[1]->get_family() == AF_INET6 && addrs[1]->get_port() == 80);
+      MOKA_ASSERT(s_queries == 2);
+
+      // 命中缓存，大小写和末尾的'.'不影响
+      addrs.clear();
+      MOKA_ASSERT(resolver->resolve("A.Test.", addrs, 0, AF_INET));
+      MOKA_ASSERT(addrs.size() == 1 && addrs[0]->toString() == "10.0.0.1/32:0");
+      MOKA_ASSERT(s_queries == 2);
+      MOKA_ASSERT(resolver->get_stats().cache_hits == 1);
+
+      // TTL过期后重新查询
+      usleep(1100 * 1000);
+      addrs.clear();
+      MOKA_ASSERT(resolver->resolve("a.test", addrs));
+      MOKA_ASSERT(s_queries == 4);
+
+      // hosts文件
+      addrs.clear();
+      MOKA_ASSERT(resolver->resolve("alias.test", addrs, 8080));
+      MOKA_ASSERT(addrs.size() == 1 && addrs[0]->toString() == "10.1.2.3/32:8080");
+      addrs.clear();
+      MOKA_ASSERT(resolver->resolve("myhost.test", addrs, 0, AF_INET6));
+      MOKA_ASSERT(addrs.size() == 1);
+      MOKA_ASSERT(resolver->get_stats().hosts_hits == 2);
+
+      // 数字形式的地址不查询
+      addrs.clear();
+      MOKA_ASSERT(resolver->resolve("127.0.0.1", addrs, 53));
+      MOKA_ASSERT(addrs[0]->toString() == "127.0.0.1/32:53");
+
+      // CNAME记录被跳过
+      addrs.clear();
+      MOKA_ASSERT(resolver->resolve("cname.test", addrs));
+      MOKA_ASSERT(addrs.size() == 2);
+
+      // NXDOMAIN被缓存
+      int queries = s_queries;
+      addrs.clear();
+      MOKA_ASSERT(!resolver->resolve("nx.test", addrs));
+      MOKA_ASSERT(!resolver->resolve("nx.test", addrs));
+      MOKA_ASSERT(s_queries == queries + 2);
+
+      // 服务器不响应时超时失败，不缓存
+      uint64_t begin = moka::GetCurrentMs();
+      MOKA_ASSERT(!resolver->resolve("drop.test", addrs));
+      MOKA_ASSERT(moka::GetCurrentMs() - begin >= 190);
+      MOKA_ASSERT(resolver->get_stats().timeouts == 1);
+      MOKA_ASSERT(addrs.empty());
+
+      // 同一个域名的并发查询合并为一次
+      s_queries = 0;
+      static const int s_fibers = 20;
+      moka::FiberSemaphore done;
+      for (int i = 0; i < s_fibers; ++i) {
+        iom.schedule([resolver, &done]() {
+          std::vector<moka::IPAddress::ptr> addrs;
+          MOKA_ASSERT(resolver->resolve("slow.test", addrs));
+          MOKA_ASSERT(addrs.size() == 2);
+          done.post();
+        });
+      }
+      for (int i = 0; i < s_fibers; ++i) {
+        done.wait();
+      }
+      MOKA_ASSERT(s_queries == 2);
+      MOKA_ASSERT(resolver->get_stats().merged == s_fibers - 1);
+      stop_stub();
+    });
+  }
+  unlink(hosts);
+  MOKA_LOG_INFO(g_logger) << "test_resolve ok";
+}
+
+// 不在协程中时同步查询
+void test_no_fiber() {
+  moka::IOManager iom(1, false, "dns_stub");
+  std::vector<moka::Address::ptr> servers = {start_stub(iom)};
+  moka::DnsResolver resolver(servers, "");
+  std::vector<moka::IPAddress::ptr> addrs;
+  MOKA_ASSERT(resolver.resolve("a.test", addrs, 443));
+  MOKA_ASSERT(addrs.size() == 2 && addrs[0]->toString() == "10.0.0.1/32:443");
+  stop_stub();
+  MOKA_LOG_INFO(g_logger) << "test_no_fiber ok";
+}
+
+// 短域名按search列表展开
+void test_search() {
+  moka::IOManager iom(1, false, "dns_search");
+  std::vector<moka::Address::ptr> servers = {start_stub(iom)};
+  moka::DnsResolver::ptr resolver(new moka::DnsResolver(servers, ""));
+  resolver->set_search({"corp.test", "Other.Test."});
+  MOKA_ASSERT(resolver->get_search().size() == 2 && resolver->get_search()[1] == "other.test");
+  iom.schedule([resolver]() {
+    std::vector<moka::IPAddress::ptr> addrs;
+    // 点的数量少于ndots，先查询搜索域
+    s_names.clear();
+    MOKA_ASSERT(resolver->resolve("host", addrs, 80));
+    MOKA_ASSERT(addrs.size() == 2 && addrs[0]->toString() == "10.0.0.1/32:80");
+    MOKA_ASSERT(s_names == std::vector<std::string>({"host.corp.test"}));
+
+    // 所有展开的域名都不存在，不存在的结果按展开后的域名缓存
+    s_names.clear();
+    addrs.clear();
+    MOKA_ASSERT(!resolver->resolve("nx", addrs));
+    MOKA_ASSERT(s_names == std::vector<std::string>({"nx.corp.test", "nx.other.test", "nx"}));
+    MOKA_ASSERT(!resolver->resolve("nx", addrs));
+    MOKA_ASSERT(s_names.size() == 3);
+
+    // 点的数量足够时先查询域名本身，不存在时再查询搜索域
+    s_names.clear();
+    MOKA_ASSERT(resolver->resolve("a.test", addrs));
+    MOKA_ASSERT(s_names == std::vector<std::string>({"a.test"}));
+    s_names.clear();
+    addrs.clear();
+    MOKA_ASSERT(resolver->resolve("c.b", addrs));
+    MOKA_ASSERT(s_names == std::vector<std::string>({"c.b", "c.b.corp.test"}));
+
+    // 以'.'结尾的域名不展开
+    s_names.clear();
+    addrs.clear();
+    MOKA_ASSERT(!resolver->resolve("host.", addrs));
+    MOKA_ASSERT(s_names == std::vector<std::string>({"host"}));
+
+    // ndots为2时a.b也先查询搜索域
+    resolver->set_search({"corp.test"}, 2);
+    resolver->clearCache();
+    s_names.clear();
+    addrs.clear();
+    MOKA_ASSERT(resolver->resolve("a.b", addrs));
+    MOKA_ASSERT(s_names == std::vector<std::string>({"a.b.corp.test"}));
+    stop_stub();
+  });
+  MOKA_LOG_INFO(g_logger) << "test_search ok";
+}
+
+// IPAddress::DnsToIPAddr使用全局的解析器(localhost在hosts文件中)
+void test_dns_to_ip() {
+  std::vector<moka::IPAddress::ptr> addrs;
+  MOKA_ASSERT(moka::IPAddress::DnsToIPAddr("127.0.0.1", "http", addrs));
+  MOKA_ASSERT(addrs.size() == 1 && addrs[0]->toString() == "127.0.0.1/32:80");
+  moka::IPAddress::ptr addr = moka::IPAddress::LookupIPv4Addr("localhost", "8080");
+  MOKA_ASSERT(addr && addr->get_family() == AF_INET && addr->get_port() == 8080);
+  MOKA_LOG_INFO(g_logger) << "test_dns_to_ip ok " << addr->toString();
+}
+
+int main(int argc, char** argv) {
+  test_resolve();
+  test_no_fiber();
+  test_search();
+  test_dns_to_ip();
+  return 0;
+}
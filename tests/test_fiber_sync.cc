@@ -0,0 +1,153 @@
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+
+#include "../moka/fiber_sync.h"
+#include "../moka/iomanager.h"
+#include "../moka/macro.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+static moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+// 多个线程上的协程对同一个计数器加锁累加，临界区中让出协程
+void test_mutex() {
+  static const int s_fibers = 200;
+  static const int s_loops = 100;
+  moka::FiberMutex mutex;
+  int count = 0;
+  {
+    moka::IOManager iom(4, false, "mutex");
+    for (int i = 0; i < s_fibers; ++i) {
+      iom.schedule([&mutex, &count]() {
+        for (int j = 0; j < s_loops; ++j) {
+          moka::FiberMutex::LockGuard lock(mutex);
+          int v = count;
+          if (j % 10 == 0) {
+            moka::Fiber::YieldToReady();
+          }
+          count = v + 1;
+        }
+      });
+    }
+  }
+  MOKA_ASSERT(count == s_fibers * s_loops);
+  MOKA_ASSERT(mutex.try_lock());
+  mutex.unlock();
+  MOKA_LOG_INFO(g_logger) << "test_mutex ok";
+}
+
+// 等待者按加锁的顺序获得锁
+void test_fifo() {
+  moka::FiberMutex mutex;
+  std::vector<int> order;
+  {
+    moka::IOManager iom(1, false, "fifo");
+    iom.schedule([&mutex, &order, &iom]() {
+      mutex.lock();
+      for (int i = 0; i < 10; ++i) {
+        iom.schedule([&mutex, &order, i]() {
+          moka::FiberMutex::LockGuard lock(mutex);
+          order.push_back(i);
+        });
+      }
+      // 让所有协程都挂起在lock上
+      usleep(20 * 1000);
+      mutex.unlock();
+    });
+  }
+  for (int i = 0; i < 10; ++i) {
+    MOKA_ASSERT(order[i] == i);
+  }
+  MOKA_LOG_INFO(g_logger) << "test_fifo ok";
+}
+
+// 生产者消费者
+void test_condition() {
+  static const int s_items = 10000;
+  moka::FiberMutex mutex;
+  moka::FiberCondition cond;
+  std::vector<int> queue;
+  int64_t sum = 0;
+  {
+    moka::IOManager iom(2, false, "cond");
+    for (int c = 0; c < 4; ++c) {
+      iom.schedule([&]() {
+        moka::FiberMutex::LockGuard lock(mutex);
+        while (true) {
+          while (queue.empty()) {
+            cond.wait(mutex);
+          }
+          int v = queue.back();
+          queue.pop_back();
+          if (v < 0) {
+            break;
+          }
+          sum += v;
+        }
+      });
+    }
+    iom.schedule([&]() {
+      for (int i = 1; i <= s_items; ++i) {
+        moka::FiberMutex::LockGuard lock(mutex);
+        queue.push_back(i);
+        cond.notify_one();
+      }
+      moka::FiberMutex::LockGuard lock(mutex);
+      queue.insert(queue.begin(), 4, -1);
+      cond.notify_all();
+    });
+  }
+  {
+    // 超时等待
+    moka::IOManager iom(2, false, "cond");
+    iom.schedule([&]() {
+      moka::FiberMutex::LockGuard lock(mutex);
+      uint64_t begin = moka::GetCurrentMs();
+      MOKA_ASSERT(!cond.wait(mutex, 30));
+      MOKA_ASSERT(moka::GetCurrentMs() - begin >= 30);
+      iom.schedule([&]() {
+        usleep(10 * 1000);
+        moka::FiberMutex::LockGuard lock(mutex);
+        cond.notify_one();
+      });
+      MOKA_ASSERT(cond.wait(mutex, 1000));
+    });
+  }
+  MOKA_ASSERT(sum == (int64_t)s_items * (s_items + 1) / 2);
+  MOKA_LOG_INFO(g_logger) << "test_condition ok";
+}
+
+// 信号量限制同时执行的协程数量
+void test_semaphore() {
+  static const int s_fibers = 100;
+  moka::FiberSemaphore sem(3);
+  std::atomic<int> running = {0};
+  std::atomic<int> max_running = {0};
+  {
+    moka::IOManager iom(2, false, "sem");
+    for (int i = 0; i < s_fibers; ++i) {
+      iom.schedule([&]() {
+        sem.wait();
+        int n = ++running;
+        int m = max_running;
+        while (n > m && !max_running.compare_exchange_weak(m, n)) {
+        }
+        usleep(1000);
+        --running;
+        sem.post();
+      });
+    }
+  }
+  MOKA_ASSERT(max_running <= 3 && max_running > 0);
+  MOKA_ASSERT(sem.try_wait() && sem.try_wait() && sem.try_wait() && !sem.try_wait());
+  MOKA_LOG_INFO(g_logger) << "test_semaphore ok, max_running=" << max_running;
+}
+
+int main(int argc, char** argv) {
+  test_mutex();
+  test_fifo();
+  test_condition();
+  test_semaphore();
+  return 0;
+}
@@ -0,0 +1,167 @@
+#include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <fstream>
+#include <string>
+
+#include "../moka/hook.h"
+#include "../moka/file_io.h"
+#include "../moka/iomanager.h"
+#include "../moka/config.h"
+#include "../moka/macro.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+static moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+// 协程中读写普通文件: open/write/pwrite/fsync/stat/pread/read的结果和直接调用一致
+void test_rw(bool io_uring) {
+  moka::Config::Lookup<bool>("iomanager.io_uring", false)->set_value(io_uring);
+  uint64_t offloaded = moka::FileIOPool::GetInstance()->get_offloaded();
+  bool uring = false;
+  {
+    moka::IOManager iom(1, false, "file_rw");
+    uring = iom.isUring();
+    iom.schedule([]() {
+      const char* path = "/tmp/moka_test_file_io";
+      int fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+      MOKA_ASSERT(fd >= 0);
+      MOKA_ASSERT(write(fd, "hello world", 11) == 11);
+      MOKA_ASSERT(pwrite(fd, "moka!", 5, 6) == 5);
+      MOKA_ASSERT(fsync(fd) == 0);
+
+      struct stat st;
+      MOKA_ASSERT(stat(path, &st) == 0);
+      MOKA_ASSERT(st.st_size == 11);
+
+      char buf[32] = {0};
+      MOKA_ASSERT(pread(fd, buf, sizeof(buf), 0) == 11);
+      MOKA_ASSERT(memcmp(buf, "hello moka!", 11) == 0);
+      // read使用文件当前的偏移量(write之后在文件末尾)
+      MOKA_ASSERT(read(fd, buf, sizeof(buf)) == 0);
+      MOKA_ASSERT(lseek(fd, 6, SEEK_SET) == 6);
+      memset(buf, 0, sizeof(buf));
+      MOKA_ASSERT(read(fd, buf, sizeof(buf)) == 5);
+      MOKA_ASSERT(memcmp(buf, "moka!", 5) == 0);
+      close(fd);
+
+      // 错误码
+      MOKA_ASSERT(open("/tmp/moka_test_file_io_nonexist/a", O_RDONLY) == -1 && errno == ENOENT);
+      MOKA_ASSERT(stat("/tmp/moka_test_file_io_nonexist", &st) == -1 && errno == ENOENT);
+      unlink(path);
+    });
+  }
+  offloaded = moka::FileIOPool::GetInstance()->get_offloaded() - offloaded;
+  // open和stat总是交给卸载线程池，其余的操作只在没有io_uring时交给线程池
+  MOKA_ASSERT(uring? offloaded == 4: offloaded == 10);
+  moka::Config::Lookup<bool>("iomanager.io_uring", false)->set_value(false);
+  MOKA_LOG_INFO(g_logger) << "test_rw io_uring=" << uring << " offloaded=" << offloaded << " ok";
+}
+
+// 打开FIFO会一直阻塞到对端也打开，只有一个调度线程时另一个协程仍然可以运行并打开对端
+// FIFO可以通过epoll等待，读端没有数据时挂起的是协程而不是调度线程
+void test_blocking_open() {
+  const char* path = "/tmp/moka_test_file_io_fifo";
+  unlink(path);
+  MOKA_ASSERT(mkfifo(path, 0644) == 0);
+  std::atomic<int> ticks = {0};
+  {
+    moka::IOManager iom(1, false, "file_open");
+    iom.schedule([path, &ticks]() {
+      int fd = open(path, O_RDONLY);
+      MOKA_ASSERT(fd >= 0);
+      char c = 0;
+      MOKA_ASSERT(read(fd, &c, 1) == 1 && c == 'x');
+      // 等待数据期间写端协程在同一个线程上继续运行
+      MOKA_ASSERT(ticks == 20);
+      MOKA_ASSERT(read(fd, &c, 1) == 0);
+      close(fd);
+    });
+    iom.schedule([path, &ticks]() {
+      for (int i = 0; i < 10; ++i) {
+        usleep(5 * 1000);
+        ++ticks;
+      }
+      int fd = open(path, O_WRONLY);
+      MOKA_ASSERT(fd >= 0);
+      for (int i = 0; i < 10; ++i) {
+        usleep(5 * 1000);
+        ++ticks;
+      }
+      MOKA_ASSERT(write(fd, "x", 1) == 1);
+      close(fd);
+    });
+  }
+  MOKA_ASSERT(ticks == 20);
+  unlink(path);
+  MOKA_LOG_INFO(g_logger) << "test_blocking_open ok";
+}
+
+// 删除目录下的所有文件，返回删除前文件中的总行数
+static int remove_files(const std::string& dir, int* files) {
+  int count = 0;
+  DIR* d = opendir(dir.c_str());
+  if (!d) {
+    return 0;
+  }
+  while (struct dirent* ent = readdir(d)) {
+    if (ent->d_name[0] == '.') {
+      continue;
+    }
+    std::string path = dir + "/" + ent->d_name;
+    std::ifstream ifs(path);
+    std::string line;
+    while (std::getline(ifs, line)) {
+      ++count;
+    }
+    unlink(path.c_str());
+    ++*files;
+  }
+  closedir(d);
+  return count;
+}
+
+// 同一个调度线程上的多个协程写文件日志: 日志输出器持有自旋锁写文件，不能切走协程
+// 轮转后重新打开的文件如果走hook会交给卸载线程池，其他协程再写日志时会在自旋锁上死锁
+void test_log_after_rotate() {
+  const std::string dir = "/tmp/moka_test_log_rotate";
+  int files = 0;
+  remove_files(dir, &files);
+  mkdir(dir.c_str(), 0755);
+  moka::Logger::ptr logger(new moka::Logger("file_io_log"));
+  logger->addAppender(moka::LogAppender::ptr(
+          new moka::FileLogAppender(dir + "/test.log", 4096, moka::FileLogAppender::NONE, 0)));
+  const int fibers = 4;
+  const int lines = 200;
+  {
+    moka::IOManager iom(1, false, "file_log");
+    for (int i = 0; i < fibers; ++i) {
+      iom.schedule([logger, i]() {
+        for (int j = 0; j < lines; ++j) {
+          MOKA_LOG_INFO(logger) << "fiber " << i << " line " << j;
+          if (j % 10 == 0) {
+            moka::Fiber::YieldToReady();
+          }
+        }
+      });
+    }
+  }
+  logger->clearAppenders();
+
+  // 所有日志都写到了轮转前后的文件中
+  files = 0;
+  int count = remove_files(dir, &files);
+  rmdir(dir.c_str());
+  MOKA_ASSERT(files > 1);
+  MOKA_ASSERT(count == fibers * lines);
+  MOKA_LOG_INFO(g_logger) << "test_log_after_rotate files=" << files << " ok";
+}
+
+int main(int argc, char** argv) {
+  test_rw(false);
+  test_rw(true);
+  test_blocking_open();
+  test_log_after_rotate();
+  return 0;
+}
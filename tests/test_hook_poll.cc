@@ -0,0 +1,258 @@
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <atomic>
+
+#include "../moka/hook.h"
+#include "../moka/fd_manager.h"
+#include "../moka/iomanager.h"
+#include "../moka/config.h"
+#include "../moka/macro.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+static moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static std::atomic<int> s_ticks = {0};
+
+// 和等待的协程在同一个调度线程上运行，等待期间计数一直增加说明线程没有被阻塞
+static void ticker(int count) {
+  for (int i = 0; i < count; ++i) {
+    usleep(2 * 1000);
+    ++s_ticks;
+  }
+}
+
+// 模拟第三方客户端库: 自己创建非阻塞的fd，用poll等待响应或者被eventfd唤醒
+static void test_poll() {
+  static int s_sv[2];
+  MOKA_ASSERT(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, s_sv) == 0);
+  {
+    moka::IOManager iom(1, false, "hook_poll");
+    iom.schedule([]() {
+      int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      MOKA_ASSERT(efd >= 0);
+      // 创建时指定的非阻塞保留给用户: 没有数据时直接返回EAGAIN
+      uint64_t v = 0;
+      MOKA_ASSERT(read(efd, &v, sizeof(v)) == -1 && errno == EAGAIN);
+      char buf[16];
+      MOKA_ASSERT(read(s_sv[0], buf, sizeof(buf)) == -1 && errno == EAGAIN);
+
+      struct pollfd fds[2] = {{s_sv[0], POLLIN, 0}, {efd, POLLIN, 0}};
+      int ticks = s_ticks;
+      uint64_t begin = moka::GetCurrentMs();
+      MOKA_ASSERT(poll(fds, 2, 1000) == 1);
+      MOKA_ASSERT((fds[0].revents & POLLIN) && fds[1].revents == 0);
+      MOKA_ASSERT(moka::GetCurrentMs() - begin >= 15);
+      MOKA_ASSERT(s_ticks > ticks);
+      MOKA_ASSERT(read(s_sv[0], buf, sizeof(buf)) == 4 && memcmp(buf, "pong", 4) == 0);
+
+      // 超时
+      begin = moka::GetCurrentMs();
+      MOKA_ASSERT(poll(fds, 2, 30) == 0);
+      MOKA_ASSERT(moka::GetCurrentMs() - begin >= 25);
+      // 可写的fd立即返回
+      struct pollfd wfd = {s_sv[0], POLLOUT, 0};
+      MOKA_ASSERT(poll(&wfd, 1, -1) == 1 && (wfd.revents & POLLOUT));
+      close(efd);
+      close(s_sv[0]);
+    });
+    iom.schedule([]() {
+      usleep(20 * 1000);
+      MOKA_ASSERT(write(s_sv[1], "pong", 4) == 4);
+    });
+    iom.schedule(std::bind(ticker, 20));
+  }
+  close(s_sv[1]);
+  MOKA_LOG_INFO(g_logger) << "test_poll ok";
+}
+
+// 阻塞的管道读写挂起协程，select等待管道可读
+static void test_pipe_select() {
+  static int s_fds[2];
+  {
+    moka::IOManager iom(1, false, "hook_poll");
+    iom.schedule([]() {
+      MOKA_ASSERT(pipe(s_fds) == 0);
+      MOKA_ASSERT(moka::FdMgr::GetInstance()->get(s_fds[0])->isPollable());
+      // 用户看到的仍然是阻塞的fd
+      MOKA_ASSERT(!(fcntl(s_fds[0], F_GETFL) & O_NONBLOCK));
+
+      fd_set rfds;
+      FD_ZERO(&rfds);
+      FD_SET(s_fds[0], &rfds);
+      int ticks = s_ticks;
+      MOKA_ASSERT(select(s_fds[0] + 1, &rfds, nullptr, nullptr, nullptr) == 1);
+      MOKA_ASSERT(FD_ISSET(s_fds[0], &rfds));
+      MOKA_ASSERT(s_ticks > ticks);
+      char c = 0;
+      MOKA_ASSERT(read(s_fds[0], &c, 1) == 1 && c == 'a');
+
+      // 超时返回0，fd_set被清空
+      struct timeval tv = {0, 30 * 1000};
+      FD_SET(s_fds[0], &rfds);
+      MOKA_ASSERT(select(s_fds[0] + 1, &rfds, nullptr, nullptr, &tv) == 0);
+      MOKA_ASSERT(!FD_ISSET(s_fds[0], &rfds));
+
+      // dup出来的fd继承hook信息，阻塞的read挂起协程
+      int fd = dup(s_fds[0]);
+      MOKA_ASSERT(fd >= 0 && moka::FdMgr::GetInstance()->get(fd));
+      ticks = s_ticks;
+      MOKA_ASSERT(read(fd, &c, 1) == 1 && c == 'b');
+      MOKA_ASSERT(s_ticks > ticks);
+      close(fd);
+
+      // fcntl(F_DUPFD)复制出来的fd同样继承hook信息
+      fd = fcntl(s_fds[0], F_DUPFD_CLOEXEC, 0);
+      MOKA_ASSERT(fd >= 0 && moka::FdMgr::GetInstance()->get(fd));
+      MOKA_ASSERT(!(fcntl(fd, F_GETFL) & O_NONBLOCK));
+      ticks = s_ticks;
+      MOKA_ASSERT(read(fd, &c, 1) == 1 && c == 'c');
+      MOKA_ASSERT(s_ticks > ticks);
+      close(fd);
+      close(s_fds[0]);
+    });
+    iom.schedule([]() {
+      usleep(20 * 1000);
+      MOKA_ASSERT(write(s_fds[1], "a", 1) == 1);
+      usleep(60 * 1000);
+      MOKA_ASSERT(write(s_fds[1], "b", 1) == 1);
+      usleep(60 * 1000);
+      MOKA_ASSERT(write(s_fds[1], "c", 1) == 1);
+      close(s_fds[1]);
+    });
+    iom.schedule(std::bind(ticker, 80));
+  }
+  MOKA_LOG_INFO(g_logger) << "test_pipe_select ok";
+}
+
+// 第三方库自己的epoll事件循环
+static void test_epoll_wait() {
+  static int s_efd = -1;
+  s_efd = eventfd(0, EFD_NONBLOCK);
+  {
+    moka::IOManager iom(1, false, "hook_poll");
+    iom.schedule([]() {
+      int epfd = epoll_create1(EPOLL_CLOEXEC);
+      MOKA_ASSERT(epfd >= 0);
+      struct epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.fd = s_efd;
+      MOKA_ASSERT(epoll_ctl(epfd, EPOLL_CTL_ADD, s_efd, &ev) == 0);
+
+      struct epoll_event events[4];
+      uint64_t begin = moka::GetCurrentMs();
+      MOKA_ASSERT(epoll_wait(epfd, events, 4, 30) == 0);
+      MOKA_ASSERT(moka::GetCurrentMs() - begin >= 25);
+
+      int ticks = s_ticks;
+      MOKA_ASSERT(epoll_wait(epfd, events, 4, -1) == 1);
+      MOKA_ASSERT(events[0].data.fd == s_efd && (events[0].events & EPOLLIN));
+      MOKA_ASSERT(s_ticks > ticks);
+      eventfd_t v = 0;
+      MOKA_ASSERT(eventfd_read(s_efd, &v) == 0 && v == 3);
+      close(epfd);
+    });
+    iom.schedule([]() {
+      usleep(60 * 1000);
+      MOKA_ASSERT(eventfd_write(s_efd, 3) == 0);
+    });
+    iom.schedule(std::bind(ticker, 40));
+  }
+  close(s_efd);
+  MOKA_LOG_INFO(g_logger) << "test_epoll_wait ok";
+}
+
+// 同一个fd在一次poll中出现多次，或者同时被hook的read、其他poll/epoll_wait等待
+static void test_shared_fd() {
+  static int s_fds[2];
+  static int s_efd = -1;
+  static int s_epfd = -1;
+  {
+    moka::IOManager iom(1, false, "hook_poll");
+    iom.schedule([]() {
+      // 阻塞的管道，read会挂起协程等待
+      MOKA_ASSERT(pipe(s_fds) == 0);
+      struct pollfd pfds[2] = {{s_fds[0], POLLIN, 0}, {s_fds[0], POLLIN, 0}};
+      uint64_t begin = moka::GetCurrentMs();
+      MOKA_ASSERT(poll(pfds, 2, 20) == 0);
+      MOKA_ASSERT(moka::GetCurrentMs() - begin >= 15);
+    });
+  }
+  {
+    // 先挂起的read占用了读事件，之后的poll定时检查
+    moka::IOManager iom(1, false, "hook_poll");
+    iom.schedule([]() {
+      char c = 0;
+      MOKA_ASSERT(read(s_fds[0], &c, 1) == 1 && c == 'a');
+    });
+    for (int i = 0; i < 2; ++i) {
+      iom.schedule([]() {
+        struct pollfd pfds[2] = {{s_fds[0], POLLIN, 0}, {s_fds[0], POLLIN, 0}};
+        MOKA_ASSERT(poll(pfds, 2, -1) == 2);
+        MOKA_ASSERT((pfds[0].revents & POLLIN) && (pfds[1].revents & POLLIN));
+      });
+    }
+    iom.schedule([]() {
+      usleep(30 * 1000);
+      MOKA_ASSERT(write(s_fds[1], "ab", 2) == 2);
+    });
+  }
+  {
+    // 在协程中关闭，fd的hook信息也一起删除
+    moka::IOManager iom(1, false, "hook_poll");
+    iom.schedule([]() {
+      char c = 0;
+      MOKA_ASSERT(read(s_fds[0], &c, 1) == 1 && c == 'b');
+      close(s_fds[0]);
+      close(s_fds[1]);
+
+      // 两个协程在同一个epoll fd上epoll_wait
+      s_efd = eventfd(0, EFD_NONBLOCK);
+      s_epfd = epoll_create1(EPOLL_CLOEXEC);
+      struct epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.fd = s_efd;
+      MOKA_ASSERT(epoll_ctl(s_epfd, EPOLL_CTL_ADD, s_efd, &ev) == 0);
+    });
+  }
+  {
+    moka::IOManager iom(1, false, "hook_poll");
+    for (int i = 0; i < 2; ++i) {
+      iom.schedule([]() {
+        struct epoll_event events[4];
+        MOKA_ASSERT(epoll_wait(s_epfd, events, 4, 1000) == 1);
+        MOKA_ASSERT(events[0].data.fd == s_efd);
+      });
+    }
+    iom.schedule([]() {
+      usleep(30 * 1000);
+      MOKA_ASSERT(eventfd_write(s_efd, 1) == 0);
+    });
+  }
+  {
+    moka::IOManager iom(1, false, "hook_poll");
+    iom.schedule([]() {
+      close(s_epfd);
+      close(s_efd);
+    });
+  }
+  MOKA_LOG_INFO(g_logger) << "test_shared_fd ok";
+}
+
+void test_all(bool io_uring) {
+  moka::Config::Lookup<bool>("iomanager.io_uring", false)->set_value(io_uring);
+  test_poll();
+  test_pipe_select();
+  test_epoll_wait();
+  test_shared_fd();
+  moka::Config::Lookup<bool>("iomanager.io_uring", false)->set_value(false);
+  MOKA_LOG_INFO(g_logger) << "test_all io_uring=" << io_uring << " ok";
+}
+
+int main(int argc, char** argv) {
+  test_all(false);
+  test_all(true);
+  return 0;
+}
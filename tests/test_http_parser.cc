@@ -0,0 +1,224 @@
+#include "../moka/http_parser.h"
+#include "../moka/macro.h"
+#include "../moka/log.h"
+
+static moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+// 模拟接收: 追加到缓冲区末尾，读写位置不变
+static void feed(moka::ByteArray& ba, const std::string& data) {
+  size_t pos = ba.get_rw_position();
+  ba.set_rw_position(ba.get_size());
+  ba.write(data.c_str(), data.size());
+  ba.set_rw_position(pos);
+}
+
+static const char s_request[] =
+    "\r\n"
+    "POST /echo/path?a=1&b=2#frag HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Content-Length: 11\r\n"
+    "X-Empty:\r\n"
+    "X-Spaces:   padded value  \r\n"
+    "\r\n"
+    "hello world";
+
+static void check_request(moka::HttpRequest::ptr req) {
+  MOKA_ASSERT(req->get_method() == moka::HttpMethod::POST);
+  MOKA_ASSERT(req->get_version() == 0x11);
+  MOKA_ASSERT(req->get_uri() == "/echo/path?a=1&b=2#frag");
+  MOKA_ASSERT(req->get_path() == "/echo/path");
+  MOKA_ASSERT(req->get_query() == "a=1&b=2");
+  MOKA_ASSERT(req->get_fragment() == "frag");
+  MOKA_ASSERT(req->get_headers().size() == 4);
+  MOKA_ASSERT(req->get_header("host") == "localhost");
+  MOKA_ASSERT(req->has_header("x-empty") && req->get_header("x-empty").empty());
+  MOKA_ASSERT(req->get_header("X-Spaces") == "padded value");
+  MOKA_ASSERT(!req->has_header("Connection"));
+  MOKA_ASSERT(req->is_keep_alive());
+  MOKA_ASSERT(req->get_body().toString() == "hello world");
+}
+
+// 每次只到达一个字节，节点很小(头部跨越多个节点，需要拷贝)
+void test_byte_by_byte() {
+  const size_t node_sizes[] = {1, 3, 16, 4096};
+  for (auto node_size : node_sizes) {
+    moka::ByteArray ba(node_size);
+    moka::HttpParser parser(moka::HttpParser::REQUEST);
+    std::string data(s_request);
+    for (size_t i = 0; i < data.size() - 1; ++i) {
+      feed(ba, data.substr(i, 1));
+      MOKA_ASSERT(parser.execute(ba) == moka::HttpParser::AGAIN);
+    }
+    feed(ba, data.substr(data.size() - 1));
+    MOKA_ASSERT(parser.execute(ba) == moka::HttpParser::DONE);
+    MOKA_ASSERT(ba.get_readable_size() == 0);
+    check_request(parser.get_request());
+  }
+  MOKA_LOG_INFO(g_logger) << "test_byte_by_byte ok";
+}
+
+// 流水线: 一次到达多个请求，逐个解析，节点释放后之前的请求仍然有效
+void test_pipeline() {
+  moka::ByteArray ba(64);
+  moka::HttpParser parser(moka::HttpParser::REQUEST);
+  std::string data;
+  const int count = 20;
+  for (int i = 0; i < count; ++i) {
+    data += s_request;
+  }
+  data += "GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\nGET /x";
+  feed(ba, data);
+  std::vector<moka::HttpRequest::ptr> reqs;
+  while (parser.execute(ba) == moka::HttpParser::DONE) {
+    reqs.push_back(parser.get_request());
+    ba.discardRead();
+  }
+  MOKA_ASSERT(reqs.size() == count + 1);
+  for (int i = 0; i < count; ++i) {
+    check_request(reqs[i]);
+  }
+  MOKA_ASSERT(reqs[count]->get_version() == 0x10);
+  MOKA_ASSERT(reqs[count]->is_keep_alive());
+  MOKA_ASSERT(reqs[count]->get_path() == "/");
+  MOKA_ASSERT(reqs[count]->get_body().empty());
+
+  feed(ba, " HTTP/1.0\r\n\r\n");
+  MOKA_ASSERT(parser.execute(ba) == moka::HttpParser::DONE);
+  MOKA_ASSERT(parser.get_request()->get_path() == "/x");
+  MOKA_ASSERT(!parser.get_request()->is_keep_alive());
+  MOKA_LOG_INFO(g_logger) << "test_pipeline ok";
+}
+
+void test_chunked() {
+  const char* data =
+      "PUT /upload HTTP/1.1\r\n"
+      "Transfer-Encoding: gzip, chunked\r\n"
+      "Connection: close\r\n"
+      "\r\n"
+      "5;ext=1\r\nhello\r\n"
+      "1\r\n \r\n"
+      "A\r\n0123456789\r\n"
+      "0\r\n"
+      "Trailer-Field: x\r\n"
+      "\r\n"
+      "GET / HTTP/1.1\r\n\r\n";
+  for (size_t step = 1; step < 8; ++step) {
+    moka::ByteArray ba(7);
+    moka::HttpParser parser(moka::HttpParser::REQUEST);
+    std::string str(data);
+    moka::HttpParser::Result rt = moka::HttpParser::AGAIN;
+    for (size_t i = 0; i < str.size() && rt == moka::HttpParser::AGAIN; i += step) {
+      feed(ba, str.substr(i, step));
+      rt = parser.execute(ba);
+    }
+    MOKA_ASSERT(rt == moka::HttpParser::DONE);
+    moka::HttpRequest::ptr req = parser.get_request();
+    MOKA_ASSERT(req->is_chunked());
+    MOKA_ASSERT(!req->is_keep_alive());
+    MOKA_ASSERT(req->get_body().toString() == "hello 0123456789");
+  }
+  MOKA_LOG_INFO(g_logger) << "test_chunked ok";
+}
+
+void test_reply() {
+  moka::ByteArray ba;
+  moka::HttpParser parser(moka::HttpParser::RESPONSE);
+  feed(ba, "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok"
+           "HTTP/1.1 204 No Content\r\n\r\n"
+           "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n"
+           "HTTP/1.0 404 Not Found\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n");
+  MOKA_ASSERT(parser.execute(ba) == moka::HttpParser::DONE);
+  MOKA_ASSERT(parser.get_reply()->get_status() == 200);
+  MOKA_ASSERT(parser.get_reply()->get_reason() == "OK");
+  MOKA_ASSERT(parser.get_reply()->get_body().toString() == "ok");
+  MOKA_ASSERT(parser.execute(ba) == moka::HttpParser::DONE);
+  MOKA_ASSERT(parser.get_reply()->get_status() == 204);
+  // HEAD请求的响应有Content-Length但没有消息体
+  parser.set_head_only(true);
+  MOKA_ASSERT(parser.execute(ba) == moka::HttpParser::DONE);
+  MOKA_ASSERT(parser.get_reply()->get_body().empty());
+  parser.set_head_only(false);
+  MOKA_ASSERT(parser.execute(ba) == moka::HttpParser::DONE);
+  MOKA_ASSERT(parser.get_reply()->get_status() == 404);
+  MOKA_ASSERT(!parser.get_reply()->is_keep_alive());
+  MOKA_ASSERT(parser.get_reply()->get_body().toString() == "abc");
+  MOKA_LOG_INFO(g_logger) << "test_reply ok";
+}
+
+void test_errors() {
+  struct {
+    const char* data;
+    moka::HttpStatus status;
+  } cases[] = {
+    {"GET / HTTP/2.0\r\n\r\n", moka::HttpStatus::HTTP_VERSION_NOT_SUPPORTED},
+    {"GET / HTTP/1.1 \r\n\r\n", moka::HttpStatus::BAD_REQUEST},
+    {"FETCH / HTTP/1.1\r\n\r\n", moka::HttpStatus::NOT_IMPLEMENTED},
+    {"GET /\r\n\r\n", moka::HttpStatus::BAD_REQUEST},
+    {"GET / HTTP/1.1\r\nHost : x\r\n\r\n", moka::HttpStatus::BAD_REQUEST},
+    {"GET / HTTP/1.1\r\nHost: x\r\n folded\r\n\r\n", moka::HttpStatus::BAD_REQUEST},
+    {"GET / HTTP/1.1\r\nNoColon\r\n\r\n", moka::HttpStatus::BAD_REQUEST},
+    {"POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n", moka::HttpStatus::BAD_REQUEST},
+    {"POST / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n", moka::HttpStatus::BAD_REQUEST},
+    {"POST / HTTP/1.1\r\nContent-Length: 1\r\nTransfer-Encoding: chunked\r\n\r\n", moka::HttpStatus::BAD_REQUEST},
+    {"POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n", moka::HttpStatus::NOT_IMPLEMENTED},
+    {"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n", moka::HttpStatus::BAD_REQUEST},
+    {"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n1\r\nab\r\n", moka::HttpStatus::BAD_REQUEST},
+    {"POST / HTTP/1.1\r\nContent-Length: 999999999999\r\n\r\n", moka::HttpStatus::PAYLOAD_TOO_LARGE},
+  };
+  for (auto& i : cases) {
+    moka::ByteArray ba;
+    moka::HttpParser parser(moka::HttpParser::REQUEST);
+    feed(ba, i.data);
+    MOKA_ASSERT(parser.execute(ba) == moka::HttpParser::ERROR);
+    MOKA_ASSERT(parser.get_error_status() == i.status);
+    // 出错后不能继续使用
+    MOKA_ASSERT(parser.execute(ba) == moka::HttpParser::ERROR);
+  }
+
+  // 头部超过限制，不需要等到头部结束
+  moka::ByteArray ba;
+  moka::HttpParser parser(moka::HttpParser::REQUEST);
+  feed(ba, "GET / HTTP/1.1\r\n");
+  MOKA_ASSERT(parser.execute(ba) == moka::HttpParser::AGAIN);
+  feed(ba, "X-Big: " + std::string(64 * 1024, 'x'));
+  MOKA_ASSERT(parser.execute(ba) == moka::HttpParser::ERROR);
+  MOKA_ASSERT(parser.get_error_status() == moka::HttpStatus::REQUEST_HEADER_FIELDS_TOO_LARGE);
+  MOKA_LOG_INFO(g_logger) << "test_errors ok";
+}
+
+void test_response() {
+  moka::HttpResponse rsp(0x11, true);
+  rsp.set_header("Content-Length", "100");
+  rsp.set_header("Content-Type", "text/plain");
+  rsp.set_body("hi");
+  MOKA_ASSERT(rsp.toString() == "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 2\r\n\r\nhi");
+
+  moka::HttpResponse chunked(0x11, false);
+  chunked.add_chunk("abc");
+  chunked.add_chunk("0123456789");
+  MOKA_ASSERT(chunked.toString() == "HTTP/1.1 200 OK\r\nConnection: close\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                    "3\r\nabc\r\na\r\n0123456789\r\n0\r\n\r\n");
+
+  // 序列化的结果可以被解析回来
+  moka::ByteArray ba;
+  moka::HttpParser parser(moka::HttpParser::RESPONSE);
+  feed(ba, chunked.toString());
+  MOKA_ASSERT(parser.execute(ba) == moka::HttpParser::DONE);
+  MOKA_ASSERT(parser.get_reply()->get_body().toString() == "abc0123456789");
+
+  moka::HttpResponse old(0x10, true);
+  old.set_status(moka::HttpStatus::NOT_FOUND);
+  old.add_chunk("abc");
+  MOKA_ASSERT(old.toString() == "HTTP/1.0 404 Not Found\r\nConnection: keep-alive\r\nContent-Length: 3\r\n\r\nabc");
+  MOKA_LOG_INFO(g_logger) << "test_response ok";
+}
+
+int main(int argc, char** argv) {
+  test_byte_by_byte();
+  test_pipeline();
+  test_chunked();
+  test_reply();
+  test_errors();
+  test_response();
+  return 0;
+}
@@ -0,0 +1,58 @@
+// 示例HTTP服务器，可以用moka_wrk或curl测试
+// 用法: test_http_server [port] [threads]
+#include <stdlib.h>
+
+#include "../moka/http_server.h"
+#include "../moka/log.h"
+
+static moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static int s_port = 8020;
+static int s_threads = 2;
+
+void run() {
+  moka::HttpServer::ptr server(new moka::HttpServer);
+  moka::Address::ptr addr(new moka::IPv4Address("0.0.0.0", s_port));
+  if (!server->bind(addr)) {
+    MOKA_LOG_ERROR(g_logger) << "bind " << addr->toString() << " failed";
+    return;
+  }
+  moka::ServletDispatch::ptr sd = server->get_dispatch();
+  sd->addServlet("/hello", [](moka::HttpRequest::ptr req, moka::HttpResponse::ptr rsp) {
+    rsp->set_header("Content-Type", "text/plain");
+    rsp->set_body("hello world\n");
+    return 0;
+  });
+  // 原样返回请求
+  sd->addServlet("/echo", [](moka::HttpRequest::ptr req, moka::HttpResponse::ptr rsp) {
+    rsp->set_header("Content-Type", "text/plain");
+    rsp->set_body(req->toString());
+    return 0;
+  });
+  sd->addServlet("/chunked", [](moka::HttpRequest::ptr req, moka::HttpResponse::ptr rsp) {
+    rsp->set_header("Content-Type", "text/plain");
+    for (int i = 0; i < 5; ++i) {
+      rsp->add_chunk("chunk " + std::to_string(i) + "\n");
+    }
+    return 0;
+  });
+  sd->addGlobServlet("/static/*", [](moka::HttpRequest::ptr req, moka::HttpResponse::ptr rsp) {
+    rsp->set_header("Content-Type", "text/plain");
+    rsp->set_body("glob: " + req->get_path().str() + "\n");
+    return 0;
+  });
+  server->start();
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    s_port = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    s_threads = atoi(argv[2]);
+  }
+  MOKA_LOG_NAME("system")->set_level(moka::LogLevel::INFO);
+  moka::IOManager iom(s_threads, true, "http");
+  iom.schedule(run);
+  return 0;
+}
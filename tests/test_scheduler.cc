@@ -1,6 +1,8 @@
 #include "../moka/scheduler.h"
 #include "../moka/log.h"
 #include "../moka/fiber.h"
+#include "../moka/macro.h"
+#include <atomic>
 
 moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
 
@@ -30,7 +32,30 @@ void test_scheduler() {
   s.stop();
 }
 
+// 协程在YieldToHoldSched之前就把自己放回任务队列(相当于事件在挂起之前就已经触发)
+// 切换完成之前协程保持EXEC状态，其他调度线程不会同时执行它
+void test_yield_to_hold() {
+  static std::atomic<int> s_count = {0};
+  moka::Scheduler s(4, false, "yield_hold");
+  s.start();
+  for (int i = 0; i < 8; ++i) {
+    s.schedule([]() {
+      for (int j = 0; j < 1000; ++j) {
+        moka::Fiber::ptr self = moka::Fiber::GetThis();
+        moka::Scheduler::GetThis()->schedule(self);
+        moka::Fiber::YieldToHoldSched();
+        MOKA_ASSERT(self->get_state() == moka::Fiber::EXEC);
+        ++s_count;
+      }
+    });
+  }
+  s.stop();
+  MOKA_ASSERT(s_count == 8000);
+  MOKA_LOG_INFO(g_logger) << "test_yield_to_hold ok";
+}
+
 int main(int agrc, char** argv) {
   test_scheduler();
+  test_yield_to_hold();
   return 0;
 }
\ No newline at end of file
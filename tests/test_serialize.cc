@@ -0,0 +1,143 @@
+#include "../moka/serialize.h"
+#include "../moka/macro.h"
+#include "../moka/log.h"
+
+static moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+enum class Side : uint8_t {
+  BUY = 1,
+  SELL = 2,
+};
+
+struct Point {
+  int32_t x;
+  int32_t y;
+  double w;
+  MOKA_SERIALIZE_FIELDS(x, y, w)
+
+  bool operator==(const Point& oth) const {
+    return x == oth.x && y == oth.y && w == oth.w;
+  }
+};
+
+struct Order {
+  int64_t id;
+  uint16_t flags;
+  Side side;
+  Point pos;             // 定长的嵌套结构体和前面的字段合并编码
+  std::string symbol;
+  float price;
+  std::vector<Point> path;
+  std::list<std::string> tags;
+  std::map<std::string, int32_t> attrs;
+  std::unordered_map<int32_t, std::vector<uint8_t>> blobs;
+  std::set<int64_t> ids;
+  std::vector<bool> bits;
+  MOKA_SERIALIZE_FIELDS(id, flags, side, pos, symbol, price, path, tags, attrs, blobs, ids, bits)
+
+  bool operator==(const Order& oth) const {
+    return id == oth.id && flags == oth.flags && side == oth.side && pos == oth.pos
+        && symbol == oth.symbol && price == oth.price && path == oth.path && tags == oth.tags
+        && attrs == oth.attrs && blobs == oth.blobs && ids == oth.ids && bits == oth.bits;
+  }
+};
+
+static_assert(moka::SerializeFixed<Point>::value && moka::SerializeFixed<Point>::size == 16,
+              "Point is a fixed 16 byte layout");
+static_assert(!moka::SerializeFixed<Order>::value, "Order has variable fields");
+static_assert(moka::SerializeRun<decltype(std::declval<Order&>().moka_fields()), 0>::end == 4
+              && moka::SerializeRun<decltype(std::declval<Order&>().moka_fields()), 0>::bytes == 27,
+              "id/flags/side/pos form one run");
+
+static Order make_order() {
+  Order o;
+  o.id = ((int64_t)rand() << 32) | rand();
+  o.flags = rand();
+  o.side = rand() % 2? Side::BUY: Side::SELL;
+  o.pos = {rand(), -rand(), rand() / 3.0};
+  o.symbol = std::string(rand() % 20, 'a' + rand() % 26);
+  o.price = rand() / 7.0f;
+  for (int i = rand() % 10; i > 0; --i) {
+    o.path.push_back({rand(), rand(), -rand() / 5.0});
+    o.tags.push_back(std::to_string(rand()));
+    o.attrs[std::to_string(rand())] = rand();
+    o.blobs[rand()] = std::vector<uint8_t>(rand() % 100, rand());
+    o.ids.insert(rand());
+    o.bits.push_back(rand() % 2);
+  }
+  return o;
+}
+
+void test_round_trip() {
+  for (int little = 0; little < 2; ++little) {
+    for (size_t base_len = 1; base_len <= 4096; base_len *= 8) {
+      std::vector<Order> orders;
+      for (int i = 0; i < 100; ++i) {
+        orders.push_back(make_order());
+      }
+      moka::ByteArray ba(base_len);
+      if (little) {
+        ba.set_little_endian();
+      }
+      moka::Serialize(ba, orders);
+      ba.set_rw_position(0);
+      std::vector<Order> out = moka::Deserialize<std::vector<Order>>(ba);
+      MOKA_ASSERT(out == orders);
+      MOKA_ASSERT(ba.get_readable_size() == 0);
+    }
+  }
+  MOKA_LOG_INFO(g_logger) << "test_round_trip ok";
+}
+
+// 编码结果与手写ByteArray调用相同
+void test_format() {
+  Point p = {1, -2, 3.5};
+  std::vector<int32_t> values = {1, 2, 3};
+  std::string str = "moka";
+
+  moka::ByteArray expect;
+  expect.writeInt32F(p.x);
+  expect.writeInt32F(p.y);
+  expect.writeDouble(p.w);
+  expect.writeUint64V(values.size());
+  for (auto v : values) {
+    expect.writeInt32F(v);
+  }
+  expect.writeStringIntV(str);
+
+  moka::ByteArray ba;
+  moka::Serialize(ba, p);
+  moka::Serialize(ba, values);
+  moka::Serialize(ba, str);
+  ba.set_rw_position(0);
+  expect.set_rw_position(0);
+  MOKA_ASSERT(ba.toString() == expect.toString());
+  MOKA_LOG_INFO(g_logger) << "test_format ok";
+}
+
+void test_truncated() {
+  moka::ByteArray ba;
+  moka::Serialize(ba, make_order());
+  ba.set_rw_position(0);
+  std::string data = ba.toString();
+  for (size_t len = 0; len < data.size(); ++len) {
+    moka::ByteArray part;
+    part.write(data.c_str(), len);
+    part.set_rw_position(0);
+    bool thrown = false;
+    try {
+      moka::Deserialize<Order>(part);
+    } catch (std::out_of_range& e) {
+      thrown = true;
+    }
+    MOKA_ASSERT(thrown);
+  }
+  MOKA_LOG_INFO(g_logger) << "test_truncated ok";
+}
+
+int main(int argc, char** argv) {
+  test_round_trip();
+  test_format();
+  test_truncated();
+  return 0;
+}
@@ -0,0 +1,148 @@
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+
+#include "../moka/socket_pool.h"
+#include "../moka/tcp_server.h"
+#include "../moka/config.h"
+#include "../moka/macro.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+static moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+// 回显服务器，收到"close"时关闭连接
+class EchoServer : public moka::TcpServer {
+ public:
+  EchoServer(moka::IOManager* worker) : moka::TcpServer(worker, worker) {}
+
+ protected:
+  virtual void handleClient(moka::Socket::ptr client) override {
+    char buf[1024];
+    while (true) {
+      int n = client->recv(buf, sizeof(buf));
+      if (n <= 0 || (n == 5 && memcmp(buf, "close", 5) == 0)) {
+        break;
+      }
+      if (client->send(buf, n) != n) {
+        break;
+      }
+    }
+    client->close();
+  }
+};
+
+static moka::Address::ptr s_addr;
+static std::atomic<bool> s_done = {false};
+
+static bool request(moka::Socket::ptr sock, const std::string& msg) {
+  if (sock->send(msg.c_str(), msg.size()) != (int)msg.size()) {
+    return false;
+  }
+  std::string buf(msg.size(), 0);
+  return sock->recv(&buf[0], buf.size(), MSG_WAITALL) == (int)buf.size() && buf == msg;
+}
+
+void test_reuse(moka::SocketPool::ptr pool) {
+  moka::Socket::ptr sock = pool->get(s_addr);
+  MOKA_ASSERT(sock && request(sock, "hello"));
+  int fd = sock->get_socketfd();
+  pool->put(sock);
+  sock = pool->get(s_addr);
+  MOKA_ASSERT(sock && sock->get_socketfd() == fd && request(sock, "again"));
+  pool->put(sock);
+  moka::SocketPool::Stats stats = pool->get_stats();
+  MOKA_ASSERT(stats.gets == 2 && stats.hits == 1 && stats.creates == 1);
+  MOKA_ASSERT(pool->get_connections(s_addr) == 1);
+  MOKA_LOG_INFO(g_logger) << "test_reuse ok";
+}
+
+// 对端关闭的空闲连接在取出时被丢弃
+void test_unhealthy(moka::SocketPool::ptr pool) {
+  moka::Socket::ptr sock = pool->get(s_addr);
+  MOKA_ASSERT(sock->send("close", 5) == 5);
+  pool->put(sock);
+  usleep(20 * 1000);
+  sock = pool->get(s_addr);
+  MOKA_ASSERT(sock && request(sock, "fresh"));
+  pool->put(sock);
+  MOKA_ASSERT(pool->get_stats().unhealthy == 1);
+  MOKA_ASSERT(pool->get_connections(s_addr) == 1);
+  MOKA_LOG_INFO(g_logger) << "test_unhealthy ok";
+}
+
+// 连接数达到上限时等待归还
+void test_wait(moka::SocketPool::ptr pool) {
+  pool->set_max_connections(2);
+  moka::Socket::ptr a = pool->get(s_addr);
+  moka::Socket::ptr b = pool->get(s_addr);
+  MOKA_ASSERT(a && b);
+  // 超时
+  uint64_t begin = moka::GetCurrentMs();
+  MOKA_ASSERT(!pool->get(s_addr, 50));
+  MOKA_ASSERT(moka::GetCurrentMs() - begin >= 50);
+  MOKA_ASSERT(pool->get_stats().wait_timeouts == 1);
+
+  // 其他协程归还后被唤醒，直接拿到归还的连接
+  int fd = a->get_socketfd();
+  moka::IOManager::GetThis()->schedule([pool, a]() {
+    usleep(30 * 1000);
+    pool->put(a);
+  });
+  moka::Socket::ptr c = pool->get(s_addr, 1000);
+  MOKA_ASSERT(c && c->get_socketfd() == fd && request(c, "waited"));
+
+  // 关闭连接后等待者新建连接
+  moka::IOManager::GetThis()->schedule([pool, b]() {
+    usleep(30 * 1000);
+    pool->put(b, false);
+  });
+  moka::Socket::ptr d = pool->get(s_addr, 1000);
+  MOKA_ASSERT(d && request(d, "new"));
+  pool->put(c);
+  pool->put(d);
+  MOKA_ASSERT(pool->get_connections(s_addr) == 2);
+  moka::SocketPool::Stats stats = pool->get_stats();
+  MOKA_ASSERT(stats.waits == 3);
+  MOKA_LOG_INFO(g_logger) << "test_wait ok, wait_us=" << stats.wait_us;
+}
+
+// 空闲超时的连接由定时器关闭
+void test_idle_timeout(moka::SocketPool::ptr pool) {
+  MOKA_ASSERT(pool->get_connections(s_addr) == 2);
+  usleep(300 * 1000);
+  MOKA_ASSERT(pool->get_connections(s_addr) == 0);
+  MOKA_ASSERT(pool->get_stats().expired == 2);
+  MOKA_LOG_INFO(g_logger) << "test_idle_timeout ok";
+}
+
+void run() {
+  moka::SocketPool::ptr pool(new moka::SocketPool);
+  test_reuse(pool);
+  test_unhealthy(pool);
+  test_wait(pool);
+  test_idle_timeout(pool);
+  moka::SocketPool::Stats stats = pool->get_stats();
+  MOKA_LOG_INFO(g_logger) << "gets=" << stats.gets << " hit_rate=" << stats.hit_rate()
+                          << " creates=" << stats.creates;
+  pool.reset();
+  s_done = true;
+}
+
+int main(int argc, char** argv) {
+  moka::Config::Lookup<uint64_t>("socket_pool.idle_timeout", 0)->set_value(100);
+  moka::IOManager server_iom(1, false, "server");
+  std::shared_ptr<EchoServer> server(new EchoServer(&server_iom));
+  MOKA_ASSERT(server->bind(moka::Address::ptr(new moka::IPv4Address("127.0.0.1", 0))));
+  server->start();
+  s_addr = server->get_sockets()[0]->get_local_address();
+  {
+    moka::IOManager iom(2, false, "client");
+    iom.schedule(run);
+    while (!s_done) {
+      usleep(1000);
+    }
+  }
+  server->stop();
+  return 0;
+}
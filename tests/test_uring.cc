@@ -0,0 +1,127 @@
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+#include <atomic>
+
+#include "../moka/hook.h"
+#include "../moka/iomanager.h"
+#include "../moka/config.h"
+#include "../moka/macro.h"
+#include "../moka/log.h"
+#include "../moka/util.h"
+
+static moka::Logger::ptr g_logger = MOKA_LOG_ROOT();
+
+static void set_recv_timeout(int fd, int ms) {
+  struct timeval tv = {ms / 1000, ms % 1000 * 1000};
+  MOKA_ASSERT(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0);
+}
+
+// 带超时的IO操作: 超时返回ETIMEDOUT，被close取消时返回ECANCELED
+void test_cancel_vs_timeout() {
+  static int s_sv[2];
+  {
+    moka::IOManager iom(1, false, "uring");
+    iom.schedule([]() {
+      MOKA_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, s_sv) == 0);
+      set_recv_timeout(s_sv[0], 1000);
+      char c;
+      uint64_t begin = moka::GetCurrentMs();
+      MOKA_ASSERT(read(s_sv[0], &c, 1) == -1);
+      MOKA_ASSERT(errno == ECANCELED);
+      MOKA_ASSERT(moka::GetCurrentMs() - begin < 500);
+      close(s_sv[1]);
+
+      MOKA_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, s_sv) == 0);
+      set_recv_timeout(s_sv[0], 30);
+      begin = moka::GetCurrentMs();
+      MOKA_ASSERT(read(s_sv[0], &c, 1) == -1);
+      MOKA_ASSERT(errno == ETIMEDOUT);
+      MOKA_ASSERT(moka::GetCurrentMs() - begin >= 25);
+      close(s_sv[0]);
+      close(s_sv[1]);
+    });
+    iom.schedule([]() {
+      usleep(20 * 1000);
+      close(s_sv[0]);
+    });
+  }
+  MOKA_LOG_INFO(g_logger) << "test_cancel_vs_timeout ok";
+}
+
+// 其他调度器的协程在io_uring的IOManager上注册事件，不需要等调度线程从idle超时返回
+void test_foreign_add_event() {
+  static int s_fds[2];
+  MOKA_ASSERT(pipe2(s_fds, O_NONBLOCK) == 0);
+  static std::atomic<uint64_t> s_begin = {0};
+  static std::atomic<uint64_t> s_fired = {0};
+  {
+    moka::IOManager iom(1, false, "uring");
+    // 等待iom的调度线程进入idle
+    usleep(50 * 1000);
+    // 注册事件的协程运行在另一个(epoll的)IOManager上，事件的回调也交给它执行
+    moka::Config::Lookup<bool>("iomanager.io_uring", false)->set_value(false);
+    moka::IOManager other(1, false, "other");
+    moka::Config::Lookup<bool>("iomanager.io_uring", false)->set_value(true);
+    other.schedule([&iom]() {
+      MOKA_ASSERT(iom.addEvent(s_fds[0], moka::IOManager::READ, []() {
+        s_fired = moka::GetCurrentMs();
+      }) == 0);
+      s_begin = moka::GetCurrentMs();
+      MOKA_ASSERT(write(s_fds[1], "x", 1) == 1);
+    });
+    uint64_t begin = moka::GetCurrentMs();
+    while (!s_fired && moka::GetCurrentMs() - begin < 2000) {
+      usleep(1000);
+    }
+    MOKA_ASSERT(s_fired && s_fired - s_begin < 500);
+  }
+  close(s_fds[0]);
+  close(s_fds[1]);
+  MOKA_LOG_INFO(g_logger) << "test_foreign_add_event ok";
+}
+
+// connect在内核支持IORING_OP_CONNECT时直接提交，否则退回到等待写事件的方式，两种方式的结果一致
+void test_connect() {
+  moka::IOManager iom(1, false, "uring");
+  iom.schedule([&iom]() {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    MOKA_ASSERT(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+    MOKA_ASSERT(listen(listen_fd, 16) == 0);
+    socklen_t len = sizeof(addr);
+    MOKA_ASSERT(getsockname(listen_fd, (sockaddr*)&addr, &len) == 0);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    MOKA_ASSERT(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+    close(fd);
+    close(listen_fd);
+
+    // 端口已经没有监听
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    MOKA_ASSERT(connect(fd, (sockaddr*)&addr, sizeof(addr)) == -1 && errno == ECONNREFUSED);
+    close(fd);
+    MOKA_LOG_INFO(g_logger) << "test_connect uring_connect="
+                            << iom.isUringOpSupported(IORING_OP_CONNECT) << " ok";
+  });
+}
+
+int main(int argc, char** argv) {
+  moka::Config::Lookup<bool>("iomanager.io_uring", false)->set_value(true);
+  {
+    moka::IOManager iom(1, false, "uring");
+    if (!iom.isUring()) {
+      MOKA_LOG_INFO(g_logger) << "io_uring not supported, skip";
+      return 0;
+    }
+  }
+  test_cancel_vs_timeout();
+  test_foreign_add_event();
+  test_connect();
+  return 0;
+}
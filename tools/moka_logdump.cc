@@ -0,0 +1,56 @@
+// 把BinaryLogAppender写入的二进制日志还原为文本
+// 用法: moka_logdump <file> [-p pattern]，默认使用文件中记录的输出格式
+#include <errno.h>
+#include <string.h>
+#include <iostream>
+#include <map>
+
+#include "../moka/log.h"
+#include "../moka/binlog.h"
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <file> [-p pattern]" << std::endl;
+    return 1;
+  }
+  std::string pattern;
+  for (int i = 2; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-p")) {
+      pattern = argv[i + 1];
+    }
+  }
+  moka::BinaryLogReader reader;
+  if (!reader.open(argv[1])) {
+    std::cerr << "open " << argv[1] << " failed: " << strerror(errno) << std::endl;
+    return 1;
+  }
+
+  std::map<std::string, moka::Logger::ptr> loggers;   // 按名称缓存，%c输出日志器名称
+  std::string cur_pattern;
+  moka::LogFormatter::ptr formatter;
+  moka::BinLogRecord record;
+  std::string out;
+  while (reader.next(record)) {
+    // 文件中每段的格式可能不同
+    const std::string& p = pattern.empty()? reader.get_pattern(): pattern;
+    if (!formatter || p != cur_pattern) {
+      cur_pattern = p;
+      formatter = p.empty()? moka::Logger().get_formatter(): std::make_shared<moka::LogFormatter>(p);
+      if (formatter->isError()) {
+        std::cerr << "invalid pattern: " << p << std::endl;
+        return 1;
+      }
+    }
+    auto& logger = loggers[*record.logger_name];
+    if (!logger) {
+      logger.reset(new moka::Logger(*record.logger_name));
+    }
+    moka::LogEvent event(record.file, 0, record.line, record.thread_id, record.fiber_id,
+                         *record.thread_name, record.timestamp, logger, record.level);
+    event.get_ss() << record.message;
+    out.clear();
+    formatter->format(out, moka::LogEvent::ptr(moka::LogEvent::ptr(), &event));
+    std::cout << out;
+  }
+  return 0;
+}
@@ -0,0 +1,238 @@
+// HTTP压测工具(类似wrk): 每个连接一个协程，支持长连接和流水线，输出吞吐量和延迟分布
+// 用法: moka_wrk [-c connections] [-t threads] [-d seconds] [-p pipeline] [-k 0|1] http://host[:port]/path
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <vector>
+
+#include "../moka/http_parser.h"
+#include "../moka/iomanager.h"
+#include "../moka/socket.h"
+#include "../moka/util.h"
+#include "../moka/log.h"
+
+struct Options {
+  int connections = 64;
+  int threads = 2;
+  int seconds = 10;
+  int pipeline = 1;
+  bool keep_alive = true;
+  uint64_t timeout = 2000;    // 连接和接收的超时时间(毫秒)
+};
+
+// 每个连接协程独立统计，结束后汇总(不需要加锁)
+struct Stats {
+  uint64_t requests = 0;
+  uint64_t bytes = 0;
+  uint64_t non2xx = 0;
+  uint64_t connect_errors = 0;
+  uint64_t io_errors = 0;
+  uint64_t parse_errors = 0;
+  std::vector<uint32_t> latencies;   // 微秒
+};
+
+static Options s_options;
+static std::string s_request;          // 一批(pipeline个)请求
+static moka::Address::ptr s_addr;
+static uint64_t s_deadline_us = 0;
+static std::atomic<int> s_running = {0};
+
+static void client(Stats* stats) {
+  moka::ByteArray in(16 * 1024);
+  moka::HttpParser parser(moka::HttpParser::RESPONSE);
+  moka::Socket::ptr sock;
+  while (moka::GetCurrentUs() < s_deadline_us) {
+    if (!sock) {
+      sock = moka::Socket::CreateTCP(s_addr);
+      if (!sock->connect(s_addr, s_options.timeout)) {
+        ++stats->connect_errors;
+        sock.reset();
+        // 连接失败时稍等再试，避免空转
+        usleep(10 * 1000);
+        continue;
+      }
+      sock->set_recv_timeout(s_options.timeout);
+      in.clear();
+      parser.reset();
+    }
+    uint64_t begin = moka::GetCurrentUs();
+    bool ok = sock->send(s_request.c_str(), s_request.size()) == (int)s_request.size();
+    bool keep_alive = true;
+    int done = 0;
+    while (ok && done < s_options.pipeline) {
+      moka::HttpParser::Result rt = parser.execute(in);
+      if (rt == moka::HttpParser::DONE) {
+        moka::HttpReply::ptr reply = parser.get_reply();
+        stats->latencies.push_back(moka::GetCurrentUs() - begin);
+        ++stats->requests;
+        if (reply->get_status() < 200 || reply->get_status() >= 300) {
+          ++stats->non2xx;
+        }
+        keep_alive = keep_alive && reply->is_keep_alive();
+        ++done;
+        continue;
+      }
+      if (rt == moka::HttpParser::ERROR) {
+        ++stats->parse_errors;
+        ok = false;
+        break;
+      }
+      in.discardRead();
+      size_t pos = in.get_rw_position();
+      in.set_rw_position(in.get_size());
+      int n = sock->recv(in, in.get_base_size());
+      in.set_rw_position(pos);
+      if (n <= 0) {
+        ++stats->io_errors;
+        ok = false;
+        break;
+      }
+      stats->bytes += n;
+    }
+    if (!ok || !keep_alive) {
+      sock->close();
+      sock.reset();
+    }
+  }
+  if (sock) {
+    sock->close();
+  }
+  --s_running;
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+  return sorted[idx];
+}
+
+static void usage(const char* name) {
+  std::cerr << "usage: " << name << " [-c connections] [-t threads] [-d seconds]"
+            << " [-p pipeline] [-k 0|1] http://host[:port]/path" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  std::string url;
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] == '-' && i + 1 < argc) {
+      int v = atoi(argv[i + 1]);
+      switch (argv[i][1]) {
+        case 'c': s_options.connections = v; break;
+        case 't': s_options.threads = v; break;
+        case 'd': s_options.seconds = v; break;
+        case 'p': s_options.pipeline = v; break;
+        case 'k': s_options.keep_alive = v != 0; break;
+        default: usage(argv[0]); return 1;
+      }
+      ++i;
+    } else {
+      url = argv[i];
+    }
+  }
+  if (url.compare(0, 7, "http://") != 0 || s_options.connections <= 0
+      || s_options.threads <= 0 || s_options.pipeline <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // http://host[:port]/path
+  std::string hostport = url.substr(7);
+  std::string path = "/";
+  size_t slash = hostport.find('/');
+  if (slash != std::string::npos) {
+    path = hostport.substr(slash);
+    hostport = hostport.substr(0, slash);
+  }
+  std::string host = hostport;
+  std::string port = "80";
+  size_t colon = hostport.rfind(':');
+  if (colon != std::string::npos) {
+    host = hostport.substr(0, colon);
+    port = hostport.substr(colon + 1);
+  }
+  s_addr = moka::IPAddress::LookupIPv4Addr(host.c_str(), port.c_str());
+  if (!s_addr) {
+    std::cerr << "resolve " << hostport << " failed" << std::endl;
+    return 1;
+  }
+
+  std::string req = "GET " + path + " HTTP/1.1\r\nHost: " + hostport + "\r\n";
+  if (!s_options.keep_alive) {
+    req += "Connection: close\r\n";
+    s_options.pipeline = 1;
+  }
+  req += "\r\n";
+  for (int i = 0; i < s_options.pipeline; ++i) {
+    s_request += req;
+  }
+
+  MOKA_LOG_ROOT()->set_level(moka::LogLevel::ERROR);
+  MOKA_LOG_NAME("system")->set_level(moka::LogLevel::ERROR);
+  std::cout << "running " << s_options.seconds << "s test @ " << url << std::endl
+            << "  " << s_options.threads << " threads and " << s_options.connections
+            << " connections, pipeline " << s_options.pipeline
+            << (s_options.keep_alive? "": ", no keep-alive") << std::endl;
+
+  std::vector<Stats> stats(s_options.connections);
+  uint64_t begin = moka::GetCurrentUs();
+  uint64_t used = 0;
+  {
+    moka::IOManager iom(s_options.threads, false, "wrk");
+    s_deadline_us = begin + s_options.seconds * 1000000ull;
+    s_running = s_options.connections;
+    for (auto& i : stats) {
+      iom.schedule(std::bind(client, &i));
+    }
+    while (s_running > 0) {
+      usleep(10 * 1000);
+    }
+    used = moka::GetCurrentUs() - begin;
+  }
+
+  Stats total;
+  for (auto& i : stats) {
+    total.requests += i.requests;
+    total.bytes += i.bytes;
+    total.non2xx += i.non2xx;
+    total.connect_errors += i.connect_errors;
+    total.io_errors += i.io_errors;
+    total.parse_errors += i.parse_errors;
+    total.latencies.insert(total.latencies.end(), i.latencies.begin(), i.latencies.end());
+  }
+  std::vector<uint32_t>& lat = total.latencies;
+  std::sort(lat.begin(), lat.end());
+  double avg = 0;
+  double stdev = 0;
+  for (auto i : lat) {
+    avg += i;
+  }
+  avg = lat.empty()? 0: avg / lat.size();
+  for (auto i : lat) {
+    stdev += (i - avg) * (i - avg);
+  }
+  stdev = lat.empty()? 0: sqrt(stdev / lat.size());
+
+  double secs = used / 1000000.0;
+  std::cout << "  latency(us) avg=" << (uint64_t)avg << " stdev=" << (uint64_t)stdev
+            << " p50=" << percentile(lat, 0.5) << " p90=" << percentile(lat, 0.9)
+            << " p99=" << percentile(lat, 0.99) << " max=" << (lat.empty()? 0: lat.back()) << std::endl
+            << "  " << total.requests << " requests in " << secs << "s, "
+            << total.bytes / 1024.0 / 1024.0 << "MB read" << std::endl;
+  if (total.connect_errors || total.io_errors || total.parse_errors) {
+    std::cout << "  socket errors: connect " << total.connect_errors << ", io " << total.io_errors
+              << ", parse " << total.parse_errors << std::endl;
+  }
+  if (total.non2xx) {
+    std::cout << "  non-2xx responses: " << total.non2xx << std::endl;
+  }
+  std::cout << "requests/sec: " << (uint64_t)(total.requests / secs) << std::endl
+            << "transfer/sec: " << total.bytes / secs / 1024.0 / 1024.0 << "MB" << std::endl;
+  return 0;
+}